@@ -0,0 +1,202 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Complexity regression checks (nc --check-complexity).
+// Every axis generates sources at doubling sizes, runs the front end
+// (parse, package construction, resolution) on them and fits the scaling
+// exponent of wall time and peak memory with a least squares fit in log
+// space. An axis fails when it grows faster than n log n over its range.
+// The AST printer runs on every input too, so fixed-size tables overflow
+// here rather than in production, but it is not timed: the printed tree
+// indents every line by its depth and is inherently quadratic for deep
+// nesting.
+
+typedef struct ComplexityAxis {
+	const char* name;
+	isize base;  // size of the smallest input
+	void (*gen)(char** src, isize n);
+} ComplexityAxis;
+
+#define COMPLEXITY_STEPS 6
+#define COMPLEXITY_REPEAT 3
+// allowance for timer noise and cache effects on top of n log n
+#define COMPLEXITY_SLACK 0.25
+
+void complexity_gen_idents(char** src, isize n) {
+	buf_puts(*src, "fn f() {\n");
+	for(isize i = 0; i < n; i++) {
+		buf_puts(*src, "let v");
+		buf_puti(*src, i);
+		buf_puts(*src, " = 0\n");
+	}
+	buf_puts(*src, "}\n");
+}
+
+void complexity_gen_decls(char** src, isize n) {
+	for(isize i = 0; i < n; i++) {
+		buf_puts(*src, "const c");
+		buf_puti(*src, i);
+		buf_puts(*src, " = 1\n");
+	}
+}
+
+void complexity_gen_nesting(char** src, isize n) {
+	buf_puts(*src, "let x = ");
+	for(isize i = 0; i < n; i++) {
+		buf_puts(*src, "(1 + ");
+	}
+	buf_putc(*src, '1');
+	buf_putn(*src, ')', n);
+	buf_putc(*src, '\n');
+}
+
+void complexity_gen_ident_len(char** src, isize n) {
+	buf_puts(*src, "let ");
+	buf_putn(*src, 'a', n);
+	buf_puts(*src, " = 1\nlet y = ");
+	buf_putn(*src, 'a', n);
+	buf_putc(*src, '\n');
+}
+
+void complexity_gen_comment(char** src, isize n) {
+	buf_puts(*src, "/* ");
+	buf_putn(*src, 'x', n);
+	buf_puts(*src, " */\n// ");
+	buf_putn(*src, 'x', n);
+	buf_puts(*src, "\nlet x = 1\n");
+}
+
+void complexity_gen_array(char** src, isize n) {
+	buf_puts(*src, "let a = [");
+	for(isize i = 0; i < n; i++) {
+		buf_puti(*src, i);
+		buf_puts(*src, ", ");
+	}
+	buf_puts(*src, "0]\n");
+}
+
+// every const depends on the next one, declared after it
+void complexity_gen_chain(char** src, isize n) {
+	for(isize i = 0; i < n; i++) {
+		buf_puts(*src, "const c");
+		buf_puti(*src, i);
+		buf_puts(*src, " = c");
+		buf_puti(*src, i + 1);
+		buf_puts(*src, " + 1\n");
+	}
+	buf_puts(*src, "const c");
+	buf_puti(*src, n);
+	buf_puts(*src, " = 0\n");
+}
+
+ComplexityAxis complexity_axes[] = {
+	{ "distinct identifiers", 2048, complexity_gen_idents },
+	{ "top-level decls", 2048, complexity_gen_decls },
+	{ "expression nesting", 128, complexity_gen_nesting },
+	{ "identifier length", 16384, complexity_gen_ident_len },
+	{ "comment size", 65536, complexity_gen_comment },
+	{ "array-literal length", 4096, complexity_gen_array },
+	{ "dependency chain", 2048, complexity_gen_chain },
+};
+
+typedef struct ComplexitySample {
+	i64 time;   // microseconds, best of COMPLEXITY_REPEAT
+	isize mem;  // peak bytes above the live bytes at the start of the run
+} ComplexitySample;
+
+ComplexitySample complexity_run(StrRange src) {
+	ComplexitySample sample = { -1, 0 };
+	for(isize r = 0; r < COMPLEXITY_REPEAT; r++) {
+		isize live = mem_stats_total.live;
+		mem_stats_total.peak = live;
+		i64 start = trace_now();
+
+		Parser p;
+		parser_init(&p, "<generated>", src);
+		AstFile* file = parser_parse_file(&p);
+		Package pkg;
+		package_init(&pkg, "<generated>");
+		package_add_file(&pkg, file);
+		resolver_resolve_package(&pkg);
+
+		i64 time = trace_now() - start;
+		sample.time = sample.time < 0 ? time : MIN(sample.time, time);
+		sample.mem = MAX(sample.mem, mem_stats_total.peak - live);
+
+		if(r == 0)
+			string_ast_file(file);
+		package_free(&pkg);
+		mpool_free(&ast_pool);
+	}
+	return sample;
+}
+
+// natural logarithm, x > 0 (keeps the compiler free of libm)
+double complexity_log(double x) {
+	double k = 0;
+	while(x >= 2) {
+		x /= 2;
+		k++;
+	}
+	while(x < 1) {
+		x *= 2;
+		k--;
+	}
+	// ln x = 2 atanh((x - 1) / (x + 1)), with x in [1, 2)
+	double t = (x - 1) / (x + 1);
+	double t2 = t * t;
+	double sum = 0;
+	double term = t;
+	for(isize i = 1; i < 40; i += 2) {
+		sum += term / i;
+		term *= t2;
+	}
+	return 2 * sum + k * 0.69314718055994530942;
+}
+
+// slope of the least squares line through (log n, log y)
+double complexity_fit(isize* n, double* y, isize count) {
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	for(isize i = 0; i < count; i++) {
+		double lx = complexity_log((double)n[i]);
+		double ly = complexity_log(MAX(y[i], 1.0));
+		sx += lx;
+		sy += ly;
+		sxx += lx * lx;
+		sxy += lx * ly;
+	}
+	return (count * sxy - sx * sy) / (count * sxx - sx * sx);
+}
+
+bool complexity_check_axis(ComplexityAxis* axis) {
+	isize sizes[COMPLEXITY_STEPS];
+	double times[COMPLEXITY_STEPS];
+	double mems[COMPLEXITY_STEPS];
+	printf("%s:\n", axis->name);
+	for(isize i = 0; i < COMPLEXITY_STEPS; i++) {
+		sizes[i] = axis->base << i;
+		char* src = NULL;
+		axis->gen(&src, sizes[i]);
+		ComplexitySample s = complexity_run(string_range_len(src, buf_len(src)));
+		buf_free(src);
+		times[i] = (double)s.time;
+		mems[i] = (double)s.mem;
+		printf("  n = %8lld  %10.3f ms %12lld bytes\n", (long long)sizes[i], s.time / 1000.0, (long long)s.mem);
+	}
+	// the local exponent of n log n is 1 + 1 / ln n, largest at the smallest size
+	double limit = 1.0 + 1.0 / complexity_log((double)sizes[0]) + COMPLEXITY_SLACK;
+	double et = complexity_fit(sizes, times, COMPLEXITY_STEPS);
+	double em = complexity_fit(sizes, mems, COMPLEXITY_STEPS);
+	bool ok = et <= limit && em <= limit;
+	printf("  time ~ n^%.2f, memory ~ n^%.2f (limit n^%.2f) %s\n", et, em, limit, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+bool complexity_check(void) {
+	bool ok = true;
+	for(isize i = 0; i < sizeof(complexity_axes) / sizeof(*complexity_axes); i++) {
+		ok = complexity_check_axis(&complexity_axes[i]) && ok;
+	}
+	printf(ok ? "complexity check passed\n" : "complexity check FAILED\n");
+	return ok;
+}
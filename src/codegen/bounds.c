@@ -0,0 +1,1418 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Bounds checks of the C backend. Indexing an array or a slice checks the
+// index against the length (nl_check in the preamble), unless checks are
+// off. In hoisted mode, this pass finds the indexes a for loop condition
+// already bounds: in `for i < s.len { ... s[i] ... }` the condition holds
+// whenever s[i] is reached, as long as neither i nor s change in between,
+// so only i >= 0 is left to check. When i only grows and s[i] is reached
+// on every iteration, that is checked once, when the loop is entered, and
+// not at all for unsigned indexes. The same goes for arrays, with a
+// condition `i < n` against a constant n no larger than their length.
+// Checks that cannot be moved stay where the index is.
+// A hoisted check fails when the loop is entered, before the first
+// iteration runs, where the check it replaces would have failed later in
+// that iteration.
+// Before that, a range analysis of the integer locals of the fn drops the
+// checks of indexes it proves in bounds, anywhere in the fn: a[i + 1] in
+// `for i < a.len - 1` as well as a[2] of an array of 4.
+
+// The largest constant a loop may add to a signed index and still be taken
+// to only move one way: an i64 then needs at least 2^47 iterations to wrap
+// around. Narrower types may wrap in a loop that runs long enough.
+#define BOUNDS_MAX_STEP ((i64)1 << 16)
+
+typedef enum BoundsMode {
+	BOUNDS_MODE_ON,       // check every index
+	BOUNDS_MODE_HOISTED,  // move the checks of bounded loop indexes out of the loops
+	BOUNDS_MODE_OFF,
+} BoundsMode;
+
+// --bounds-checks
+BoundsMode bounds_mode = BOUNDS_MODE_HOISTED;
+
+typedef enum BoundsKind {
+	BOUNDS_CHECK,     // checked where it is evaluated
+	BOUNDS_AT_ENTRY,  // its lower bound is checked when the loop is entered
+	BOUNDS_SAFE,      // needs no check
+} BoundsKind;
+
+// the check of a loop index, moved before the loop
+typedef struct BoundsHoist {
+	AstStmt* loop;
+	AstExpr* index;   // first index expression it covers
+} BoundsHoist;
+
+// why the range analysis keeps the check of an index
+typedef enum BoundsReason {
+	BOUNDS_PROVEN,
+	BOUNDS_NEGATIVE,   // the index may be negative
+	BOUNDS_UNTRACKED,  // the slice is not a local, or its address is taken
+	BOUNDS_TOO_LARGE,  // the index may reach the length
+} BoundsReason;
+
+// Range of an integer: lo and hi, INT64_MIN and INT64_MAX standing for no
+// bound, and when len is the slot of a local slice, at most its len + off.
+// A u64 above INT64_MAX is only in ranges up to INT64_MAX.
+typedef struct BoundsRange {
+	i64 lo;
+	i64 hi;
+	i32 len;
+	i64 off;
+} BoundsRange;
+
+// an index the range analysis visited, for --bounds-report
+typedef struct BoundsIndex {
+	AstExpr* index;
+	BoundsRange range;
+	BoundsReason reason;
+	StrIntern len_name;   // of the slice range.len
+} BoundsIndex;
+
+typedef struct Bounds {
+	MapCodegenIds kinds;    // AstExpr* of an index -> BoundsKind, when not BOUNDS_CHECK
+	MapCodegenIds loops;    // AstStmt* of a for -> its first check in hoists
+	MapCodegenIds entries;  // AstExpr* of a BOUNDS_AT_ENTRY index -> AstStmt* of its loop
+	BoundsHoist* hoists;    // grouped by loop
+	bool* taken;            // locals whose address is taken in the fn, by slot
+	BoundsIndex* indexes;   // of the fn, in source order
+} Bounds;
+
+// a loop index and what bounds it in the loop condition
+typedef struct BoundsVar {
+	AstStmt* loop;
+	i32 slot;
+	bool is_signed;
+	i32 slice;        // local slice whose len bounds the index, or -1
+	i64 limit;        // constant bound, when slice is -1
+	bool after_return;  // a statement that may return was seen
+	isize first_hoist;
+} BoundsVar;
+
+bool bounds_is_local(AstExpr* expr) {
+	return expr && expr->kind == AST_EXPR_IDENT && !expr->ident.sym;
+}
+
+bool bounds_const(AstExpr* expr, i64* value) {
+	if(expr->kind == AST_EXPR_LIT_INT && expr->lit_int <= (u64)INT64_MAX) {
+		*value = (i64)expr->lit_int;
+		return true;
+	}
+	if(expr->kind == AST_EXPR_IDENT && expr->ident.sym && expr->ident.sym->kind == SYMBOL_CONST) {
+		ConstValue v = expr->ident.sym->cold->value;
+		if(v.kind != CONST_INT || (v.type && v.type->kind == TYPE_UNSIGNED && v.u > (u64)INT64_MAX))
+			return false;
+		*value = v.i;
+		return true;
+	}
+	return false;
+}
+
+// the local a store through expr changes, or -1
+i32 bounds_root(AstExpr* expr) {
+	while(expr->kind == AST_EXPR_MEMBER || (expr->kind == AST_EXPR_INDEX && expr->index.x->type &&
+			expr->index.x->type->kind == TYPE_ARRAY)) {
+		Type* t = expr->kind == AST_EXPR_MEMBER ? expr->member.x->type : NULL;
+		if(t && t->kind == TYPE_PTR)
+			return -1;
+		expr = expr->kind == AST_EXPR_MEMBER ? expr->member.x : expr->index.x;
+	}
+	return bounds_is_local(expr) ? expr->ident.slot : -1;
+}
+
+void bounds_take(Bounds* b, i32 slot) {
+	while(buf_len(b->taken) <= slot) {
+		buf_push(b->taken, false);
+	}
+	b->taken[slot] = true;
+}
+
+bool bounds_is_taken(Bounds* b, i32 slot) {
+	return slot < buf_len(b->taken) && b->taken[slot];
+}
+
+void bounds_taken_expr(Bounds* b, AstExpr* expr);
+
+void bounds_taken_expr_list(Bounds* b, AstExprList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		bounds_taken_expr(b, list->list[i]);
+	}
+}
+
+// marks the locals whose address is taken in expr
+void bounds_taken_expr(Bounds* b, AstExpr* expr) {
+	if(!expr)
+		return;
+	switch(expr->kind) {
+		case AST_EXPR_MEMBER:
+			bounds_taken_expr(b, expr->member.x);
+			break;
+		case AST_EXPR_CALL:
+			bounds_taken_expr(b, expr->call.x);
+			bounds_taken_expr_list(b, &expr->call.args);
+			break;
+		case AST_EXPR_UNARY:
+			if(expr->unary.op == T_AND) {
+				i32 slot = bounds_root(expr->unary.x);
+				if(slot >= 0)
+					bounds_take(b, slot);
+			}
+			bounds_taken_expr(b, expr->unary.x);
+			break;
+		case AST_EXPR_BINARY:
+			bounds_taken_expr(b, expr->binary.x);
+			bounds_taken_expr(b, expr->binary.y);
+			break;
+		case AST_EXPR_CAST:
+			bounds_taken_expr(b, expr->cast.x);
+			break;
+		case AST_EXPR_INDEX:
+			bounds_taken_expr(b, expr->index.x);
+			bounds_taken_expr(b, expr->index.arg);
+			break;
+		case AST_EXPR_TUPLE:
+			bounds_taken_expr_list(b, &expr->tuple.args);
+			break;
+		case AST_EXPR_ARRAY:
+			bounds_taken_expr(b, expr->array.init);
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			bounds_taken_expr_list(b, &expr->array_list.args);
+			break;
+		case AST_EXPR_INIT:
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				bounds_taken_expr(b, expr->init.fields.list[i]->expr);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void bounds_taken_stmt(Bounds* b, AstStmt* stmt);
+
+void bounds_taken_block(Bounds* b, AstStmtList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		bounds_taken_stmt(b, list->list[i]);
+	}
+}
+
+void bounds_taken_stmt(Bounds* b, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL:
+			bounds_taken_expr(b, stmt->decl->kind == AST_DECL_LET ? stmt->decl->let.value : stmt->decl->const_.value);
+			break;
+		case AST_STMT_EXPR:
+			bounds_taken_expr(b, stmt->expr);
+			break;
+		case AST_STMT_IF:
+			bounds_taken_expr(b, stmt->if_.cond);
+			bounds_taken_block(b, &stmt->if_.body);
+			bounds_taken_stmt(b, stmt->if_.els);
+			break;
+		case AST_STMT_FOR:
+			bounds_taken_expr(b, stmt->for_.cond);
+			bounds_taken_block(b, &stmt->for_.body);
+			break;
+		case AST_STMT_RETURN:
+			bounds_taken_expr(b, stmt->return_);
+			break;
+		case AST_STMT_ASSIGN:
+			bounds_taken_expr(b, stmt->assign.x);
+			bounds_taken_expr(b, stmt->assign.y);
+			break;
+		case AST_STMT_BLOCK:
+			bounds_taken_block(b, &stmt->block.body);
+			break;
+	}
+}
+
+// Whether the stores of stmt leave v bounded. Nested stores to the index
+// or to the slice are not followed; a signed index may only grow, by a
+// constant, in the statements of the loop body itself.
+bool bounds_keeps(BoundsVar* v, AstStmt* stmt, bool nested) {
+	if(!stmt)
+		return true;
+	switch(stmt->kind) {
+		case AST_STMT_ASSIGN: {
+			i32 root = bounds_root(stmt->assign.x);
+			if(v->slice >= 0 && root == v->slice)
+				return false;
+			if(!bounds_is_local(stmt->assign.x) || stmt->assign.x->ident.slot != v->slot)
+				return true;
+			if(nested)
+				return false;
+			if(!v->is_signed)
+				return true;
+			AstExpr* y = stmt->assign.y;
+			i64 c;
+			if(stmt->assign.op == T_ADD_ASSIGN)
+				return bounds_const(y, &c) && c >= 0 && c <= BOUNDS_MAX_STEP;
+			return stmt->assign.op == T_ASSIGN && y->kind == AST_EXPR_BINARY && y->binary.op == T_ADD &&
+				bounds_is_local(y->binary.x) && y->binary.x->ident.slot == v->slot && bounds_const(y->binary.y, &c) &&
+				c >= 0 && c <= BOUNDS_MAX_STEP;
+		}
+		case AST_STMT_IF:
+			for(isize i = 0; i < stmt->if_.body.len; i++) {
+				if(!bounds_keeps(v, stmt->if_.body.list[i], true))
+					return false;
+			}
+			return bounds_keeps(v, stmt->if_.els, true);
+		case AST_STMT_FOR:
+			for(isize i = 0; i < stmt->for_.body.len; i++) {
+				if(!bounds_keeps(v, stmt->for_.body.list[i], true))
+					return false;
+			}
+			return true;
+		case AST_STMT_BLOCK:
+			for(isize i = 0; i < stmt->block.body.len; i++) {
+				if(!bounds_keeps(v, stmt->block.body.list[i], true))
+					return false;
+			}
+			return true;
+		default:
+			return true;
+	}
+}
+
+// whether stmt stores to the index of v
+bool bounds_assigns(BoundsVar* v, AstStmt* stmt) {
+	return stmt->kind == AST_STMT_ASSIGN && bounds_is_local(stmt->assign.x) && stmt->assign.x->ident.slot == v->slot;
+}
+
+bool bounds_may_return(AstStmt* stmt) {
+	if(!stmt)
+		return false;
+	switch(stmt->kind) {
+		case AST_STMT_RETURN:
+			return true;
+		case AST_STMT_IF:
+			for(isize i = 0; i < stmt->if_.body.len; i++) {
+				if(bounds_may_return(stmt->if_.body.list[i]))
+					return true;
+			}
+			return bounds_may_return(stmt->if_.els);
+		case AST_STMT_FOR:
+		case AST_STMT_BLOCK: {
+			AstStmtList* body = stmt->kind == AST_STMT_FOR ? &stmt->for_.body : &stmt->block.body;
+			for(isize i = 0; i < body->len; i++) {
+				if(bounds_may_return(body->list[i]))
+					return true;
+			}
+			return false;
+		}
+		default:
+			return false;
+	}
+}
+
+void bounds_mark(Bounds* b, AstExpr* index, BoundsKind kind) {
+	isize* old = map_lookup(&b->kinds, (u64)index);
+	if(!old || *old < kind)
+		map_set(&b->kinds, (u64)index, kind);
+}
+
+// an index of the loop body, evaluated on every iteration unless
+// conditional
+void bounds_use(Bounds* b, BoundsVar* v, AstExpr* expr, bool conditional) {
+	AstExpr* x = expr->index.x;
+	AstExpr* arg = expr->index.arg;
+	if(!bounds_is_local(arg) || arg->ident.slot != v->slot || !x->type)
+		return;
+	if(v->slice >= 0 ? !bounds_is_local(x) || x->ident.slot != v->slice :
+			x->type->kind != TYPE_ARRAY || x->type->array.len < v->limit)
+		return;
+	isize* kind = map_lookup(&b->kinds, (u64)expr);
+	if(kind && *kind == BOUNDS_SAFE)
+		return;  // proven by the range analysis
+	if(!v->is_signed) {
+		bounds_mark(b, expr, BOUNDS_SAFE);
+		return;
+	}
+	if(conditional || v->after_return || !arg->type || arg->type->size < 8)
+		return;
+	bounds_mark(b, expr, BOUNDS_AT_ENTRY);
+	map_set(&b->entries, (u64)expr, (isize)v->loop);
+	for(isize i = v->first_hoist; i < buf_len(b->hoists); i++) {
+		AstExpr* h = b->hoists[i].index->index.arg;
+		if(h->ident.slot == v->slot)
+			return;
+	}
+	buf_push(b->hoists, (BoundsHoist){ v->loop, expr });
+}
+
+void bounds_visit_expr(Bounds* b, BoundsVar* v, AstExpr* expr, bool conditional);
+
+void bounds_visit_expr_list(Bounds* b, BoundsVar* v, AstExprList* list, bool conditional) {
+	for(isize i = 0; i < list->len; i++) {
+		bounds_visit_expr(b, v, list->list[i], conditional);
+	}
+}
+
+void bounds_visit_expr(Bounds* b, BoundsVar* v, AstExpr* expr, bool conditional) {
+	if(!expr)
+		return;
+	switch(expr->kind) {
+		case AST_EXPR_MEMBER:
+			bounds_visit_expr(b, v, expr->member.x, conditional);
+			break;
+		case AST_EXPR_CALL:
+			bounds_visit_expr(b, v, expr->call.x, conditional);
+			bounds_visit_expr_list(b, v, &expr->call.args, conditional);
+			break;
+		case AST_EXPR_UNARY:
+			bounds_visit_expr(b, v, expr->unary.x, conditional);
+			break;
+		case AST_EXPR_BINARY: {
+			bool short_circuit = expr->binary.op == T_LAND || expr->binary.op == T_LOR;
+			bounds_visit_expr(b, v, expr->binary.x, conditional);
+			bounds_visit_expr(b, v, expr->binary.y, conditional || short_circuit);
+			break;
+		}
+		case AST_EXPR_CAST:
+			bounds_visit_expr(b, v, expr->cast.x, conditional);
+			break;
+		case AST_EXPR_INDEX:
+			bounds_visit_expr(b, v, expr->index.x, conditional);
+			bounds_visit_expr(b, v, expr->index.arg, conditional);
+			bounds_use(b, v, expr, conditional);
+			break;
+		case AST_EXPR_TUPLE:
+			bounds_visit_expr_list(b, v, &expr->tuple.args, conditional);
+			break;
+		case AST_EXPR_ARRAY:
+			bounds_visit_expr(b, v, expr->array.init, conditional);
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			bounds_visit_expr_list(b, v, &expr->array_list.args, conditional);
+			break;
+		case AST_EXPR_INIT:
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				bounds_visit_expr(b, v, expr->init.fields.list[i]->expr, conditional);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void bounds_visit_stmt(Bounds* b, BoundsVar* v, AstStmt* stmt, bool conditional) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL:
+			bounds_visit_expr(b, v, stmt->decl->kind == AST_DECL_LET ? stmt->decl->let.value : stmt->decl->const_.value,
+				conditional);
+			break;
+		case AST_STMT_EXPR:
+			bounds_visit_expr(b, v, stmt->expr, conditional);
+			break;
+		case AST_STMT_IF:
+			bounds_visit_expr(b, v, stmt->if_.cond, conditional);
+			for(isize i = 0; i < stmt->if_.body.len; i++) {
+				bounds_visit_stmt(b, v, stmt->if_.body.list[i], true);
+			}
+			bounds_visit_stmt(b, v, stmt->if_.els, true);
+			break;
+		case AST_STMT_FOR:
+			bounds_visit_expr(b, v, stmt->for_.cond, true);
+			for(isize i = 0; i < stmt->for_.body.len; i++) {
+				bounds_visit_stmt(b, v, stmt->for_.body.list[i], true);
+			}
+			break;
+		case AST_STMT_RETURN:
+			bounds_visit_expr(b, v, stmt->return_, conditional);
+			break;
+		case AST_STMT_ASSIGN:
+			bounds_visit_expr(b, v, stmt->assign.x, conditional);
+			bounds_visit_expr(b, v, stmt->assign.y, conditional);
+			break;
+		case AST_STMT_BLOCK:
+			for(isize i = 0; i < stmt->block.body.len; i++) {
+				bounds_visit_stmt(b, v, stmt->block.body.list[i], conditional);
+			}
+			break;
+	}
+}
+
+// Takes the bound of a conjunct `i < bound` (or `bound > i`) of the
+// condition of loop.
+void bounds_conjunct(Bounds* b, AstStmt* loop, AstExpr* cond) {
+	if(cond->kind != AST_EXPR_BINARY)
+		return;
+	if(cond->binary.op == T_LAND) {
+		bounds_conjunct(b, loop, cond->binary.x);
+		bounds_conjunct(b, loop, cond->binary.y);
+		return;
+	}
+	if(cond->binary.op != T_LT && cond->binary.op != T_GT)
+		return;
+	AstExpr* index = cond->binary.op == T_LT ? cond->binary.x : cond->binary.y;
+	AstExpr* bound = cond->binary.op == T_LT ? cond->binary.y : cond->binary.x;
+	Type* t = index->type;
+	if(!bounds_is_local(index) || !t || (t->kind != TYPE_SIGNED && t->kind != TYPE_UNSIGNED) ||
+			bounds_is_taken(b, index->ident.slot))
+		return;
+	BoundsVar v = { .loop = loop, .slot = index->ident.slot, .is_signed = t->kind == TYPE_SIGNED, .slice = -1,
+		.first_hoist = buf_len(b->hoists) };
+	if(bound->kind == AST_EXPR_MEMBER && bound->member.name == str_intern_c("len") && bounds_is_local(bound->member.x) &&
+			bound->member.x->type && bound->member.x->type->kind == TYPE_SLICE) {
+		v.slice = bound->member.x->ident.slot;
+		if(bounds_is_taken(b, v.slice))
+			return;
+	} else if(!bounds_const(bound, &v.limit)) {
+		return;
+	}
+	AstStmtList* body = &loop->for_.body;
+	for(isize i = 0; i < body->len; i++) {
+		if(!bounds_keeps(&v, body->list[i], false))
+			return;
+	}
+	// indexes are bounded up to the first store to the index
+	for(isize i = 0; i < body->len && !bounds_assigns(&v, body->list[i]); i++) {
+		bounds_visit_stmt(b, &v, body->list[i], false);
+		v.after_return = v.after_return || bounds_may_return(body->list[i]);
+	}
+}
+
+void bounds_loops(Bounds* b, AstStmt* stmt);
+
+void bounds_loops_block(Bounds* b, AstStmtList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		bounds_loops(b, list->list[i]);
+	}
+}
+
+// analyzes the loops of stmt, outer loops first
+void bounds_loops(Bounds* b, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_IF:
+			bounds_loops_block(b, &stmt->if_.body);
+			bounds_loops(b, stmt->if_.els);
+			break;
+		case AST_STMT_FOR: {
+			isize first = buf_len(b->hoists);
+			if(stmt->for_.cond)
+				bounds_conjunct(b, stmt, stmt->for_.cond);
+			if(buf_len(b->hoists) > first)
+				map_set(&b->loops, (u64)stmt, first);
+			bounds_loops_block(b, &stmt->for_.body);
+			break;
+		}
+		case AST_STMT_BLOCK:
+			bounds_loops_block(b, &stmt->block.body);
+			break;
+		default:
+			break;
+	}
+}
+
+// --bounds-report
+bool bounds_report;
+
+typedef struct BoundsSaved {
+	i32 slot;
+	BoundsRange r;
+} BoundsSaved;
+
+// how the stores of a loop body move a local
+enum {
+	BOUNDS_MOVE_UP = 1,    // only grows, by constants
+	BOUNDS_MOVE_DOWN = 2,  // only shrinks, by constants
+	BOUNDS_MOVE_ANY = 3,
+};
+
+// Range analysis of a fn, in one pass over its statements. The branches
+// of an if are walked from the same ranges and joined after it. A loop
+// body is walked once, from ranges that hold on every iteration: the
+// locals it changes lose the bounds they may move away from.
+typedef struct BoundsFlow {
+	Bounds* b;
+	i32 slots;
+	i32 next_slot;        // slot of the next local declared in the fn
+	BoundsRange* ranges;  // by slot
+	Type** types;         // by slot, of the integers and slices whose address is not taken
+	StrIntern* names;     // by slot
+	u8* moves;            // by slot, BOUNDS_MOVE_* of the loop being entered
+	i32* moved;           // the slots moves is set for
+	BoundsSaved* trail;   // previous ranges, to undo a branch
+	BoundsSaved* joins;   // ranges at the end of the branches of an if
+	isize* seen;          // by slot, position in joins, or -1
+	StrIntern len_name;
+	bool dead;            // the code walked is not reached
+	bool quiet;           // evaluating again, do not record indexes
+} BoundsFlow;
+
+bool bounds_is_int(Type* t) {
+	return t && (t->kind == TYPE_SIGNED || t->kind == TYPE_UNSIGNED);
+}
+
+// the range of any value of type t
+BoundsRange bounds_top(Type* t) {
+	if(t && t->kind == TYPE_BOOLEAN)
+		return (BoundsRange){ 0, 1, -1, 0 };
+	if(!bounds_is_int(t))
+		return (BoundsRange){ INT64_MIN, INT64_MAX, -1, 0 };
+	if(t->kind == TYPE_SIGNED)
+		return (BoundsRange){ const_min(t), const_max(t), -1, 0 };
+	return (BoundsRange){ 0, t->size == 8 ? INT64_MAX : (i64)const_umax(t), -1, 0 };
+}
+
+BoundsRange bounds_exact(i64 v) {
+	return (BoundsRange){ v, v, -1, 0 };
+}
+
+bool bounds_is_exact(BoundsRange r, i64* value) {
+	*value = r.lo;
+	return r.lo == r.hi && r.lo != INT64_MIN && r.lo != INT64_MAX;
+}
+
+// whether a + b overflows, for bounds a and b that are not inf
+bool bounds_add_wraps(i64 a, i64 b, i64 inf) {
+	return a != inf && b != inf && (b > 0 ? a > INT64_MAX - b : a < INT64_MIN - b);
+}
+
+// a + b for a bound, inf when either is inf, saturating on overflow
+i64 bounds_add(i64 a, i64 b, i64 inf) {
+	if(a == inf || b == inf)
+		return inf;
+	if(b > 0 ? a > INT64_MAX - b : a < INT64_MIN - b)
+		return b > 0 ? INT64_MAX : INT64_MIN;
+	return a + b;
+}
+
+i64 bounds_neg(i64 a) {
+	return a == INT64_MIN ? INT64_MAX : a == INT64_MAX ? INT64_MIN : -a;
+}
+
+// whether a * c overflows, for a bound a that is not inf
+bool bounds_mul_wraps(i64 a, i64 c) {
+	i64 r;
+	return a != INT64_MIN && a != INT64_MAX && !const_mul_i64(a, c, &r);
+}
+
+// a * c for a bound, saturating
+i64 bounds_mul(i64 a, i64 c) {
+	i64 r;
+	if(a == INT64_MIN || a == INT64_MAX || !const_mul_i64(a, c, &r))
+		return (a > 0) == (c > 0) ? INT64_MAX : INT64_MIN;
+	return r;
+}
+
+// the least range holding a and b
+BoundsRange bounds_join(BoundsRange a, BoundsRange b) {
+	BoundsRange r = { a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi, -1, 0 };
+	if(a.len >= 0 && a.len == b.len) {
+		r.len = a.len;
+		r.off = a.off > b.off ? a.off : b.off;
+	}
+	return r;
+}
+
+// the values in both a and b
+BoundsRange bounds_meet(BoundsRange a, BoundsRange b) {
+	BoundsRange r = { a.lo > b.lo ? a.lo : b.lo, a.hi < b.hi ? a.hi : b.hi, a.len, a.off };
+	if(b.len >= 0 && (a.len != b.len || b.off < a.off)) {
+		r.len = b.len;
+		r.off = b.off;
+	}
+	return r;
+}
+
+// shifts r by c, dropping the len bound when its offset overflows
+BoundsRange bounds_shift(BoundsRange r, i64 c) {
+	r.lo = bounds_add(r.lo, c, INT64_MIN);
+	r.hi = bounds_add(r.hi, c, INT64_MAX);
+	r.off = bounds_add(r.off, c, INT64_MAX);
+	if(r.off == INT64_MAX || r.off == INT64_MIN)
+		r.len = -1;
+	return r;
+}
+
+// The type C computes a binary operation on x and y in, after the integer
+// promotions, or NULL when it is not an integer. Untyped constants are
+// int or, when they do not fit, long.
+Type* bounds_arith_type(AstExpr* x, BoundsRange rx, AstExpr* y, BoundsRange ry) {
+	isize size = 0;
+	bool is_unsigned = false;
+	for(int i = 0; i < 2; i++) {
+		Type* t = i == 0 ? x->type : y->type;
+		BoundsRange r = i == 0 ? rx : ry;
+		isize s = 4;
+		bool u = false;
+		if(!t) {
+			s = r.lo >= INT32_MIN && r.hi <= INT32_MAX ? 4 : 8;
+		} else if(bounds_is_int(t)) {
+			s = t->size < 4 ? 4 : t->size;
+			u = t->kind == TYPE_UNSIGNED && t->size >= 4;
+		} else if(t->kind != TYPE_BOOLEAN) {
+			return NULL;
+		}
+		if(s > size)
+			is_unsigned = u;
+		else if(s == size)
+			is_unsigned = is_unsigned || u;
+		size = s > size ? s : size;
+	}
+	if(size == 8)
+		return is_unsigned ? primitive_u64 : primitive_i64;
+	return is_unsigned ? primitive_u32 : primitive_i32;
+}
+
+// r as C computes it in t: unsigned results wrap around, and signed ones
+// that overflow are not known
+BoundsRange bounds_result(Type* t, BoundsRange r) {
+	if(!t)
+		return bounds_top(NULL);
+	BoundsRange top = bounds_top(t);
+	if(r.lo < top.lo || r.hi > top.hi)
+		return t->kind == TYPE_UNSIGNED ? top : bounds_top(NULL);
+	return r;
+}
+
+// whether C may compute expr as a u64, then above INT64_MAX
+bool bounds_is_wide(AstExpr* expr) {
+	Type* t = expr->type;
+	if(t && t->kind == TYPE_UNSIGNED && t->size == 8)
+		return true;
+	switch(expr->kind) {
+		case AST_EXPR_UNARY:
+			return (expr->unary.op == T_SUB || expr->unary.op == T_ADD) && bounds_is_wide(expr->unary.x);
+		case AST_EXPR_BINARY:
+			switch(expr->binary.op) {
+				case T_EQL: case T_NEQ: case T_LT: case T_GT: case T_LTE: case T_GTE: case T_LAND: case T_LOR:
+					return false;
+				case T_LSHIFT: case T_RSHIFT:
+					return bounds_is_wide(expr->binary.x);
+				default:
+					return bounds_is_wide(expr->binary.x) || bounds_is_wide(expr->binary.y);
+			}
+		default:
+			return false;
+	}
+}
+
+// r converted to t, where wide is whether r may be a u64 above INT64_MAX
+BoundsRange bounds_convert(Type* t, bool wide, BoundsRange r) {
+	BoundsRange top = bounds_top(t);
+	if(wide && r.hi == INT64_MAX && !(t && t->kind == TYPE_UNSIGNED && t->size == 8))
+		return top;
+	return r.lo < top.lo || r.hi > top.hi ? top : r;
+}
+
+// The range of x op y, computed in t. A bound that overflows i64 wraps
+// around in C as well, so the result is then not known: a saturated bound
+// would be taken for a real one.
+BoundsRange bounds_binary(TokenKind op, BoundsRange x, BoundsRange y, Type* t) {
+	BoundsRange r = bounds_top(NULL);
+	bool wraps = false;
+	i64 c;
+	switch(op) {
+		case T_ADD:
+			wraps = bounds_add_wraps(x.lo, y.lo, INT64_MIN) || bounds_add_wraps(x.hi, y.hi, INT64_MAX);
+			r.lo = bounds_add(x.lo, y.lo, INT64_MIN);
+			r.hi = bounds_add(x.hi, y.hi, INT64_MAX);
+			if(x.len >= 0 && y.hi != INT64_MAX) {
+				r.len = x.len;
+				r.off = bounds_add(x.off, y.hi, INT64_MAX);
+			} else if(y.len >= 0 && x.hi != INT64_MAX) {
+				r.len = y.len;
+				r.off = bounds_add(y.off, x.hi, INT64_MAX);
+			}
+			break;
+		case T_SUB:
+			// -y is not a bound when y is at the end of i64 that is not inf
+			wraps = y.hi == INT64_MIN || y.lo == INT64_MAX ||
+				bounds_add_wraps(x.lo, bounds_neg(y.hi), INT64_MIN) || bounds_add_wraps(x.hi, bounds_neg(y.lo), INT64_MAX);
+			r.lo = bounds_add(x.lo, bounds_neg(y.hi), INT64_MIN);
+			r.hi = bounds_add(x.hi, bounds_neg(y.lo), INT64_MAX);
+			if(x.len >= 0 && y.lo != INT64_MIN) {
+				r.len = x.len;
+				r.off = bounds_add(x.off, bounds_neg(y.lo), INT64_MAX);
+			}
+			break;
+		case T_MUL:
+			if(bounds_is_exact(x, &c)) {
+				BoundsRange tmp = x;
+				x = y;
+				y = tmp;
+			}
+			if(bounds_is_exact(y, &c)) {
+				wraps = bounds_mul_wraps(x.lo, c) || bounds_mul_wraps(x.hi, c);
+				r.lo = bounds_mul(c >= 0 ? x.lo : x.hi, c);
+				r.hi = bounds_mul(c >= 0 ? x.hi : x.lo, c);
+			}
+			break;
+		case T_DIV:
+			if(bounds_is_exact(y, &c) && c > 0) {
+				r.lo = x.lo == INT64_MIN ? INT64_MIN : x.lo / c;
+				r.hi = x.hi == INT64_MAX ? INT64_MAX : x.hi / c;
+			}
+			break;
+		case T_REM:
+			if(bounds_is_exact(y, &c) && c > 0) {
+				r.lo = x.lo >= 0 ? 0 : 1 - c;
+				r.hi = x.hi < c - 1 && x.lo >= 0 ? x.hi : c - 1;
+			}
+			break;
+		case T_AND:
+			// with a non-negative operand, at most that operand
+			if(x.lo >= 0 || y.lo >= 0) {
+				r.lo = 0;
+				r.hi = x.lo < 0 ? y.hi : y.lo < 0 ? x.hi : x.hi < y.hi ? x.hi : y.hi;
+			}
+			break;
+		case T_LSHIFT:
+			if(x.lo >= 0 && bounds_is_exact(y, &c) && c >= 0 && c < 63) {
+				wraps = bounds_mul_wraps(x.lo, (i64)1 << c) || bounds_mul_wraps(x.hi, (i64)1 << c);
+				r.lo = bounds_mul(x.lo, (i64)1 << c);
+				r.hi = bounds_mul(x.hi, (i64)1 << c);
+			}
+			break;
+		case T_RSHIFT:
+			if(x.lo >= 0 && bounds_is_exact(y, &c) && c >= 0 && c < 64) {
+				r.lo = x.lo >> c;
+				r.hi = x.hi == INT64_MAX ? INT64_MAX : x.hi >> c;
+			}
+			break;
+		case T_EQL: case T_NEQ: case T_LT: case T_GT: case T_LTE: case T_GTE: case T_LAND: case T_LOR:
+			return bounds_top(primitive_bool);
+		default:
+			break;
+	}
+	if(wraps)
+		return t && t->kind == TYPE_UNSIGNED ? bounds_top(t) : bounds_top(NULL);
+	if(r.off == INT64_MAX)
+		r.len = -1;
+	return bounds_result(t, r);
+}
+
+// the slot of expr when it is an integer local the analysis follows, or -1
+i32 bounds_int_local(BoundsFlow* f, AstExpr* expr) {
+	if(!bounds_is_local(expr) || !bounds_is_int(f->types[expr->ident.slot]))
+		return -1;
+	return expr->ident.slot;
+}
+
+// the slot of expr when it is a slice local the analysis follows, or -1
+i32 bounds_slice_local(BoundsFlow* f, AstExpr* expr) {
+	if(!bounds_is_local(expr) || !f->types[expr->ident.slot] || f->types[expr->ident.slot]->kind != TYPE_SLICE)
+		return -1;
+	return expr->ident.slot;
+}
+
+void bounds_set(BoundsFlow* f, i32 slot, BoundsRange r) {
+	buf_push(f->trail, (BoundsSaved){ slot, f->ranges[slot] });
+	f->ranges[slot] = r;
+}
+
+// restores the ranges changed since mark
+void bounds_undo(BoundsFlow* f, isize mark) {
+	for(isize i = buf_len(f->trail) - 1; i >= mark; i--) {
+		f->ranges[f->trail[i].slot] = f->trail[i].r;
+	}
+	buf_truncate(f->trail, mark);
+}
+
+// drops the bounds by the len of slice, which changes
+void bounds_forget(BoundsFlow* f, i32 slice) {
+	for(i32 i = 0; i < f->slots; i++) {
+		if(f->ranges[i].len == slice) {
+			BoundsRange r = f->ranges[i];
+			r.len = -1;
+			bounds_set(f, i, r);
+		}
+	}
+}
+
+void bounds_declare(BoundsFlow* f, i32 slot, StrIntern name, Type* t) {
+	bool tracked = (bounds_is_int(t) || (t && t->kind == TYPE_SLICE)) && !bounds_is_taken(f->b, slot);
+	f->names[slot] = name;
+	f->types[slot] = tracked ? t : NULL;
+	f->ranges[slot] = bounds_top(t);
+}
+
+// records an index of an array or a slice, with the range of its value
+void bounds_index(BoundsFlow* f, AstExpr* expr, BoundsRange r) {
+	AstExpr* x = expr->index.x;
+	Type* t = x->type;
+	if(f->quiet || !t || (t->kind != TYPE_ARRAY && t->kind != TYPE_SLICE))
+		return;
+	// code that is not reached needs no check
+	BoundsReason reason = BOUNDS_PROVEN;
+	if(!f->dead && r.lo < 0)
+		reason = BOUNDS_NEGATIVE;
+	else if(!f->dead && t->kind == TYPE_ARRAY)
+		reason = r.hi > t->array.len - 1 ? BOUNDS_TOO_LARGE : BOUNDS_PROVEN;
+	else if(!f->dead && bounds_slice_local(f, x) < 0)
+		reason = BOUNDS_UNTRACKED;
+	else if(!f->dead && (r.len != x->ident.slot || r.off > -1))
+		reason = BOUNDS_TOO_LARGE;
+	if(reason == BOUNDS_PROVEN)
+		bounds_mark(f->b, expr, BOUNDS_SAFE);
+	if(bounds_report && !f->dead)
+		buf_push(f->b->indexes, (BoundsIndex){ expr, r, reason, r.len >= 0 ? f->names[r.len] : NULL });
+}
+
+BoundsRange bounds_eval(BoundsFlow* f, AstExpr* expr);
+void bounds_refine(BoundsFlow* f, AstExpr* cond, bool truth);
+
+void bounds_eval_list(BoundsFlow* f, AstExprList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		bounds_eval(f, list->list[i]);
+	}
+}
+
+// the range of the value of expr, recording the indexes it evaluates
+BoundsRange bounds_eval(BoundsFlow* f, AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+			if(expr->lit_int <= (u64)INT64_MAX)
+				return bounds_exact((i64)expr->lit_int);
+			break;
+		case AST_EXPR_LIT_CHAR:
+			return bounds_exact(expr->lit_char);
+		case AST_EXPR_IDENT: {
+			i32 slot = bounds_int_local(f, expr);
+			i64 c;
+			if(slot >= 0)
+				return f->ranges[slot];
+			if(expr->ident.sym && bounds_const(expr, &c))
+				return bounds_exact(c);
+			break;
+		}
+		case AST_EXPR_MEMBER: {
+			bounds_eval(f, expr->member.x);
+			i32 slot = bounds_slice_local(f, expr->member.x);
+			if(slot >= 0 && expr->member.name == f->len_name)
+				return (BoundsRange){ 0, INT64_MAX, slot, 0 };
+			break;
+		}
+		case AST_EXPR_CALL:
+			bounds_eval(f, expr->call.x);
+			bounds_eval_list(f, &expr->call.args);
+			break;
+		case AST_EXPR_UNARY: {
+			AstExpr* x = expr->unary.x;
+			BoundsRange r = bounds_eval(f, x);
+			if(expr->unary.op == T_SUB || expr->unary.op == T_ADD) {
+				if(expr->unary.op == T_SUB && r.lo == INT64_MAX)
+					return bounds_top(NULL);  // -INT64_MAX is not a bound
+				if(expr->unary.op == T_SUB)
+					r = (BoundsRange){ bounds_neg(r.hi), bounds_neg(r.lo), -1, 0 };
+				if(expr->unary.op == T_SUB && !typing_is_untyped(x) && codegen_wraps(T_SUB, expr->type))
+					return bounds_result(expr->type, r);
+				return bounds_result(bounds_arith_type(x, r, x, r), r);
+			}
+			break;
+		}
+		case AST_EXPR_BINARY: {
+			TokenKind op = expr->binary.op;
+			BoundsRange x = bounds_eval(f, expr->binary.x);
+			if(op == T_LAND || op == T_LOR) {
+				// the right operand is only evaluated when the left one is
+				// true for &&, false for ||
+				isize mark = buf_len(f->trail);
+				bool dead = f->dead;
+				bounds_refine(f, expr->binary.x, op == T_LAND);
+				bounds_eval(f, expr->binary.y);
+				bounds_undo(f, mark);
+				f->dead = dead;
+				break;
+			}
+			BoundsRange y = bounds_eval(f, expr->binary.y);
+			// a divisor that converts to 0 or -1 in the type
+			if((op == T_DIV || op == T_REM) && codegen_helper(op, expr->type, expr->binary.y))
+				return bounds_top(expr->type);
+			if(op == T_LSHIFT || op == T_RSHIFT)
+				return bounds_binary(op, x, y, bounds_arith_type(expr->binary.x, x, expr->binary.x, x));
+			if(codegen_wraps(op, expr->type))
+				return bounds_binary(op, x, y, expr->type);
+			return bounds_binary(op, x, y, bounds_arith_type(expr->binary.x, x, expr->binary.y, y));
+		}
+		case AST_EXPR_CAST: {
+			BoundsRange r = bounds_eval(f, expr->cast.x);
+			return bounds_convert(expr->cast.type->resolved, bounds_is_wide(expr->cast.x), r);
+		}
+		case AST_EXPR_INDEX: {
+			bounds_eval(f, expr->index.x);
+			bounds_index(f, expr, bounds_eval(f, expr->index.arg));
+			break;
+		}
+		case AST_EXPR_TUPLE:
+			bounds_eval_list(f, &expr->tuple.args);
+			break;
+		case AST_EXPR_ARRAY:
+			bounds_eval(f, expr->array.init);
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			bounds_eval_list(f, &expr->array_list.args);
+			break;
+		case AST_EXPR_INIT:
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				bounds_eval(f, expr->init.fields.list[i]->expr);
+			}
+			break;
+		default:
+			break;
+	}
+	return bounds_top(expr->type);
+}
+
+// whether x + d stays in t for every x in r, so that it does not wrap
+bool bounds_fits(BoundsRange r, i64 d, Type* t) {
+	BoundsRange top = bounds_top(t);
+	if(d >= 0) {
+		if(r.len >= 0 && t->kind == TYPE_SIGNED && t->size == 8 && !bounds_add_wraps(r.off, d, INT64_MAX) && r.off + d <= 0)
+			return true;  // at most the len
+		return r.hi != INT64_MAX && !bounds_add_wraps(r.hi, d, INT64_MAX) && r.hi + d <= top.hi;
+	}
+	return r.lo != INT64_MIN && !bounds_add_wraps(r.lo, d, INT64_MIN) && r.lo + d >= top.lo;
+}
+
+// narrows the range of expr, a local or a local plus or minus a constant,
+// to r
+void bounds_narrow(BoundsFlow* f, AstExpr* expr, BoundsRange r) {
+	i64 c;
+	if(expr->kind == AST_EXPR_BINARY && (expr->binary.op == T_ADD || expr->binary.op == T_SUB) &&
+			bounds_const(expr->binary.y, &c) && c != INT64_MIN) {
+		i32 slot = bounds_int_local(f, expr->binary.x);
+		Type* t = slot >= 0 ? f->types[slot] : NULL;
+		i64 d = expr->binary.op == T_ADD ? c : -c;
+		if(!t || !bounds_fits(f->ranges[slot], d, t))
+			return;  // x + c may wrap around
+		r = bounds_shift(r, -d);
+		expr = expr->binary.x;
+	}
+	i32 slot = bounds_int_local(f, expr);
+	if(slot < 0)
+		return;
+	BoundsRange m = bounds_meet(f->ranges[slot], r);
+	if(m.lo > m.hi)
+		f->dead = true;
+	bounds_set(f, slot, m);
+}
+
+// narrows the ranges of the locals in cond, knowing it is truth
+void bounds_refine(BoundsFlow* f, AstExpr* cond, bool truth) {
+	if(f->dead)
+		return;
+	if(cond->kind == AST_EXPR_UNARY && cond->unary.op == T_NOT) {
+		bounds_refine(f, cond->unary.x, !truth);
+		return;
+	}
+	if(cond->kind != AST_EXPR_BINARY)
+		return;
+	TokenKind op = cond->binary.op;
+	AstExpr* x = cond->binary.x;
+	AstExpr* y = cond->binary.y;
+	if(op == T_LAND || op == T_LOR) {
+		if(truth == (op == T_LAND)) {
+			bounds_refine(f, x, truth);
+			bounds_refine(f, y, truth);
+		}
+		return;
+	}
+	if(!truth) {
+		switch(op) {
+			case T_LT: op = T_GTE; break;
+			case T_LTE: op = T_GT; break;
+			case T_GT: op = T_LTE; break;
+			case T_GTE: op = T_LT; break;
+			case T_EQL: op = T_NEQ; break;
+			case T_NEQ: op = T_EQL; break;
+			default: return;
+		}
+	}
+	if(op == T_GT || op == T_GTE) {
+		AstExpr* tmp = x;
+		x = y;
+		y = tmp;
+		op = op == T_GT ? T_LT : T_LTE;
+	}
+	bool quiet = f->quiet;
+	f->quiet = true;
+	BoundsRange rx = bounds_eval(f, x);
+	BoundsRange ry = bounds_eval(f, y);
+	f->quiet = quiet;
+	// an unsigned comparison only orders negative values as they are when
+	// there are none
+	Type* t = bounds_arith_type(x, rx, y, ry);
+	if(!t || (t->kind == TYPE_UNSIGNED && (rx.lo < 0 || ry.lo < 0)))
+		return;
+	if(op == T_LT || op == T_LTE) {
+		i64 d = op == T_LT ? 1 : 0;
+		BoundsRange below = bounds_shift((BoundsRange){ INT64_MIN, ry.hi, ry.len, ry.off }, -d);
+		BoundsRange above = bounds_shift((BoundsRange){ rx.lo, INT64_MAX, -1, 0 }, d);
+		bounds_narrow(f, x, below);
+		bounds_narrow(f, y, above);
+	} else if(op == T_EQL) {
+		bounds_narrow(f, x, ry);
+		bounds_narrow(f, y, rx);
+	}
+}
+
+// the direction a store to a local moves it in
+u8 bounds_move(AstStmt* stmt) {
+	AstExpr* x = stmt->assign.x;
+	AstExpr* y = stmt->assign.y;
+	TokenKind op = stmt->assign.op;
+	i64 c;
+	if(op == T_ASSIGN && y->kind == AST_EXPR_BINARY && (y->binary.op == T_ADD || y->binary.op == T_SUB) &&
+			bounds_is_local(y->binary.x) && y->binary.x->ident.slot == x->ident.slot) {
+		op = y->binary.op == T_ADD ? T_ADD_ASSIGN : T_SUB_ASSIGN;
+		y = y->binary.y;
+	}
+	if((op == T_ADD_ASSIGN || op == T_SUB_ASSIGN) && bounds_const(y, &c) && c >= 0 && c <= BOUNDS_MAX_STEP)
+		return op == T_ADD_ASSIGN ? BOUNDS_MOVE_UP : BOUNDS_MOVE_DOWN;
+	return BOUNDS_MOVE_ANY;
+}
+
+// collects in f->moves how the stores of stmt move the locals
+void bounds_moves(BoundsFlow* f, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	AstStmtList* body = NULL;
+	switch(stmt->kind) {
+		case AST_STMT_ASSIGN: {
+			i32 slot = bounds_root(stmt->assign.x);
+			if(slot < 0)
+				return;
+			if(!f->moves[slot])
+				buf_push(f->moved, slot);
+			f->moves[slot] |= bounds_is_local(stmt->assign.x) ? bounds_move(stmt) : BOUNDS_MOVE_ANY;
+			return;
+		}
+		case AST_STMT_IF:
+			bounds_moves(f, stmt->if_.els);
+			body = &stmt->if_.body;
+			break;
+		case AST_STMT_FOR:
+			body = &stmt->for_.body;
+			break;
+		case AST_STMT_BLOCK:
+			body = &stmt->block.body;
+			break;
+		default:
+			return;
+	}
+	for(isize i = 0; i < body->len; i++) {
+		bounds_moves(f, body->list[i]);
+	}
+}
+
+// Widens the ranges of the locals changed by body to hold on every
+// iteration: a signed local that only grows keeps its lower bound, one
+// that only shrinks its upper bound, and other changed locals keep none.
+void bounds_widen(BoundsFlow* f, AstStmtList* body) {
+	for(isize i = 0; i < body->len; i++) {
+		bounds_moves(f, body->list[i]);
+	}
+	for(isize i = 0; i < buf_len(f->moved); i++) {
+		i32 slot = f->moved[i];
+		u8 move = f->moves[slot];
+		Type* t = f->types[slot];
+		f->moves[slot] = 0;
+		if(!t)
+			continue;
+		if(t->kind == TYPE_SLICE) {
+			bounds_forget(f, slot);
+			continue;
+		}
+		BoundsRange cur = f->ranges[slot];
+		BoundsRange r = bounds_top(t);
+		if(t->kind == TYPE_SIGNED && t->size == 8 && move == BOUNDS_MOVE_UP) {
+			r.lo = cur.lo;
+		} else if(t->kind == TYPE_SIGNED && t->size == 8 && move == BOUNDS_MOVE_DOWN) {
+			r.hi = cur.hi;
+			r.len = cur.len;
+			r.off = cur.off;
+		}
+		bounds_set(f, slot, r);
+	}
+	buf_clear(f->moved);
+}
+
+// Pushes to f->joins the ranges of the locals changed since mark, then
+// undoes the changes. Returns the position of the first one.
+isize bounds_branch(BoundsFlow* f, isize mark) {
+	isize first = buf_len(f->joins);
+	for(isize i = mark; i < buf_len(f->trail); i++) {
+		i32 slot = f->trail[i].slot;
+		if(f->seen[slot] < 0) {
+			f->seen[slot] = buf_len(f->joins);
+			buf_push(f->joins, (BoundsSaved){ slot, f->ranges[slot] });
+		}
+	}
+	for(isize i = first; i < buf_len(f->joins); i++) {
+		f->seen[f->joins[i].slot] = -1;
+	}
+	bounds_undo(f, mark);
+	return first;
+}
+
+void bounds_flow_stmt(BoundsFlow* f, AstStmt* stmt);
+
+void bounds_flow_block(BoundsFlow* f, AstStmtList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		bounds_flow_stmt(f, list->list[i]);
+	}
+}
+
+void bounds_flow_if(BoundsFlow* f, AstStmt* stmt) {
+	AstExpr* cond = stmt->if_.cond;
+	bounds_eval(f, cond);
+	bool dead = f->dead;
+	isize mark = buf_len(f->trail);
+	bounds_refine(f, cond, true);
+	bounds_flow_block(f, &stmt->if_.body);
+	bool then_dead = f->dead;
+	isize first = bounds_branch(f, mark);
+	f->dead = dead;
+	bounds_refine(f, cond, false);
+	bounds_flow_stmt(f, stmt->if_.els);
+	bool else_dead = f->dead;
+	isize last = bounds_branch(f, mark);
+	isize end = buf_len(f->joins);
+	// joins[first:last] hold the ranges changed by the then branch,
+	// joins[last:end] those changed by the else branch
+	for(isize i = last; i < end; i++) {
+		f->seen[f->joins[i].slot] = i;
+	}
+	for(isize i = first; i < last; i++) {
+		i32 slot = f->joins[i].slot;
+		BoundsRange r = f->seen[slot] >= 0 ? f->joins[f->seen[slot]].r : f->ranges[slot];
+		f->seen[slot] = -1;
+		if(!then_dead || !else_dead)
+			bounds_set(f, slot, then_dead ? r : else_dead ? f->joins[i].r : bounds_join(f->joins[i].r, r));
+	}
+	for(isize i = last; i < end; i++) {
+		i32 slot = f->joins[i].slot;
+		if(f->seen[slot] < 0)
+			continue;
+		f->seen[slot] = -1;
+		BoundsRange r = f->ranges[slot];
+		if(!then_dead || !else_dead)
+			bounds_set(f, slot, then_dead ? f->joins[i].r : else_dead ? r : bounds_join(r, f->joins[i].r));
+	}
+	buf_truncate(f->joins, first);
+	f->dead = then_dead && else_dead;
+}
+
+void bounds_flow_for(BoundsFlow* f, AstStmt* stmt) {
+	AstExpr* cond = stmt->for_.cond;
+	bool dead = f->dead;
+	if(!dead)
+		bounds_widen(f, &stmt->for_.body);
+	if(cond)
+		bounds_eval(f, cond);
+	isize mark = buf_len(f->trail);
+	if(cond)
+		bounds_refine(f, cond, true);
+	bounds_flow_block(f, &stmt->for_.body);
+	bounds_undo(f, mark);
+	f->dead = dead || !cond;  // a loop without condition is only left by returning
+	if(cond)
+		bounds_refine(f, cond, false);
+}
+
+void bounds_flow_assign(BoundsFlow* f, AstStmt* stmt) {
+	AstExpr* x = stmt->assign.x;
+	AstExpr* y = stmt->assign.y;
+	BoundsRange rx = bounds_eval(f, x);
+	BoundsRange ry = bounds_eval(f, y);
+	i32 slot = bounds_int_local(f, x);
+	if(slot >= 0 && !f->dead) {
+		Type* t = f->types[slot];
+		TokenKind op;
+		switch(stmt->assign.op) {
+			case T_ASSIGN:
+				bounds_set(f, slot, bounds_convert(t, bounds_is_wide(y), ry));
+				return;
+			case T_ADD_ASSIGN: op = T_ADD; break;
+			case T_SUB_ASSIGN: op = T_SUB; break;
+			case T_MUL_ASSIGN: op = T_MUL; break;
+			case T_DIV_ASSIGN: op = T_DIV; break;
+			case T_REM_ASSIGN: op = T_REM; break;
+			case T_AND_ASSIGN: op = T_AND; break;
+			case T_LSHIFT_ASSIGN: op = T_LSHIFT; break;
+			case T_RSHIFT_ASSIGN: op = T_RSHIFT; break;
+			default: op = T_ASSIGN; break;
+		}
+		BoundsRange r = bounds_top(t);
+		if((op == T_DIV || op == T_REM) && codegen_helper(op, t, y))
+			op = T_ASSIGN;
+		if(op == T_LSHIFT || op == T_RSHIFT)
+			r = bounds_binary(op, rx, ry, bounds_arith_type(x, rx, x, rx));
+		else if(op != T_ASSIGN)
+			r = bounds_binary(op, rx, ry, bounds_arith_type(x, rx, y, ry));
+		bounds_set(f, slot, bounds_convert(t, bounds_is_wide(x) || bounds_is_wide(y), r));
+		return;
+	}
+	i32 root = bounds_root(x);
+	if(root >= 0 && f->types[root] && f->types[root]->kind == TYPE_SLICE)
+		bounds_forget(f, root);
+}
+
+void bounds_flow_stmt(BoundsFlow* f, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL: {
+			AstDecl* decl = stmt->decl;
+			AstExpr* value = decl->kind == AST_DECL_LET ? decl->let.value : decl->const_.value;
+			Type* t = decl->kind == AST_DECL_LET && decl->let.type ? decl->let.type->resolved : value ? value->type : NULL;
+			BoundsRange r = value ? bounds_eval(f, value) : bounds_exact(0);
+			i32 slot = f->next_slot++;
+			bounds_declare(f, slot, decl->name, t);
+			if(bounds_is_int(f->types[slot]) && !f->dead)
+				f->ranges[slot] = bounds_convert(t, value && bounds_is_wide(value), r);
+			break;
+		}
+		case AST_STMT_EXPR:
+			bounds_eval(f, stmt->expr);
+			break;
+		case AST_STMT_IF:
+			bounds_flow_if(f, stmt);
+			break;
+		case AST_STMT_FOR:
+			bounds_flow_for(f, stmt);
+			break;
+		case AST_STMT_RETURN:
+			if(stmt->return_)
+				bounds_eval(f, stmt->return_);
+			f->dead = true;
+			break;
+		case AST_STMT_ASSIGN:
+			bounds_flow_assign(f, stmt);
+			break;
+		case AST_STMT_BLOCK:
+			bounds_flow_block(f, &stmt->block.body);
+			break;
+	}
+}
+
+// marks the indexes of sym the ranges of its locals prove in bounds
+void bounds_ranges(Bounds* b, Symbol* sym) {
+	i32 slots = sym->cold->frame_slots;
+	BoundsFlow f = { .b = b, .slots = slots, .len_name = str_intern_c("len") };
+	f.ranges = xcalloc(slots + 1, sizeof(BoundsRange));
+	f.types = xcalloc(slots + 1, sizeof(Type*));
+	f.names = xcalloc(slots + 1, sizeof(StrIntern));
+	f.moves = xcalloc(slots + 1, sizeof(u8));
+	f.seen = xmalloc((slots + 1) * sizeof(isize));
+	for(i32 i = 0; i < slots; i++) {
+		f.ranges[i] = bounds_top(NULL);
+		f.seen[i] = -1;
+	}
+	Type* t = sym->type;
+	for(isize i = 0; i < t->fn.args_len; i++) {
+		bounds_declare(&f, f.next_slot++, sym->decl->fn.params.list[i]->name, t->fn.args[i]);
+	}
+	bounds_flow_block(&f, &sym->decl->fn.body);
+	xfree(f.ranges);
+	xfree(f.types);
+	xfree(f.names);
+	xfree(f.moves);
+	xfree(f.seen);
+	buf_free(f.moved);
+	buf_free(f.trail);
+	buf_free(f.joins);
+}
+
+void bounds_print_range(BoundsIndex* ix) {
+	BoundsRange r = ix->range;
+	if(r.lo == INT64_MIN)
+		printf("[-inf, ");
+	else
+		printf("[%lld, ", (long long)r.lo);
+	if(r.hi == INT64_MAX)
+		printf("+inf]");
+	else
+		printf("%lld]", (long long)r.hi);
+	if(r.len >= 0 && r.off != 0)
+		printf(", at most %s.len %c %lld", ix->len_name, r.off < 0 ? '-' : '+',
+			r.off < 0 ? -(long long)r.off : (long long)r.off);
+	else if(r.len >= 0)
+		printf(", at most %s.len", ix->len_name);
+}
+
+// prints the checks kept in the fn analyzed last, and why
+void bounds_print(Bounds* b) {
+	for(isize i = 0; i < buf_len(b->indexes); i++) {
+		BoundsIndex* ix = &b->indexes[i];
+		isize* kind = map_lookup(&b->kinds, (u64)ix->index);
+		if(kind && *kind == BOUNDS_SAFE)
+			continue;
+		AstExpr* x = ix->index->index.x;
+		FileLoc loc = ix->index->loc;
+		printf("%s:%d:%d: index of %s", loc.file, loc.line, loc.col, x->type->kind == TYPE_ARRAY ? "array" : "slice");
+		if(x->kind == AST_EXPR_IDENT)
+			printf(" '%s'", x->ident.name);
+		if(kind && *kind == BOUNDS_AT_ENTRY) {
+			AstStmt* loop = (AstStmt*)*(isize*)map_lookup(&b->entries, (u64)ix->index);
+			printf(" checked when the loop at %d:%d is entered: ", loop->loc.line, loop->loc.col);
+		} else {
+			printf(" checked: ");
+		}
+		switch(ix->reason) {
+			case BOUNDS_NEGATIVE:
+				printf("may be negative, in ");
+				bounds_print_range(ix);
+				break;
+			case BOUNDS_UNTRACKED:
+				printf("not a local slice, or its address is taken");
+				break;
+			case BOUNDS_TOO_LARGE:
+				if(x->type->kind == TYPE_ARRAY)
+					printf("may reach the length %lld, in ", (long long)x->type->array.len);
+				else
+					printf("may reach the length, in ");
+				bounds_print_range(ix);
+				break;
+			case BOUNDS_PROVEN:
+				break;
+		}
+		printf("\n");
+	}
+	buf_clear(b->indexes);
+}
+
+// Finds the indexes that need no check and the checks to move out of the
+// loops, in every fn of syms.
+void bounds_package(Bounds* b, Symbol** syms) {
+	if(bounds_mode != BOUNDS_MODE_HOISTED)
+		return;
+	for(isize i = 0; i < buf_len(syms); i++) {
+		Symbol* sym = syms[i];
+		if(sym->kind != SYMBOL_FN || sym->decl->fn.is_extern)
+			continue;
+		buf_clear(b->taken);
+		bounds_taken_block(b, &sym->decl->fn.body);
+		bounds_ranges(b, sym);
+		bounds_loops_block(b, &sym->decl->fn.body);
+		if(bounds_report)
+			bounds_print(b);
+	}
+}
+
+// whether index, of an array or a slice, is checked where it is evaluated
+bool bounds_is_checked(Bounds* b, AstExpr* index) {
+	if(bounds_mode == BOUNDS_MODE_OFF)
+		return false;
+	return bounds_mode == BOUNDS_MODE_ON || !map_lookup(&b->kinds, (u64)index);
+}
+
+void bounds_free(Bounds* b) {
+	map_free(&b->kinds);
+	map_free(&b->loops);
+	map_free(&b->entries);
+	buf_free(b->hoists);
+	buf_free(b->taken);
+	buf_free(b->indexes);
+}
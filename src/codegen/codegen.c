@@ -0,0 +1,2028 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// C code generation.
+// The resolved package is written out as a single C11 translation unit
+// that uses the GNU extensions GCC and Clang share (range designators,
+// statement expressions, __auto_type). The output is produced in passes
+// over the resolved symbols, in the order they were declared
+// (symbol_order): every type the package uses is collected first and
+// written as forward declarations, fn pointer typedefs and definitions in
+// dependency order, followed by the prototypes of every fn and global, the
+// globals, and the fn bodies one at a time. Output goes through a Writer,
+// so memory stays bounded by the largest fn whatever the size of the
+// package.
+// Package symbols keep their names, unless a name is a C keyword, a name
+// the included headers may define, or starts with nl_: those get the nl_
+// prefix. Every other generated name starts with nl_: structural types are
+// nl_t_<mangled type>, locals nl_l<slot>_<name> (slots are unique in a fn,
+// so shadowing needs no care) and enum constructors nl_c_<enum>_<variant>.
+// Arrays and tuples are wrapped in structs, so they are passed and
+// assigned by value; enums are a tag followed by a union of the payloads,
+// or their payload alone when the tag is stored in its niche (layout.c).
+// Struct fields are written in offset order and their layout is checked
+// against the layout pass with static asserts. Constants are written out
+// as values wherever they are named.
+// Direct calls to small fns that are not recursive go to a static inline
+// copy of the fn, nl_i_<fn>, which the C compiler is told to always
+// inline; the fn itself forwards to its copy, so it stays callable as a fn
+// value and from C. Indexes of arrays and slices are checked (bounds.c).
+
+typedef struct CodegenPrimitive {
+	Type** type;
+	const char* c;
+	char mangle;
+} CodegenPrimitive;
+
+CodegenPrimitive codegen_primitives[] = {
+	{ &primitive_void, "void", 'v' },
+	{ &primitive_bool, "bool", 'b' },
+	{ &primitive_u8, "uint8_t", 'h' },
+	{ &primitive_u16, "uint16_t", 't' },
+	{ &primitive_u32, "uint32_t", 'j' },
+	{ &primitive_u64, "uint64_t", 'm' },
+	{ &primitive_usize, "uintptr_t", 'z' },
+	{ &primitive_i8, "int8_t", 'a' },
+	{ &primitive_i16, "int16_t", 's' },
+	{ &primitive_i32, "int32_t", 'i' },
+	{ &primitive_i64, "int64_t", 'l' },
+	{ &primitive_isize, "intptr_t", 'x' },
+	{ &primitive_f32, "float", 'f' },
+	{ &primitive_f64, "double", 'd' },
+};
+
+const char* codegen_keywords[] = {
+	"auto", "break", "case", "char", "const", "continue", "default", "do", "double",
+	"else", "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long",
+	"register", "restrict", "return", "short", "signed", "sizeof", "static", "struct",
+	"switch", "typedef", "union", "unsigned", "void", "volatile", "while", "asm",
+	"typeof", "bool", "true", "false", "NULL", "offsetof",
+};
+
+const char* codegen_preamble =
+	"// generated by nc, do not edit\n"
+	"#include <stdbool.h>\n"
+	"#include <stdint.h>\n"
+	"\n"
+	"// reinterprets the bytes of x as a T\n"
+	"#define nl_bitcast(T, ...) ({ __typeof__(__VA_ARGS__) nl_x_ = (__VA_ARGS__); T nl_r_; \\\n"
+	"\t__builtin_memset(&nl_r_, 0, sizeof(nl_r_)); \\\n"
+	"\t__builtin_memcpy(&nl_r_, &nl_x_, sizeof(nl_r_) < sizeof(nl_x_) ? sizeof(nl_r_) : sizeof(nl_x_)); nl_r_; })\n"
+	"\n"
+	"__attribute__((noreturn, cold)) static inline void nl_bounds_fail(intptr_t i, intptr_t len, const char* pos) {\n"
+	"\t__builtin_printf(\"runtime error: index %lld out of bounds for length %lld at %s\\n\", (long long)i, (long long)len, pos);\n"
+	"\t__builtin_exit(1);\n"
+	"}\n"
+	"\n"
+	"// x + y, x - y and x * y wrapped around in T, as the VM computes them\n"
+	"#define nl_add(T, x, y) ({ T nl_w_; __builtin_add_overflow(x, y, &nl_w_); nl_w_; })\n"
+	"#define nl_sub(T, x, y) ({ T nl_w_; __builtin_sub_overflow(x, y, &nl_w_); nl_w_; })\n"
+	"#define nl_mul(T, x, y) ({ T nl_w_; __builtin_mul_overflow(x, y, &nl_w_); nl_w_; })\n"
+	"\n"
+	"__attribute__((noreturn, cold)) static inline void nl_div_fail(const char* fn) {\n"
+	"\t__builtin_printf(\"runtime error: division by zero in fn '%s'\\n\", fn);\n"
+	"\t__builtin_exit(1);\n"
+	"}\n"
+	"\n"
+	"// x / y and x % y in T, as the VM computes them: the least value divided\n"
+	"// by -1 wraps around, and division by zero is a runtime error in fn\n"
+	"#define nl_div(T, x, y, fn) ({ T nl_dx_ = (x), nl_dy_ = (y); if(nl_dy_ == 0) nl_div_fail(fn); \\\n"
+	"\t(T)((T)-1 < 0 && nl_dy_ == (T)-1 ? 0 - (uint64_t)nl_dx_ : (uint64_t)(nl_dx_ / nl_dy_)); })\n"
+	"#define nl_rem(T, x, y, fn) ({ T nl_dx_ = (x), nl_dy_ = (y); if(nl_dy_ == 0) nl_div_fail(fn); \\\n"
+	"\t(T)((T)-1 < 0 && nl_dy_ == (T)-1 ? 0 : nl_dx_ % nl_dy_); })\n"
+	"\n"
+	"// x << y and x >> y in T, the count taken modulo 64 as the VM does\n"
+	"#define nl_shl(T, x, y) ((T)((uint64_t)(x) << ((y) & 63)))\n"
+	"#define nl_shr(T, x, y) ((T)((T)-1 < 0 ? (uint64_t)((int64_t)(x) >> ((y) & 63)) : (uint64_t)(x) >> ((y) & 63)))\n"
+	"\n"
+	"// a T whose bytes are all b\n"
+	"#define nl_fill(T, b) ({ T nl_f_; __builtin_memset(&nl_f_, b, sizeof(nl_f_)); nl_f_; })\n"
+	"\n"
+	"// i, an index of an array or a slice of length len\n"
+	"static inline intptr_t nl_check(intptr_t i, intptr_t len, const char* pos) {\n"
+	"\tif(__builtin_expect((uintptr_t)i >= (uintptr_t)len, 0))\n"
+	"\t\tnl_bounds_fail(i, len, pos);\n"
+	"\treturn i;\n"
+	"}\n"
+	"\n";
+
+// a type that needs a C name
+typedef struct CodegenType {
+	Type* type;
+	char* name;
+	bool done;  // declared (fn types) or defined (the others)
+} CodegenType;
+
+typedef map_type(u64, isize) MapCodegenIds;
+
+// Whether x op y in t goes through nl_add, nl_sub or nl_mul. Signed overflow
+// is undefined in C, and types narrower than int are computed in int, but
+// the VM and --native wrap around in t.
+bool codegen_wraps(TokenKind op, Type* t) {
+	if(op != T_ADD && op != T_SUB && op != T_MUL)
+		return false;
+	return t && (t->kind == TYPE_SIGNED || (t->kind == TYPE_UNSIGNED && t->size < 4));
+}
+
+// v as a t, sign extended for signed types
+u64 codegen_fit(Type* t, u64 v) {
+	if(t->size < 8) {
+		u64 bits = (u64)t->size * 8;
+		v &= ((u64)1 << bits) - 1;
+		if(t->kind == TYPE_SIGNED && v >> (bits - 1))
+			v |= ~(((u64)1 << bits) - 1);
+	}
+	return v;
+}
+
+bool codegen_const_int(AstExpr* expr, u64* value);
+
+// The nl_ helper that computes x op y in t, or NULL when the C operator
+// gives the same result. Besides wrapping around (codegen_wraps), the VM
+// and --native define the least value divided by -1 and shifts by the
+// width or more, which C leaves undefined, and report division by zero.
+const char* codegen_helper(TokenKind op, Type* t, AstExpr* y) {
+	if(!t || (t->kind != TYPE_SIGNED && t->kind != TYPE_UNSIGNED))
+		return NULL;
+	u64 c;
+	bool is_const = codegen_const_int(y, &c);
+	switch(op) {
+		case T_ADD:
+		case T_SUB:
+		case T_MUL:
+			if(!codegen_wraps(op, t))
+				return NULL;
+			return op == T_ADD ? "nl_add" : op == T_SUB ? "nl_sub" : "nl_mul";
+		case T_DIV:
+		case T_REM:
+			c = is_const ? codegen_fit(t, c) : 0;
+			if(is_const && c != 0 && (t->kind == TYPE_UNSIGNED || c != (u64)-1))
+				return NULL;
+			return op == T_DIV ? "nl_div" : "nl_rem";
+		case T_LSHIFT:
+		case T_RSHIFT:
+			// C shifts x as promoted: only a signed one, shifted left, may
+			// overflow
+			if(is_const && c < (u64)t->size * 8 && t->size >= 4 && (op == T_RSHIFT || t->kind == TYPE_UNSIGNED))
+				return NULL;
+			return op == T_LSHIFT ? "nl_shl" : "nl_shr";
+		default:
+			return NULL;
+	}
+}
+
+#include "bounds.c"
+
+typedef struct Codegen {
+	Package* pkg;
+	Writer w;
+	Symbol** syms;           // resolved symbols, in declaration order
+	CodegenType* types;      // named types, in the order they were found
+	MapCodegenIds type_ids;  // Type* -> index in types, -1 for unnamed types
+	MapCodegenIds reserved;  // StrIntern -> 1 for the names to prefix
+	isize indent;
+	i32 next_slot;           // slot of the next local declared in the fn
+	MapCodegenIds inlined;   // Symbol* -> 1 for the fns called through their inline copy
+	Symbol** inline_order;   // those fns, each after the ones it calls
+	Bounds bounds;
+	const char* fn_name;     // of the fn being written, for runtime errors
+} Codegen;
+
+#define cg_puts(g, s)  buf_puts((g)->w.buf, s)
+#define cg_putc(g, c)  buf_putc((g)->w.buf, c)
+#define cg_puti(g, x)  buf_puti((g)->w.buf, x)
+#define cg_putu(g, x)  buf_putu((g)->w.buf, x)
+#define cg_printf(g, ...) buf_printf((g)->w.buf, __VA_ARGS__)
+
+#define codegen_error(loc, fmt, ...) (print_error_pos(loc, "codegen error: " fmt, ##__VA_ARGS__), resolve_abort())
+
+CodegenPrimitive* codegen_primitive(Type* t) {
+	for(isize i = 0; i < (isize)(sizeof(codegen_primitives) / sizeof(codegen_primitives[0])); i++) {
+		if(*codegen_primitives[i].type == t)
+			return &codegen_primitives[i];
+	}
+	return NULL;
+}
+
+bool codegen_is_reserved(Codegen* g, StrIntern name) {
+	if(map_lookup(&g->reserved, (u64)name))
+		return true;
+	isize len = strlen(name);
+	if(strncmp(name, "nl_", 3) == 0 || strncmp(name, "__", 2) == 0 || (name[0] == '_' && isupper(name[1])))
+		return true;
+	// typedefs and limits of stdint.h
+	if(len > 2 && strcmp(name + len - 2, "_t") == 0)
+		return true;
+	return strncmp(name, "INT", 3) == 0 || strncmp(name, "UINT", 4) == 0 || strncmp(name, "PTRDIFF_", 8) == 0 ||
+		strncmp(name, "SIZE_", 5) == 0 || strncmp(name, "SIG_ATOMIC_", 11) == 0 ||
+		strncmp(name, "WCHAR_", 6) == 0 || strncmp(name, "WINT_", 5) == 0;
+}
+
+void codegen_put_name(Codegen* g, char** b, StrIntern name) {
+	if(codegen_is_reserved(g, name))
+		buf_puts(*b, "nl_");
+	buf_puts(*b, name);
+}
+
+// Mangled structural types are a prefix code: nominal types are their
+// name with its length in front, primitives a letter, and the others a
+// letter followed by their components.
+void codegen_mangle(char** b, Type* t) {
+	CodegenPrimitive* p = codegen_primitive(t);
+	if(p) {
+		buf_putc(*b, p->mangle);
+		return;
+	}
+	switch(t->kind) {
+		case TYPE_STRUCT:
+		case TYPE_ENUM:
+			buf_putu(*b, strlen(t->symbol->name));
+			buf_puts(*b, t->symbol->name);
+			break;
+		case TYPE_PTR:
+			buf_putc(*b, 'P');
+			codegen_mangle(b, t->ptr);
+			break;
+		case TYPE_ARRAY:
+			buf_putc(*b, 'A');
+			buf_putu(*b, t->array.len);
+			buf_putc(*b, '_');
+			codegen_mangle(b, t->array.base);
+			break;
+		case TYPE_SLICE:
+			buf_putc(*b, 'S');
+			codegen_mangle(b, t->slice);
+			break;
+		case TYPE_TUPLE:
+			buf_putc(*b, 'T');
+			buf_putu(*b, t->tuple.args_len);
+			buf_putc(*b, '_');
+			for(isize i = 0; i < t->tuple.args_len; i++) {
+				codegen_mangle(b, t->tuple.args[i]);
+			}
+			break;
+		case TYPE_FN:
+			buf_putc(*b, 'F');
+			buf_putu(*b, t->fn.args_len);
+			buf_putc(*b, '_');
+			for(isize i = 0; i < t->fn.args_len; i++) {
+				codegen_mangle(b, t->fn.args[i]);
+			}
+			codegen_mangle(b, t->fn.ret);
+			break;
+		default:
+			assert(0);
+			break;
+	}
+}
+
+// types t names, by value or not
+isize codegen_components_len(Type* t) {
+	switch(t->kind) {
+		case TYPE_PTR:
+		case TYPE_SLICE:
+			return 1;
+		case TYPE_FN:
+			return t->fn.args_len + 1;
+		case TYPE_ENUM:
+			return t->enum_.variants_len + 1;
+		default:
+			return layout_components_len(t);
+	}
+}
+
+Type* codegen_component(Type* t, isize i) {
+	switch(t->kind) {
+		case TYPE_PTR:
+			return t->ptr;
+		case TYPE_SLICE:
+			return t->slice;
+		case TYPE_FN:
+			return i < t->fn.args_len ? t->fn.args[i] : t->fn.ret;
+		case TYPE_ENUM:
+			return i < t->enum_.variants_len ? t->enum_.variants[i].payload : t->enum_.tag;
+		default:
+			return layout_component(t, i);
+	}
+}
+
+// Registers t and the types it is made of. Primitives and pointers are
+// spelled in place and get no name. Types may nest deeply, so there is no
+// recursion.
+void codegen_use_type(Codegen* g, Type* t) {
+	Type** stack = NULL;
+	buf_push(stack, t);
+	while(buf_len(stack) > 0) {
+		t = stack[buf_len(stack) - 1];
+		buf_truncate(stack, buf_len(stack) - 1);
+		if(!t || map_lookup(&g->type_ids, (u64)t))
+			continue;
+		bool named = !codegen_primitive(t) && t->kind != TYPE_PTR;
+		map_set(&g->type_ids, (u64)t, named ? buf_len(g->types) : -1);
+		if(named) {
+			char* name = NULL;
+			if(t->kind == TYPE_STRUCT || t->kind == TYPE_ENUM) {
+				codegen_put_name(g, &name, t->symbol->name);
+			} else {
+				buf_puts(name, "nl_t_");
+				codegen_mangle(&name, t);
+			}
+			buf_push(g->types, (CodegenType){ t, name, false });
+		}
+		for(isize i = codegen_components_len(t) - 1; i >= 0; i--) {
+			buf_push(stack, codegen_component(t, i));
+		}
+	}
+	buf_free(stack);
+}
+
+CodegenType* codegen_type_info(Codegen* g, Type* t) {
+	isize* id = map_lookup(&g->type_ids, (u64)t);
+	assert(id && *id >= 0);
+	return &g->types[*id];
+}
+
+void codegen_put_type(Codegen* g, char** b, Type* t) {
+	CodegenPrimitive* p = codegen_primitive(t);
+	if(p) {
+		buf_puts(*b, p->c);
+	} else if(t->kind == TYPE_PTR) {
+		codegen_put_type(g, b, t->ptr);
+		buf_putc(*b, '*');
+	} else {
+		buf_puts(*b, codegen_type_info(g, t)->name);
+	}
+}
+
+#define cg_type(g, t) codegen_put_type((g), &(g)->w.buf, (t))
+#define cg_name(g, n) codegen_put_name((g), &(g)->w.buf, (n))
+
+void codegen_indent(Codegen* g) {
+	buf_putn(g->w.buf, '\t', g->indent);
+}
+
+bool codegen_is_aggregate(Type* t) {
+	return t && (t->kind == TYPE_ARRAY || t->kind == TYPE_TUPLE || t->kind == TYPE_SLICE ||
+		t->kind == TYPE_STRUCT || t->kind == TYPE_ENUM);
+}
+
+void codegen_collect_expr(Codegen* g, AstExpr* expr);
+
+void codegen_collect_expr_list(Codegen* g, AstExprList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		codegen_collect_expr(g, list->list[i]);
+	}
+}
+
+void codegen_collect_expr(Codegen* g, AstExpr* expr) {
+	if(!expr)
+		return;
+	codegen_use_type(g, expr->type);
+	switch(expr->kind) {
+		case AST_EXPR_MEMBER:
+			codegen_collect_expr(g, expr->member.x);
+			break;
+		case AST_EXPR_CALL:
+			codegen_collect_expr(g, expr->call.x);
+			codegen_collect_expr_list(g, &expr->call.args);
+			break;
+		case AST_EXPR_UNARY:
+			codegen_collect_expr(g, expr->unary.x);
+			break;
+		case AST_EXPR_BINARY:
+			codegen_collect_expr(g, expr->binary.x);
+			codegen_collect_expr(g, expr->binary.y);
+			break;
+		case AST_EXPR_CAST:
+			codegen_collect_expr(g, expr->cast.x);
+			break;
+		case AST_EXPR_INDEX:
+			codegen_collect_expr(g, expr->index.x);
+			codegen_collect_expr(g, expr->index.arg);
+			break;
+		case AST_EXPR_TUPLE:
+			codegen_collect_expr_list(g, &expr->tuple.args);
+			break;
+		case AST_EXPR_ARRAY:
+			codegen_collect_expr(g, expr->array.init);
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			codegen_collect_expr_list(g, &expr->array_list.args);
+			break;
+		case AST_EXPR_INIT:
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				codegen_collect_expr(g, expr->init.fields.list[i]->expr);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void codegen_collect_stmt(Codegen* g, AstStmt* stmt);
+
+void codegen_collect_block(Codegen* g, AstStmtList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		codegen_collect_stmt(g, list->list[i]);
+	}
+}
+
+void codegen_collect_stmt(Codegen* g, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL:
+			if(stmt->decl->kind == AST_DECL_LET) {
+				codegen_use_type(g, stmt->decl->let.type ? stmt->decl->let.type->resolved : NULL);
+				codegen_collect_expr(g, stmt->decl->let.value);
+			} else {
+				codegen_collect_expr(g, stmt->decl->const_.value);
+			}
+			break;
+		case AST_STMT_EXPR:
+			codegen_collect_expr(g, stmt->expr);
+			break;
+		case AST_STMT_IF:
+			codegen_collect_expr(g, stmt->if_.cond);
+			codegen_collect_block(g, &stmt->if_.body);
+			codegen_collect_stmt(g, stmt->if_.els);
+			break;
+		case AST_STMT_FOR:
+			codegen_collect_expr(g, stmt->for_.cond);
+			codegen_collect_block(g, &stmt->for_.body);
+			break;
+		case AST_STMT_RETURN:
+			codegen_collect_expr(g, stmt->return_);
+			break;
+		case AST_STMT_ASSIGN:
+			codegen_collect_expr(g, stmt->assign.x);
+			codegen_collect_expr(g, stmt->assign.y);
+			break;
+		case AST_STMT_BLOCK:
+			codegen_collect_block(g, &stmt->block.body);
+			break;
+	}
+}
+
+void codegen_fn_typedef(Codegen* g, Type* t) {
+	cg_puts(g, "typedef ");
+	cg_type(g, t->fn.ret);
+	cg_printf(g, " (*%s)(", codegen_type_info(g, t)->name);
+	for(isize i = 0; i < t->fn.args_len; i++) {
+		if(i > 0)
+			cg_puts(g, ", ");
+		cg_type(g, t->fn.args[i]);
+	}
+	cg_puts(g, t->fn.args_len == 0 ? "void);\n" : ");\n");
+}
+
+int codegen_cmp_field(const void* x, const void* y) {
+	const TypeField* a = *(const TypeField**)x;
+	const TypeField* b = *(const TypeField**)y;
+	if(a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a->bit < b->bit ? -1 : a->bit > b->bit;
+}
+
+void codegen_define_struct(Codegen* g, Type* t) {
+	TypeField** fields = NULL;
+	for(isize i = 0; i < t->struct_.fields_len; i++) {
+		buf_push(fields, &t->struct_.fields[i]);
+	}
+	if(fields)
+		qsort(fields, buf_len(fields), sizeof(TypeField*), codegen_cmp_field);
+	for(isize i = 0; i < buf_len(fields); i++) {
+		cg_putc(g, '\t');
+		cg_type(g, fields[i]->type);
+		cg_putc(g, ' ');
+		cg_name(g, fields[i]->name);
+		cg_puts(g, fields[i]->bit >= 0 ? " : 1;\n" : ";\n");
+	}
+	buf_free(fields);
+}
+
+void codegen_define_enum(Codegen* g, Type* t) {
+	if(!t->enum_.tag) {
+		TypeVariant* v = t->enum_.niche_variant >= 0 ? &t->enum_.variants[t->enum_.niche_variant] : NULL;
+		if(v && v->payload) {
+			cg_putc(g, '\t');
+			cg_type(g, v->payload);
+			cg_puts(g, " payload;\n");
+		}
+		return;
+	}
+	cg_putc(g, '\t');
+	cg_type(g, t->enum_.tag);
+	cg_puts(g, " tag;\n");
+	bool has_payload = false;
+	for(isize i = 0; i < t->enum_.variants_len; i++) {
+		has_payload = has_payload || t->enum_.variants[i].payload;
+	}
+	if(!has_payload)
+		return;
+	cg_puts(g, "\tunion {\n");
+	for(isize i = 0; i < t->enum_.variants_len; i++) {
+		TypeVariant* v = &t->enum_.variants[i];
+		if(!v->payload)
+			continue;
+		cg_puts(g, "\t\t");
+		cg_type(g, v->payload);
+		cg_putc(g, ' ');
+		cg_name(g, v->name);
+		cg_puts(g, ";\n");
+	}
+	cg_puts(g, "\t} payload;\n");
+}
+
+void codegen_definition(Codegen* g, Type* t) {
+	CodegenType* info = codegen_type_info(g, t);
+	cg_printf(g, "struct %s {\n", info->name);
+	switch(t->kind) {
+		case TYPE_ARRAY:
+			cg_putc(g, '\t');
+			cg_type(g, t->array.base);
+			cg_printf(g, " a[%lld];\n", (long long)t->array.len);
+			break;
+		case TYPE_SLICE:
+			cg_putc(g, '\t');
+			cg_type(g, t->slice);
+			cg_puts(g, "* ptr;\n\tintptr_t len;\n");
+			break;
+		case TYPE_TUPLE:
+			for(isize i = 0; i < t->tuple.args_len; i++) {
+				cg_putc(g, '\t');
+				cg_type(g, t->tuple.args[i]);
+				cg_printf(g, " f%lld;\n", (long long)i);
+			}
+			break;
+		case TYPE_STRUCT:
+			codegen_define_struct(g, t);
+			break;
+		case TYPE_ENUM:
+			codegen_define_enum(g, t);
+			break;
+		default:
+			assert(0);
+			break;
+	}
+	cg_puts(g, "};\n");
+	// types built after the layout pass (typing.c) have no layout
+	if(t->align > 0) {
+		cg_printf(g, "_Static_assert(sizeof(%s) == %lld && _Alignof(%s) == %lld, \"layout of %s\");\n",
+			info->name, (long long)t->size, info->name, (long long)t->align, info->name);
+	}
+	writer_flush(&g->w, false);
+}
+
+void codegen_put_constructor_name(Codegen* g, Type* t, TypeVariant* v) {
+	cg_printf(g, "nl_c_%lld%s_%s", (long long)strlen(t->symbol->name), t->symbol->name, v->name);
+}
+
+// stores the bytes of value at offset of e, for the variants in the niche
+void codegen_put_niche_store(Codegen* g, TypeNiche niche, u64 value) {
+	cg_printf(g, "\t{ uint%lld_t v = %lluu; __builtin_memcpy((char*)&e + %lld, &v, sizeof(v)); }\n",
+		(long long)niche.size * 8, (unsigned long long)value, (long long)niche.offset);
+}
+
+void codegen_enum_constructors(Codegen* g, Type* t) {
+	const char* name = codegen_type_info(g, t)->name;
+	for(isize i = 0; i < t->enum_.variants_len; i++) {
+		TypeVariant* v = &t->enum_.variants[i];
+		cg_printf(g, "static inline %s ", name);
+		codegen_put_constructor_name(g, t, v);
+		cg_putc(g, '(');
+		if(v->payload) {
+			cg_type(g, v->payload);
+			cg_puts(g, " p");
+		} else {
+			cg_puts(g, "void");
+		}
+		cg_printf(g, ") {\n\t%s e;\n\t__builtin_memset(&e, 0, sizeof(e));\n", name);
+		if(t->enum_.tag) {
+			cg_printf(g, "\te.tag = %lld;\n", (long long)v->value);
+			if(v->payload) {
+				cg_puts(g, "\te.payload.");
+				cg_name(g, v->name);
+				cg_puts(g, " = p;\n");
+			}
+		} else if(i == t->enum_.niche_variant) {
+			if(v->payload)
+				cg_puts(g, "\te.payload = p;\n");
+		} else {
+			codegen_put_niche_store(g, t->niche, v->niche_value);
+		}
+		cg_puts(g, "\treturn e;\n}\n");
+	}
+	writer_flush(&g->w, false);
+}
+
+typedef struct CodegenFrame {
+	Type* type;
+	isize next;  // next component to visit
+} CodegenFrame;
+
+// The dependency of t to write first: fn pointer typedefs only need the
+// types they name to be declared, except for the fn types among them;
+// definitions need the types they hold by value to be defined.
+Type* codegen_dependency(Type* t, isize i, bool fns) {
+	Type* c = fns ? codegen_component(t, i) : layout_component(t, i);
+	while(fns && c && c->kind == TYPE_PTR) {
+		c = c->ptr;
+	}
+	if(!c || codegen_primitive(c) || c->kind == TYPE_PTR || fns != (c->kind == TYPE_FN))
+		return NULL;
+	return c;
+}
+
+// writes t after its dependencies, with an explicit stack like layout_type
+void codegen_write_type(Codegen* g, Type* t, bool fns) {
+	CodegenFrame* stack = NULL;
+	codegen_type_info(g, t)->done = true;
+	buf_push(stack, (CodegenFrame){ t, 0 });
+	while(buf_len(stack) > 0) {
+		CodegenFrame* f = &stack[buf_len(stack) - 1];
+		isize len = fns ? codegen_components_len(f->type) : layout_components_len(f->type);
+		if(f->next < len) {
+			Type* c = codegen_dependency(f->type, f->next++, fns);
+			if(c && !codegen_type_info(g, c)->done) {
+				codegen_type_info(g, c)->done = true;
+				buf_push(stack, (CodegenFrame){ c, 0 });
+			}
+			continue;
+		}
+		if(fns)
+			codegen_fn_typedef(g, f->type);
+		else
+			codegen_definition(g, f->type);
+		buf_truncate(stack, buf_len(stack) - 1);
+	}
+	buf_free(stack);
+}
+
+void codegen_types(Codegen* g) {
+	isize len = buf_len(g->types);
+	for(isize i = 0; i < len; i++) {
+		if(g->types[i].type->kind != TYPE_FN)
+			cg_printf(g, "typedef struct %s %s;\n", g->types[i].name, g->types[i].name);
+	}
+	for(isize i = 0; i < len; i++) {
+		if(g->types[i].type->kind == TYPE_FN && !g->types[i].done)
+			codegen_write_type(g, g->types[i].type, true);
+	}
+	cg_putc(g, '\n');
+	writer_flush(&g->w, false);
+	for(isize i = 0; i < len; i++) {
+		if(g->types[i].type->kind != TYPE_FN && !g->types[i].done)
+			codegen_write_type(g, g->types[i].type, false);
+	}
+	for(isize i = 0; i < len; i++) {
+		if(g->types[i].type->kind == TYPE_ENUM)
+			codegen_enum_constructors(g, g->types[i].type);
+	}
+	cg_putc(g, '\n');
+}
+
+void codegen_float(Codegen* g, double f) {
+	if(f != f) {
+		cg_puts(g, "__builtin_nan(\"\")");
+	} else if(f - f != f - f) {
+		cg_puts(g, f < 0 ? "(-__builtin_inf())" : "__builtin_inf()");
+	} else {
+		char tmp[32];
+		snprintf(tmp, sizeof(tmp), "%.17g", f);
+		cg_puts(g, tmp);
+		if(!strpbrk(tmp, ".e"))
+			cg_puts(g, ".0");
+	}
+}
+
+void codegen_int(Codegen* g, i64 x) {
+	if(x == INT64_MIN)
+		cg_puts(g, "(-INT64_C(9223372036854775807) - 1)");
+	else if(x >= INT32_MIN && x <= INT32_MAX)
+		cg_puti(g, x);
+	else
+		cg_printf(g, "INT64_C(%lld)", (long long)x);
+}
+
+void codegen_const(Codegen* g, ConstValue v) {
+	if(v.type) {
+		cg_puts(g, "((");
+		cg_type(g, v.type);
+		cg_putc(g, ')');
+	}
+	switch(v.kind) {
+		case CONST_INT:
+			if(v.type && v.type->kind == TYPE_UNSIGNED)
+				cg_printf(g, "UINT64_C(%llu)", (unsigned long long)v.u);
+			else
+				codegen_int(g, v.i);
+			break;
+		case CONST_FLOAT:
+			codegen_float(g, v.f);
+			break;
+		case CONST_BOOL:
+			cg_puts(g, v.b ? "true" : "false");
+			break;
+	}
+	if(v.type)
+		cg_putc(g, ')');
+}
+
+// Escapes are decoded by C as they are by the lexer, except \x, which
+// takes any number of digits in C: it is written in octal instead.
+void codegen_string(Codegen* g, StrRange s) {
+	cg_puts(g, "((uint8_t*)\"");
+	for(isize i = 0; i < s.l; i++) {
+		if(s.s[i] == '\\' && i + 1 < s.l && s.s[i + 1] == 'x') {
+			char digits[3] = { 0 };
+			memcpy(digits, s.s + i + 2, MIN(2, s.l - i - 2));
+			cg_printf(g, "\\%03o", (unsigned)strtoul(digits, NULL, 16));
+			i += 3;
+		} else if(s.s[i] == '\\' && i + 1 < s.l) {
+			cg_putc(g, s.s[i]);
+			cg_putc(g, s.s[++i]);
+		} else if(s.s[i] == '?') {
+			cg_puts(g, "\\?");  // no trigraphs
+		} else {
+			cg_putc(g, s.s[i]);
+		}
+	}
+	cg_puts(g, "\")");
+}
+
+// the static inline copy of a fn
+void codegen_put_inline_name(Codegen* g, Symbol* sym) {
+	cg_puts(g, "nl_i_");
+	cg_puts(g, sym->name);
+}
+
+void codegen_local(Codegen* g, i32 slot, StrIntern name) {
+	cg_printf(g, "nl_l%d_%s", slot, name);
+}
+
+void codegen_expr(Codegen* g, AstExpr* expr);
+
+void codegen_expr_list(Codegen* g, AstExprList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		if(i > 0)
+			cg_puts(g, ", ");
+		codegen_expr(g, list->list[i]);
+	}
+}
+
+// the type of an aggregate literal, which C needs to name it
+Type* codegen_literal_type(AstExpr* expr) {
+	if(!expr->type)
+		codegen_error(expr->loc, "cannot tell the type of this %s", expr->kind == AST_EXPR_INIT ? "initializer" : "literal");
+	return expr->type;
+}
+
+// Aggregate literals are brace lists, preceded by their type unless they
+// initialize a global (C only takes brace lists there).
+void codegen_aggregate(Codegen* g, AstExpr* expr, bool braces_only);
+bool codegen_is_constant(AstExpr* expr);
+
+// the value of expr when it is an integer constant, wrapped to 64 bits
+bool codegen_const_int(AstExpr* expr, u64* value) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+			*value = expr->lit_int;
+			return true;
+		case AST_EXPR_LIT_CHAR:
+			*value = (u64)(i64)expr->lit_char;
+			return true;
+		case AST_EXPR_IDENT: {
+			Symbol* sym = expr->ident.sym;
+			if(!sym || sym->kind != SYMBOL_CONST || (sym->cold->value.kind != CONST_INT && sym->cold->value.kind != CONST_BOOL))
+				return false;
+			ConstValue v = sym->cold->value;
+			*value = v.kind == CONST_BOOL ? v.b : v.u;
+			return true;
+		}
+		case AST_EXPR_UNARY:
+			if(expr->unary.op != T_SUB || !codegen_const_int(expr->unary.x, value))
+				return false;
+			*value = 0 - *value;
+			return true;
+		case AST_EXPR_BINARY: {
+			// the low bits of these do not depend on the high ones
+			u64 y;
+			if(!codegen_const_int(expr->binary.x, value) || !codegen_const_int(expr->binary.y, &y))
+				return false;
+			switch(expr->binary.op) {
+				case T_ADD: *value += y; return true;
+				case T_SUB: *value -= y; return true;
+				case T_MUL: *value *= y; return true;
+				case T_AND: *value &= y; return true;
+				case T_OR: *value |= y; return true;
+				case T_XOR: *value ^= y; return true;
+				default: return false;
+			}
+		}
+		case AST_EXPR_CAST: {
+			Type* t = expr->cast.type->resolved;
+			Type* from = expr->cast.x->type;
+			if((t->kind != TYPE_SIGNED && t->kind != TYPE_UNSIGNED) || (from && from->kind == TYPE_FLOAT) ||
+					!codegen_const_int(expr->cast.x, value))
+				return false;
+			*value = codegen_fit(t, *value);
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+// whether the constant expr, as a t, is made of a single byte repeated
+bool codegen_fill_byte(AstExpr* expr, Type* t, int* byte) {
+	u64 v;
+	switch(expr->kind) {
+		case AST_EXPR_ARRAY:
+			return t->kind == TYPE_ARRAY && codegen_fill_byte(expr->array.init, t->array.base, byte);
+		case AST_EXPR_ARRAY_LIST: {
+			AstExprList* args = &expr->array_list.args;
+			int first;
+			if(t->kind != TYPE_ARRAY || args->len != t->array.len || !codegen_fill_byte(args->list[0], t->array.base, &first))
+				return false;
+			for(isize i = 1; i < args->len; i++) {
+				if(!codegen_fill_byte(args->list[i], t->array.base, byte) || *byte != first)
+					return false;
+			}
+			*byte = first;
+			return true;
+		}
+		case AST_EXPR_LIT_FLOAT:
+			*byte = 0;
+			return t->kind == TYPE_FLOAT && expr->lit_float == 0;  // literals are not negative
+		default:
+			break;
+	}
+	if(!codegen_const_int(expr, &v))
+		return false;
+	if(t->kind == TYPE_BOOLEAN) {
+		*byte = v != 0;
+		return true;
+	}
+	if(t->kind == TYPE_FLOAT) {
+		*byte = 0;
+		return v == 0;
+	}
+	if(t->kind != TYPE_SIGNED && t->kind != TYPE_UNSIGNED)
+		return false;
+	*byte = v & 0xff;
+	for(isize i = 1; i < t->size; i++) {
+		if(((v >> (i * 8)) & 0xff) != (u64)*byte)
+			return false;
+	}
+	return true;
+}
+
+// Array literals in fns whose elements are all constant are not stored
+// element by element: a single byte repeated is a memset, and the others
+// are copied from read-only data, as C initializes static consts.
+bool codegen_constant_array(Codegen* g, AstExpr* expr) {
+	Type* t = codegen_literal_type(expr);
+	int byte;
+	if(t->kind != TYPE_ARRAY || t->array.len == 0 || !codegen_is_constant(expr))
+		return false;
+	if(codegen_fill_byte(expr, t, &byte)) {
+		cg_puts(g, "nl_fill(");
+		cg_type(g, t);
+		cg_printf(g, ", %d)", byte);
+		return true;
+	}
+	cg_puts(g, "({ static const ");
+	cg_type(g, t);
+	cg_puts(g, " nl_c_ = ");
+	codegen_aggregate(g, expr, true);
+	cg_puts(g, "; nl_c_; })");
+	return true;
+}
+
+void codegen_init(Codegen* g, AstExpr* expr, bool braces_only) {
+	switch(expr->kind) {
+		case AST_EXPR_ARRAY:
+		case AST_EXPR_ARRAY_LIST:
+		case AST_EXPR_INIT:
+			codegen_aggregate(g, expr, braces_only);
+			break;
+		case AST_EXPR_TUPLE:
+			if(expr->tuple.args.len > 0)
+				codegen_aggregate(g, expr, braces_only);
+			else
+				codegen_expr(g, expr);
+			break;
+		default:
+			codegen_expr(g, expr);
+			break;
+	}
+}
+
+void codegen_aggregate(Codegen* g, AstExpr* expr, bool braces_only) {
+	Type* t = codegen_literal_type(expr);
+	if(!braces_only && (expr->kind == AST_EXPR_ARRAY || expr->kind == AST_EXPR_ARRAY_LIST) &&
+			codegen_constant_array(g, expr))
+		return;
+	if(!braces_only) {
+		cg_putc(g, '(');
+		cg_type(g, t);
+		cg_putc(g, ')');
+	}
+	cg_puts(g, "{ ");
+	switch(expr->kind) {
+		case AST_EXPR_TUPLE:
+			for(isize i = 0; i < expr->tuple.args.len; i++) {
+				cg_puts(g, i > 0 ? ", " : "");
+				codegen_init(g, expr->tuple.args.list[i], braces_only);
+			}
+			break;
+		case AST_EXPR_ARRAY:
+			// the initializer is evaluated once (GCC, Clang)
+			if(expr->array.count > 0) {
+				cg_printf(g, "{ [0 ... %lld] = ", (long long)expr->array.count - 1);
+				codegen_init(g, expr->array.init, braces_only);
+				cg_puts(g, " }");
+			} else {
+				cg_puts(g, "{ 0 }");
+			}
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			cg_puts(g, "{ ");
+			for(isize i = 0; i < expr->array_list.args.len; i++) {
+				cg_puts(g, i > 0 ? ", " : "");
+				codegen_init(g, expr->array_list.args.list[i], braces_only);
+			}
+			cg_puts(g, " }");
+			break;
+		case AST_EXPR_INIT:
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				AstArg* field = expr->init.fields.list[i];
+				cg_puts(g, i > 0 ? ", ." : ".");
+				cg_name(g, field->name);
+				cg_puts(g, " = ");
+				codegen_init(g, field->expr, braces_only);
+			}
+			if(expr->init.fields.len == 0)
+				cg_putc(g, '0');
+			break;
+		default:
+			assert(0);
+			break;
+	}
+	cg_puts(g, " }");
+}
+
+// E.V(args): the arguments make up the payload, a tuple when there are
+// several
+void codegen_constructor_call(Codegen* g, Type* t, StrIntern variant, AstExprList* args, FileLoc loc) {
+	TypeVariant* v = NULL;
+	for(isize i = 0; i < t->enum_.variants_len && !v; i++) {
+		if(t->enum_.variants[i].name == variant)
+			v = &t->enum_.variants[i];
+	}
+	if(!v)
+		codegen_error(loc, "no variant '%s' in enum '%s'", variant, t->symbol->name);
+	codegen_put_constructor_name(g, t, v);
+	cg_putc(g, '(');
+	if(args && args->len > 1 && v->payload && v->payload->kind == TYPE_TUPLE) {
+		cg_putc(g, '(');
+		cg_type(g, v->payload);
+		cg_puts(g, "){ ");
+		codegen_expr_list(g, args);
+		cg_puts(g, " }");
+	} else if(args) {
+		codegen_expr_list(g, args);
+	}
+	cg_putc(g, ')');
+}
+
+// "file:line:col" of loc
+void codegen_pos(Codegen* g, FileLoc loc) {
+	cg_putc(g, '"');
+	for(const char* c = loc.file; *c; c++) {
+		if(*c == '"' || *c == '\\')
+			cg_putc(g, '\\');
+		cg_putc(g, *c);
+	}
+	cg_printf(g, ":%d:%d\"", loc.line, loc.col);
+}
+
+// whether expr can be evaluated twice
+bool codegen_is_simple(AstExpr* expr) {
+	while(expr->kind == AST_EXPR_MEMBER) {
+		expr = expr->member.x;
+	}
+	return expr->kind == AST_EXPR_IDENT;
+}
+
+// Checked indexes of arrays and slices go through nl_check. A slice is
+// copied first unless it can be read twice: the copy has the same ptr.
+void codegen_index(Codegen* g, AstExpr* expr) {
+	AstExpr* x = expr->index.x;
+	Type* t = x->type;
+	bool checked = t && (t->kind == TYPE_ARRAY || t->kind == TYPE_SLICE) && bounds_is_checked(&g->bounds, expr);
+	if(checked && t->kind == TYPE_SLICE && !codegen_is_simple(x)) {
+		cg_puts(g, "(*({ __auto_type nl_s_ = ");
+		codegen_expr(g, x);
+		cg_puts(g, "; nl_s_.ptr + nl_check(");
+		codegen_expr(g, expr->index.arg);
+		cg_puts(g, ", nl_s_.len, ");
+		codegen_pos(g, expr->loc);
+		cg_puts(g, "); }))");
+		return;
+	}
+	codegen_expr(g, x);
+	if(t && t->kind == TYPE_ARRAY)
+		cg_puts(g, ".a");
+	else if(t && t->kind == TYPE_SLICE)
+		cg_puts(g, ".ptr");
+	cg_putc(g, '[');
+	if(!checked) {
+		codegen_expr(g, expr->index.arg);
+		cg_putc(g, ']');
+		return;
+	}
+	cg_puts(g, "nl_check(");
+	codegen_expr(g, expr->index.arg);
+	cg_puts(g, ", ");
+	if(t->kind == TYPE_ARRAY) {
+		cg_puti(g, t->array.len);
+	} else {
+		codegen_expr(g, x);
+		cg_puts(g, ".len");
+	}
+	cg_puts(g, ", ");
+	codegen_pos(g, expr->loc);
+	cg_puts(g, ")]");
+}
+
+// the checks moved out of loop (bounds.c): the index must not be negative
+// when the loop is entered
+void codegen_hoisted_checks(Codegen* g, AstStmt* loop) {
+	isize* first = map_lookup(&g->bounds.loops, (u64)loop);
+	if(!first)
+		return;
+	for(isize i = *first; i < buf_len(g->bounds.hoists) && g->bounds.hoists[i].loop == loop; i++) {
+		AstExpr* index = g->bounds.hoists[i].index;
+		Type* t = index->index.x->type;
+		cg_puts(g, "if(");
+		codegen_expr(g, index->index.arg);
+		cg_puts(g, " < 0 && ");
+		codegen_expr(g, loop->for_.cond);
+		cg_puts(g, ") nl_bounds_fail(");
+		codegen_expr(g, index->index.arg);
+		cg_puts(g, ", ");
+		if(t->kind == TYPE_ARRAY) {
+			cg_puti(g, t->array.len);
+		} else {
+			codegen_expr(g, index->index.x);
+			cg_puts(g, ".len");
+		}
+		cg_puts(g, ", ");
+		codegen_pos(g, index->loc);
+		cg_puts(g, ");\n");
+		codegen_indent(g);
+	}
+}
+
+// An untyped operand is converted to the type the operation is done at, as
+// ir_binary does: C would otherwise compute 1 << 40 in int, and compare a
+// u32 with -1 in i64. The conversion is left to C where it gives the same.
+void codegen_operand(Codegen* g, AstExpr* x, Type* t, bool convert) {
+	if(!convert || !typing_is_untyped(x) || !t || (t->kind != TYPE_SIGNED && t->kind != TYPE_UNSIGNED && t->kind != TYPE_FLOAT)) {
+		codegen_expr(g, x);
+		return;
+	}
+	cg_puts(g, "((");
+	cg_type(g, t);
+	cg_putc(g, ')');
+	codegen_expr(g, x);
+	cg_putc(g, ')');
+}
+
+void codegen_helper_open(Codegen* g, const char* helper, Type* t) {
+	cg_printf(g, "%s(", helper);
+	cg_type(g, t);
+	cg_puts(g, ", ");
+}
+
+void codegen_helper_close(Codegen* g, TokenKind op) {
+	if(op == T_DIV || op == T_REM)
+		cg_printf(g, ", \"%s\"", g->fn_name);
+	cg_putc(g, ')');
+}
+
+void codegen_binary(Codegen* g, AstExpr* expr) {
+	TokenKind op = expr->binary.op;
+	AstExpr* x = expr->binary.x;
+	AstExpr* y = expr->binary.y;
+	Type* t = expr->type;
+	bool shift = op == T_LSHIFT || op == T_RSHIFT;
+	switch(op) {
+		case T_EQL: case T_NEQ: case T_LT: case T_GT: case T_LTE: case T_GTE:
+			t = typing_is_untyped(x) ? y->type : x->type;
+			break;
+		default:
+			break;
+	}
+	const char* helper = codegen_helper(op, t, y);
+	u64 v;
+	if(helper && codegen_const_int(expr, &v)) {
+		// folded, so that it can initialize a package let
+		codegen_const(g, (ConstValue){ CONST_INT, t, .u = codegen_fit(t, v) });
+		return;
+	}
+	if(helper) {
+		// the helpers convert the operands themselves
+		codegen_helper_open(g, helper, t);
+		codegen_expr(g, x);
+		cg_puts(g, ", ");
+		codegen_expr(g, y);
+		codegen_helper_close(g, op);
+		return;
+	}
+	// with a typed operand of 8 bytes, the usual arithmetic conversions
+	// already give t
+	bool convert = shift || typing_is_untyped(expr) || !t || t->size < 8;
+	cg_putc(g, '(');
+	codegen_operand(g, x, t, convert);
+	cg_printf(g, " %s ", token_kind_names[op]);
+	codegen_operand(g, y, t, convert && !shift);
+	cg_putc(g, ')');
+}
+
+void codegen_expr(Codegen* g, AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+			if(expr->lit_int > (u64)INT64_MAX)
+				cg_printf(g, "UINT64_C(%llu)", (unsigned long long)expr->lit_int);
+			else
+				codegen_int(g, (i64)expr->lit_int);
+			break;
+		case AST_EXPR_LIT_FLOAT:
+			codegen_float(g, expr->lit_float);
+			break;
+		case AST_EXPR_LIT_STRING:
+			codegen_string(g, expr->lit_string);
+			break;
+		case AST_EXPR_LIT_CHAR:
+			cg_puti(g, expr->lit_char);
+			break;
+		case AST_EXPR_IDENT: {
+			Symbol* sym = expr->ident.sym;
+			if(!sym)
+				codegen_local(g, expr->ident.slot, expr->ident.name);
+			else if(sym->kind == SYMBOL_CONST)
+				codegen_const(g, sym->cold->value);
+			else
+				cg_name(g, sym->name);
+			break;
+		}
+		case AST_EXPR_MEMBER: {
+			Type* t = typing_enum_name(expr->member.x);
+			if(t) {
+				codegen_constructor_call(g, t, expr->member.name, NULL, expr->loc);
+				break;
+			}
+			codegen_expr(g, expr->member.x);
+			Type* xt = expr->member.x->type;
+			cg_puts(g, xt && xt->kind == TYPE_PTR ? "->" : ".");
+			cg_name(g, expr->member.name);
+			break;
+		}
+		case AST_EXPR_CALL: {
+			AstExpr* x = expr->call.x;
+			Type* t = x->kind == AST_EXPR_MEMBER ? typing_enum_name(x->member.x) : NULL;
+			if(t) {
+				codegen_constructor_call(g, t, x->member.name, &expr->call.args, expr->loc);
+				break;
+			}
+			if(x->kind == AST_EXPR_IDENT && x->ident.sym && map_lookup(&g->inlined, (u64)x->ident.sym))
+				codegen_put_inline_name(g, x->ident.sym);
+			else
+				codegen_expr(g, x);
+			cg_putc(g, '(');
+			codegen_expr_list(g, &expr->call.args);
+			cg_putc(g, ')');
+			break;
+		}
+		case AST_EXPR_UNARY: {
+			AstExpr* x = expr->unary.x;
+			if(expr->unary.op == T_AND && x->kind == AST_EXPR_MEMBER) {
+				// a C bit-field has no address
+				TypeField* field = typing_field(x->member.x->type, x->member.name);
+				if(field && field->bit >= 0)
+					codegen_error(x->loc, "cannot take the address of a bool packed in a bitset");
+			}
+			if(expr->unary.op == T_SUB && !typing_is_untyped(x) && codegen_wraps(T_SUB, expr->type)) {
+				u64 v;
+				if(codegen_const_int(expr, &v)) {
+					codegen_const(g, (ConstValue){ CONST_INT, expr->type, .u = codegen_fit(expr->type, v) });
+					break;
+				}
+				codegen_helper_open(g, "nl_sub", expr->type);
+				cg_puts(g, "0, ");
+				codegen_expr(g, x);
+				cg_putc(g, ')');
+				break;
+			}
+			cg_printf(g, "(%s", token_kind_names[expr->unary.op]);
+			codegen_expr(g, x);
+			cg_putc(g, ')');
+			break;
+		}
+		case AST_EXPR_BINARY:
+			codegen_binary(g, expr);
+			break;
+		case AST_EXPR_CAST: {
+			Type* t = expr->cast.type->resolved;
+			bool bitcast = codegen_is_aggregate(t) || codegen_is_aggregate(expr->cast.x->type);
+			cg_puts(g, bitcast ? "nl_bitcast(" : "((");
+			cg_type(g, t);
+			cg_puts(g, bitcast ? ", " : ")");
+			codegen_expr(g, expr->cast.x);
+			cg_putc(g, ')');
+			break;
+		}
+		case AST_EXPR_INDEX:
+			codegen_index(g, expr);
+			break;
+		case AST_EXPR_TUPLE:
+			if(expr->tuple.args.len == 0) {
+				cg_puts(g, "((void)0)");
+				break;
+			}
+			codegen_aggregate(g, expr, false);
+			break;
+		case AST_EXPR_ARRAY:
+		case AST_EXPR_ARRAY_LIST:
+		case AST_EXPR_INIT:
+			codegen_aggregate(g, expr, false);
+			break;
+	}
+}
+
+// whether expr can initialize a global in C
+bool codegen_is_constant(AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+		case AST_EXPR_LIT_FLOAT:
+		case AST_EXPR_LIT_STRING:
+		case AST_EXPR_LIT_CHAR:
+			return true;
+		case AST_EXPR_IDENT:
+			return expr->ident.sym && (expr->ident.sym->kind == SYMBOL_CONST || expr->ident.sym->kind == SYMBOL_FN);
+		case AST_EXPR_UNARY:
+			if(expr->unary.op == T_AND)
+				return expr->unary.x->kind == AST_EXPR_IDENT && expr->unary.x->ident.sym;
+			return expr->unary.op != T_MUL && codegen_is_constant(expr->unary.x);
+		case AST_EXPR_BINARY: {
+			// a helper that is not folded is a statement expression
+			u64 v;
+			if(codegen_helper(expr->binary.op, expr->type, expr->binary.y) && !codegen_const_int(expr, &v))
+				return false;
+			return codegen_is_constant(expr->binary.x) && codegen_is_constant(expr->binary.y);
+		}
+		case AST_EXPR_CAST:
+			return !codegen_is_aggregate(expr->cast.type->resolved) && !codegen_is_aggregate(expr->cast.x->type) &&
+				codegen_is_constant(expr->cast.x);
+		case AST_EXPR_TUPLE:
+			for(isize i = 0; i < expr->tuple.args.len; i++) {
+				if(!codegen_is_constant(expr->tuple.args.list[i]))
+					return false;
+			}
+			return expr->tuple.args.len > 0;
+		case AST_EXPR_ARRAY:
+			return codegen_is_constant(expr->array.init);
+		case AST_EXPR_ARRAY_LIST:
+			for(isize i = 0; i < expr->array_list.args.len; i++) {
+				if(!codegen_is_constant(expr->array_list.args.list[i]))
+					return false;
+			}
+			return true;
+		case AST_EXPR_INIT:
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				if(!codegen_is_constant(expr->init.fields.list[i]->expr))
+					return false;
+			}
+			return true;
+		default:
+			return false;
+	}
+}
+
+// type of a declaration, __auto_type when it is not known
+void codegen_decl_type(Codegen* g, Type* t, AstExpr* value) {
+	if(t) {
+		cg_type(g, t);
+	} else if(value) {
+		cg_puts(g, "__auto_type");
+	} else {
+		assert(0);
+	}
+}
+
+void codegen_stmt(Codegen* g, AstStmt* stmt);
+
+void codegen_block(Codegen* g, AstStmtList* list) {
+	cg_puts(g, "{\n");
+	g->indent++;
+	for(isize i = 0; i < list->len; i++) {
+		codegen_stmt(g, list->list[i]);
+	}
+	g->indent--;
+	codegen_indent(g);
+	cg_putc(g, '}');
+}
+
+// x op= y goes through the helper of x op y; x is only evaluated once
+void codegen_assign(Codegen* g, AstStmt* stmt) {
+	AstExpr* x = stmt->assign.x;
+	TokenKind op = stmt->assign.op;
+	TokenKind bin;
+	switch(op) {
+		case T_ADD_ASSIGN: bin = T_ADD; break;
+		case T_SUB_ASSIGN: bin = T_SUB; break;
+		case T_MUL_ASSIGN: bin = T_MUL; break;
+		case T_DIV_ASSIGN: bin = T_DIV; break;
+		case T_REM_ASSIGN: bin = T_REM; break;
+		case T_LSHIFT_ASSIGN: bin = T_LSHIFT; break;
+		case T_RSHIFT_ASSIGN: bin = T_RSHIFT; break;
+		default: bin = T_ASSIGN; break;
+	}
+	const char* helper = codegen_helper(bin, x->type, stmt->assign.y);
+	if(!helper) {
+		codegen_expr(g, x);
+		cg_printf(g, " %s ", token_kind_names[op]);
+		codegen_expr(g, stmt->assign.y);
+		cg_puts(g, ";\n");
+		return;
+	}
+	bool simple = codegen_is_simple(x);
+	if(simple) {
+		codegen_expr(g, x);
+	} else {
+		cg_puts(g, "{ ");
+		cg_type(g, x->type);
+		cg_puts(g, "* nl_p_ = &");
+		codegen_expr(g, x);
+		cg_puts(g, "; *nl_p_");
+	}
+	cg_puts(g, " = ");
+	codegen_helper_open(g, helper, x->type);
+	if(simple)
+		codegen_expr(g, x);
+	else
+		cg_puts(g, "*nl_p_");
+	cg_puts(g, ", ");
+	codegen_expr(g, stmt->assign.y);
+	codegen_helper_close(g, bin);
+	cg_puts(g, simple ? ";\n" : "; }\n");
+}
+
+void codegen_stmt(Codegen* g, AstStmt* stmt) {
+	codegen_indent(g);
+	switch(stmt->kind) {
+		case AST_STMT_DECL: {
+			AstDecl* decl = stmt->decl;
+			AstExpr* value = decl->kind == AST_DECL_LET ? decl->let.value : decl->const_.value;
+			Type* t = decl->kind == AST_DECL_LET && decl->let.type ? decl->let.type->resolved : value ? value->type : NULL;
+			if(decl->kind == AST_DECL_CONST)
+				cg_puts(g, "const ");
+			codegen_decl_type(g, t, value);
+			cg_putc(g, ' ');
+			codegen_local(g, g->next_slot++, decl->name);
+			cg_puts(g, " = ");
+			if(value)
+				codegen_expr(g, value);
+			else
+				cg_puts(g, codegen_is_aggregate(t) ? "{ 0 }" : "0");
+			cg_puts(g, ";\n");
+			break;
+		}
+		case AST_STMT_EXPR:
+			codegen_expr(g, stmt->expr);
+			cg_puts(g, ";\n");
+			break;
+		case AST_STMT_IF:
+			for(;;) {
+				cg_puts(g, "if(");
+				codegen_expr(g, stmt->if_.cond);
+				cg_puts(g, ") ");
+				codegen_block(g, &stmt->if_.body);
+				stmt = stmt->if_.els;
+				if(!stmt)
+					break;
+				cg_puts(g, " else ");
+				if(stmt->kind != AST_STMT_IF) {
+					assert(stmt->kind == AST_STMT_BLOCK);
+					codegen_block(g, &stmt->block.body);
+					break;
+				}
+			}
+			cg_putc(g, '\n');
+			break;
+		case AST_STMT_FOR:
+			codegen_hoisted_checks(g, stmt);
+			if(stmt->for_.cond) {
+				cg_puts(g, "while(");
+				codegen_expr(g, stmt->for_.cond);
+				cg_puts(g, ") ");
+			} else {
+				cg_puts(g, "for(;;) ");
+			}
+			codegen_block(g, &stmt->for_.body);
+			cg_putc(g, '\n');
+			break;
+		case AST_STMT_RETURN:
+			cg_puts(g, "return");
+			if(stmt->return_) {
+				cg_putc(g, ' ');
+				codegen_expr(g, stmt->return_);
+			}
+			cg_puts(g, ";\n");
+			break;
+		case AST_STMT_ASSIGN:
+			codegen_assign(g, stmt);
+			break;
+		case AST_STMT_BLOCK:
+			codegen_block(g, &stmt->block.body);
+			cg_putc(g, '\n');
+			break;
+	}
+}
+
+void codegen_fn_header(Codegen* g, Symbol* sym, bool inline_copy) {
+	Type* t = sym->type;
+	AstDecl* decl = sym->decl;
+	if(inline_copy)
+		cg_puts(g, "static inline __attribute__((always_inline)) ");
+	cg_type(g, t->fn.ret);
+	cg_putc(g, ' ');
+	if(inline_copy)
+		codegen_put_inline_name(g, sym);
+	else
+		cg_name(g, sym->name);
+	cg_putc(g, '(');
+	for(isize i = 0; i < t->fn.args_len; i++) {
+		if(i > 0)
+			cg_puts(g, ", ");
+		cg_type(g, t->fn.args[i]);
+		cg_putc(g, ' ');
+		codegen_local(g, i, decl->fn.params.list[i]->name);
+	}
+	cg_puts(g, t->fn.args_len == 0 ? "void)" : ")");
+}
+
+// declares every fn and inline copy, and the globals defined elsewhere:
+// the extern ones, or all of them when the declarations go to a shared
+// header
+void codegen_prototypes(Codegen* g, bool all_globals) {
+	for(isize i = 0; i < buf_len(g->syms); i++) {
+		Symbol* sym = g->syms[i];
+		if(sym->kind == SYMBOL_FN) {
+			codegen_fn_header(g, sym, false);
+			cg_puts(g, ";\n");
+			if(map_lookup(&g->inlined, (u64)sym)) {
+				codegen_fn_header(g, sym, true);
+				cg_puts(g, ";\n");
+			}
+		} else if(sym->kind == SYMBOL_LET && (sym->decl->let.is_extern || all_globals)) {
+			cg_puts(g, "extern ");
+			cg_type(g, sym->type);
+			cg_putc(g, ' ');
+			cg_name(g, sym->name);
+			cg_puts(g, ";\n");
+		}
+		writer_flush(&g->w, false);
+	}
+	cg_putc(g, '\n');
+}
+
+// Globals with a constant initializer are initialized by C, the others are
+// zeroed and assigned at startup, in declaration order.
+void codegen_globals(Codegen* g) {
+	Symbol** dynamic = NULL;
+	for(isize i = 0; i < buf_len(g->syms); i++) {
+		Symbol* sym = g->syms[i];
+		if(sym->kind != SYMBOL_LET || sym->decl->let.is_extern)
+			continue;
+		AstExpr* value = sym->decl->let.value;
+		if(sym->type) {
+			cg_type(g, sym->type);
+		} else {
+			cg_puts(g, "__typeof__(");
+			codegen_expr(g, value);
+			cg_putc(g, ')');
+		}
+		cg_putc(g, ' ');
+		cg_name(g, sym->name);
+		if(value && codegen_is_constant(value)) {
+			cg_puts(g, " = ");
+			codegen_init(g, value, true);
+		} else if(value) {
+			buf_push(dynamic, sym);
+		}
+		cg_puts(g, ";\n");
+		writer_flush(&g->w, false);
+	}
+	if(dynamic) {
+		cg_puts(g, "\n__attribute__((constructor)) static void nl_init(void) {\n");
+		g->fn_name = "<init>";
+		for(isize i = 0; i < buf_len(dynamic); i++) {
+			cg_putc(g, '\t');
+			cg_name(g, dynamic[i]->name);
+			cg_puts(g, " = ");
+			codegen_expr(g, dynamic[i]->decl->let.value);
+			cg_puts(g, ";\n");
+		}
+		cg_puts(g, "}\n");
+	}
+	cg_putc(g, '\n');
+	buf_free(dynamic);
+}
+
+// a fn with an inline copy passes its arguments on to it
+void codegen_forward(Codegen* g, Symbol* sym) {
+	Type* t = sym->type;
+	cg_puts(g, t->fn.ret->kind == TYPE_VOID ? "{\n\t" : "{\n\treturn ");
+	codegen_put_inline_name(g, sym);
+	cg_putc(g, '(');
+	for(isize i = 0; i < t->fn.args_len; i++) {
+		if(i > 0)
+			cg_puts(g, ", ");
+		codegen_local(g, i, sym->decl->fn.params.list[i]->name);
+	}
+	cg_puts(g, ");\n}");
+}
+
+void codegen_fn(Codegen* g, Symbol* sym, bool inline_copy) {
+	trace_begin(TRACE_SYMBOL, sym->name);
+	g->next_slot = (i32)sym->type->fn.args_len;
+	g->fn_name = sym->name;
+	codegen_fn_header(g, sym, inline_copy);
+	cg_putc(g, ' ');
+	if(!inline_copy && map_lookup(&g->inlined, (u64)sym))
+		codegen_forward(g, sym);
+	else
+		codegen_block(g, &sym->decl->fn.body);
+	cg_puts(g, "\n\n");
+	writer_flush(&g->w, false);
+	trace_end();
+}
+
+void codegen_collect(Codegen* g) {
+	for(isize i = 0; i < buf_len(g->syms); i++) {
+		Symbol* sym = g->syms[i];
+		AstDecl* decl = sym->decl;
+		switch(sym->kind) {
+			case SYMBOL_LET:
+				codegen_use_type(g, sym->type);
+				codegen_collect_expr(g, decl->let.value);
+				break;
+			case SYMBOL_FN:
+				codegen_use_type(g, sym->type);
+				if(!decl->fn.is_extern)
+					codegen_collect_block(g, &decl->fn.body);
+				break;
+			case SYMBOL_TYPE:
+				if(decl->kind == AST_DECL_STRUCT || decl->kind == AST_DECL_ENUM)
+					codegen_use_type(g, sym->type);
+				break;
+			case SYMBOL_CONST:
+				break;
+		}
+	}
+}
+
+// number of C files the fn bodies are split into (--units)
+isize codegen_units = 1;
+
+// Estimated size of the code of a fn body: its number of statements and
+// expressions. When calls is not NULL, the calls found are appended to it
+// in source order.
+isize codegen_weight_expr(AstExpr* expr, AstExpr*** calls);
+
+isize codegen_weight_expr_list(AstExprList* list, AstExpr*** calls) {
+	isize w = 0;
+	for(isize i = 0; i < list->len; i++) {
+		w += codegen_weight_expr(list->list[i], calls);
+	}
+	return w;
+}
+
+isize codegen_weight_expr(AstExpr* expr, AstExpr*** calls) {
+	if(!expr)
+		return 0;
+	switch(expr->kind) {
+		case AST_EXPR_MEMBER:
+			return 1 + codegen_weight_expr(expr->member.x, calls);
+		case AST_EXPR_CALL:
+			if(calls)
+				buf_push(*calls, expr);
+			return 1 + codegen_weight_expr(expr->call.x, calls) + codegen_weight_expr_list(&expr->call.args, calls);
+		case AST_EXPR_UNARY:
+			return 1 + codegen_weight_expr(expr->unary.x, calls);
+		case AST_EXPR_BINARY:
+			return 1 + codegen_weight_expr(expr->binary.x, calls) + codegen_weight_expr(expr->binary.y, calls);
+		case AST_EXPR_CAST:
+			return 1 + codegen_weight_expr(expr->cast.x, calls);
+		case AST_EXPR_INDEX:
+			return 1 + codegen_weight_expr(expr->index.x, calls) + codegen_weight_expr(expr->index.arg, calls);
+		case AST_EXPR_TUPLE:
+			return 1 + codegen_weight_expr_list(&expr->tuple.args, calls);
+		case AST_EXPR_ARRAY:
+			return 1 + codegen_weight_expr(expr->array.init, calls);
+		case AST_EXPR_ARRAY_LIST:
+			return 1 + codegen_weight_expr_list(&expr->array_list.args, calls);
+		case AST_EXPR_INIT: {
+			isize w = 1;
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				w += codegen_weight_expr(expr->init.fields.list[i]->expr, calls);
+			}
+			return w;
+		}
+		default:
+			return 1;
+	}
+}
+
+isize codegen_weight_stmt(AstStmt* stmt, AstExpr*** calls);
+
+isize codegen_weight_block(AstStmtList* list, AstExpr*** calls) {
+	isize w = 0;
+	for(isize i = 0; i < list->len; i++) {
+		w += codegen_weight_stmt(list->list[i], calls);
+	}
+	return w;
+}
+
+isize codegen_weight_stmt(AstStmt* stmt, AstExpr*** calls) {
+	if(!stmt)
+		return 0;
+	switch(stmt->kind) {
+		case AST_STMT_DECL: {
+			AstDecl* decl = stmt->decl;
+			return 1 + codegen_weight_expr(decl->kind == AST_DECL_LET ? decl->let.value : decl->const_.value, calls);
+		}
+		case AST_STMT_EXPR:
+			return 1 + codegen_weight_expr(stmt->expr, calls);
+		case AST_STMT_IF:
+			return 1 + codegen_weight_expr(stmt->if_.cond, calls) + codegen_weight_block(&stmt->if_.body, calls) +
+				codegen_weight_stmt(stmt->if_.els, calls);
+		case AST_STMT_FOR:
+			return 1 + codegen_weight_expr(stmt->for_.cond, calls) + codegen_weight_block(&stmt->for_.body, calls);
+		case AST_STMT_RETURN:
+			return 1 + codegen_weight_expr(stmt->return_, calls);
+		case AST_STMT_ASSIGN:
+			return 1 + codegen_weight_expr(stmt->assign.x, calls) + codegen_weight_expr(stmt->assign.y, calls);
+		case AST_STMT_BLOCK:
+			return 1 + codegen_weight_block(&stmt->block.body, calls);
+	}
+	return 1;
+}
+
+typedef struct CodegenPart {
+	Symbol* sym;
+	isize weight;
+	u64 hash;  // of the fn name
+} CodegenPart;
+
+int codegen_cmp_part(const void* x, const void* y) {
+	const CodegenPart* a = x;
+	const CodegenPart* b = y;
+	if(a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return strcmp(a->sym->name, b->sym->name);
+}
+
+// Assigns the fn bodies to units, balanced by weight. A fn goes to the
+// unit its name ranks first (rendezvous hashing) unless that unit is full,
+// and fns are placed in the order of their name hashes, so where a fn goes
+// does not depend on the order of the source. Editing, adding or removing
+// a fn only moves the few fns that overflow because of it: the other units
+// keep the same bodies, and their files the same bytes.
+void codegen_partition(Codegen* g, isize units, Symbol**** out) {
+	CodegenPart* parts = NULL;
+	isize total = 0;
+	for(isize i = 0; i < buf_len(g->syms); i++) {
+		Symbol* sym = g->syms[i];
+		if(sym->kind != SYMBOL_FN || sym->decl->fn.is_extern)
+			continue;
+		isize w = 1 + codegen_weight_block(&sym->decl->fn.body, NULL);
+		buf_push(parts, (CodegenPart){ sym, w, map_hash_bytes(sym->name, strlen(sym->name)) });
+		total += w;
+	}
+	if(parts)
+		qsort(parts, buf_len(parts), sizeof(CodegenPart), codegen_cmp_part);
+	// up to 1/8 over the average
+	isize capacity = total / units + total / units / 8 + 1;
+	isize* load = xcalloc(units, sizeof(isize));
+	isize* unit_of = xmalloc((buf_len(parts) + 1) * sizeof(isize));
+	for(isize i = 0; i < buf_len(parts); i++) {
+		isize best = -1, lightest = 0;
+		u64 best_score = 0;
+		for(isize u = 0; u < units; u++) {
+			u64 score = map_hash_mix(parts[i].hash, map_hash_u64(u + 1));
+			if(load[u] + parts[i].weight <= capacity && (best < 0 || score > best_score)) {
+				best = u;
+				best_score = score;
+			}
+			lightest = load[u] < load[lightest] ? u : lightest;
+		}
+		best = best >= 0 ? best : lightest;
+		load[best] += parts[i].weight;
+		unit_of[i] = best;
+	}
+	// bodies are written in declaration order within a unit
+	Symbol*** unit_syms = xcalloc(units, sizeof(Symbol**));
+	MapCodegenIds index = {0};
+	for(isize i = 0; i < buf_len(parts); i++) {
+		map_set(&index, (u64)parts[i].sym, unit_of[i]);
+	}
+	for(isize i = 0; i < buf_len(g->syms); i++) {
+		isize* u = map_lookup(&index, (u64)g->syms[i]);
+		if(u)
+			buf_push(unit_syms[*u], g->syms[i]);
+	}
+	map_free(&index);
+	xfree(unit_of);
+	xfree(load);
+	buf_free(parts);
+	*out = unit_syms;
+}
+
+// largest weight of a fn whose calls are inlined, 0 for none
+// (--inline-limit)
+isize codegen_inline_limit = 16;
+// print the inlining decision of every call (--inline-report)
+bool codegen_inline_report;
+
+typedef struct CodegenCallee {
+	Symbol* sym;
+	isize weight;
+	isize calls;      // its calls: calls to calls_end in CodegenInliner.calls
+	isize calls_end;
+	bool recursive;
+} CodegenCallee;
+
+typedef struct CodegenInliner {
+	CodegenCallee* fns;  // fns with a body, in declaration order
+	MapCodegenIds ids;   // Symbol* -> index in fns
+	AstExpr** calls;     // in the fn bodies and global initializers, in source order
+} CodegenInliner;
+
+// index of the fn call names directly, -1 for extern fns and fn values
+isize codegen_direct_callee(CodegenInliner* in, AstExpr* call) {
+	AstExpr* x = call->call.x;
+	if(x->kind != AST_EXPR_IDENT || !x->ident.sym)
+		return -1;
+	isize* i = map_lookup(&in->ids, (u64)x->ident.sym);
+	return i ? *i : -1;
+}
+
+// Marks the fns on a cycle of direct calls, with an iterative Tarjan SCC
+// pass like the resolver's, and appends every fn to order after the fns
+// it calls.
+void codegen_find_recursion(CodegenInliner* in, isize** order) {
+	isize len = buf_len(in->fns);
+	isize* index = xmalloc(MAX(len, 1) * sizeof(isize));
+	isize* low = xmalloc(MAX(len, 1) * sizeof(isize));
+	bool* on_stack = xcalloc(MAX(len, 1), sizeof(bool));
+	isize* stack = NULL;
+	TarjanFrame* frames = NULL;
+	isize counter = 0;
+	for(isize i = 0; i < len; i++) {
+		index[i] = -1;
+	}
+	for(isize root = 0; root < len; root++) {
+		if(index[root] >= 0)
+			continue;
+		index[root] = low[root] = counter++;
+		buf_push(stack, root);
+		on_stack[root] = true;
+		buf_push(frames, (TarjanFrame){ root, in->fns[root].calls });
+		while(buf_len(frames) > 0) {
+			TarjanFrame* f = &frames[buf_len(frames) - 1];
+			isize v = f->v;
+			if(f->edge < in->fns[v].calls_end) {
+				isize w = codegen_direct_callee(in, in->calls[f->edge++]);
+				if(w < 0)
+					continue;
+				if(w == v)
+					in->fns[v].recursive = true;
+				if(index[w] < 0) {
+					index[w] = low[w] = counter++;
+					buf_push(stack, w);
+					on_stack[w] = true;
+					buf_push(frames, (TarjanFrame){ w, in->fns[w].calls });
+				} else if(on_stack[w]) {
+					low[v] = MIN(low[v], index[w]);
+				}
+				continue;
+			}
+			buf_truncate(frames, buf_len(frames) - 1);
+			if(buf_len(frames) > 0) {
+				isize u = frames[buf_len(frames) - 1].v;
+				low[u] = MIN(low[u], low[v]);
+			}
+			if(low[v] != index[v])
+				continue;
+			isize first = buf_len(*order);
+			isize w;
+			do {
+				w = stack[buf_len(stack) - 1];
+				buf_truncate(stack, buf_len(stack) - 1);
+				on_stack[w] = false;
+				buf_push(*order, w);
+			} while(w != v);
+			for(isize i = first; buf_len(*order) - first > 1 && i < buf_len(*order); i++) {
+				in->fns[(*order)[i]].recursive = true;
+			}
+		}
+	}
+	buf_free(frames);
+	buf_free(stack);
+	xfree(on_stack);
+	xfree(low);
+	xfree(index);
+}
+
+void codegen_print_inlining(Codegen* g, CodegenInliner* in) {
+	for(isize i = 0; i < buf_len(in->calls); i++) {
+		AstExpr* call = in->calls[i];
+		AstExpr* x = call->call.x;
+		FileLoc loc = call->loc;
+		if(x->kind == AST_EXPR_MEMBER && typing_enum_name(x->member.x))
+			continue;  // enum constructor
+		printf("%s:%d:%d: ", loc.file, loc.line, loc.col);
+		isize w = codegen_direct_callee(in, call);
+		if(w < 0) {
+			Symbol* sym = x->kind == AST_EXPR_IDENT ? x->ident.sym : NULL;
+			if(sym && sym->kind == SYMBOL_FN)
+				printf("call to extern fn '%s' not inlined\n", sym->name);
+			else
+				printf("call through a fn value not inlined\n");
+			continue;
+		}
+		CodegenCallee* f = &in->fns[w];
+		if(map_lookup(&g->inlined, (u64)f->sym))
+			printf("call to '%s' inlined, size %lld\n", f->sym->name, (long long)f->weight);
+		else if(f->recursive)
+			printf("call to '%s' not inlined: recursive\n", f->sym->name);
+		else
+			printf("call to '%s' not inlined: size %lld over %lld\n", f->sym->name, (long long)f->weight,
+				(long long)codegen_inline_limit);
+	}
+}
+
+// Picks the fns whose direct calls are inlined: those with a body of at
+// most codegen_inline_limit, by the weight the units are balanced with,
+// that do not call themselves through any chain of direct calls. Only fns
+// called directly somewhere get an inline copy.
+void codegen_plan_inlining(Codegen* g) {
+	CodegenInliner in = {0};
+	for(isize i = 0; i < buf_len(g->syms); i++) {
+		Symbol* sym = g->syms[i];
+		if(sym->kind == SYMBOL_FN && !sym->decl->fn.is_extern) {
+			CodegenCallee f = { .sym = sym, .calls = buf_len(in.calls) };
+			f.weight = 1 + codegen_weight_block(&sym->decl->fn.body, &in.calls);
+			f.calls_end = buf_len(in.calls);
+			map_set(&in.ids, (u64)sym, buf_len(in.fns));
+			buf_push(in.fns, f);
+		} else if(sym->kind == SYMBOL_LET && !sym->decl->let.is_extern) {
+			codegen_weight_expr(sym->decl->let.value, &in.calls);
+		}
+	}
+	isize* order = NULL;
+	codegen_find_recursion(&in, &order);
+	bool* called = xcalloc(MAX(buf_len(in.fns), 1), sizeof(bool));
+	for(isize i = 0; i < buf_len(in.calls); i++) {
+		isize w = codegen_direct_callee(&in, in.calls[i]);
+		if(w >= 0)
+			called[w] = true;
+	}
+	for(isize i = 0; i < buf_len(order); i++) {
+		CodegenCallee* f = &in.fns[order[i]];
+		if(called[order[i]] && !f->recursive && f->weight <= codegen_inline_limit) {
+			map_set(&g->inlined, (u64)f->sym, 1);
+			buf_push(g->inline_order, f->sym);
+		}
+	}
+	if(codegen_inline_report)
+		codegen_print_inlining(g, &in);
+	xfree(called);
+	buf_free(order);
+	buf_free(in.calls);
+	map_free(&in.ids);
+	buf_free(in.fns);
+}
+
+// the inline copies, after the declarations they use
+void codegen_inline_fns(Codegen* g) {
+	for(isize i = 0; i < buf_len(g->inline_order); i++) {
+		codegen_fn(g, g->inline_order[i], true);
+	}
+}
+
+void codegen_free(Codegen* g) {
+	for(isize i = 0; i < buf_len(g->types); i++) {
+		buf_free(g->types[i].name);
+	}
+	buf_free(g->types);
+	buf_free(g->syms);
+	buf_free(g->inline_order);
+	map_free(&g->inlined);
+	bounds_free(&g->bounds);
+	map_free(&g->type_ids);
+	map_free(&g->reserved);
+}
+
+// Writes the resolved symbols of pkg to path as C. Expression types must
+// be set (typing_package) and types laid out (layout_package).
+// With more than one unit, path names a header with the types, prototypes,
+// extern declarations of every global and inline copies of fns, and the
+// fn bodies are split across units that include it: for out.c these are
+// out.h and out_0.c to out_<n-1>.c. The globals are defined in the first
+// unit. Units from an earlier run with more of them are removed.
+void codegen_package(Package* pkg, const char* path) {
+	Codegen g = { .pkg = pkg };
+	MemTag old_tag = mem_tag_set(MEM_CODEGEN);
+	for(isize i = 0; i < (isize)(sizeof(codegen_keywords) / sizeof(codegen_keywords[0])); i++) {
+		map_set(&g.reserved, (u64)str_intern_c(codegen_keywords[i]), 1);
+	}
+	for(isize i = 0; i < buf_len(pkg->symbol_order); i++) {
+		SymbolOrder o = pkg->symbol_order[i];
+		Symbol* sym = o.is_decl ? resolver_resolve_name(pkg, (FileLoc){ pkg->path }, o.name, false) : NULL;
+		if(sym && sym->state == SYMSTATE_RESOLVED)
+			buf_push(g.syms, sym);
+	}
+	codegen_collect(&g);
+	codegen_plan_inlining(&g);
+	bounds_package(&g.bounds, g.syms);
+
+	if(codegen_units <= 1) {
+		writer_open(&g.w, path);
+		cg_puts(&g, codegen_preamble);
+		codegen_types(&g);
+		codegen_prototypes(&g, false);
+		codegen_globals(&g);
+		codegen_inline_fns(&g);
+		for(isize i = 0; i < buf_len(g.syms); i++) {
+			if(g.syms[i]->kind == SYMBOL_FN && !g.syms[i]->decl->fn.is_extern)
+				codegen_fn(&g, g.syms[i], false);
+		}
+		writer_close(&g.w);
+		codegen_free(&g);
+		mem_tag_set(old_tag);
+		return;
+	}
+
+	isize len = strlen(path);
+	isize base_len = len > 2 && strcmp(path + len - 2, ".c") == 0 ? len - 2 : len;
+	char* file = NULL;
+	buf_printf(file, "%.*s.h", (int)base_len, path);
+	const char* header = file;
+	for(const char* c = file; *c; c++) {
+		if(*c == '/' || *c == '\\')
+			header = c + 1;
+	}
+	writer_open(&g.w, file);
+	cg_puts(&g, "#pragma once\n");
+	cg_puts(&g, codegen_preamble);
+	codegen_types(&g);
+	codegen_prototypes(&g, true);
+	codegen_inline_fns(&g);
+	writer_close(&g.w);
+	char* include = NULL;
+	buf_printf(include, "// generated by nc, do not edit\n#include \"%s\"\n\n", header);
+
+	Symbol*** units;
+	codegen_partition(&g, codegen_units, &units);
+	for(isize u = 0; u < codegen_units; u++) {
+		buf_clear(file);
+		buf_printf(file, "%.*s_%lld.c", (int)base_len, path, (long long)u);
+		writer_open(&g.w, file);
+		cg_puts(&g, include);
+		if(u == 0)
+			codegen_globals(&g);
+		for(isize i = 0; i < buf_len(units[u]); i++) {
+			codegen_fn(&g, units[u][i], false);
+		}
+		writer_close(&g.w);
+		buf_free(units[u]);
+	}
+	// units left over from a run with more of them would be built too
+	for(isize u = codegen_units; ; u++) {
+		buf_clear(file);
+		buf_printf(file, "%.*s_%lld.c", (int)base_len, path, (long long)u);
+		if(remove(file) != 0)
+			break;
+	}
+	xfree(units);
+	buf_free(include);
+	buf_free(file);
+	codegen_free(&g);
+	mem_tag_set(old_tag);
+}
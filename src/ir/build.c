@@ -0,0 +1,1194 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Lowering of resolved fn bodies to SSA.
+// Locals of scalar type whose address is never taken are SSA variables,
+// the others live in frame slots. SSA form is built in one pass over the
+// body as in Braun et al., "Simple and Efficient Construction of Static
+// Single Assignment Form": the value of a variable is looked up through
+// the predecessors of the block that reads it, and a phi is placed where
+// they meet. A block is sealed once all its predecessors are known; reads
+// in a block that is not sealed yet (a loop header) get a phi whose
+// operands are filled in when it is. Phis with a single distinct operand
+// are left for copy propagation (opt.c) to remove.
+
+typedef struct IrLocal {
+	Type* type;
+	IrRef addr;           // slot or argument holding the local, -1 for SSA variables
+} IrLocal;
+
+typedef struct IrPending {
+	i32 var;
+	IrRef phi;
+} IrPending;
+
+typedef map_type(u64, isize) MapIrDefs;
+
+typedef struct IrBuilder {
+	IrFn* fn;
+	i32 block;            // block being built
+	IrLocal* locals;      // by slot
+	u8* addressed;        // by slot: the address of the local is taken
+	MapIrDefs defs;       // block << 32 | slot -> value of the variable at the end of block
+	u8* sealed;           // by block: every predecessor is known
+	IrPending** pending;  // by block: phis waiting for the predecessors
+	Type* ret;
+	IrRef ret_ptr;        // where aggregate results go, -1 otherwise
+	i32 next_slot;        // slot of the next local declared
+} IrBuilder;
+
+// where a value is stored
+typedef enum IrPlaceKind {
+	IR_PLACE_VAR,         // SSA variable var
+	IR_PLACE_MEM,         // memory at addr
+	IR_PLACE_BIT,         // bit var of the byte at addr
+} IrPlaceKind;
+
+typedef struct IrPlace {
+	IrPlaceKind kind;
+	Type* type;
+	IrRef addr;
+	i32 var;
+} IrPlace;
+
+// a field of a struct, tuple or slice
+typedef struct IrMember {
+	Type* type;
+	isize offset;
+	i32 bit;              // see TypeField
+} IrMember;
+
+void ir_layout(Type* t) {
+	// types built by typing_package are laid out on demand
+	if(t->align == 0)
+		layout_type(t);
+}
+
+i32 ir_block(IrBuilder* b) {
+	buf_push(b->sealed, false);
+	buf_push(b->pending, NULL);
+	return ir_block_new(b->fn);
+}
+
+IrRef ir_op(IrBuilder* b, IrOp op, IrType type, IrRef x, IrRef y) {
+	return ir_emit(b->fn, b->block, op, type, x, y);
+}
+
+IrRef ir_op_imm(IrBuilder* b, IrOp op, IrType type, IrRef x, IrRef y, i64 imm) {
+	IrRef r = ir_emit(b->fn, b->block, op, type, x, y);
+	b->fn->instrs[r].imm = imm;
+	return r;
+}
+
+IrRef ir_const(IrBuilder* b, IrType type, i64 x) {
+	return ir_op_imm(b, IR_CONST, type, -1, -1, ir_sext(x, type));
+}
+
+IrRef ir_fconst(IrBuilder* b, IrType type, double f) {
+	IrRef r = ir_op(b, IR_CONST, type, -1, -1);
+	b->fn->instrs[r].f = type == IR_F32 ? (float)f : f;
+	return r;
+}
+
+IrRef ir_zero(IrBuilder* b, IrType type) {
+	return ir_is_float(type) ? ir_fconst(b, type, 0) : ir_const(b, type, 0);
+}
+
+IrRef ir_offset(IrBuilder* b, IrRef addr, isize offset) {
+	return offset == 0 ? addr : ir_op(b, IR_ADD, IR_I64, addr, ir_const(b, IR_I64, offset));
+}
+
+IrRef ir_temp_sized(IrBuilder* b, isize size, isize align) {
+	buf_push(b->fn->slots, (IrSlot){ size, align });
+	return ir_op_imm(b, IR_SLOT, IR_I64, -1, -1, buf_len(b->fn->slots) - 1);
+}
+
+// a new frame slot for a value of type t
+IrRef ir_temp(IrBuilder* b, Type* t) {
+	ir_layout(t);
+	return ir_temp_sized(b, t->size, t->align);
+}
+
+void ir_edge(IrBuilder* b, i32 to) {
+	buf_push(b->fn->blocks[to].preds, b->block);
+}
+
+void ir_jump(IrBuilder* b, i32 to) {
+	ir_op(b, IR_JUMP, IR_VOID, -1, -1);
+	b->fn->blocks[b->block].succ[0] = to;
+	ir_edge(b, to);
+}
+
+void ir_branch(IrBuilder* b, IrRef cond, i32 t, i32 f) {
+	ir_op(b, IR_BRANCH, IR_VOID, cond, -1);
+	b->fn->blocks[b->block].succ[0] = t;
+	b->fn->blocks[b->block].succ[1] = f;
+	ir_edge(b, t);
+	ir_edge(b, f);
+}
+
+// Statements after a return are built in a block without predecessors,
+// which optimization removes.
+void ir_ret(IrBuilder* b, IrRef x) {
+	ir_op(b, IR_RET, IR_VOID, x, -1);
+	b->block = ir_block(b);
+	b->sealed[b->block] = true;
+}
+
+void ir_set_args(IrFn* fn, IrRef ref, IrRef* args, isize len) {
+	fn->instrs[ref].args.start = (i32)buf_len(fn->args);
+	fn->instrs[ref].args.len = (i32)len;
+	for(isize i = 0; i < len; i++) {
+		buf_push(fn->args, args[i]);
+	}
+}
+
+IrRef ir_phi(IrBuilder* b, i32 block, IrType type) {
+	IrRef phi = ir_instr_new(b->fn, block, IR_PHI, type, -1, -1);
+	ir_insert(b->fn, block, ir_phis_len(b->fn, block), phi);
+	return phi;
+}
+
+void ir_write_var(IrBuilder* b, i32 var, i32 block, IrRef value) {
+	map_set(&b->defs, (u64)block << 32 | (u32)var, value);
+}
+
+IrRef ir_read_var(IrBuilder* b, i32 var, i32 block);
+
+// the operands of phi are the values of var at the end of the predecessors
+void ir_phi_fill(IrBuilder* b, i32 var, IrRef phi) {
+	i32 block = b->fn->instrs[phi].block;
+	IrRef* values = NULL;
+	for(isize i = 0; i < buf_len(b->fn->blocks[block].preds); i++) {
+		buf_push(values, ir_read_var(b, var, b->fn->blocks[block].preds[i]));
+	}
+	ir_set_args(b->fn, phi, values, buf_len(values));
+	buf_free(values);
+}
+
+IrRef ir_read_var(IrBuilder* b, i32 var, i32 block) {
+	isize* def = map_lookup(&b->defs, (u64)block << 32 | (u32)var);
+	if(def)
+		return (IrRef)*def;
+	IrType type = ir_type(b->locals[var].type);
+	isize preds = buf_len(b->fn->blocks[block].preds);
+	IrRef value;
+	if(!b->sealed[block]) {
+		value = ir_phi(b, block, type);
+		buf_push(b->pending[block], (IrPending){ var, value });
+	} else if(preds == 0) {
+		// unreachable block
+		value = ir_instr_new(b->fn, block, IR_CONST, type, -1, -1);
+		ir_insert(b->fn, block, ir_phis_len(b->fn, block), value);
+	} else if(preds == 1) {
+		value = ir_read_var(b, var, b->fn->blocks[block].preds[0]);
+	} else {
+		// the phi breaks cycles through loops
+		value = ir_phi(b, block, type);
+		ir_write_var(b, var, block, value);
+		ir_phi_fill(b, var, value);
+	}
+	ir_write_var(b, var, block, value);
+	return value;
+}
+
+void ir_seal(IrBuilder* b, i32 block) {
+	for(isize i = 0; i < buf_len(b->pending[block]); i++) {
+		ir_phi_fill(b, b->pending[block][i].var, b->pending[block][i].phi);
+	}
+	buf_free(b->pending[block]);
+	b->sealed[block] = true;
+}
+
+// the type of the value computed for expr: untyped constants not combined
+// with a typed operand default to i64, f64 or bool
+Type* ir_untyped_type(AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_FLOAT:
+			return primitive_f64;
+		case AST_EXPR_IDENT: {
+			ConstValue v = expr->ident.sym->cold->value;
+			return v.kind == CONST_FLOAT ? primitive_f64 : v.kind == CONST_BOOL ? primitive_bool : primitive_i64;
+		}
+		case AST_EXPR_UNARY:
+			return ir_untyped_type(expr->unary.x);
+		case AST_EXPR_BINARY: {
+			Type* x = ir_untyped_type(expr->binary.x);
+			return x == primitive_f64 ? x : ir_untyped_type(expr->binary.y);
+		}
+		default:
+			return primitive_i64;
+	}
+}
+
+Type* ir_expr_type(AstExpr* expr) {
+	if(expr->type)
+		return expr->type;
+	if(typing_is_untyped(expr))
+		return ir_untyped_type(expr);
+	ir_error(expr->loc, "cannot tell the type of this expression");
+	return NULL;
+}
+
+// tuple members are laid out in order, each at its alignment
+IrMember ir_tuple_member(Type* t, isize index) {
+	isize offset = 0;
+	for(isize i = 0; i < index; i++) {
+		offset = ALIGN_UP(offset, t->tuple.args[i]->align) + t->tuple.args[i]->size;
+	}
+	Type* f = t->tuple.args[index];
+	return (IrMember){ f, ALIGN_UP(offset, f->align), -1 };
+}
+
+bool ir_member(Type* t, StrIntern name, IrMember* m) {
+	ir_layout(t);
+	switch(t->kind) {
+		case TYPE_STRUCT:
+			for(isize i = 0; i < t->struct_.fields_len; i++) {
+				TypeField* f = &t->struct_.fields[i];
+				if(f->name == name) {
+					*m = (IrMember){ f->type, f->offset, f->bit };
+					return true;
+				}
+			}
+			return false;
+		case TYPE_TUPLE: {
+			isize index = typing_tuple_index(t, name);
+			if(index < 0)
+				return false;
+			*m = ir_tuple_member(t, index);
+			return true;
+		}
+		case TYPE_SLICE: {
+			Type* f = typing_member(t, name);
+			*m = (IrMember){ f, f == primitive_isize ? sizeof(void*) : 0, -1 };
+			return f != NULL;
+		}
+		default:
+			return false;
+	}
+}
+
+IrPlace ir_mem(IrRef addr, Type* t) {
+	return (IrPlace){ IR_PLACE_MEM, t, addr };
+}
+
+IrRef ir_load(IrBuilder* b, IrPlace p) {
+	switch(p.kind) {
+		case IR_PLACE_VAR:
+			return ir_read_var(b, p.var, b->block);
+		case IR_PLACE_MEM:
+			// aggregates are handled by address
+			return ir_is_aggregate(p.type) ? p.addr : ir_op(b, IR_LOAD, ir_type(p.type), p.addr, -1);
+		case IR_PLACE_BIT: {
+			IrRef byte = ir_op(b, IR_LOAD, IR_I8, p.addr, -1);
+			IrRef shifted = p.var > 0 ? ir_op(b, IR_SHR, IR_I8, byte, ir_const(b, IR_I8, p.var)) : byte;
+			return ir_op(b, IR_AND, IR_I8, shifted, ir_const(b, IR_I8, 1));
+		}
+	}
+	return -1;
+}
+
+void ir_store(IrBuilder* b, IrPlace p, IrRef value) {
+	switch(p.kind) {
+		case IR_PLACE_VAR:
+			ir_write_var(b, p.var, b->block, value);
+			break;
+		case IR_PLACE_MEM:
+			if(!ir_is_aggregate(p.type))
+				ir_op(b, IR_STORE, ir_type(p.type), p.addr, value);
+			else if(value != p.addr && p.type->size > 0)
+				ir_op_imm(b, IR_MEMCPY, IR_VOID, p.addr, value, p.type->size);
+			break;
+		case IR_PLACE_BIT: {
+			IrRef byte = ir_op(b, IR_LOAD, IR_I8, p.addr, -1);
+			IrRef cleared = ir_op(b, IR_AND, IR_I8, byte, ir_const(b, IR_I8, ~(1 << p.var)));
+			IrRef bit = p.var > 0 ? ir_op(b, IR_SHL, IR_I8, value, ir_const(b, IR_I8, p.var)) : value;
+			ir_op(b, IR_STORE, IR_I8, p.addr, ir_op(b, IR_OR, IR_I8, cleared, bit));
+			break;
+		}
+	}
+}
+
+// converts the scalar x from type from to type to, as C does
+IrRef ir_convert(IrBuilder* b, IrRef x, Type* from, Type* to) {
+	IrType ft = ir_type(from), tt = ir_type(to);
+	if(tt == IR_VOID || from == to)
+		return x;
+	if(to->kind == TYPE_BOOLEAN) {
+		if(from->kind == TYPE_BOOLEAN)
+			return x;
+		return ir_op(b, IR_NE, IR_I8, x, ir_zero(b, ft));
+	}
+	if(ir_is_float(ft) && ir_is_float(tt)) {
+		if(ft == tt)
+			return x;
+		return ir_op(b, ft == IR_F32 ? IR_FEXT : IR_FTRUNC, tt, x, -1);
+	}
+	if(ir_is_float(ft))
+		return ir_op(b, ir_is_signed(to) ? IR_FTOI : IR_FTOU, tt, x, -1);
+	if(ir_is_float(tt))
+		return ir_op(b, ir_is_signed(from) ? IR_ITOF : IR_UTOF, tt, x, -1);
+	if(ft == tt)
+		return x;
+	if(ir_type_bits(tt) < ir_type_bits(ft))
+		return ir_op(b, IR_TRUNC, tt, x, -1);
+	return ir_op(b, ir_is_signed(from) ? IR_SEXT : IR_ZEXT, tt, x, -1);
+}
+
+IrRef ir_expr(IrBuilder* b, AstExpr* expr);
+IrRef ir_value(IrBuilder* b, AstExpr* expr, Type* t);
+IrRef ir_aggregate(IrBuilder* b, AstExpr* expr, Type* t);
+void ir_cond(IrBuilder* b, AstExpr* expr, i32 t, i32 f);
+
+IrPlace ir_place(IrBuilder* b, AstExpr* expr);
+
+// the address of the place expr names, or of a temporary holding an
+// aggregate value
+IrRef ir_addr(IrBuilder* b, AstExpr* expr) {
+	IrPlace p = ir_place(b, expr);
+	if(p.kind == IR_PLACE_BIT)
+		ir_error(expr->loc, "cannot take the address of a bool packed in a bitset");
+	assert(p.kind == IR_PLACE_MEM);
+	return p.addr;
+}
+
+IrPlace ir_place(IrBuilder* b, AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_IDENT: {
+			Symbol* sym = expr->ident.sym;
+			if(!sym) {
+				IrLocal* l = &b->locals[expr->ident.slot];
+				if(l->addr >= 0)
+					return ir_mem(l->addr, l->type);
+				return (IrPlace){ IR_PLACE_VAR, l->type, -1, expr->ident.slot };
+			}
+			if(sym->kind == SYMBOL_LET) {
+				IrRef addr = ir_op(b, IR_GLOBAL, IR_I64, -1, -1);
+				b->fn->instrs[addr].sym = sym;
+				return ir_mem(addr, sym->type);
+			}
+			break;
+		}
+		case AST_EXPR_MEMBER: {
+			if(typing_enum_name(expr->member.x))
+				break;
+			Type* t = ir_expr_type(expr->member.x);
+			IrRef base;
+			if(t->kind == TYPE_PTR) {
+				base = ir_expr(b, expr->member.x);
+				t = t->ptr;
+			} else {
+				base = ir_addr(b, expr->member.x);
+			}
+			IrMember m;
+			if(!ir_member(t, expr->member.name, &m))
+				ir_error(expr->loc, "no field '%s' in '%s'", expr->member.name, string_type(t));
+			IrRef addr = ir_offset(b, base, m.offset);
+			if(m.bit >= 0)
+				return (IrPlace){ IR_PLACE_BIT, m.type, addr, m.bit };
+			return ir_mem(addr, m.type);
+		}
+		case AST_EXPR_INDEX: {
+			Type* t = ir_expr_type(expr->index.x);
+			IrRef base;
+			Type* elem;
+			switch(t->kind) {
+				case TYPE_ARRAY:
+					base = ir_addr(b, expr->index.x);
+					elem = t->array.base;
+					break;
+				case TYPE_SLICE:
+					base = ir_op(b, IR_LOAD, IR_I64, ir_addr(b, expr->index.x), -1);
+					elem = t->slice;
+					break;
+				case TYPE_PTR:
+					base = ir_expr(b, expr->index.x);
+					elem = t->ptr;
+					break;
+				default:
+					ir_error(expr->loc, "cannot index a value of type '%s'", string_type(t));
+					return (IrPlace){0};
+			}
+			ir_layout(elem);
+			IrRef index = ir_value(b, expr->index.arg, primitive_isize);
+			if(elem->size != 1)
+				index = ir_op(b, IR_MUL, IR_I64, index, ir_const(b, IR_I64, elem->size));
+			return ir_mem(ir_op(b, IR_ADD, IR_I64, base, index), elem);
+		}
+		case AST_EXPR_UNARY: {
+			if(expr->unary.op != T_MUL)
+				break;
+			Type* t = ir_expr_type(expr->unary.x);
+			if(t->kind != TYPE_PTR)
+				ir_error(expr->loc, "cannot dereference a value of type '%s'", string_type(t));
+			return ir_mem(ir_expr(b, expr->unary.x), t->ptr);
+		}
+		default:
+			break;
+	}
+	Type* t = ir_expr_type(expr);
+	if(!ir_is_aggregate(t))
+		ir_error(expr->loc, "expression is not addressable");
+	return ir_mem(ir_expr(b, expr), t);
+}
+
+// stores the value of expr as a t at offset of addr
+void ir_store_at(IrBuilder* b, IrRef addr, isize offset, AstExpr* expr, Type* t) {
+	ir_store(b, ir_mem(ir_offset(b, addr, offset), t), ir_value(b, expr, t));
+}
+
+// E.V or E.V(args): a zeroed enum with the tag and the payload stored
+IrRef ir_enum(IrBuilder* b, Type* t, StrIntern name, AstExprList* args, FileLoc loc) {
+	TypeVariant* v = NULL;
+	for(isize i = 0; i < t->enum_.variants_len && !v; i++) {
+		if(t->enum_.variants[i].name == name)
+			v = &t->enum_.variants[i];
+	}
+	if(!v)
+		ir_error(loc, "no variant '%s' in enum '%s'", name, t->symbol->name);
+	IrRef addr = ir_temp(b, t);
+	if(t->size > 0)
+		ir_op_imm(b, IR_MEMZERO, IR_VOID, addr, -1, t->size);
+	if(t->enum_.tag) {
+		IrType tag = ir_type(t->enum_.tag);
+		ir_op(b, IR_STORE, tag, addr, ir_const(b, tag, v->value));
+	} else if(v - t->enum_.variants != t->enum_.niche_variant) {
+		IrType niche = ir_type(t->niche.size == 8 ? primitive_u64 : t->niche.size == 4 ? primitive_u32 :
+			t->niche.size == 2 ? primitive_u16 : primitive_u8);
+		ir_op(b, IR_STORE, niche, ir_offset(b, addr, t->niche.offset), ir_const(b, niche, v->niche_value));
+	}
+	isize len = args ? args->len : 0;
+	if(!v->payload || len == 0)
+		return addr;
+	IrRef payload = ir_offset(b, addr, t->enum_.tag ? t->enum_.payload_offset : 0);
+	Type* p = v->payload;
+	if(len > 1 && p->kind == TYPE_TUPLE && p->tuple.args_len == len) {
+		for(isize i = 0; i < len; i++) {
+			IrMember m = ir_tuple_member(p, i);
+			ir_store_at(b, payload, m.offset, args->list[i], m.type);
+		}
+	} else if(len == 1) {
+		ir_store_at(b, payload, 0, args->list[0], p);
+	} else {
+		ir_error(loc, "variant '%s' takes one payload", name);
+	}
+	return addr;
+}
+
+// expr names a temporary that nothing else refers to
+bool ir_is_temp(AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_CALL:
+		case AST_EXPR_CAST:
+		case AST_EXPR_TUPLE:
+		case AST_EXPR_ARRAY:
+		case AST_EXPR_ARRAY_LIST:
+		case AST_EXPR_INIT:
+			return true;
+		case AST_EXPR_MEMBER:
+			return typing_enum_name(expr->member.x) != NULL;
+		default:
+			return false;
+	}
+}
+
+IrRef ir_call(IrBuilder* b, AstExpr* expr) {
+	AstExpr* x = expr->call.x;
+	AstExprList* args = &expr->call.args;
+	Type* t = ir_expr_type(x);
+	if(t->kind != TYPE_FN)
+		ir_error(expr->loc, "cannot call a value of type '%s'", string_type(t));
+	if(args->len != t->fn.args_len)
+		ir_error(expr->loc, "%lld arguments given, %lld expected", (long long)args->len, (long long)t->fn.args_len);
+	IrRef* values = NULL;
+	IrRef result = -1;
+	Type* ret = t->fn.ret;
+	if(ir_is_aggregate(ret)) {
+		result = ir_temp(b, ret);
+		buf_push(values, result);
+	}
+	for(isize i = 0; i < args->len; i++) {
+		Type* pt = t->fn.args[i];
+		IrRef v = ir_value(b, args->list[i], pt);
+		// the callee gets a copy it owns
+		if(ir_is_aggregate(pt) && !ir_is_temp(args->list[i])) {
+			IrRef copy = ir_temp(b, pt);
+			ir_store(b, ir_mem(copy, pt), v);
+			v = copy;
+		}
+		buf_push(values, v);
+	}
+	IrRef callee = ir_expr(b, x);
+	IrRef call = ir_op(b, IR_CALL, result >= 0 ? IR_VOID : ir_type(ret), callee, -1);
+	ir_set_args(b->fn, call, values, buf_len(values));
+	buf_free(values);
+	return result >= 0 ? result : call;
+}
+
+IrOp ir_arith_op(TokenKind op, Type* t) {
+	bool is_float = t->kind == TYPE_FLOAT;
+	bool is_signed = ir_is_signed(t) || is_float;
+	switch(op) {
+		case T_ADD: return IR_ADD;
+		case T_SUB: return IR_SUB;
+		case T_MUL: return IR_MUL;
+		case T_DIV: return is_signed ? IR_DIV : IR_UDIV;
+		case T_REM: return is_float ? IR_NOP : is_signed ? IR_REM : IR_UREM;
+		case T_AND: return is_float ? IR_NOP : IR_AND;
+		case T_OR: return is_float ? IR_NOP : IR_OR;
+		case T_XOR: return is_float ? IR_NOP : IR_XOR;
+		case T_LSHIFT: return is_float ? IR_NOP : IR_SHL;
+		case T_RSHIFT: return is_float ? IR_NOP : is_signed ? IR_SAR : IR_SHR;
+		case T_ADD_ASSIGN: return ir_arith_op(T_ADD, t);
+		case T_SUB_ASSIGN: return ir_arith_op(T_SUB, t);
+		case T_MUL_ASSIGN: return ir_arith_op(T_MUL, t);
+		case T_DIV_ASSIGN: return ir_arith_op(T_DIV, t);
+		case T_REM_ASSIGN: return ir_arith_op(T_REM, t);
+		case T_AND_ASSIGN: return ir_arith_op(T_AND, t);
+		case T_OR_ASSIGN: return ir_arith_op(T_OR, t);
+		case T_XOR_ASSIGN: return ir_arith_op(T_XOR, t);
+		case T_LSHIFT_ASSIGN: return ir_arith_op(T_LSHIFT, t);
+		case T_RSHIFT_ASSIGN: return ir_arith_op(T_RSHIFT, t);
+		default: return IR_NOP;
+	}
+}
+
+// x op y on values of type t. Adding an integer to a pointer moves it by
+// that many elements, as in C.
+IrRef ir_arith(IrBuilder* b, TokenKind op, Type* t, IrRef x, IrRef y, FileLoc loc) {
+	IrOp irop = ir_arith_op(op, t);
+	if(irop == IR_NOP || ir_is_aggregate(t) || (t->kind == TYPE_PTR && irop != IR_ADD && irop != IR_SUB))
+		ir_error(loc, "operator '%s' does not apply to '%s'", token_kind_names[op], string_type(t));
+	if(t->kind == TYPE_PTR) {
+		ir_layout(t->ptr);
+		if(t->ptr->size != 1)
+			y = ir_op(b, IR_MUL, IR_I64, y, ir_const(b, IR_I64, t->ptr->size));
+	}
+	return ir_op(b, irop, ir_type(t), x, y);
+}
+
+IrOp ir_compare_op(TokenKind op, Type* t) {
+	bool is_signed = ir_is_signed(t) || t->kind == TYPE_FLOAT;
+	switch(op) {
+		case T_EQL: return IR_EQ;
+		case T_NEQ: return IR_NE;
+		case T_LT: return is_signed ? IR_LT : IR_ULT;
+		case T_GT: return is_signed ? IR_GT : IR_UGT;
+		case T_LTE: return is_signed ? IR_LE : IR_ULE;
+		default: return is_signed ? IR_GE : IR_UGE;
+	}
+}
+
+// a bool from the branches taken on expr (&&, ||)
+IrRef ir_bool(IrBuilder* b, AstExpr* expr) {
+	i32 t = ir_block(b), f = ir_block(b), join = ir_block(b);
+	ir_cond(b, expr, t, f);
+	ir_seal(b, t);
+	ir_seal(b, f);
+	IrRef values[2];
+	b->block = t;
+	values[0] = ir_const(b, IR_I8, 1);
+	ir_jump(b, join);
+	b->block = f;
+	values[1] = ir_const(b, IR_I8, 0);
+	ir_jump(b, join);
+	ir_seal(b, join);
+	b->block = join;
+	IrRef phi = ir_phi(b, join, IR_I8);
+	ir_set_args(b->fn, phi, values, 2);
+	return phi;
+}
+
+IrRef ir_binary(IrBuilder* b, AstExpr* expr) {
+	TokenKind op = expr->binary.op;
+	AstExpr* x = expr->binary.x;
+	AstExpr* y = expr->binary.y;
+	switch(op) {
+		case T_LAND:
+		case T_LOR:
+			return ir_bool(b, expr);
+		case T_EQL: case T_NEQ: case T_LT: case T_GT: case T_LTE: case T_GTE: {
+			Type* t = typing_is_untyped(x) ? ir_expr_type(y) : ir_expr_type(x);
+			if(ir_is_aggregate(t))
+				ir_error(expr->loc, "cannot compare values of type '%s'", string_type(t));
+			IrRef a = ir_value(b, x, t);
+			return ir_op(b, ir_compare_op(op, t), IR_I8, a, ir_value(b, y, t));
+		}
+		default: {
+			Type* t = ir_expr_type(expr);
+			if(t->kind == TYPE_PTR) {
+				if(ir_expr_type(y)->kind == TYPE_PTR && op == T_ADD) {
+					// n + p
+					AstExpr* tmp = x;
+					x = y;
+					y = tmp;
+				}
+				if(ir_expr_type(y)->kind == TYPE_PTR)
+					ir_error(expr->loc, "operator '%s' does not apply to two pointers", token_kind_names[op]);
+			}
+			IrRef a = ir_value(b, x, t);
+			return ir_arith(b, op, t, a, ir_value(b, y, t), expr->loc);
+		}
+	}
+}
+
+IrRef ir_cast(IrBuilder* b, AstExpr* expr) {
+	Type* to = expr->cast.type->resolved;
+	Type* from = ir_expr_type(expr->cast.x);
+	if(!ir_is_aggregate(to) && !ir_is_aggregate(from))
+		return ir_convert(b, ir_expr(b, expr->cast.x), from, to);
+	// the bytes are reinterpreted, as by nl_bitcast in the C backend
+	ir_layout(from);
+	ir_layout(to);
+	IrRef addr = ir_temp_sized(b, MAX(from->size, to->size), MAX(from->align, to->align));
+	if(MAX(from->size, to->size) > 0)
+		ir_op_imm(b, IR_MEMZERO, IR_VOID, addr, -1, MAX(from->size, to->size));
+	ir_store(b, ir_mem(addr, from), ir_expr(b, expr->cast.x));
+	return ir_load(b, ir_mem(addr, to));
+}
+
+IrRef ir_const_value(IrBuilder* b, ConstValue v, Type* t) {
+	if(v.type)
+		t = v.type;
+	switch(v.kind) {
+		case CONST_INT:
+			return ir_const(b, ir_type(t), v.i);
+		case CONST_FLOAT:
+			return ir_fconst(b, ir_type(t), v.f);
+		case CONST_BOOL:
+			return ir_const(b, IR_I8, v.b);
+	}
+	return -1;
+}
+
+void ir_decode_string(char** out, StrRange s) {
+	for(isize i = 0; i < s.l; i++) {
+		char c = s.s[i];
+		if(c != '\\' || i + 1 >= s.l) {
+			buf_putc(*out, c);
+			continue;
+		}
+		c = s.s[++i];
+		const char* simple = strchr("a\ab\bf\fn\nr\rt\tv\v\\\\", c);
+		if(simple && c != '\0') {
+			buf_putc(*out, simple[1]);
+			continue;
+		}
+		isize digits = c == 'x' ? 2 : c == 'u' ? 4 : c == 'U' ? 8 : 3;
+		isize base = c == 'x' || c == 'u' || c == 'U' ? 16 : 8;
+		i += base == 16;
+		u32 x = 0;
+		for(isize k = 0; k < digits && i < s.l; k++, i++) {
+			char d = s.s[i];
+			x = x * base + (d <= '9' ? d - '0' : (d | 0x20) - 'a' + 10);
+		}
+		i--;
+		if(c != 'u' && c != 'U') {
+			buf_putc(*out, (char)x);
+		} else if(x < 0x80) {
+			buf_putc(*out, (char)x);
+		} else if(x < 0x800) {
+			buf_putc(*out, (char)(0xC0 | x >> 6));
+			buf_putc(*out, (char)(0x80 | (x & 0x3F)));
+		} else if(x < 0x10000) {
+			buf_putc(*out, (char)(0xE0 | x >> 12));
+			buf_putc(*out, (char)(0x80 | (x >> 6 & 0x3F)));
+			buf_putc(*out, (char)(0x80 | (x & 0x3F)));
+		} else {
+			buf_putc(*out, (char)(0xF0 | x >> 18));
+			buf_putc(*out, (char)(0x80 | (x >> 12 & 0x3F)));
+			buf_putc(*out, (char)(0x80 | (x >> 6 & 0x3F)));
+			buf_putc(*out, (char)(0x80 | (x & 0x3F)));
+		}
+	}
+}
+
+IrRef ir_expr(IrBuilder* b, AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+			return ir_const(b, ir_type(ir_expr_type(expr)), (i64)expr->lit_int);
+		case AST_EXPR_LIT_FLOAT:
+			return ir_fconst(b, ir_type(ir_expr_type(expr)), expr->lit_float);
+		case AST_EXPR_LIT_CHAR:
+			return ir_const(b, ir_type(ir_expr_type(expr)), expr->lit_char);
+		case AST_EXPR_LIT_STRING: {
+			char* s = NULL;
+			ir_decode_string(&s, expr->lit_string);
+			buf_putc(s, '\0');
+			buf_push(b->fn->strings, s);
+			return ir_op_imm(b, IR_STRING, IR_I64, -1, -1, buf_len(b->fn->strings) - 1);
+		}
+		case AST_EXPR_IDENT: {
+			Symbol* sym = expr->ident.sym;
+			if(sym && sym->kind == SYMBOL_CONST)
+				return ir_const_value(b, sym->cold->value, ir_expr_type(expr));
+			if(sym && sym->kind == SYMBOL_FN) {
+				IrRef r = ir_op(b, IR_FN, IR_I64, -1, -1);
+				b->fn->instrs[r].sym = sym;
+				return r;
+			}
+			if(sym && sym->kind != SYMBOL_LET)
+				ir_error(expr->loc, "'%s' is not a value", sym->name);
+			return ir_load(b, ir_place(b, expr));
+		}
+		case AST_EXPR_MEMBER: {
+			Type* t = typing_enum_name(expr->member.x);
+			if(t)
+				return ir_enum(b, t, expr->member.name, NULL, expr->loc);
+			return ir_load(b, ir_place(b, expr));
+		}
+		case AST_EXPR_CALL: {
+			AstExpr* x = expr->call.x;
+			Type* t = x->kind == AST_EXPR_MEMBER ? typing_enum_name(x->member.x) : NULL;
+			if(t)
+				return ir_enum(b, t, x->member.name, &expr->call.args, expr->loc);
+			return ir_call(b, expr);
+		}
+		case AST_EXPR_UNARY: {
+			AstExpr* x = expr->unary.x;
+			switch(expr->unary.op) {
+				case T_AND:
+					return ir_addr(b, x);
+				case T_MUL:
+					return ir_load(b, ir_place(b, expr));
+				case T_NOT: {
+					Type* t = ir_expr_type(x);
+					IrRef v = ir_expr(b, x);
+					return ir_op(b, IR_EQ, IR_I8, v, ir_zero(b, ir_type(t)));
+				}
+				case T_SUB: {
+					Type* t = ir_expr_type(expr);
+					return ir_op(b, IR_NEG, ir_type(t), ir_value(b, x, t), -1);
+				}
+				default:
+					return ir_value(b, x, ir_expr_type(expr));
+			}
+		}
+		case AST_EXPR_BINARY:
+			return ir_binary(b, expr);
+		case AST_EXPR_CAST:
+			return ir_cast(b, expr);
+		case AST_EXPR_INDEX:
+			return ir_load(b, ir_place(b, expr));
+		case AST_EXPR_TUPLE:
+			if(expr->tuple.args.len == 0)
+				return -1;
+			return ir_aggregate(b, expr, ir_expr_type(expr));
+		case AST_EXPR_ARRAY:
+		case AST_EXPR_ARRAY_LIST:
+		case AST_EXPR_INIT:
+			return ir_aggregate(b, expr, ir_expr_type(expr));
+	}
+	return -1;
+}
+
+// the value of expr as a t: scalars are converted, aggregate literals are
+// built as a t
+IrRef ir_value(IrBuilder* b, AstExpr* expr, Type* t) {
+	if(!ir_is_aggregate(t))
+		return ir_convert(b, ir_expr(b, expr), ir_expr_type(expr), t);
+	switch(expr->kind) {
+		case AST_EXPR_TUPLE:
+		case AST_EXPR_ARRAY:
+		case AST_EXPR_ARRAY_LIST:
+			if(expr->kind != AST_EXPR_TUPLE || expr->tuple.args.len > 0)
+				return ir_aggregate(b, expr, t);
+			break;
+		default:
+			break;
+	}
+	return ir_expr(b, expr);
+}
+
+// [x; n]: the value is stored n times, in a loop unless n is small
+void ir_repeat(IrBuilder* b, IrRef addr, AstExpr* init, Type* elem, isize n) {
+	IrRef v = ir_value(b, init, elem);
+	IrInstr* in = &b->fn->instrs[v];
+	if(!ir_is_aggregate(elem) && in->op == IR_CONST && in->imm == 0 && !(ir_is_float(in->type) && in->f != 0)) {
+		ir_op_imm(b, IR_MEMZERO, IR_VOID, addr, -1, elem->size * n);
+		return;
+	}
+	if(n <= 8) {
+		for(isize i = 0; i < n; i++) {
+			ir_store(b, ir_mem(ir_offset(b, addr, i * elem->size), elem), v);
+		}
+		return;
+	}
+	IrRef start = ir_const(b, IR_I64, 0);
+	i32 pre = b->block, header = ir_block(b), body = ir_block(b), exit = ir_block(b);
+	ir_jump(b, header);
+	b->block = header;
+	IrRef i = ir_phi(b, header, IR_I64);
+	ir_branch(b, ir_op(b, IR_ULT, IR_I8, i, ir_const(b, IR_I64, n)), body, exit);
+	b->block = body;
+	IrRef offset = ir_op(b, IR_MUL, IR_I64, i, ir_const(b, IR_I64, elem->size));
+	ir_store(b, ir_mem(ir_op(b, IR_ADD, IR_I64, addr, offset), elem), v);
+	IrRef next = ir_op(b, IR_ADD, IR_I64, i, ir_const(b, IR_I64, 1));
+	ir_jump(b, header);
+	IrRef values[2] = { start, next };
+	assert(b->fn->blocks[header].preds[0] == pre);
+	ir_set_args(b->fn, i, values, 2);
+	ir_seal(b, header);
+	ir_seal(b, body);
+	ir_seal(b, exit);
+	b->block = exit;
+}
+
+// builds the aggregate literal expr as a t in a new temporary
+IrRef ir_aggregate(IrBuilder* b, AstExpr* expr, Type* t) {
+	IrRef addr = ir_temp(b, t);
+	switch(expr->kind) {
+		case AST_EXPR_TUPLE: {
+			AstExprList* args = &expr->tuple.args;
+			if(t->kind != TYPE_TUPLE || t->tuple.args_len != args->len)
+				ir_error(expr->loc, "tuple literal used as a '%s'", string_type(t));
+			for(isize i = 0; i < args->len; i++) {
+				IrMember m = ir_tuple_member(t, i);
+				ir_store_at(b, addr, m.offset, args->list[i], m.type);
+			}
+			break;
+		}
+		case AST_EXPR_ARRAY:
+			if(t->kind != TYPE_ARRAY)
+				ir_error(expr->loc, "array literal used as a '%s'", string_type(t));
+			if(t->array.len > 0)
+				ir_repeat(b, addr, expr->array.init, t->array.base, t->array.len);
+			break;
+		case AST_EXPR_ARRAY_LIST: {
+			AstExprList* args = &expr->array_list.args;
+			if(t->kind != TYPE_ARRAY || t->array.len < args->len)
+				ir_error(expr->loc, "array literal used as a '%s'", string_type(t));
+			Type* elem = t->array.base;
+			if(t->array.len > args->len)
+				ir_op_imm(b, IR_MEMZERO, IR_VOID, addr, -1, t->size);
+			for(isize i = 0; i < args->len; i++) {
+				ir_store_at(b, addr, i * elem->size, args->list[i], elem);
+			}
+			break;
+		}
+		case AST_EXPR_INIT: {
+			if(t->kind != TYPE_STRUCT)
+				ir_error(expr->loc, "initializer used as a '%s'", string_type(t));
+			if(t->size > 0)
+				ir_op_imm(b, IR_MEMZERO, IR_VOID, addr, -1, t->size);
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				AstArg* field = expr->init.fields.list[i];
+				IrMember m;
+				if(!ir_member(t, field->name, &m))
+					ir_error(field->expr->loc, "no field '%s' in '%s'", field->name, string_type(t));
+				IrRef faddr = ir_offset(b, addr, m.offset);
+				IrPlace p = m.bit >= 0 ? (IrPlace){ IR_PLACE_BIT, m.type, faddr, m.bit } : ir_mem(faddr, m.type);
+				ir_store(b, p, ir_value(b, field->expr, m.type));
+			}
+			break;
+		}
+		default:
+			assert(0);
+			break;
+	}
+	return addr;
+}
+
+// branches to t if expr is true, else to f
+void ir_cond(IrBuilder* b, AstExpr* expr, i32 t, i32 f) {
+	if(expr->kind == AST_EXPR_BINARY && (expr->binary.op == T_LAND || expr->binary.op == T_LOR)) {
+		i32 mid = ir_block(b);
+		if(expr->binary.op == T_LAND)
+			ir_cond(b, expr->binary.x, mid, f);
+		else
+			ir_cond(b, expr->binary.x, t, mid);
+		ir_seal(b, mid);
+		b->block = mid;
+		ir_cond(b, expr->binary.y, t, f);
+		return;
+	}
+	if(expr->kind == AST_EXPR_UNARY && expr->unary.op == T_NOT) {
+		ir_cond(b, expr->unary.x, f, t);
+		return;
+	}
+	Type* type = ir_expr_type(expr);
+	if(ir_is_aggregate(type) || type->kind == TYPE_VOID)
+		ir_error(expr->loc, "a value of type '%s' is not a condition", string_type(type));
+	IrRef v = ir_expr(b, expr);
+	if(type->kind == TYPE_FLOAT)
+		v = ir_op(b, IR_NE, IR_I8, v, ir_zero(b, ir_type(type)));
+	ir_branch(b, v, t, f);
+}
+
+void ir_stmt(IrBuilder* b, AstStmt* stmt);
+
+void ir_block_stmts(IrBuilder* b, AstStmtList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		ir_stmt(b, list->list[i]);
+	}
+}
+
+void ir_stmt(IrBuilder* b, AstStmt* stmt) {
+	switch(stmt->kind) {
+		case AST_STMT_DECL: {
+			AstDecl* decl = stmt->decl;
+			AstExpr* value = decl->kind == AST_DECL_LET ? decl->let.value : decl->const_.value;
+			i32 slot = b->next_slot++;
+			Type* t = decl->kind == AST_DECL_LET && decl->let.type ? decl->let.type->resolved : ir_expr_type(value);
+			if(t->kind == TYPE_VOID || (t->kind == TYPE_TUPLE && t->tuple.args_len == 0))
+				ir_error(decl->loc, "'%s' has no value", decl->name);
+			b->locals[slot] = (IrLocal){ t, -1 };
+			if(ir_is_aggregate(t) && value && ir_is_temp(value)) {
+				// the local takes over the temporary holding its value
+				b->locals[slot].addr = ir_value(b, value, t);
+			} else if(ir_is_aggregate(t) || b->addressed[slot]) {
+				IrRef addr = ir_temp(b, t);
+				IrRef v = value ? ir_value(b, value, t) : -1;
+				b->locals[slot].addr = addr;
+				if(v >= 0)
+					ir_store(b, ir_mem(addr, t), v);
+				else if(ir_is_aggregate(t) && t->size > 0)
+					ir_op_imm(b, IR_MEMZERO, IR_VOID, addr, -1, t->size);
+				else if(!ir_is_aggregate(t))
+					ir_store(b, ir_mem(addr, t), ir_zero(b, ir_type(t)));
+			} else {
+				ir_write_var(b, slot, b->block, value ? ir_value(b, value, t) : ir_zero(b, ir_type(t)));
+			}
+			break;
+		}
+		case AST_STMT_EXPR:
+			ir_expr(b, stmt->expr);
+			break;
+		case AST_STMT_IF: {
+			i32 then = ir_block(b), join = ir_block(b);
+			i32 els = stmt->if_.els ? ir_block(b) : join;
+			ir_cond(b, stmt->if_.cond, then, els);
+			ir_seal(b, then);
+			b->block = then;
+			ir_block_stmts(b, &stmt->if_.body);
+			ir_jump(b, join);
+			if(stmt->if_.els) {
+				ir_seal(b, els);
+				b->block = els;
+				ir_stmt(b, stmt->if_.els);
+				ir_jump(b, join);
+			}
+			ir_seal(b, join);
+			b->block = join;
+			break;
+		}
+		case AST_STMT_FOR: {
+			i32 header = ir_block(b);
+			ir_jump(b, header);
+			b->block = header;
+			i32 exit = ir_block(b);
+			if(stmt->for_.cond) {
+				i32 body = ir_block(b);
+				ir_cond(b, stmt->for_.cond, body, exit);
+				ir_seal(b, body);
+				b->block = body;
+			}
+			ir_block_stmts(b, &stmt->for_.body);
+			ir_jump(b, header);
+			ir_seal(b, header);
+			ir_seal(b, exit);
+			b->block = exit;
+			break;
+		}
+		case AST_STMT_RETURN: {
+			AstExpr* x = stmt->return_;
+			if(b->ret_ptr >= 0) {
+				if(!x)
+					ir_error(stmt->loc, "missing return value");
+				ir_store(b, ir_mem(b->ret_ptr, b->ret), ir_value(b, x, b->ret));
+				ir_ret(b, -1);
+			} else if(b->fn->ret != IR_VOID) {
+				if(!x)
+					ir_error(stmt->loc, "missing return value");
+				ir_ret(b, ir_value(b, x, b->ret));
+			} else {
+				if(x)
+					ir_expr(b, x);
+				ir_ret(b, -1);
+			}
+			break;
+		}
+		case AST_STMT_ASSIGN: {
+			IrPlace p = ir_place(b, stmt->assign.x);
+			if(stmt->assign.op == T_ASSIGN) {
+				ir_store(b, p, ir_value(b, stmt->assign.y, p.type));
+				break;
+			}
+			IrRef old = ir_load(b, p);
+			IrRef y = ir_value(b, stmt->assign.y, p.type->kind == TYPE_PTR ? primitive_isize : p.type);
+			ir_store(b, p, ir_arith(b, stmt->assign.op, p.type, old, y, stmt->loc));
+			break;
+		}
+		case AST_STMT_BLOCK:
+			ir_block_stmts(b, &stmt->block.body);
+			break;
+	}
+}
+
+// marks the locals whose address is taken, they are kept in memory
+void ir_scan_stmt(IrBuilder* b, AstStmt* stmt);
+
+void ir_scan_expr(IrBuilder* b, AstExpr* expr) {
+	if(!expr)
+		return;
+	switch(expr->kind) {
+		case AST_EXPR_MEMBER:
+			ir_scan_expr(b, expr->member.x);
+			break;
+		case AST_EXPR_CALL:
+			ir_scan_expr(b, expr->call.x);
+			for(isize i = 0; i < expr->call.args.len; i++) {
+				ir_scan_expr(b, expr->call.args.list[i]);
+			}
+			break;
+		case AST_EXPR_UNARY: {
+			AstExpr* x = expr->unary.x;
+			if(expr->unary.op == T_AND && x->kind == AST_EXPR_IDENT && !x->ident.sym)
+				b->addressed[x->ident.slot] = true;
+			ir_scan_expr(b, x);
+			break;
+		}
+		case AST_EXPR_BINARY:
+			ir_scan_expr(b, expr->binary.x);
+			ir_scan_expr(b, expr->binary.y);
+			break;
+		case AST_EXPR_CAST:
+			ir_scan_expr(b, expr->cast.x);
+			break;
+		case AST_EXPR_INDEX:
+			ir_scan_expr(b, expr->index.x);
+			ir_scan_expr(b, expr->index.arg);
+			break;
+		case AST_EXPR_TUPLE:
+			for(isize i = 0; i < expr->tuple.args.len; i++) {
+				ir_scan_expr(b, expr->tuple.args.list[i]);
+			}
+			break;
+		case AST_EXPR_ARRAY:
+			ir_scan_expr(b, expr->array.init);
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			for(isize i = 0; i < expr->array_list.args.len; i++) {
+				ir_scan_expr(b, expr->array_list.args.list[i]);
+			}
+			break;
+		case AST_EXPR_INIT:
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				ir_scan_expr(b, expr->init.fields.list[i]->expr);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void ir_scan_block(IrBuilder* b, AstStmtList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		ir_scan_stmt(b, list->list[i]);
+	}
+}
+
+void ir_scan_stmt(IrBuilder* b, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL:
+			ir_scan_expr(b, stmt->decl->kind == AST_DECL_LET ? stmt->decl->let.value : stmt->decl->const_.value);
+			break;
+		case AST_STMT_EXPR:
+			ir_scan_expr(b, stmt->expr);
+			break;
+		case AST_STMT_IF:
+			ir_scan_expr(b, stmt->if_.cond);
+			ir_scan_block(b, &stmt->if_.body);
+			ir_scan_stmt(b, stmt->if_.els);
+			break;
+		case AST_STMT_FOR:
+			ir_scan_expr(b, stmt->for_.cond);
+			ir_scan_block(b, &stmt->for_.body);
+			break;
+		case AST_STMT_RETURN:
+			ir_scan_expr(b, stmt->return_);
+			break;
+		case AST_STMT_ASSIGN:
+			ir_scan_expr(b, stmt->assign.x);
+			ir_scan_expr(b, stmt->assign.y);
+			break;
+		case AST_STMT_BLOCK:
+			ir_scan_block(b, &stmt->block.body);
+			break;
+	}
+}
+
+void ir_builder_init(IrBuilder* b, IrFn* fn, Type* ret, i32 locals) {
+	*b = (IrBuilder){ .fn = fn, .ret = ret, .ret_ptr = -1 };
+	b->locals = xcalloc(MAX(locals, 1), sizeof(IrLocal));
+	b->addressed = xcalloc(MAX(locals, 1), 1);
+	fn->ret_ptr = ir_is_aggregate(ret);
+	fn->ret = fn->ret_ptr ? IR_VOID : ir_type(ret);
+	b->block = ir_block(b);
+	b->sealed[b->block] = true;
+	if(fn->ret_ptr)
+		b->ret_ptr = ir_op_imm(b, IR_PARAM, IR_I64, -1, -1, fn->params_len++);
+}
+
+// ends the last block, a fn that does not return a value returns zero
+void ir_builder_finish(IrBuilder* b) {
+	if(!ir_terminator(b->fn, b->block))
+		ir_op(b, IR_RET, IR_VOID, b->fn->ret == IR_VOID ? -1 : ir_zero(b, b->fn->ret), -1);
+	for(isize i = 0; i < buf_len(b->pending); i++) {
+		assert(!b->pending[i]);
+	}
+	buf_free(b->pending);
+	buf_free(b->sealed);
+	map_free(&b->defs);
+	xfree(b->addressed);
+	xfree(b->locals);
+}
+
+IrFn* ir_build_fn(Symbol* sym) {
+	IrFn* fn = ir_fn_new(sym);
+	IrBuilder b;
+	Type* t = sym->type;
+	ir_builder_init(&b, fn, t->fn.ret, sym->cold->frame_slots);
+	ir_scan_block(&b, &sym->decl->fn.body);
+	for(isize i = 0; i < t->fn.args_len; i++) {
+		Type* pt = t->fn.args[i];
+		bool aggregate = ir_is_aggregate(pt);
+		IrRef v = ir_op_imm(&b, IR_PARAM, aggregate ? IR_I64 : ir_type(pt), -1, -1, fn->params_len++);
+		b.locals[i] = (IrLocal){ pt, aggregate ? v : -1 };
+		if(!aggregate && b.addressed[i]) {
+			b.locals[i].addr = ir_temp(&b, pt);
+			ir_store(&b, ir_mem(b.locals[i].addr, pt), v);
+		} else if(!aggregate) {
+			ir_write_var(&b, (i32)i, b.block, v);
+		}
+	}
+	b.next_slot = (i32)t->fn.args_len;
+	ir_block_stmts(&b, &sym->decl->fn.body);
+	ir_builder_finish(&b);
+	return fn;
+}
+
+// The package initializer stores the initial value of every let, in
+// declaration order.
+IrFn* ir_build_init(Symbol** lets) {
+	IrFn* fn = ir_fn_new(NULL);
+	IrBuilder b;
+	ir_builder_init(&b, fn, primitive_void, 0);
+	for(isize i = 0; i < buf_len(lets); i++) {
+		Symbol* sym = lets[i];
+		AstExpr* value = sym->decl->let.value;
+		if(!value)
+			continue;
+		if(!sym->type)
+			ir_error(sym->decl->loc, "cannot tell the type of '%s'", sym->name);
+		ir_scan_expr(&b, value);
+		IrRef addr = ir_op(&b, IR_GLOBAL, IR_I64, -1, -1);
+		fn->instrs[addr].sym = sym;
+		ir_store(&b, ir_mem(addr, sym->type), ir_value(&b, value, sym->type));
+	}
+	ir_builder_finish(&b);
+	return fn;
+}
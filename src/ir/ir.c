@@ -0,0 +1,430 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// SSA intermediate representation of fn bodies, the middle end between
+// the resolved package and the backends that do not go through C.
+// A fn is an array of instructions and an array of basic blocks. An
+// instruction is its own result: operands are indices in IrFn.instrs
+// (IrRef). A block lists its instructions in order, phis first and the
+// terminator (jump, branch or ret) last, and the targets of the terminator
+// are its successors. Phis and calls keep their operands in IrFn.args; a
+// phi has one operand per predecessor, in the order of IrBlock.preds.
+// Everything a fn owns comes from its arena and is freed at once; once
+// optimized (opt.c) a fn is compacted so that its blocks are in reverse
+// postorder and their instructions contiguous, in the order they run.
+// Values are integers of 8 to 64 bits, f32 and f64. Bools are 0 or 1 in a
+// byte and pointers 64 bit integers; whether an integer is signed is a
+// property of the operations (div and udiv, lt and ult, ...), as in the
+// machine. Aggregates (arrays, tuples, slices, structs and enums) live in
+// memory and are handled by address: a fn gets a pointer to a copy of an
+// aggregate argument, which it owns, and returns an aggregate through a
+// pointer to the result that the caller passes as an extra first
+// argument.
+
+typedef enum IrOp {
+	IR_NOP,
+	// values
+	IR_CONST,        // imm, or f for floats
+	IR_PARAM,        // argument imm
+	IR_SLOT,         // address of frame slot imm
+	IR_GLOBAL,       // address of the package let sym
+	IR_FN,           // address of the fn sym
+	IR_STRING,       // address of string literal imm (IrFn.strings)
+	IR_COPY,         // x, only while building
+	IR_PHI,
+	// arithmetic, on floats too except for rem and the bitwise ops
+	IR_ADD,
+	IR_SUB,
+	IR_MUL,
+	IR_DIV,
+	IR_UDIV,
+	IR_REM,
+	IR_UREM,
+	IR_AND,
+	IR_OR,
+	IR_XOR,
+	IR_SHL,
+	IR_SHR,          // logical
+	IR_SAR,          // arithmetic
+	IR_NEG,
+	// comparisons, the operands are floats or signed unless stated, the
+	// result is a bool
+	IR_EQ,
+	IR_NE,
+	IR_LT,
+	IR_LE,
+	IR_GT,
+	IR_GE,
+	IR_ULT,
+	IR_ULE,
+	IR_UGT,
+	IR_UGE,
+	// conversions from the type of x
+	IR_TRUNC,
+	IR_SEXT,
+	IR_ZEXT,
+	IR_ITOF,
+	IR_UTOF,
+	IR_FTOI,
+	IR_FTOU,
+	IR_FEXT,
+	IR_FTRUNC,
+	// memory and calls
+	IR_LOAD,         // from x
+	IR_STORE,        // y to x, type is the type of y
+	IR_MEMCPY,       // imm bytes from y to x
+	IR_MEMZERO,      // imm bytes at x
+	IR_CALL,         // x(args), the result is void or a scalar
+	// terminators
+	IR_JUMP,         // to succ[0]
+	IR_BRANCH,       // to succ[0] if x is not zero, else to succ[1]
+	IR_RET,          // x, or -1 for void fns
+	IR_OP_MAX
+} IrOp;
+
+const char* ir_op_names[] = {
+	[IR_NOP] = "nop",
+	[IR_CONST] = "const",
+	[IR_PARAM] = "param",
+	[IR_SLOT] = "slot",
+	[IR_GLOBAL] = "global",
+	[IR_FN] = "fn",
+	[IR_STRING] = "string",
+	[IR_COPY] = "copy",
+	[IR_PHI] = "phi",
+	[IR_ADD] = "add",
+	[IR_SUB] = "sub",
+	[IR_MUL] = "mul",
+	[IR_DIV] = "div",
+	[IR_UDIV] = "udiv",
+	[IR_REM] = "rem",
+	[IR_UREM] = "urem",
+	[IR_AND] = "and",
+	[IR_OR] = "or",
+	[IR_XOR] = "xor",
+	[IR_SHL] = "shl",
+	[IR_SHR] = "shr",
+	[IR_SAR] = "sar",
+	[IR_NEG] = "neg",
+	[IR_EQ] = "eq",
+	[IR_NE] = "ne",
+	[IR_LT] = "lt",
+	[IR_LE] = "le",
+	[IR_GT] = "gt",
+	[IR_GE] = "ge",
+	[IR_ULT] = "ult",
+	[IR_ULE] = "ule",
+	[IR_UGT] = "ugt",
+	[IR_UGE] = "uge",
+	[IR_TRUNC] = "trunc",
+	[IR_SEXT] = "sext",
+	[IR_ZEXT] = "zext",
+	[IR_ITOF] = "itof",
+	[IR_UTOF] = "utof",
+	[IR_FTOI] = "ftoi",
+	[IR_FTOU] = "ftou",
+	[IR_FEXT] = "fext",
+	[IR_FTRUNC] = "ftrunc",
+	[IR_LOAD] = "load",
+	[IR_STORE] = "store",
+	[IR_MEMCPY] = "memcpy",
+	[IR_MEMZERO] = "memzero",
+	[IR_CALL] = "call",
+	[IR_JUMP] = "jump",
+	[IR_BRANCH] = "branch",
+	[IR_RET] = "ret",
+};
+
+typedef enum IrType {
+	IR_VOID,
+	IR_I8,
+	IR_I16,
+	IR_I32,
+	IR_I64,
+	IR_F32,
+	IR_F64,
+} IrType;
+
+const char* ir_type_names[] = {
+	[IR_VOID] = "void",
+	[IR_I8] = "i8",
+	[IR_I16] = "i16",
+	[IR_I32] = "i32",
+	[IR_I64] = "i64",
+	[IR_F32] = "f32",
+	[IR_F64] = "f64",
+};
+
+typedef i32 IrRef;
+
+typedef struct IrInstr {
+	u8 op;            // IrOp
+	u8 type;          // IrType of the result
+	i32 block;        // block holding the instruction
+	IrRef x, y;       // operands, -1 when absent
+	union {
+		i64 imm;
+		double f;
+		Symbol* sym;
+		struct {
+			i32 start;
+			i32 len;
+		} args;       // IR_PHI, IR_CALL: operands in IrFn.args
+	};
+} IrInstr;
+
+typedef struct IrBlock {
+	IrRef* code;      // phis first, the terminator last
+	i32* preds;
+	i32 succ[2];      // targets of the terminator, -1 when there are fewer
+	i32 idom;         // immediate dominator, set by ir_dominators
+	i32 rpo;          // index in reverse postorder, -1 for unreachable blocks
+} IrBlock;
+
+typedef struct IrSlot {
+	isize size;
+	isize align;
+} IrSlot;
+
+typedef struct IrFn {
+	Symbol* sym;      // NULL for the package initializer
+	MemoryPool pool;
+	IrInstr* instrs;
+	IrRef* args;      // operands of phis and calls
+	IrBlock* blocks;  // blocks[0] is the entry
+	IrSlot* slots;    // frame slots, for locals kept in memory and temporaries
+	char** strings;   // string literals, decoded and NUL terminated
+	i32 params_len;   // the result pointer included
+	bool ret_ptr;     // parameter 0 points to the aggregate result
+	IrType ret;
+} IrFn;
+
+typedef struct IrPackage {
+	Package* pkg;
+	IrFn** fns;       // in declaration order, then the package initializer
+	Symbol** globals; // package lets, in declaration order
+	isize instrs;     // after optimization
+	isize instrs_built;
+} IrPackage;
+
+// print the optimized IR of every fn (--dump-ir)
+bool ir_dump;
+
+#define ir_error(loc, fmt, ...) (print_error_pos(loc, "ir error: " fmt, ##__VA_ARGS__), resolve_abort())
+
+IrType ir_type(Type* t) {
+	switch(t->kind) {
+		case TYPE_VOID:
+			return IR_VOID;
+		case TYPE_BOOLEAN:
+			return IR_I8;
+		case TYPE_SIGNED:
+		case TYPE_UNSIGNED:
+			return t->size == 1 ? IR_I8 : t->size == 2 ? IR_I16 : t->size == 4 ? IR_I32 : IR_I64;
+		case TYPE_FLOAT:
+			return t->size == 4 ? IR_F32 : IR_F64;
+		case TYPE_TUPLE:
+			// () is void
+			return t->tuple.args_len == 0 ? IR_VOID : IR_I64;
+		default:
+			return IR_I64;
+	}
+}
+
+bool ir_is_float(IrType t) {
+	return t == IR_F32 || t == IR_F64;
+}
+
+isize ir_type_bits(IrType t) {
+	static const isize bits[] = { 0, 8, 16, 32, 64, 32, 64 };
+	return bits[t];
+}
+
+// Integer constants are kept sign extended from their width, so equal
+// values have equal bits whatever their signedness.
+i64 ir_sext(i64 x, IrType t) {
+	isize bits = ir_type_bits(t);
+	if(bits == 0 || bits >= 64)
+		return x;
+	return (i64)((u64)x << (64 - bits)) >> (64 - bits);
+}
+
+u64 ir_zext(i64 x, IrType t) {
+	isize bits = ir_type_bits(t);
+	if(bits == 0 || bits >= 64)
+		return (u64)x;
+	return (u64)x & (((u64)1 << bits) - 1);
+}
+
+bool ir_is_terminator(IrOp op) {
+	return op == IR_JUMP || op == IR_BRANCH || op == IR_RET;
+}
+
+// Whether the instruction only computes its result from its operands: it
+// can be removed when unused, merged with an equal one and moved.
+bool ir_is_pure(IrOp op) {
+	return (op >= IR_CONST && op <= IR_STRING) || (op >= IR_ADD && op <= IR_FTRUNC);
+}
+
+bool ir_is_commutative(IrOp op) {
+	return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_XOR ||
+		op == IR_EQ || op == IR_NE;
+}
+
+// whether the instruction may trap for some operands (division by zero)
+bool ir_may_trap(IrFn* fn, IrInstr* in) {
+	if(in->op < IR_DIV || in->op > IR_UREM || ir_is_float(in->type))
+		return false;
+	IrInstr* y = &fn->instrs[in->y];
+	// INT_MIN / -1 overflows
+	return y->op != IR_CONST || y->imm == 0 || y->imm == -1;
+}
+
+bool ir_is_aggregate(Type* t) {
+	return t->kind == TYPE_ARRAY || t->kind == TYPE_SLICE || (t->kind == TYPE_TUPLE && t->tuple.args_len > 0) ||
+		t->kind == TYPE_STRUCT || t->kind == TYPE_ENUM;
+}
+
+bool ir_is_signed(Type* t) {
+	return t->kind == TYPE_SIGNED;
+}
+
+IrFn* ir_fn_new(Symbol* sym) {
+	IrFn* fn = xcalloc(1, sizeof(IrFn));
+	fn->sym = sym;
+	fn->pool.tag = MEM_IR;
+	buf_arena(fn->instrs, &fn->pool, 64);
+	buf_arena(fn->args, &fn->pool, 16);
+	buf_arena(fn->blocks, &fn->pool, 8);
+	return fn;
+}
+
+void ir_fn_free(IrFn* fn) {
+	for(isize i = 0; i < buf_len(fn->strings); i++) {
+		buf_free(fn->strings[i]);
+	}
+	buf_free(fn->strings);
+	buf_free(fn->slots);
+	mpool_free(&fn->pool);
+	xfree(fn);
+}
+
+i32 ir_block_new(IrFn* fn) {
+	IrBlock b = { .succ = { -1, -1 }, .idom = -1, .rpo = -1 };
+	buf_arena(b.code, &fn->pool, 0);
+	buf_arena(b.preds, &fn->pool, 0);
+	buf_push(fn->blocks, b);
+	return (i32)buf_len(fn->blocks) - 1;
+}
+
+IrRef ir_instr_new(IrFn* fn, i32 block, IrOp op, IrType type, IrRef x, IrRef y) {
+	buf_push(fn->instrs, (IrInstr){ .op = op, .type = type, .block = block, .x = x, .y = y });
+	return (IrRef)buf_len(fn->instrs) - 1;
+}
+
+// appends a new instruction to block
+IrRef ir_emit(IrFn* fn, i32 block, IrOp op, IrType type, IrRef x, IrRef y) {
+	IrRef ref = ir_instr_new(fn, block, op, type, x, y);
+	buf_push(fn->blocks[block].code, ref);
+	return ref;
+}
+
+// inserts ref at position i of the code of block
+void ir_insert(IrFn* fn, i32 block, isize i, IrRef ref) {
+	IrBlock* b = &fn->blocks[block];
+	buf_push(b->code, 0);
+	memmove(b->code + i + 1, b->code + i, (buf_len(b->code) - 1 - i) * sizeof(IrRef));
+	b->code[i] = ref;
+	fn->instrs[ref].block = block;
+}
+
+isize ir_phis_len(IrFn* fn, i32 block) {
+	IrBlock* b = &fn->blocks[block];
+	isize i = 0;
+	while(i < buf_len(b->code) && fn->instrs[b->code[i]].op == IR_PHI) {
+		i++;
+	}
+	return i;
+}
+
+IrInstr* ir_terminator(IrFn* fn, i32 block) {
+	IrBlock* b = &fn->blocks[block];
+	if(buf_len(b->code) == 0)
+		return NULL;
+	IrInstr* in = &fn->instrs[b->code[buf_len(b->code) - 1]];
+	return ir_is_terminator(in->op) ? in : NULL;
+}
+
+// index of pred in the predecessors of block, the operand of its phis
+isize ir_pred_index(IrFn* fn, i32 block, i32 pred) {
+	IrBlock* b = &fn->blocks[block];
+	for(isize i = 0; i < buf_len(b->preds); i++) {
+		if(b->preds[i] == pred)
+			return i;
+	}
+	return -1;
+}
+
+// removes predecessor i of block, with the matching operand of its phis
+void ir_remove_pred(IrFn* fn, i32 block, isize i) {
+	IrBlock* b = &fn->blocks[block];
+	isize len = buf_len(b->preds);
+	memmove(b->preds + i, b->preds + i + 1, (len - 1 - i) * sizeof(i32));
+	buf_truncate(b->preds, len - 1);
+	isize phis = ir_phis_len(fn, block);
+	for(isize k = 0; k < phis; k++) {
+		IrInstr* phi = &fn->instrs[b->code[k]];
+		IrRef* args = fn->args + phi->args.start;
+		memmove(args + i, args + i + 1, (phi->args.len - 1 - i) * sizeof(IrRef));
+		phi->args.len--;
+	}
+}
+
+#include "build.c"
+#include "opt.c"
+#include "print.c"
+#include "live.c"
+
+void ir_optimize_task(void* ctx, isize worker, isize task) {
+	IrPackage* ir = ctx;
+	MemTag old_tag = mem_tag_set(MEM_IR);
+	ir_optimize(ir->fns[task]);
+	mem_tag_set(old_tag);
+}
+
+// Builds the IR of every fn of the package, and of its initializer, and
+// optimizes it. Building is serial and in declaration order, so the first
+// error reported is always the same; fns are then optimized on
+// resolver_jobs threads.
+// Types must be set (typing_package) and laid out (layout_package).
+void ir_package(Package* pkg, IrPackage* ir) {
+	*ir = (IrPackage){ .pkg = pkg };
+	MemTag old_tag = mem_tag_set(MEM_IR);
+	for(isize i = 0; i < buf_len(pkg->symbol_order); i++) {
+		SymbolOrder o = pkg->symbol_order[i];
+		Symbol* sym = o.is_decl ? resolver_resolve_name(pkg, (FileLoc){ pkg->path }, o.name, false) : NULL;
+		if(!sym || sym->state != SYMSTATE_RESOLVED)
+			continue;
+		if(sym->kind == SYMBOL_FN && !sym->decl->fn.is_extern)
+			buf_push(ir->fns, ir_build_fn(sym));
+		else if(sym->kind == SYMBOL_LET)
+			buf_push(ir->globals, sym);
+	}
+	buf_push(ir->fns, ir_build_init(ir->globals));
+	for(isize i = 0; i < buf_len(ir->fns); i++) {
+		ir->instrs_built += buf_len(ir->fns[i]->instrs);
+	}
+	jobs_run(resolver_jobs, buf_len(ir->fns), ir_optimize_task, ir);
+	for(isize i = 0; i < buf_len(ir->fns); i++) {
+		ir->instrs += buf_len(ir->fns[i]->instrs);
+	}
+	mem_tag_set(old_tag);
+}
+
+void ir_package_free(IrPackage* ir) {
+	for(isize i = 0; i < buf_len(ir->fns); i++) {
+		ir_fn_free(ir->fns[i]);
+	}
+	buf_free(ir->fns);
+	buf_free(ir->globals);
+}
@@ -0,0 +1,168 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Live intervals over the compacted IR of a fn, whose instructions are
+// numbered in the order they run, for the register allocators of the
+// backends. Every value gets one interval: the smallest range of
+// positions covering the blocks it is live in, found by walking back from
+// each use to the definition. A phi is defined at the start of its block
+// and written at the end of every predecessor, so its interval covers
+// those too, and the operands of a phi are used at the end of the
+// matching predecessor. Params arrive on entry, before any instruction
+// runs, so their intervals start at 0.
+
+typedef struct IrInterval {
+	i32 start, end;
+	bool across_call;   // a call is strictly inside
+} IrInterval;
+
+// whether the instruction has a result
+bool ir_has_value(IrInstr* in) {
+	return in->type != IR_VOID && in->op != IR_STORE && in->op != IR_NOP;
+}
+
+void ir_extend(IrInterval* iv, i32 pos) {
+	iv->start = MIN(iv->start, pos);
+	iv->end = MAX(iv->end, pos);
+}
+
+typedef struct IrLive {
+	IrFn* fn;
+	IrInterval* iv;
+	i32* block_start;
+	i32* block_end;
+	i32* stamp;       // per block, the value + 1 whose walk visited it
+	i32* stack;
+} IrLive;
+
+// marks v live from its definition to a use in block at pos
+void ir_live_use(IrLive* l, IrRef v, i32 block, i32 pos) {
+	IrInterval* iv = &l->iv[v];
+	ir_extend(iv, pos);
+	i32 def = l->fn->instrs[v].block;
+	if(block == def)
+		return;
+	buf_clear(l->stack);
+	buf_push(l->stack, block);
+	while(buf_len(l->stack) > 0) {
+		i32 b = l->stack[buf_len(l->stack) - 1];
+		buf_truncate(l->stack, buf_len(l->stack) - 1);
+		if(l->stamp[b] == v + 1)
+			continue;
+		l->stamp[b] = v + 1;
+		// live in at b, so live out at its predecessors
+		ir_extend(iv, l->block_start[b]);
+		IrBlock* bb = &l->fn->blocks[b];
+		for(isize k = 0; k < buf_len(bb->preds); k++) {
+			i32 p = bb->preds[k];
+			ir_extend(iv, l->block_end[p]);
+			if(p != def && l->stamp[p] != v + 1)
+				buf_push(l->stack, p);
+		}
+	}
+}
+
+// Computes the interval of every value, and the first and last position
+// of every block. Uses are walked value by value, so that a block is
+// visited at most once per value.
+void ir_intervals(IrFn* fn, IrInterval* iv, i32* block_start, i32* block_end) {
+	isize n = buf_len(fn->instrs);
+	isize nblocks = buf_len(fn->blocks);
+	for(isize b = 0; b < nblocks; b++) {
+		IrBlock* bb = &fn->blocks[b];
+		block_start[b] = bb->code[0];
+		block_end[b] = bb->code[buf_len(bb->code) - 1];
+	}
+	// uses as (block, position) pairs grouped by value
+	i32* count = xcalloc(n + 1, sizeof(i32));
+	for(IrRef r = 0; r < n; r++) {
+		IrInstr* in = &fn->instrs[r];
+		if(in->x >= 0) count[in->x]++;
+		if(in->y >= 0) count[in->y]++;
+		if(in->op == IR_PHI || in->op == IR_CALL) {
+			for(isize k = 0; k < in->args.len; k++) {
+				count[fn->args[in->args.start + k]]++;
+			}
+		}
+	}
+	i32* first = xmalloc((n + 1) * sizeof(i32));
+	first[0] = 0;
+	for(isize v = 0; v < n; v++) {
+		first[v + 1] = first[v] + count[v];
+		count[v] = first[v];
+	}
+	i32* use_block = xmalloc(MAX(first[n], 1) * sizeof(i32));
+	i32* use_pos = xmalloc(MAX(first[n], 1) * sizeof(i32));
+#define IR_USE(v, b, p) (use_block[count[v]] = (b), use_pos[count[v]++] = (p))
+	for(IrRef r = 0; r < n; r++) {
+		IrInstr* in = &fn->instrs[r];
+		if(in->x >= 0) IR_USE(in->x, in->block, r);
+		if(in->y >= 0) IR_USE(in->y, in->block, r);
+		if(in->op == IR_CALL) {
+			for(isize k = 0; k < in->args.len; k++) {
+				IR_USE(fn->args[in->args.start + k], in->block, r);
+			}
+		} else if(in->op == IR_PHI) {
+			IrBlock* b = &fn->blocks[in->block];
+			for(isize k = 0; k < in->args.len; k++) {
+				IR_USE(fn->args[in->args.start + k], b->preds[k], block_end[b->preds[k]]);
+			}
+		}
+	}
+#undef IR_USE
+
+	IrLive l = { fn, iv, block_start, block_end, xcalloc(nblocks, sizeof(i32)) };
+	for(IrRef v = 0; v < n; v++) {
+		IrInstr* in = &fn->instrs[v];
+		i32 def = in->op == IR_PHI ? block_start[in->block] : v;
+		iv[v] = (IrInterval){ def, def };
+		if(in->op == IR_PARAM) {
+			iv[v].start = 0;
+		} else if(in->op == IR_PHI) {
+			IrBlock* b = &fn->blocks[in->block];
+			for(isize k = 0; k < buf_len(b->preds); k++) {
+				ir_extend(&iv[v], block_end[b->preds[k]]);
+			}
+		}
+		for(i32 u = first[v]; u < first[v + 1]; u++) {
+			ir_live_use(&l, v, use_block[u], use_pos[u]);
+		}
+	}
+
+	// calls strictly inside an interval clobber the caller-saved registers
+	i32* calls = count;
+	calls[0] = 0;
+	for(IrRef r = 0; r < n; r++) {
+		calls[r + 1] = calls[r] + (fn->instrs[r].op == IR_CALL);
+	}
+	for(IrRef v = 0; v < n; v++) {
+		iv[v].across_call = iv[v].end > iv[v].start + 1 && calls[iv[v].end] - calls[iv[v].start + 1] > 0;
+	}
+
+	buf_free(l.stack);
+	xfree(l.stamp);
+	xfree(use_pos);
+	xfree(use_block);
+	xfree(first);
+	xfree(count);
+}
+
+// sorts the values in order by the start of their interval, stable
+void ir_sort_intervals(IrRef* order, IrInterval* iv) {
+	// merge sort
+	isize n = buf_len(order);
+	IrRef* tmp = xmalloc(MAX(n, 1) * sizeof(IrRef));
+	for(isize width = 1; width < n; width *= 2) {
+		for(isize lo = 0; lo < n; lo += 2 * width) {
+			isize mid = MIN(lo + width, n), hi = MIN(lo + 2 * width, n);
+			isize i = lo, j = mid, k = lo;
+			while(i < mid && j < hi) {
+				tmp[k++] = iv[order[j]].start < iv[order[i]].start ? order[j++] : order[i++];
+			}
+			while(i < mid) tmp[k++] = order[i++];
+			while(j < hi) tmp[k++] = order[j++];
+		}
+		memcpy(order, tmp, n * sizeof(IrRef));
+	}
+	xfree(tmp);
+}
@@ -0,0 +1,850 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Optimization of one fn. The passes are, in order:
+//   copy propagation: phis whose operands are all the same value (or the
+//     phi itself) are replaced by that value;
+//   sparse conditional constant propagation (Wegman and Zadeck): values are
+//     evaluated assuming only the blocks found reachable so far run, which
+//     finds constants through loops and removes branches on constants;
+//   removal of unreachable blocks, and merging of blocks into the only
+//     block jumping to them;
+//   loop-invariant code motion: pure instructions whose operands are
+//     computed outside a loop are moved to the block before it;
+//   common subexpression elimination: a pure instruction equal to one in a
+//     dominating block is replaced by it;
+//   dead code elimination: only what stores, calls and terminators use is
+//     kept;
+//   compaction.
+// Instructions are removed by turning them into nops, which ir_sweep takes
+// out of the blocks; their uses are first redirected through a replacement
+// array (repl) by ir_rewrite.
+// A fn is only read and written by the thread optimizing it.
+
+// the value r stands for, following replacements
+IrRef ir_find(IrRef* repl, IrRef r) {
+	if(r < 0)
+		return r;
+	IrRef root = r;
+	while(repl[root] != root) {
+		root = repl[root];
+	}
+	while(repl[r] != root) {
+		IrRef next = repl[r];
+		repl[r] = root;
+		r = next;
+	}
+	return root;
+}
+
+IrRef* ir_repl_new(IrFn* fn) {
+	isize len = buf_len(fn->instrs);
+	IrRef* repl = xmalloc(MAX(len, 1) * sizeof(IrRef));
+	for(isize i = 0; i < len; i++) {
+		repl[i] = (IrRef)i;
+	}
+	return repl;
+}
+
+// redirects every operand to its replacement
+void ir_rewrite(IrFn* fn, IrRef* repl) {
+	for(isize i = 0; i < buf_len(fn->instrs); i++) {
+		IrInstr* in = &fn->instrs[i];
+		in->x = ir_find(repl, in->x);
+		in->y = ir_find(repl, in->y);
+		if(in->op == IR_PHI || in->op == IR_CALL) {
+			for(isize k = 0; k < in->args.len; k++) {
+				IrRef* arg = &fn->args[in->args.start + k];
+				*arg = ir_find(repl, *arg);
+			}
+		}
+	}
+}
+
+// removes the nops from the blocks
+void ir_sweep(IrFn* fn) {
+	for(isize b = 0; b < buf_len(fn->blocks); b++) {
+		IrBlock* block = &fn->blocks[b];
+		isize len = 0;
+		for(isize i = 0; i < buf_len(block->code); i++) {
+			if(fn->instrs[block->code[i]].op != IR_NOP)
+				block->code[len++] = block->code[i];
+		}
+		buf_truncate(block->code, len);
+	}
+}
+
+// Numbers the blocks reachable from the entry in reverse postorder and
+// returns them in that order, len of them.
+i32* ir_rpo(IrFn* fn, isize* len) {
+	isize blocks = buf_len(fn->blocks);
+	i32* order = xmalloc(blocks * sizeof(i32));
+	i32* stack = xmalloc(blocks * sizeof(i32));
+	u8* next = xcalloc(blocks, 1);  // successor to visit next
+	u8* seen = xcalloc(blocks, 1);
+	isize sp = 0, post = blocks;
+	stack[sp++] = 0;
+	seen[0] = true;
+	while(sp > 0) {
+		i32 b = stack[sp - 1];
+		if(next[b] < 2) {
+			i32 s = fn->blocks[b].succ[next[b]++];
+			if(s >= 0 && !seen[s]) {
+				seen[s] = true;
+				stack[sp++] = s;
+			}
+			continue;
+		}
+		order[--post] = b;
+		sp--;
+	}
+	*len = blocks - post;
+	memmove(order, order + post, *len * sizeof(i32));
+	for(isize b = 0; b < blocks; b++) {
+		fn->blocks[b].rpo = -1;
+	}
+	for(isize i = 0; i < *len; i++) {
+		fn->blocks[order[i]].rpo = (i32)i;
+	}
+	xfree(stack);
+	xfree(next);
+	xfree(seen);
+	return order;
+}
+
+// Immediate dominators of the blocks in order, as in Cooper, Harvey and
+// Kennedy, "A Simple, Fast Dominance Algorithm".
+void ir_dominators(IrFn* fn, i32* order, isize len) {
+	IrBlock* blocks = fn->blocks;
+	for(isize b = 0; b < buf_len(blocks); b++) {
+		blocks[b].idom = -1;
+	}
+	blocks[0].idom = 0;
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		for(isize i = 1; i < len; i++) {
+			IrBlock* b = &blocks[order[i]];
+			i32 idom = -1;
+			for(isize k = 0; k < buf_len(b->preds); k++) {
+				i32 p = b->preds[k];
+				if(blocks[p].idom < 0)
+					continue;
+				if(idom < 0) {
+					idom = p;
+					continue;
+				}
+				i32 x = p;
+				while(x != idom) {
+					while(blocks[x].rpo > blocks[idom].rpo) {
+						x = blocks[x].idom;
+					}
+					while(blocks[idom].rpo > blocks[x].rpo) {
+						idom = blocks[idom].idom;
+					}
+				}
+			}
+			if(b->idom != idom) {
+				b->idom = idom;
+				changed = true;
+			}
+		}
+	}
+}
+
+bool ir_dominates(IrFn* fn, i32 a, i32 b) {
+	while(fn->blocks[b].rpo > fn->blocks[a].rpo) {
+		b = fn->blocks[b].idom;
+	}
+	return a == b;
+}
+
+// Replaces phis with a single distinct operand, until there are none:
+// removing one can make another trivial.
+void ir_copyprop(IrFn* fn) {
+	IrRef* repl = ir_repl_new(fn);
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		for(isize i = 0; i < buf_len(fn->instrs); i++) {
+			IrInstr* in = &fn->instrs[i];
+			if(in->op == IR_COPY) {
+				repl[i] = ir_find(repl, in->x);
+				in->op = IR_NOP;
+				changed = true;
+			}
+			if(in->op != IR_PHI)
+				continue;
+			IrRef same = -1;
+			bool trivial = true;
+			for(isize k = 0; k < in->args.len && trivial; k++) {
+				IrRef arg = ir_find(repl, fn->args[in->args.start + k]);
+				if(arg == i || arg == same)
+					continue;
+				trivial = same < 0;
+				same = arg;
+			}
+			// a phi without operands only runs in unreachable code
+			if(trivial && same >= 0) {
+				repl[i] = same;
+				in->op = IR_NOP;
+				changed = true;
+			}
+		}
+	}
+	ir_rewrite(fn, repl);
+	ir_sweep(fn);
+	xfree(repl);
+}
+
+typedef enum IrLattice {
+	IR_UNDEF,         // no value seen yet
+	IR_KNOWN,         // always the same constant
+	IR_VARYING,
+} IrLattice;
+
+typedef struct IrSccp {
+	IrFn* fn;
+	u8* lattice;      // by instruction
+	IrInstr* value;   // by instruction, the constant when IR_KNOWN
+	u8* reached;      // by block
+	u8* taken;        // by block * 2 + successor, the edge was found to run
+	i32* use_start;   // users of instruction i are uses[use_start[i]..use_start[i + 1]]
+	IrRef* uses;
+	i32* blocks;      // worklist
+	IrRef* instrs;    // worklist
+} IrSccp;
+
+void ir_sccp_uses(IrSccp* s) {
+	IrFn* fn = s->fn;
+	isize len = buf_len(fn->instrs);
+	s->use_start = xcalloc(len + 1, sizeof(i32));
+	for(int pass = 0; pass < 2; pass++) {
+		for(isize i = 0; i < len; i++) {
+			IrInstr* in = &fn->instrs[i];
+			IrRef ops[2] = { in->x, in->y };
+			isize nargs = in->op == IR_PHI || in->op == IR_CALL ? in->args.len : 0;
+			for(isize k = 0; k < 2 + nargs; k++) {
+				IrRef op = k < 2 ? ops[k] : fn->args[in->args.start + k - 2];
+				if(op < 0)
+					continue;
+				if(pass == 0)
+					s->use_start[op + 1]++;
+				else
+					s->uses[s->use_start[op]++] = (IrRef)i;
+			}
+		}
+		if(pass == 0) {
+			for(isize i = 0; i < len; i++) {
+				s->use_start[i + 1] += s->use_start[i];
+			}
+			s->uses = xmalloc(MAX(s->use_start[len], 1) * sizeof(IrRef));
+		} else {
+			// the fill moved every start to the next one
+			memmove(s->use_start + 1, s->use_start, len * sizeof(i32));
+			s->use_start[0] = 0;
+		}
+	}
+}
+
+void ir_sccp_take(IrSccp* s, i32 block, isize k) {
+	i32 to = s->fn->blocks[block].succ[k];
+	if(to < 0 || s->taken[block * 2 + k])
+		return;
+	s->taken[block * 2 + k] = true;
+	if(!s->reached[to]) {
+		s->reached[to] = true;
+		buf_push(s->blocks, to);
+		return;
+	}
+	// the phis of to have one more operand to look at
+	isize phis = ir_phis_len(s->fn, to);
+	for(isize i = 0; i < phis; i++) {
+		buf_push(s->instrs, s->fn->blocks[to].code[i]);
+	}
+}
+
+// whether the edge from pred to block was found to run
+bool ir_sccp_edge(IrSccp* s, i32 pred, i32 block) {
+	IrBlock* p = &s->fn->blocks[pred];
+	return (p->succ[0] == block && s->taken[pred * 2]) || (p->succ[1] == block && s->taken[pred * 2 + 1]);
+}
+
+// Folds in applied to the constants x and y into out. Fails for operations
+// that trap or are not defined on these operands, which are left to run.
+bool ir_fold(IrInstr* in, IrInstr* x, IrInstr* y, IrInstr* out) {
+	IrType t = in->type;
+	*out = (IrInstr){ .op = IR_CONST, .type = t, .block = in->block, .x = -1, .y = -1 };
+	// comparisons and conversions look at the type of the operand
+	IrType xt = x->type;
+	if(ir_is_float(xt) && in->op >= IR_ADD && in->op <= IR_UGE) {
+		double a = x->f, b = y ? y->f : 0, r;
+		switch(in->op) {
+			case IR_ADD: r = a + b; break;
+			case IR_SUB: r = a - b; break;
+			case IR_MUL: r = a * b; break;
+			case IR_DIV: r = a / b; break;
+			case IR_NEG: r = -a; break;
+			case IR_EQ: out->imm = a == b; return true;
+			case IR_NE: out->imm = a != b; return true;
+			case IR_LT: out->imm = a < b; return true;
+			case IR_LE: out->imm = a <= b; return true;
+			case IR_GT: out->imm = a > b; return true;
+			case IR_GE: out->imm = a >= b; return true;
+			default: return false;
+		}
+		out->f = t == IR_F32 ? (float)r : r;
+		return true;
+	}
+	i64 a = x->imm, b = y ? y->imm : 0;
+	u64 ua = ir_zext(a, xt), ub = y ? ir_zext(b, y->type) : 0;
+	i64 r;
+	switch(in->op) {
+		case IR_ADD: r = (i64)((u64)a + (u64)b); break;
+		case IR_SUB: r = (i64)((u64)a - (u64)b); break;
+		case IR_MUL: r = (i64)((u64)a * (u64)b); break;
+		case IR_DIV:
+		case IR_REM:
+			if(b == 0 || b == -1)
+				return false;
+			r = in->op == IR_DIV ? a / b : a % b;
+			break;
+		case IR_UDIV:
+		case IR_UREM:
+			if(ub == 0)
+				return false;
+			r = (i64)(in->op == IR_UDIV ? ua / ub : ua % ub);
+			break;
+		case IR_AND: r = a & b; break;
+		case IR_OR: r = a | b; break;
+		case IR_XOR: r = a ^ b; break;
+		case IR_SHL:
+		case IR_SHR:
+		case IR_SAR:
+			if(ub >= (u64)ir_type_bits(t))
+				return false;
+			r = in->op == IR_SHL ? (i64)(ua << ub) : in->op == IR_SHR ? (i64)(ua >> ub) : a >> ub;
+			break;
+		case IR_NEG: r = (i64)(0 - (u64)a); break;
+		case IR_EQ: r = a == b; break;
+		case IR_NE: r = a != b; break;
+		case IR_LT: r = a < b; break;
+		case IR_LE: r = a <= b; break;
+		case IR_GT: r = a > b; break;
+		case IR_GE: r = a >= b; break;
+		case IR_ULT: r = ua < ub; break;
+		case IR_ULE: r = ua <= ub; break;
+		case IR_UGT: r = ua > ub; break;
+		case IR_UGE: r = ua >= ub; break;
+		case IR_TRUNC:
+		case IR_SEXT: r = a; break;
+		case IR_ZEXT: r = (i64)ua; break;
+		case IR_ITOF:
+		case IR_UTOF: {
+			double f = in->op == IR_ITOF ? (double)a : (double)ua;
+			out->f = t == IR_F32 ? (float)f : f;
+			return true;
+		}
+		case IR_FTOI:
+			// out of range conversions are undefined
+			if(!(x->f > -9223372036854775808.0 - 1 && x->f < 9223372036854775808.0))
+				return false;
+			r = (i64)x->f;
+			break;
+		case IR_FTOU:
+			if(!(x->f > -1 && x->f < 18446744073709551616.0))
+				return false;
+			r = (i64)(u64)x->f;
+			break;
+		case IR_FEXT:
+			out->f = x->f;
+			return true;
+		case IR_FTRUNC:
+			out->f = (float)x->f;
+			return true;
+		default:
+			return false;
+	}
+	out->imm = ir_sext(r, t);
+	return true;
+}
+
+void ir_sccp_visit(IrSccp* s, IrRef ref) {
+	IrFn* fn = s->fn;
+	IrInstr* in = &fn->instrs[ref];
+	if(in->op == IR_NOP || !s->reached[in->block])
+		return;
+	u8 lattice = IR_VARYING;
+	IrInstr value = {0};
+	switch(in->op) {
+		case IR_JUMP:
+			ir_sccp_take(s, in->block, 0);
+			return;
+		case IR_BRANCH: {
+			u8 cond = s->lattice[in->x];
+			if(cond == IR_KNOWN) {
+				ir_sccp_take(s, in->block, s->value[in->x].imm != 0 ? 0 : 1);
+			} else if(cond == IR_VARYING) {
+				ir_sccp_take(s, in->block, 0);
+				ir_sccp_take(s, in->block, 1);
+			}
+			return;
+		}
+		case IR_CONST:
+			lattice = IR_KNOWN;
+			value = *in;
+			break;
+		case IR_PHI: {
+			lattice = IR_UNDEF;
+			IrBlock* b = &fn->blocks[in->block];
+			for(isize k = 0; k < in->args.len && lattice != IR_VARYING; k++) {
+				IrRef arg = fn->args[in->args.start + k];
+				if(!ir_sccp_edge(s, b->preds[k], in->block) || s->lattice[arg] == IR_UNDEF)
+					continue;
+				if(s->lattice[arg] == IR_VARYING)
+					lattice = IR_VARYING;
+				else if(lattice == IR_UNDEF)
+					lattice = IR_KNOWN, value = s->value[arg];
+				else if(value.imm != s->value[arg].imm)
+					lattice = IR_VARYING;
+			}
+			break;
+		}
+		default: {
+			if(in->op < IR_ADD || in->op > IR_FTRUNC)
+				break;
+			u8 x = s->lattice[in->x];
+			u8 y = in->y >= 0 ? s->lattice[in->y] : IR_KNOWN;
+			if(x == IR_VARYING || y == IR_VARYING)
+				break;
+			if(x == IR_UNDEF || y == IR_UNDEF) {
+				lattice = IR_UNDEF;
+				break;
+			}
+			if(ir_fold(in, &s->value[in->x], in->y >= 0 ? &s->value[in->y] : NULL, &value))
+				lattice = IR_KNOWN;
+			break;
+		}
+	}
+	if(lattice == s->lattice[ref])
+		return;
+	s->lattice[ref] = lattice;
+	s->value[ref] = value;
+	for(isize i = s->use_start[ref]; i < s->use_start[ref + 1]; i++) {
+		buf_push(s->instrs, s->uses[i]);
+	}
+}
+
+void ir_sccp(IrFn* fn) {
+	isize len = buf_len(fn->instrs);
+	isize blocks = buf_len(fn->blocks);
+	IrSccp s = { fn };
+	s.lattice = xcalloc(MAX(len, 1), 1);
+	s.value = xcalloc(MAX(len, 1), sizeof(IrInstr));
+	s.reached = xcalloc(blocks, 1);
+	s.taken = xcalloc(blocks * 2, 1);
+	ir_sccp_uses(&s);
+	s.reached[0] = true;
+	buf_push(s.blocks, 0);
+	while(buf_len(s.blocks) > 0 || buf_len(s.instrs) > 0) {
+		while(buf_len(s.instrs) > 0) {
+			IrRef ref = s.instrs[buf_len(s.instrs) - 1];
+			buf_truncate(s.instrs, buf_len(s.instrs) - 1);
+			ir_sccp_visit(&s, ref);
+		}
+		if(buf_len(s.blocks) > 0) {
+			i32 b = s.blocks[buf_len(s.blocks) - 1];
+			buf_truncate(s.blocks, buf_len(s.blocks) - 1);
+			for(isize i = 0; i < buf_len(fn->blocks[b].code); i++) {
+				ir_sccp_visit(&s, fn->blocks[b].code[i]);
+			}
+		}
+	}
+	// constants replace what computes them
+	for(isize i = 0; i < len; i++) {
+		IrInstr* in = &fn->instrs[i];
+		if(s.lattice[i] != IR_KNOWN || in->op == IR_CONST)
+			continue;
+		i32 block = in->block;
+		*in = s.value[i];
+		in->block = block;
+	}
+	// branches taking one way become jumps
+	for(isize b = 0; b < blocks; b++) {
+		IrInstr* term = ir_terminator(fn, (i32)b);
+		if(!term || term->op != IR_BRANCH || s.taken[b * 2] == s.taken[b * 2 + 1])
+			continue;
+		IrBlock* block = &fn->blocks[b];
+		isize k = s.taken[b * 2] ? 0 : 1;
+		i32 to = block->succ[k], other = block->succ[1 - k];
+		term->op = IR_JUMP;
+		term->x = -1;
+		block->succ[0] = to;
+		block->succ[1] = -1;
+		if(other != to)
+			ir_remove_pred(fn, other, ir_pred_index(fn, other, (i32)b));
+	}
+	// phis turned into constants are moved after the remaining phis
+	for(isize b = 0; b < blocks; b++) {
+		IrRef* code = fn->blocks[b].code;
+		isize phis = 0;
+		for(isize i = 0; i < buf_len(code); i++) {
+			if(fn->instrs[code[i]].op != IR_PHI)
+				continue;
+			IrRef phi = code[i];
+			memmove(code + phis + 1, code + phis, (i - phis) * sizeof(IrRef));
+			code[phis++] = phi;
+		}
+	}
+	xfree(s.lattice);
+	xfree(s.value);
+	xfree(s.taken);
+	xfree(s.use_start);
+	xfree(s.uses);
+	xfree(s.reached);
+	buf_free(s.blocks);
+	buf_free(s.instrs);
+}
+
+// Empties the blocks not reachable from the entry and removes them from
+// the predecessors of the blocks they jumped to.
+void ir_remove_unreachable(IrFn* fn) {
+	isize len;
+	xfree(ir_rpo(fn, &len));
+	for(isize b = 0; b < buf_len(fn->blocks); b++) {
+		if(fn->blocks[b].rpo >= 0)
+			continue;
+		IrBlock* block = &fn->blocks[b];
+		for(isize k = 0; k < 2; k++) {
+			i32 to = block->succ[k];
+			if(to < 0 || fn->blocks[to].rpo < 0)
+				continue;
+			for(isize i = ir_pred_index(fn, to, (i32)b); i >= 0; i = ir_pred_index(fn, to, (i32)b)) {
+				ir_remove_pred(fn, to, i);
+			}
+		}
+		for(isize i = 0; i < buf_len(block->code); i++) {
+			fn->instrs[block->code[i]].op = IR_NOP;
+		}
+		buf_clear(block->code);
+		buf_clear(block->preds);
+		block->succ[0] = block->succ[1] = -1;
+	}
+}
+
+// Merges a block into the block jumping to it when it has no other
+// predecessor, which removes the empty blocks left by folded branches.
+void ir_merge_blocks(IrFn* fn) {
+	for(isize b = 0; b < buf_len(fn->blocks); b++) {
+		IrBlock* block = &fn->blocks[b];
+		IrInstr* term = ir_terminator(fn, (i32)b);
+		while(term && term->op == IR_JUMP) {
+			i32 s = block->succ[0];
+			IrBlock* next = &fn->blocks[s];
+			if(s == b || s == 0 || buf_len(next->preds) != 1)
+				break;
+			term->op = IR_NOP;
+			buf_truncate(block->code, buf_len(block->code) - 1);
+			for(isize i = 0; i < buf_len(next->code); i++) {
+				assert(fn->instrs[next->code[i]].op != IR_PHI);
+				fn->instrs[next->code[i]].block = (i32)b;
+				buf_push(block->code, next->code[i]);
+			}
+			for(isize k = 0; k < 2; k++) {
+				i32 to = next->succ[k];
+				block->succ[k] = to;
+				if(to >= 0)
+					fn->blocks[to].preds[ir_pred_index(fn, to, s)] = (i32)b;
+			}
+			buf_clear(next->code);
+			buf_clear(next->preds);
+			next->succ[0] = next->succ[1] = -1;
+			term = ir_terminator(fn, (i32)b);
+		}
+	}
+}
+
+u64 ir_hash(IrInstr* in) {
+	u64 h = map_hash_mix(map_hash_u64((u64)in->op << 8 | in->type), map_hash_u64((u64)(u32)in->x << 32 | (u32)in->y));
+	return map_hash_mix(h, map_hash_u64((u64)in->imm));
+}
+
+bool ir_same(IrInstr* a, IrInstr* b) {
+	return a->op == b->op && a->type == b->type && a->x == b->x && a->y == b->y && a->imm == b->imm;
+}
+
+// Common subexpressions, in dominator order: an instruction is replaced
+// by an equal one already seen in a block that dominates its own.
+void ir_cse(IrFn* fn, i32* order, isize len) {
+	typedef map_type(u64, isize) MapIrHash;
+	MapIrHash heads = {0};
+	IrRef* repl = ir_repl_new(fn);
+	IrRef* next = xmalloc(MAX(buf_len(fn->instrs), 1) * sizeof(IrRef));
+	for(isize i = 0; i < len; i++) {
+		IrBlock* b = &fn->blocks[order[i]];
+		for(isize k = 0; k < buf_len(b->code); k++) {
+			IrRef ref = b->code[k];
+			IrInstr* in = &fn->instrs[ref];
+			in->x = ir_find(repl, in->x);
+			in->y = ir_find(repl, in->y);
+			if(!ir_is_pure(in->op) || in->op == IR_PARAM)
+				continue;
+			if(ir_is_commutative(in->op) && in->x > in->y) {
+				IrRef x = in->x;
+				in->x = in->y;
+				in->y = x;
+			}
+			u64 h = ir_hash(in);
+			isize* head = map_lookup(&heads, h);
+			IrRef found = -1;
+			for(IrRef c = head ? (IrRef)*head : -1; c >= 0 && found < 0; c = next[c]) {
+				if(ir_same(&fn->instrs[c], in) && ir_dominates(fn, fn->instrs[c].block, order[i]))
+					found = c;
+			}
+			if(found >= 0) {
+				repl[ref] = found;
+				in->op = IR_NOP;
+				continue;
+			}
+			next[ref] = head ? (IrRef)*head : -1;
+			map_set(&heads, h, ref);
+		}
+	}
+	ir_rewrite(fn, repl);
+	ir_sweep(fn);
+	map_free(&heads);
+	xfree(next);
+	xfree(repl);
+}
+
+typedef struct IrLoop {
+	i32 header;
+	i32* blocks;      // header first
+} IrLoop;
+
+int ir_loop_cmp(const void* a, const void* b) {
+	isize x = buf_len(((IrLoop*)a)->blocks), y = buf_len(((IrLoop*)b)->blocks);
+	return x < y ? -1 : x > y;
+}
+
+// Natural loops: a back edge goes to a block that dominates its source,
+// and the loop is what reaches the source without going through the
+// header. Loops sharing a header are merged.
+IrLoop* ir_loops(IrFn* fn, i32* order, isize len) {
+	IrLoop* loops = NULL;
+	u8* in_loop = xcalloc(buf_len(fn->blocks), 1);
+	i32* stack = NULL;
+	for(isize i = 0; i < len; i++) {
+		i32 h = order[i];
+		IrBlock* header = &fn->blocks[h];
+		IrLoop loop = { h };
+		for(isize k = 0; k < buf_len(header->preds); k++) {
+			i32 p = header->preds[k];
+			if(!ir_dominates(fn, h, p))
+				continue;
+			if(!loop.blocks) {
+				buf_push(loop.blocks, h);
+				in_loop[h] = true;
+			}
+			buf_push(stack, p);
+			while(buf_len(stack) > 0) {
+				i32 b = stack[buf_len(stack) - 1];
+				buf_truncate(stack, buf_len(stack) - 1);
+				if(in_loop[b])
+					continue;
+				in_loop[b] = true;
+				buf_push(loop.blocks, b);
+				for(isize j = 0; j < buf_len(fn->blocks[b].preds); j++) {
+					buf_push(stack, fn->blocks[b].preds[j]);
+				}
+			}
+		}
+		if(!loop.blocks)
+			continue;
+		for(isize k = 0; k < buf_len(loop.blocks); k++) {
+			in_loop[loop.blocks[k]] = false;
+		}
+		buf_push(loops, loop);
+	}
+	buf_free(stack);
+	xfree(in_loop);
+	// inner loops first, so what they hoist can move out of the outer ones
+	if(loops)
+		qsort(loops, buf_len(loops), sizeof(IrLoop), ir_loop_cmp);
+	return loops;
+}
+
+// Moves the pure instructions of the loop whose operands are computed
+// outside it to the end of the preheader, the only block entering the
+// loop, in their order. Division is only moved when it cannot trap, as it
+// may not have run in the loop.
+void ir_licm_loop(IrFn* fn, IrLoop* loop, u8* in_loop) {
+	IrBlock* header = &fn->blocks[loop->header];
+	i32 pre = -1;
+	for(isize k = 0; k < buf_len(header->preds); k++) {
+		i32 p = header->preds[k];
+		if(in_loop[p])
+			continue;
+		if(pre >= 0 && pre != p)
+			return;
+		pre = p;
+	}
+	if(pre < 0 || fn->blocks[pre].succ[1] >= 0)
+		return;
+	// blocks in the order they run, so operands move before their uses
+	i32* blocks = NULL;
+	for(isize k = 0; k < buf_len(loop->blocks); k++) {
+		buf_push(blocks, loop->blocks[k]);
+	}
+	for(isize i = 1; i < buf_len(blocks); i++) {
+		for(isize k = i; k > 0 && fn->blocks[blocks[k - 1]].rpo > fn->blocks[blocks[k]].rpo; k--) {
+			i32 b = blocks[k];
+			blocks[k] = blocks[k - 1];
+			blocks[k - 1] = b;
+		}
+	}
+	for(isize i = 0; i < buf_len(blocks); i++) {
+		IrBlock* b = &fn->blocks[blocks[i]];
+		isize kept = 0;
+		for(isize k = 0; k < buf_len(b->code); k++) {
+			IrRef ref = b->code[k];
+			IrInstr* in = &fn->instrs[ref];
+			bool invariant = ir_is_pure(in->op) && !ir_may_trap(fn, in) &&
+				(in->x < 0 || !in_loop[fn->instrs[in->x].block]) && (in->y < 0 || !in_loop[fn->instrs[in->y].block]);
+			if(!invariant) {
+				b->code[kept++] = ref;
+				continue;
+			}
+			IrBlock* p = &fn->blocks[pre];
+			ir_insert(fn, pre, buf_len(p->code) - 1, ref);
+		}
+		buf_truncate(b->code, kept);
+	}
+	buf_free(blocks);
+}
+
+void ir_licm(IrFn* fn, i32* order, isize len) {
+	IrLoop* loops = ir_loops(fn, order, len);
+	u8* in_loop = xcalloc(buf_len(fn->blocks), 1);
+	for(isize i = 0; i < buf_len(loops); i++) {
+		IrLoop* loop = &loops[i];
+		for(isize k = 0; k < buf_len(loop->blocks); k++) {
+			in_loop[loop->blocks[k]] = true;
+		}
+		ir_licm_loop(fn, loop, in_loop);
+		for(isize k = 0; k < buf_len(loop->blocks); k++) {
+			in_loop[loop->blocks[k]] = false;
+		}
+		buf_free(loop->blocks);
+	}
+	buf_free(loops);
+	xfree(in_loop);
+}
+
+// Removes what no store, call or terminator uses, directly or not.
+void ir_dce(IrFn* fn) {
+	isize len = buf_len(fn->instrs);
+	u8* live = xcalloc(MAX(len, 1), 1);
+	IrRef* work = NULL;
+	for(isize b = 0; b < buf_len(fn->blocks); b++) {
+		for(isize i = 0; i < buf_len(fn->blocks[b].code); i++) {
+			IrRef ref = fn->blocks[b].code[i];
+			IrOp op = fn->instrs[ref].op;
+			if(op == IR_STORE || op == IR_MEMCPY || op == IR_MEMZERO || op == IR_CALL || ir_is_terminator(op)) {
+				live[ref] = true;
+				buf_push(work, ref);
+			}
+		}
+	}
+	while(buf_len(work) > 0) {
+		IrInstr* in = &fn->instrs[work[buf_len(work) - 1]];
+		buf_truncate(work, buf_len(work) - 1);
+		IrRef ops[2] = { in->x, in->y };
+		isize nargs = in->op == IR_PHI || in->op == IR_CALL ? in->args.len : 0;
+		for(isize k = 0; k < 2 + nargs; k++) {
+			IrRef op = k < 2 ? ops[k] : fn->args[in->args.start + k - 2];
+			if(op >= 0 && !live[op]) {
+				live[op] = true;
+				buf_push(work, op);
+			}
+		}
+	}
+	for(isize i = 0; i < len; i++) {
+		if(!live[i])
+			fn->instrs[i].op = IR_NOP;
+	}
+	ir_sweep(fn);
+	buf_free(work);
+	xfree(live);
+}
+
+// Rebuilds fn in a new arena with its blocks in reverse postorder and
+// their instructions numbered in order, dropping what was removed.
+void ir_compact(IrFn* fn, i32* order, isize len) {
+	IrFn* out = ir_fn_new(fn->sym);
+	isize* block_map = xmalloc(buf_len(fn->blocks) * sizeof(isize));
+	IrRef* instr_map = xmalloc(MAX(buf_len(fn->instrs), 1) * sizeof(IrRef));
+	for(isize b = 0; b < buf_len(fn->blocks); b++) {
+		block_map[b] = fn->blocks[b].rpo;
+	}
+	for(isize i = 0; i < len; i++) {
+		IrBlock* b = &fn->blocks[order[i]];
+		i32 nb = ir_block_new(out);
+		buf_reserve(out->blocks[nb].code, buf_len(b->code));
+		for(isize k = 0; k < buf_len(b->code); k++) {
+			IrRef ref = b->code[k];
+			IrInstr* in = &fn->instrs[ref];
+			instr_map[ref] = ir_emit(out, nb, in->op, in->type, in->x, in->y);
+			out->instrs[instr_map[ref]].imm = in->imm;
+			out->instrs[instr_map[ref]].args = in->args;
+		}
+	}
+	for(isize i = 0; i < buf_len(out->instrs); i++) {
+		IrInstr* in = &out->instrs[i];
+		in->x = in->x >= 0 ? instr_map[in->x] : -1;
+		in->y = in->y >= 0 ? instr_map[in->y] : -1;
+		if(in->op == IR_PHI || in->op == IR_CALL) {
+			i32 start = (i32)buf_len(out->args);
+			for(isize k = 0; k < in->args.len; k++) {
+				buf_push(out->args, instr_map[fn->args[in->args.start + k]]);
+			}
+			in->args.start = start;
+		}
+	}
+	for(isize i = 0; i < len; i++) {
+		IrBlock* b = &fn->blocks[order[i]];
+		IrBlock* nb = &out->blocks[i];
+		for(isize k = 0; k < buf_len(b->preds); k++) {
+			buf_push(nb->preds, (i32)block_map[b->preds[k]]);
+		}
+		for(isize k = 0; k < 2; k++) {
+			nb->succ[k] = b->succ[k] >= 0 ? (i32)block_map[b->succ[k]] : -1;
+		}
+		nb->idom = (i32)block_map[b->idom];
+		nb->rpo = (i32)i;
+	}
+	mpool_free(&fn->pool);
+	fn->pool = out->pool;
+	fn->instrs = out->instrs;
+	fn->args = out->args;
+	fn->blocks = out->blocks;
+	xfree(out);
+	xfree(instr_map);
+	xfree(block_map);
+}
+
+void ir_optimize(IrFn* fn) {
+	ir_copyprop(fn);
+	ir_sccp(fn);
+	ir_remove_unreachable(fn);
+	ir_copyprop(fn);
+	ir_merge_blocks(fn);
+	isize len;
+	i32* order = ir_rpo(fn, &len);
+	ir_dominators(fn, order, len);
+	ir_licm(fn, order, len);
+	ir_cse(fn, order, len);
+	ir_dce(fn);
+	ir_compact(fn, order, len);
+	xfree(order);
+}
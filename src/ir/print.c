@@ -0,0 +1,150 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Text form of the IR, for --dump-ir:
+//   fn main(i64, i64) -> i32 {
+//   b0:
+//       v0 = param.i64 0
+//       v1 = const.i64 1
+//       v2 = add.i64 v0, v1
+//       branch v2, b1, b2
+//   b1:  ; preds b0
+//   ...
+
+void print_ir_ref(IrRef r) {
+    p_printf("v%d", r);
+}
+
+void print_ir_instr(IrFn* fn, IrRef r) {
+    IrInstr* in = &fn->instrs[r];
+    p_puts("    ");
+    if(in->type != IR_VOID && in->op != IR_STORE) {
+        print_ir_ref(r);
+        p_puts(" = ");
+    }
+    p_puts(ir_op_names[in->op]);
+    if(in->type != IR_VOID)
+        p_printf(".%s", ir_type_names[in->type]);
+    IrBlock* b = &fn->blocks[in->block];
+    switch(in->op) {
+        case IR_CONST:
+            if(ir_is_float(in->type))
+                p_printf(" %.17g", in->f);
+            else
+                p_printf(" %lld", (long long)in->imm);
+            break;
+        case IR_PARAM:
+        case IR_SLOT:
+        case IR_STRING:
+            p_printf(" %lld", (long long)in->imm);
+            break;
+        case IR_GLOBAL:
+        case IR_FN:
+            p_printf(" %s", in->sym->name);
+            break;
+        case IR_PHI:
+            for(isize k = 0; k < in->args.len; k++) {
+                p_printf("%s[b%d: ", k > 0 ? ", " : " ", b->preds[k]);
+                print_ir_ref(fn->args[in->args.start + k]);
+                p_putc(']');
+            }
+            break;
+        case IR_CALL:
+            p_putc(' ');
+            print_ir_ref(in->x);
+            p_putc('(');
+            for(isize k = 0; k < in->args.len; k++) {
+                if(k > 0) p_puts(", ");
+                print_ir_ref(fn->args[in->args.start + k]);
+            }
+            p_putc(')');
+            break;
+        case IR_MEMCPY:
+        case IR_MEMZERO:
+            p_putc(' ');
+            print_ir_ref(in->x);
+            if(in->y >= 0) {
+                p_puts(", ");
+                print_ir_ref(in->y);
+            }
+            p_printf(", %lld", (long long)in->imm);
+            break;
+        case IR_JUMP:
+            p_printf(" b%d", b->succ[0]);
+            break;
+        case IR_BRANCH:
+            p_putc(' ');
+            print_ir_ref(in->x);
+            p_printf(", b%d, b%d", b->succ[0], b->succ[1]);
+            break;
+        default:
+            if(in->x >= 0) {
+                p_putc(' ');
+                print_ir_ref(in->x);
+            }
+            if(in->y >= 0) {
+                p_puts(", ");
+                print_ir_ref(in->y);
+            }
+            break;
+    }
+    p_putc('\n');
+}
+
+void print_ir_fn(IrFn* fn) {
+    if(fn->sym) {
+        p_printf("fn %s(", fn->sym->name);
+    } else {
+        p_puts("init(");
+    }
+    for(isize i = 0; i < buf_len(fn->blocks[0].code); i++) {
+        IrInstr* in = &fn->instrs[fn->blocks[0].code[i]];
+        if(in->op == IR_PARAM)
+            p_printf("%s%s", in->imm > 0 ? ", " : "", ir_type_names[in->type]);
+    }
+    p_printf(") -> %s {\n", fn->ret_ptr ? "ptr" : ir_type_names[fn->ret]);
+    for(isize i = 0; i < buf_len(fn->slots); i++) {
+        p_printf("    slot %lld: %lld bytes, align %lld\n", (long long)i, (long long)fn->slots[i].size,
+            (long long)fn->slots[i].align);
+    }
+    for(isize i = 0; i < buf_len(fn->strings); i++) {
+        p_printf("    string %lld: \"", (long long)i);
+        for(const char* c = fn->strings[i]; *c; c++) {
+            if(*c == '"' || *c == '\\')
+                p_printf("\\%c", *c);
+            else if(*c < ' ' || *c > '~')
+                p_printf("\\x%02x", (u8)*c);
+            else
+                p_putc(*c);
+        }
+        p_puts("\"\n");
+    }
+    for(isize b = 0; b < buf_len(fn->blocks); b++) {
+        IrBlock* block = &fn->blocks[b];
+        p_printf("b%lld:", (long long)b);
+        for(isize k = 0; k < buf_len(block->preds); k++) {
+            p_printf("%s b%d", k > 0 ? "," : "  ; preds", block->preds[k]);
+        }
+        p_putc('\n');
+        for(isize i = 0; i < buf_len(block->code); i++) {
+            print_ir_instr(fn, block->code[i]);
+        }
+    }
+    p_puts("}\n");
+}
+
+void print_ir_package(IrPackage* ir) {
+    for(isize i = 0; i < buf_len(ir->globals); i++) {
+        Symbol* sym = ir->globals[i];
+        ir_layout(sym->type);
+        p_printf("global %s: %lld bytes, align %lld\n", sym->name, (long long)sym->type->size,
+            (long long)sym->type->align);
+    }
+    for(isize i = 0; i < buf_len(ir->fns); i++) {
+        if(i > 0 || buf_len(ir->globals) > 0) p_putc('\n');
+        print_ir_fn(ir->fns[i]);
+    }
+}
+
+PRINT_STRING_FUNC1(ir_fn, IrFn*)
+PRINT_STRING_FUNC1(ir_package, IrPackage*)
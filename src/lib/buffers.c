@@ -12,59 +12,168 @@
 //   isize size = buf_len(vec); // size == 3
 //   buf_free(vec);
 
-#define buf__raw(b) ((isize*)(b) - 2)
-#define buf__cap(b) buf__raw(b)[0]
-#define buf__len(b) buf__raw(b)[1]
+//
+// Arena backed buffers are allocated from a MemoryPool and never call
+// realloc: they are extended in place when they are the last allocation
+// of the pool, otherwise they are moved to a fresh allocation. Freeing
+// them is a no-op, the memory goes away with the pool.
+//   AstExpr** list = NULL;
+//   buf_arena(list, &ast_pool, 4);
+//   buf_push(list, expr);
+//
+// Compiling with -DBUF_GROW_STATS counts grow events per call site,
+// buf_grow_stats_print() reports the buffers that reallocate the most.
+
+typedef struct MemoryPool MemoryPool;
+void* mpool_resize(MemoryPool* p, void* ptr, isize old_size, isize new_size);
+
+typedef struct BufHdr {
+	isize cap;
+	isize len;
+	MemoryPool* pool; // not null for arena backed buffers
+} BufHdr;
+
+#define buf__hdr(b) ((BufHdr*)(b) - 1)
+#define buf__cap(b) buf__hdr(b)->cap
+#define buf__len(b) buf__hdr(b)->len
 
 #define buf_cap(b) ((b) ? buf__cap(b) : 0)
 #define buf_len(b) ((b) ? buf__len(b) : 0)
 #define buf_end(b) ((b) + buf_len(b))
 #define buf_sizeof(b) ((b) ? buf_len(b)*sizeof(*b) : 0)
 
-#define buf_free(b) ((b) ? (free(buf__raw(b)), (b) = NULL) : 0)
-#define buf_fit(b, n) ((n) <= buf_cap(b) ? 0 : ((b) = buf__grow((b), (n), sizeof(*(b)))))
-#define buf_push(b, ...) (buf_fit((b), 1 + buf_len(b)), (b)[buf__len(b)++] = (__VA_ARGS__))
+#ifdef BUF_GROW_STATS
+#define buf__grow_site(b, n, size) buf__grow_at((b), (n), (size), __FILE__, __LINE__)
+#else
+#define buf__grow_site(b, n, size) buf__grow((b), (n), (size))
+#endif
+
+#define buf_free(b) ((b) ? (buf__hdr(b)->pool ? 0 : (xfree(buf__hdr(b)), 0), (b) = NULL) : 0)
+#define buf_fit(b, n) ((n) <= buf_cap(b) ? 0 : ((b) = buf__grow_site((b), (n), sizeof(*(b)))))
+#define buf_reserve(b, n) buf_fit((b), buf_len(b) + (n))
+#define buf_shrink_to_fit(b) ((b) ? ((b) = buf__shrink((b), sizeof(*(b)))) : 0)
+#define buf_arena(b, pool, cap) ((b) = buf__arena((pool), (cap), sizeof(*(b))))
+#define buf_push(b, ...) ((b) && buf__len(b) < buf__cap(b) ? 0 : ((b) = buf__grow_site((b), 1 + buf_len(b), sizeof(*(b)))), \
+                          (b)[buf__len(b)++] = (__VA_ARGS__))
 #define buf_printf(b, ...) ((b) = buf__printf((b), __VA_ARGS__))
 #define buf_vprintf(b, ...) ((b) = buf__vprintf((b), __VA_ARGS__))
 #define buf_clear(b) ((b) ? buf__len(b) = 0 : 0)
+#define buf_truncate(b, n) ((b) ? buf__len(b) = (n) : 0)
 #define buf_copy(b1, b2) (buf_fit(b2, buf_len(b1)), buf__copy(b1, b2, sizeof(*(b1)), sizeof(*(b2))))
 
 void* buf__grow(const void *buf, isize new_len, isize elem_size) {
-	isize new_cap = MAX(16, MAX(1 + 2 * buf_cap(buf), new_len));
-	isize new_size = sizeof(isize) * 2 + new_cap * elem_size;
-	isize* new_hdr = xrealloc(buf ? buf__raw(buf) : 0, new_size);
-	if(!buf)
-		new_hdr[1] = 0;
-	new_hdr[0] = new_cap;
-	return new_hdr + 2;
+	isize cap = buf_cap(buf);
+	isize new_cap = MAX(16, MAX(2 * cap, new_len));
+	isize new_size = sizeof(BufHdr) + new_cap * elem_size;
+	BufHdr* new_hdr;
+	if(buf && buf__hdr(buf)->pool) {
+		BufHdr* hdr = buf__hdr(buf);
+		new_hdr = mpool_resize(hdr->pool, hdr, sizeof(BufHdr) + cap * elem_size, new_size);
+	} else {
+		new_hdr = xrealloc(buf ? buf__hdr(buf) : 0, new_size);
+		if(!buf) {
+			new_hdr->len = 0;
+			new_hdr->pool = NULL;
+		}
+	}
+	new_hdr->cap = new_cap;
+	return new_hdr + 1;
+}
+void* buf__shrink(void* buf, isize elem_size) {
+	BufHdr* hdr = buf__hdr(buf);
+	isize new_size = sizeof(BufHdr) + hdr->len * elem_size;
+	if(hdr->pool)
+		hdr = mpool_resize(hdr->pool, hdr, sizeof(BufHdr) + hdr->cap * elem_size, new_size);
+	else
+		hdr = xrealloc(hdr, new_size);
+	hdr->cap = hdr->len;
+	return hdr + 1;
+}
+void* buf__arena(MemoryPool* pool, isize cap, isize elem_size) {
+	BufHdr* hdr = mpool_resize(pool, NULL, 0, sizeof(BufHdr) + cap * elem_size);
+	hdr->cap = cap;
+	hdr->len = 0;
+	hdr->pool = pool;
+	return hdr + 1;
+}
+
+#ifdef BUF_GROW_STATS
+typedef struct BufGrowSite {
+	const char* file;
+	i32 line;
+	isize grows;
+	isize bytes;
+} BufGrowSite;
+
+#define BUF_GROW_SITES_MAX 1024
+BufGrowSite buf_grow_sites[BUF_GROW_SITES_MAX];
+
+void* buf__grow_at(const void *buf, isize new_len, isize elem_size, const char* file, i32 line) {
+	// open addressing on (file, line); call sites are few and never removed
+	usize i = ((usize)file >> 3) * 31 + line;
+	while(true) {
+		BufGrowSite* site = &buf_grow_sites[i++ % BUF_GROW_SITES_MAX];
+		if(!site->file) {
+			site->file = file;
+			site->line = line;
+		}
+		if(site->file == file && site->line == line) {
+			void* ret = buf__grow(buf, new_len, elem_size);
+			site->grows++;
+			site->bytes += buf__cap(ret) * elem_size;
+			return ret;
+		}
+	}
 }
+
+int buf_grow_site_cmp(const void* x, const void* y) {
+	isize gx = ((const BufGrowSite*)x)->grows;
+	isize gy = ((const BufGrowSite*)y)->grows;
+	return gx < gy ? 1 : gx > gy ? -1 : 0;
+}
+
+void buf_grow_stats_print(void) {
+	BufGrowSite sites[BUF_GROW_SITES_MAX];
+	memcpy(sites, buf_grow_sites, sizeof(sites));
+	qsort(sites, BUF_GROW_SITES_MAX, sizeof(BufGrowSite), buf_grow_site_cmp);
+	printf("buffer grow events per call site:\n");
+	for(isize i = 0; i < BUF_GROW_SITES_MAX && sites[i].grows; i++) {
+		printf("  %8lld grows %10lld bytes  %s:%d\n", (long long)sites[i].grows, (long long)sites[i].bytes, sites[i].file, sites[i].line);
+	}
+}
+#endif
+
 void buf__copy(void* buf1, void* buf2, size_t elem_size1, size_t elem_size2) {
 	assert(elem_size1 == elem_size2);
-	isize* hdr = buf__raw(buf2);
 	size_t new_len = buf_len(buf1);
-	hdr[1] = new_len;
+	buf__len(buf2) = new_len;
 	if(new_len > 0)
 		memcpy(buf2, buf1, new_len * elem_size1);
 }
+// Formats directly into the spare capacity of the buffer; vsnprintf is
+// called a second time only when the output did not fit.
+#define BUF_PRINTF_MIN_SPARE 64
+
 char* buf__vprintf(char* buf, const char *fmt, va_list args) {
 	va_list args1;
 	va_copy(args1, args);
-	
-	size_t cap = buf_cap(buf) - buf_len(buf);
-	size_t n = 1 + vsnprintf(NULL, 0, fmt, args1);
+
+	buf_fit(buf, buf_len(buf) + BUF_PRINTF_MIN_SPARE);
+	isize cap = buf_cap(buf) - buf_len(buf);
+	isize n = vsnprintf(buf_end(buf), cap, fmt, args1);
 	va_end(args1);
-	
-	if(n > cap) {
-		buf_fit(buf, n + buf_len(buf));
-		cap = buf_cap(buf) - buf_len(buf);
+
+	if(n >= cap) {
+		buf_fit(buf, buf_len(buf) + n + 1);
+		vsnprintf(buf_end(buf), n + 1, fmt, args);
 	}
-	buf__len(buf) += vsnprintf(buf_end(buf), cap, fmt, args);
-	va_end(args);
-	
+	buf__len(buf) += n;
 	return buf;
 }
 char *buf__printf(char *buf, const char *fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
-	return buf__vprintf(buf, fmt, args);
+	buf = buf__vprintf(buf, fmt, args);
+	va_end(args);
+	return buf;
 }
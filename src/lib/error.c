@@ -1,20 +1,47 @@
 // Copyright 2018 Simone Miraglia. See the LICENSE
 // file at the top-level directory of this distribution
 
+// When error_jmp is set (on resolver workers, and on the main thread in
+// nc --watch) errors are written to error_buf and unwind to error_jmp
+// instead of exiting, so the caller can report them in a deterministic
+// order, or keep running.
+_Thread_local jmp_buf* error_jmp;
+_Thread_local char* error_buf;
+
 void print_error_pos(FileLoc loc, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    printf("%s:%d:%d: ", loc.file, loc.line, loc.col);
-    vprintf(fmt, args);
-    printf("\n");
+    if(error_jmp) {
+        buf_printf(error_buf, "%s:%d:%d: ", loc.file, loc.line, loc.col);
+        buf_vprintf(error_buf, fmt, args);
+        buf_putc(error_buf, '\n');
+    } else {
+        printf("%s:%d:%d: ", loc.file, loc.line, loc.col);
+        vprintf(fmt, args);
+        printf("\n");
+    }
     va_end(args);
 }
 
-#define resolve_error(loc, fmt, ...) (print_error_pos(loc, "resolve error: " fmt, ##__VA_ARGS__), exit(1))
+// writes an error reported earlier on another thread
+void error_puts(const char* msg) {
+    if(error_jmp)
+        buf_puts(error_buf, msg);
+    else
+        fputs(msg, stdout);
+}
+
+void resolve_abort(void) {
+    if(error_jmp)
+        longjmp(*error_jmp, 1);
+    exit(1);
+}
+
+#define resolve_error(loc, fmt, ...) (print_error_pos(loc, "resolve error: " fmt, ##__VA_ARGS__), resolve_abort())
 
 #define resolve_warning(loc, fmt, ...) (print_error_pos(loc, "resolve warning: " fmt, ##__VA_ARGS__))
 
-#define parser_error(fmt, ...) (print_error_pos(parser_loc(p), "parse error: " fmt, ##__VA_ARGS__), exit(1))
+#define parser_error(fmt, ...) (print_error_pos(parser_loc(p), "parse error: " fmt, ##__VA_ARGS__), resolve_abort())
 
 void fatal(const char* fmt, ...) {
 	va_list args;
@@ -0,0 +1,94 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Work-stealing runner for a fixed batch of independent tasks.
+// Tasks 0..n-1 are split in contiguous ranges, one per worker. A worker
+// takes tasks from the front of its own range and, once that is empty,
+// steals single tasks from the back of the other ranges. A range is packed
+// in one atomic word (lo | hi << 32), so both ends are claimed with a CAS.
+// The calling thread runs as worker 0.
+// Usage:
+//   void work(void* ctx, isize worker, isize task) { ... }
+//   jobs_run(4, ntasks, work, ctx);
+
+typedef void (*JobFn)(void* ctx, isize worker, isize task);
+
+typedef struct JobRange {
+	_Atomic u64 range;
+	char pad[64 - sizeof(u64)];  // one cache line per worker
+} JobRange;
+
+typedef struct Jobs {
+	JobFn fn;
+	void* ctx;
+	JobRange* ranges;
+	isize workers;
+} Jobs;
+
+typedef struct JobWorker {
+	Jobs* jobs;
+	isize index;
+} JobWorker;
+
+#define JOB_RANGE(lo, hi) ((u64)(lo) | (u64)(hi) << 32)
+
+bool jobs_take(JobRange* r, bool front, isize* task) {
+	u64 old = atomic_load(&r->range);
+	while(true) {
+		u32 lo = (u32)old;
+		u32 hi = (u32)(old >> 32);
+		if(lo >= hi)
+			return false;
+		u64 next = front ? JOB_RANGE(lo + 1, hi) : JOB_RANGE(lo, hi - 1);
+		if(atomic_compare_exchange_weak(&r->range, &old, next)) {
+			*task = front ? lo : hi - 1;
+			return true;
+		}
+	}
+}
+
+int jobs_worker(void* arg) {
+	JobWorker* w = arg;
+	Jobs* jobs = w->jobs;
+	isize task;
+	while(true) {
+		bool found = jobs_take(&jobs->ranges[w->index], true, &task);
+		// tasks never spawn tasks, so once every range is empty we are done
+		for(isize k = 1; k < jobs->workers && !found; k++) {
+			found = jobs_take(&jobs->ranges[(w->index + k) % jobs->workers], false, &task);
+		}
+		if(!found)
+			return 0;
+		jobs->fn(jobs->ctx, w->index, task);
+	}
+}
+
+void jobs_run(isize workers, isize tasks, JobFn fn, void* ctx) {
+	assert(tasks >= 0 && tasks <= (isize)UINT32_MAX);
+	workers = MAX(MIN(workers, tasks), 1);
+	if(workers == 1) {
+		for(isize i = 0; i < tasks; i++) {
+			fn(ctx, 0, i);
+		}
+		return;
+	}
+
+	Jobs jobs = { fn, ctx, xcalloc(workers, sizeof(JobRange)), workers };
+	JobWorker* ws = xcalloc(workers, sizeof(JobWorker));
+	thrd_t* threads = xcalloc(workers, sizeof(thrd_t));
+	for(isize i = 0; i < workers; i++) {
+		atomic_init(&jobs.ranges[i].range, JOB_RANGE(tasks * i / workers, tasks * (i + 1) / workers));
+		ws[i] = (JobWorker){ &jobs, i };
+	}
+	for(isize i = 1; i < workers; i++) {
+		if(thrd_create(&threads[i], jobs_worker, &ws[i]) != thrd_success)
+			fatal("cannot create worker thread");
+	}
+	jobs_worker(&ws[0]);
+	for(isize i = 1; i < workers; i++) {
+		thrd_join(threads[i], NULL);
+	}
+	xfree(threads);
+	xfree(ws);
+	xfree(jobs.ranges);
+}
@@ -8,7 +8,11 @@
 #include "map.c"
 #include "pool.c"
 #include "strings.c"
+#include "strbuf.c"
+#include "trace.c"
 #include "error.c"
+#include "jobs.c"
+#include "writer.c"
 
 StrRange read_file(const char* name) {
 	char* contents_str = NULL;
@@ -20,28 +24,22 @@ StrRange read_file(const char* name) {
 	}
 	isize nread;
 	char buf[256];
+	MemTag old_tag = mem_tag_set(MEM_LEXER);
 	while((nread = fread(buf, 1, sizeof(buf), file)) > 0) {
-		contents_str = realloc(contents_str, contents_len + nread);
+		contents_str = xrealloc(contents_str, contents_len + nread);
 		memcpy(contents_str + contents_len, buf, nread);
 		contents_len += nread;
 	}
+	mem_tag_set(old_tag);
 	fclose(file);
 	return string_range_len(contents_str, contents_len);
 }
 
+// Writes out to name, leaving the file untouched if it has the same
+// contents. See Writer.
 void write_file(const char* name, StrRange out) {
-	FILE* file;
-	if(fopen_s(&file, name, "w") != 0) {
-		fatal("cannot open output file \"%s\"", name);
-		return;
-	}
-	isize off = 0;
-	isize nwrote = 0;
-	while(off < out.l) {
-		nwrote = fwrite(out.s + off, 1, MIN(out.l - off, 1024), file);
-		off += nwrote;
-		if(nwrote == 0)
-			break;
-	}
-	fclose(file);
+	Writer w;
+	writer_open(&w, name);
+	writer_write(&w, out.s, out.l);
+	writer_close(&w);
 }
\ No newline at end of file
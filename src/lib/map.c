@@ -58,15 +58,24 @@ u64 map_hash_bytes(const void *ptr, isize len) {
 }
 
 void map_free_(MapBase* map) {
-	free(map->keys);
-	free(map->values);
+	xfree(map->keys);
+	xfree(map->values);
 	map->len = 0;
 	map->cap = 0;
 }
 
+// hash 0 marks empty slots, keys that hash to 0 are stored with hash 1
+#define MAP_HASH_KEY(hashfn, key) map_hash_nonzero(hashfn(key))
+
+u64 map_hash_nonzero(u64 hash) {
+	return hash ? hash : 1;
+}
+
 #define MAP_FUNCTIONS(name, K, hashfn, cmpfn) \
 void* name ## _get_(MapBase* map, K key, int vsize) { \
-	u64 hash = hashfn(key); \
+	if(map->cap == 0) \
+		return 0; \
+	u64 hash = MAP_HASH_KEY(hashfn, key); \
 	isize i = (isize)hash; \
 	while(true) { \
 		i &= map->cap - 1; \
@@ -83,11 +92,25 @@ void* name ## _get_(MapBase* map, K key, int vsize) { \
 void name ## _set_(MapBase* map, K key, u64 hash, void* value, int vsize); \
 void name ## _grow_(MapBase* map, isize new_cap, isize vsize) { \
 	new_cap = MAX(new_cap, 16); \
+	MemTag old_tag = mem_tag_set(MEM_MAPS); \
 	MapBase new_map = { xcalloc(new_cap, sizeof(MapBaseKey) + sizeof(K)), xmalloc(new_cap * vsize), 0, new_cap}; \
+	mem_tag_set(old_tag); \
 	for(isize i = 0; i < map->cap; i++) { \
 		MapBaseKey* bkey = (MapBaseKey*)((char*)map->keys + (sizeof(MapBaseKey) + sizeof(K)) * i); \
-		if(bkey->hash) { \
-			name ## _set_(&new_map, *(K*)bkey->key, bkey->hash, (char*)map->values + i * vsize, vsize); \
+		if(!bkey->hash) \
+			continue; \
+		/* keys are unique, so they are moved without comparing them */ \
+		isize j = (isize)bkey->hash; \
+		while(true) { \
+			j &= new_cap - 1; \
+			MapBaseKey* nkey = (MapBaseKey*)((char*)new_map.keys + (sizeof(MapBaseKey) + sizeof(K)) * j); \
+			if(!nkey->hash) { \
+				memcpy(nkey, bkey, sizeof(MapBaseKey) + sizeof(K)); \
+				memcpy((char*)new_map.values + j * vsize, (char*)map->values + i * vsize, vsize); \
+				new_map.len++; \
+				break; \
+			} \
+			j++; \
 		} \
 	} \
 	map_free_(map); \
@@ -97,7 +120,7 @@ void name ## _set_(MapBase* map, K key, u64 hash, void* value, int vsize) { \
 	if(2 * map->len >= map->cap) { \
 		name ## _grow_(map, 2 * map->cap, vsize); \
 	} \
-	hash = hash == 0 ? hashfn(key) : hash; \
+	hash = hash == 0 ? MAP_HASH_KEY(hashfn, key) : hash; \
 	isize i = (isize)hash; \
 	while(true) { \
 		i &= map->cap - 1; \
@@ -116,7 +139,9 @@ void name ## _set_(MapBase* map, K key, u64 hash, void* value, int vsize) { \
 	} \
 } \
 void name ## _remove_(MapBase* map, K key) { \
-	u64 hash = hashfn(key); \
+	if(map->cap == 0) \
+		return; \
+	u64 hash = MAP_HASH_KEY(hashfn, key); \
 	isize i = (isize)hash; \
 	while(true) { \
 		i &= map->cap - 1; \
@@ -131,8 +156,7 @@ void name ## _remove_(MapBase* map, K key) { \
 } \
 void name ## _next_(MapBase* map, MapIt* it) { \
 	isize i = (isize)*it; \
-	while(i < map->cap) { \
-		i++; \
+	while(++i < map->cap) { \
 		MapBaseKey* bkey = (MapBaseKey*)((char*)map->keys + (sizeof(MapBaseKey) + sizeof(K)) * i); \
 		if(bkey->hash) break; \
 	} \
@@ -140,7 +164,9 @@ void name ## _next_(MapBase* map, MapIt* it) { \
 } \
 MapIt name ## _begin_(MapBase* map) { \
 	/* if the map is unitialized (cap == 0) then return the end right away */\
-	MapIt it = map->cap == 0 ? 0 : -1; \
+	if(map->cap == 0) \
+		return 0; \
+	MapIt it = -1; \
 	name ## _next_(map, &it); \
 	return it; \
 }
@@ -148,23 +174,26 @@ MapIt name ## _begin_(MapBase* map) { \
 #define MAP_COMPARE_INTEGER(a, b) ((a) == (b) ? 0 : 1)
 
 typedef struct UserDefFn {
-	isize (*cmp)(void* x, void* y);
-	u64 (*hash)(void* x);
+	isize (*cmp)(const void* x, const void* y);
+	u64 (*hash)(const void* x);
 } UserDefFn;
 
-void* new_user_def_fn(isize (*cmp)(void* x, void* y), u64 (*hash)(void* x)) {
+// user defined maps keep their functions in place of the key reference
+void* new_user_def_fn(isize (*cmp)(const void* x, const void* y), u64 (*hash)(const void* x)) {
+	MemTag old_tag = mem_tag_set(MEM_MAPS);
 	UserDefFn* fns = xmalloc(sizeof(UserDefFn));
+	mem_tag_set(old_tag);
 	fns->cmp = cmp;
 	fns->hash = hash;
 	return fns;
 }
 
-#define MAP_COMPARE_UDEF(x, y) ((UserDefFn*)(map + 1))->cmp(x, y)
-#define MAP_HASH_UDEF(x) ((UserDefFn*)(map + 1))->hash(x)
+#define MAP_COMPARE_UDEF(x, y) (*(UserDefFn**)(map + 1))->cmp(x, y)
+#define MAP_HASH_UDEF(x) (*(UserDefFn**)(map + 1))->hash(x)
 
 MAP_FUNCTIONS(map_str, const char*, map_hash_str, strcmp)
 MAP_FUNCTIONS(map_u64, u64, map_hash_u64, MAP_COMPARE_INTEGER)
-MAP_FUNCTIONS(map_udef, void*, MAP_HASH_UDEF, MAP_COMPARE_UDEF)
+MAP_FUNCTIONS(map_udef, const void*, MAP_HASH_UDEF, MAP_COMPARE_UDEF)
 
 
 #define GENERIC_MAP_FUNC(typ, fn) _Generic((typ), \
@@ -174,6 +203,8 @@ MAP_FUNCTIONS(map_udef, void*, MAP_HASH_UDEF, MAP_COMPARE_UDEF)
 
 #define map_type(K, V)         struct { MapBase base; K* kref; V* vref; V vtmp; }
 #define map_get(m, key)        ( (m)->vref = GENERIC_MAP_FUNC(*(m)->kref, get)(&(m)->base, key, sizeof((m)->vtmp)) )
+// like map_get, but without writing to the map, for concurrent readers
+#define map_lookup(m, key)     ( GENERIC_MAP_FUNC(*(m)->kref, get)(&(m)->base, key, sizeof((m)->vtmp)) )
 #define map_set(m, key, value) ( (m)->vtmp = (value), GENERIC_MAP_FUNC(*(m)->kref, set)(&(m)->base, key, 0, &(m)->vtmp, sizeof((m)->vtmp)) )
 #define map_remove(m, key)     ( GENERIC_MAP_FUNC(*(m)->kref, remove)(&(m)->base, key) )
 #define map_begin(m)           ( GENERIC_MAP_FUNC(*(m)->kref, begin)(&(m)->base) )
@@ -183,4 +214,4 @@ MAP_FUNCTIONS(map_udef, void*, MAP_HASH_UDEF, MAP_COMPARE_UDEF)
 #define map_iter_value(m, it)  ( (void*)((char*)(m)->base.values + *it * sizeof((m)->vtmp)) )
 #define map_free(m)            ( map_free_(&(m)->base) )
 
-#define map_init_udef(hashfn, cmpfn) { .kref = new_user_def_fn(hashfn, cmpfn) }
+#define map_init_udef(hashfn, cmpfn) { .kref = new_user_def_fn(cmpfn, hashfn) }
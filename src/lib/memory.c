@@ -1,7 +1,108 @@
 // Copyright 2018 Simone Miraglia. See the LICENSE
 // file at the top-level directory of this distribution
 
+// Allocation accounting.
+// When mem_stats_enabled is set (it must be set before the first
+// allocation and never cleared) every x*alloc block carries a small header
+// with its size and the subsystem tag that was current when it was
+// allocated, so live bytes, peak bytes and call counts can be kept per
+// tag. Blocks must then be released with xfree. When the flag is off the
+// only cost is one branch per call. The current tag is per thread and the
+// counters are updated under a spinlock.
+// Usage:
+//   MemTag old = mem_tag_set(MEM_SYMBOLS);
+//   Symbol* sym = xcalloc(1, sizeof(Symbol));
+//   mem_tag_set(old);
+
+typedef enum MemTag {
+	MEM_OTHER,
+	MEM_LEXER,
+	MEM_AST,
+	MEM_INTERN,
+	MEM_SYMBOLS,
+	MEM_TYPES,
+	MEM_MAPS,
+	MEM_PRINTER,
+	MEM_CODEGEN,
+	MEM_IR,
+	MEM_X64,
+	MEM_VM,
+	MEM_TAG_MAX
+} MemTag;
+
+const char* mem_tag_names[] = {
+	[MEM_OTHER] = "other",
+	[MEM_LEXER] = "lexer",
+	[MEM_AST] = "ast",
+	[MEM_INTERN] = "intern",
+	[MEM_SYMBOLS] = "symbols",
+	[MEM_TYPES] = "types",
+	[MEM_MAPS] = "maps",
+	[MEM_PRINTER] = "printer",
+	[MEM_CODEGEN] = "codegen",
+	[MEM_IR] = "ir",
+	[MEM_X64] = "x64",
+	[MEM_VM] = "vm",
+};
+
+typedef struct MemTagStats {
+	isize live;
+	isize peak;
+	isize allocs;
+	isize frees;
+} MemTagStats;
+
+typedef struct MemHdr {
+	isize size;
+	isize tag;
+} MemHdr;
+
+bool mem_stats_enabled;
+_Thread_local MemTag mem_tag;
+atomic_flag mem_stats_lock = ATOMIC_FLAG_INIT;
+MemTagStats mem_stats[MEM_TAG_MAX];
+MemTagStats mem_stats_total;
+
+MemTag mem_tag_set(MemTag tag) {
+	MemTag old = mem_tag;
+	mem_tag = tag;
+	return old;
+}
+
+void mem_account(MemTag tag, isize delta) {
+	while(atomic_flag_test_and_set_explicit(&mem_stats_lock, memory_order_acquire))
+		;
+	MemTagStats* s = &mem_stats[tag];
+	s->live += delta;
+	s->peak = MAX(s->peak, s->live);
+	mem_stats_total.live += delta;
+	mem_stats_total.peak = MAX(mem_stats_total.peak, mem_stats_total.live);
+	if(delta > 0) {
+		s->allocs++;
+		mem_stats_total.allocs++;
+	} else {
+		s->frees++;
+		mem_stats_total.frees++;
+	}
+	atomic_flag_clear_explicit(&mem_stats_lock, memory_order_release);
+}
+
+void* mem_track(MemHdr* hdr, isize size, MemTag tag) {
+	hdr->size = size;
+	hdr->tag = tag;
+	mem_account(tag, size);
+	return hdr + 1;
+}
+
 void* xcalloc(isize num_elems, isize elem_size) {
+	if(mem_stats_enabled) {
+		MemHdr* hdr = calloc(1, sizeof(MemHdr) + num_elems * elem_size);
+		if(!hdr) {
+			perror("xcalloc failed");
+			exit(1);
+		}
+		return mem_track(hdr, num_elems * elem_size, mem_tag);
+	}
 	void* ptr = calloc(num_elems, elem_size);
 	if (!ptr) {
 		perror("xcalloc failed");
@@ -11,6 +112,18 @@ void* xcalloc(isize num_elems, isize elem_size) {
 }
 
 void* xrealloc(void* ptr, isize num_bytes) {
+	if(mem_stats_enabled) {
+		MemHdr* hdr = ptr ? (MemHdr*)ptr - 1 : NULL;
+		MemTag tag = hdr ? (MemTag)hdr->tag : mem_tag;
+		if(hdr)
+			mem_account(tag, -hdr->size);
+		hdr = realloc(hdr, sizeof(MemHdr) + num_bytes);
+		if(!hdr) {
+			perror("xrealloc failed");
+			exit(1);
+		}
+		return mem_track(hdr, num_bytes, tag);
+	}
 	ptr = realloc(ptr, num_bytes);
 	if (!ptr) {
 		perror("xrealloc failed");
@@ -20,6 +133,14 @@ void* xrealloc(void* ptr, isize num_bytes) {
 }
 
 void* xmalloc(isize num_bytes) {
+	if(mem_stats_enabled) {
+		MemHdr* hdr = malloc(sizeof(MemHdr) + num_bytes);
+		if(!hdr) {
+			perror("xmalloc failed");
+			exit(1);
+		}
+		return mem_track(hdr, num_bytes, mem_tag);
+	}
 	void* ptr = malloc(num_bytes);
 	if (!ptr) {
 		perror("xmalloc failed");
@@ -28,8 +149,30 @@ void* xmalloc(isize num_bytes) {
 	return ptr;
 }
 
+void xfree(void* ptr) {
+	if(mem_stats_enabled && ptr) {
+		MemHdr* hdr = (MemHdr*)ptr - 1;
+		mem_account((MemTag)hdr->tag, -hdr->size);
+		ptr = hdr;
+	}
+	free(ptr);
+}
+
 void* memdup(const void* src, isize size) {
 	void* dest = xmalloc(size);
 	memcpy(dest, src, size);
 	return dest;
 }
+
+void mem_stats_print(void) {
+	printf("memory by subsystem:\n");
+	printf("  %-10s %14s %14s %10s %10s\n", "tag", "live bytes", "peak bytes", "allocs", "frees");
+	for(isize i = 0; i < MEM_TAG_MAX; i++) {
+		MemTagStats* s = &mem_stats[i];
+		printf("  %-10s %14lld %14lld %10lld %10lld\n", mem_tag_names[i],
+			(long long)s->live, (long long)s->peak, (long long)s->allocs, (long long)s->frees);
+	}
+	MemTagStats* s = &mem_stats_total;
+	printf("  %-10s %14lld %14lld %10lld %10lld\n", "total",
+		(long long)s->live, (long long)s->peak, (long long)s->allocs, (long long)s->frees);
+}
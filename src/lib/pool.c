@@ -11,6 +11,7 @@ typedef struct MemoryPool {
 	void* begin;
 	void* ptr;
 	void* end;
+	MemTag tag; // subsystem charged for the blocks
 } MemoryPool;
 
 #define MEMORY_POOL_ALIGNMENT 8
@@ -18,7 +19,9 @@ typedef struct MemoryPool {
 
 void mpool_grow(MemoryPool* p, isize min_size) {
 	isize size = ALIGN_UP(MAX(MEMORY_POOL_BLOCK_SIZE, min_size), MEMORY_POOL_ALIGNMENT);
+	MemTag old_tag = mem_tag_set(p->tag);
 	void* new_ptr = xmalloc(sizeof(void*) + size);
+	mem_tag_set(old_tag);
 	p->end = (char*)new_ptr + sizeof(void*) + size;
 	*(void**)new_ptr = p->begin;
 	p->begin = (void**)new_ptr + 1;
@@ -34,11 +37,29 @@ void* mpool_alloc(MemoryPool* p, isize size) {
 	return ptr;
 }
 
+// Resizes the allocation at ptr (of old_size bytes). When it is the last
+// allocation of the pool it is extended or shrunk in place, otherwise a
+// new block is allocated and the contents are copied.
+void* mpool_resize(MemoryPool* p, void* ptr, isize old_size, isize new_size) {
+	if(ptr && ALIGN_UP_PTR((char*)ptr + old_size, MEMORY_POOL_ALIGNMENT) == p->ptr
+	   && new_size <= (isize)((char*)p->end - (char*)ptr)) {
+		p->ptr = ALIGN_UP_PTR((char*)ptr + new_size, MEMORY_POOL_ALIGNMENT);
+		return ptr;
+	}
+	if(new_size <= old_size)
+		return ptr;
+	void* new_ptr = mpool_alloc(p, new_size);
+	if(ptr)
+		memcpy(new_ptr, ptr, old_size);
+	return new_ptr;
+}
+
 void mpool_free(MemoryPool* p) {
 	void* next = p->begin;
 	while(next) {
 		void* tmp = (char*)next - sizeof(void*);
 		next = *(void**)tmp;
-		free(tmp);
+		xfree(tmp);
 	}
+	*p = (MemoryPool){ .tag = p->tag };
 }
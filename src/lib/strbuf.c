@@ -0,0 +1,85 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// String builder on top of the stretchy buffers.
+// Every append keeps the buffer NUL terminated (the terminator is not
+// counted by buf_len), so the buffer can be used as a C string at any time.
+// Usage:
+//   char* sb = NULL;
+//   buf_puts(sb, "x = ");
+//   buf_puti(sb, -42);
+//   buf_putn(sb, '!', 3);
+//   puts(sb); // x = -42!!!
+//   buf_free(sb);
+
+#define buf_write(b, s, n) ((b) = buf__write((b), (s), (n)))
+#define buf_puts(b, s)     ((b) = buf__puts((b), (s)))
+#define buf_putr(b, r)     ((b) = buf__putr((b), (r)))
+#define buf_putc(b, c)     ((b) = buf__putc((b), (c)))
+#define buf_putn(b, c, n)  ((b) = buf__putn((b), (c), (n)))
+#define buf_putu(b, x)     ((b) = buf__putu((b), (x)))
+#define buf_puti(b, x)     ((b) = buf__puti((b), (x)))
+
+const char buf__digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+char* buf__write(char* buf, const char* s, isize n) {
+	buf_fit(buf, buf_len(buf) + n + 1);
+	memcpy(buf_end(buf), s, n);
+	buf__len(buf) += n;
+	*buf_end(buf) = '\0';
+	return buf;
+}
+char* buf__puts(char* buf, const char* s) {
+	return buf__write(buf, s, strlen(s));
+}
+char* buf__putr(char* buf, StrRange r) {
+	return buf__write(buf, r.s, r.l);
+}
+char* buf__putc(char* buf, char c) {
+	buf_fit(buf, buf_len(buf) + 2);
+	buf[buf__len(buf)++] = c;
+	*buf_end(buf) = '\0';
+	return buf;
+}
+char* buf__putn(char* buf, char c, isize n) {
+	n = MAX(n, 0);
+	buf_fit(buf, buf_len(buf) + n + 1);
+	memset(buf_end(buf), c, n);
+	buf__len(buf) += n;
+	*buf_end(buf) = '\0';
+	return buf;
+}
+char* buf__putu(char* buf, u64 x) {
+	char tmp[20];
+	char* p = tmp + sizeof(tmp);
+	while(x >= 100) {
+		u64 q = x / 100;
+		p -= 2;
+		memcpy(p, buf__digit_pairs + 2 * (x - q * 100), 2);
+		x = q;
+	}
+	if(x >= 10) {
+		p -= 2;
+		memcpy(p, buf__digit_pairs + 2 * x, 2);
+	} else {
+		*--p = (char)('0' + x);
+	}
+	return buf__write(buf, p, tmp + sizeof(tmp) - p);
+}
+char* buf__puti(char* buf, i64 x) {
+	if(x < 0) {
+		buf = buf__putc(buf, '-');
+		return buf__putu(buf, (u64)0 - (u64)x);
+	}
+	return buf__putu(buf, (u64)x);
+}
@@ -30,32 +30,77 @@ StrRange string_range_copy(StrRange s) {
 }
 
 char *strf(const char* fmt, ...) {
+	char* str = NULL;
 	va_list args;
 	va_start(args, fmt);
-	i32 n = 1 + vsnprintf(NULL, 0, fmt, args);
-	va_end(args);
-	char *str = xmalloc(n);
-	va_start(args, fmt);
-	vsnprintf(str, n, fmt, args);
+	buf_vprintf(str, fmt, args);
 	va_end(args);
 	return str;
 }
 
 typedef const char* StrIntern;
 
-MemoryPool str_intern_pool;
-StrRange* str_intern_list;
+// Interned strings live in str_intern_pool and are indexed by an open
+// addressing table with linear probing, kept at most half full.
+typedef struct StrInternEntry {
+    u64 hash; // 0 for empty slots
+    StrRange str;
+} StrInternEntry;
+
+MemoryPool str_intern_pool = {.tag = MEM_INTERN};
+StrInternEntry* str_intern_table;
+isize str_intern_cap;
+isize str_intern_len;
+
+u64 str_intern_hash(StrRange str) {
+    u64 hash = map_hash_bytes(str.s, str.l);
+    return hash ? hash : 1;
+}
+
+void str_intern_grow(isize new_cap) {
+    MemTag old_tag = mem_tag_set(MEM_INTERN);
+    StrInternEntry* table = xcalloc(new_cap, sizeof(StrInternEntry));
+    mem_tag_set(old_tag);
+    for(isize i = 0; i < str_intern_cap; i++) {
+        StrInternEntry* e = &str_intern_table[i];
+        if(!e->hash)
+            continue;
+        isize j = (isize)e->hash & (new_cap - 1);
+        while(table[j].hash)
+            j = (j + 1) & (new_cap - 1);
+        table[j] = *e;
+    }
+    xfree(str_intern_table);
+    str_intern_table = table;
+    str_intern_cap = new_cap;
+}
+
+// makes room for n more strings without rehashing
+void str_intern_reserve(isize n) {
+    isize cap = MAX(str_intern_cap, 64);
+    while(2 * (str_intern_len + n) > cap)
+        cap *= 2;
+    if(cap != str_intern_cap)
+        str_intern_grow(cap);
+}
 
 StrIntern str_intern(StrRange str) {
-    for(isize i = 0; i < buf_len(str_intern_list); i++) {
-        if(str_intern_list[i].l == str.l && strncmp(str_intern_list[i].s, str.s, str.l) == 0) {
-            return str_intern_list[i].s;
-        }
+    if(2 * (str_intern_len + 1) > str_intern_cap)
+        str_intern_grow(MAX(64, 2 * str_intern_cap));
+    u64 hash = str_intern_hash(str);
+    isize i = (isize)hash & (str_intern_cap - 1);
+    for(;; i = (i + 1) & (str_intern_cap - 1)) {
+        StrInternEntry* e = &str_intern_table[i];
+        if(!e->hash)
+            break;
+        if(e->hash == hash && e->str.l == str.l && memcmp(e->str.s, str.s, str.l) == 0)
+            return e->str.s;
     }
     char *s = mpool_alloc(&str_intern_pool, str.l + 1);
     memcpy(s, str.s, str.l);
     s[str.l] = 0;
-    buf_push(str_intern_list, string_range_len(s, str.l));
+    str_intern_table[i] = (StrInternEntry){ hash, string_range_len(s, str.l) };
+    str_intern_len++;
     return s;
 }
 
@@ -0,0 +1,194 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Wall time instrumentation for the compiler pipeline.
+// Spans are recorded only when trace_enabled is set; they can be printed
+// as a per-phase summary or written in the Chrome trace event format,
+// which can be opened with chrome://tracing or https://ui.perfetto.dev
+// Every thread records into its own buffer, a track of its own in the
+// trace; the buffers are merged when the trace is written.
+// Usage:
+//   trace_begin(TRACE_PHASE, "parse");
+//   ...
+//   trace_end();
+//
+// Work that is too fine grained for one span per call (e.g. lexing a
+// single token) is summed with trace_accum_begin/trace_accum_end and
+// reported as a total.
+
+typedef enum TraceCat {
+	TRACE_PHASE,
+	TRACE_FILE,
+	TRACE_SYMBOL,
+	TRACE_CAT_MAX
+} TraceCat;
+
+const char* trace_cat_names[] = {
+	[TRACE_PHASE] = "phase",
+	[TRACE_FILE] = "file",
+	[TRACE_SYMBOL] = "symbol",
+};
+
+typedef enum TraceAccum {
+	TRACE_ACCUM_LEX,
+	TRACE_ACCUM_INTERN,
+	TRACE_ACCUM_MAX
+} TraceAccum;
+
+const char* trace_accum_names[] = {
+	[TRACE_ACCUM_LEX] = "lex",
+	[TRACE_ACCUM_INTERN] = "intern",
+};
+
+typedef struct TraceEvent {
+	TraceCat cat;
+	const char* name;
+	i64 begin;  // microseconds from trace_start
+	i64 dur;
+	i32 depth;
+} TraceEvent;
+
+typedef struct TraceThread {
+	TraceEvent* events;
+	isize* open;  // indices of the open spans
+	i32 tid;      // 1 for the thread that called trace_init
+} TraceThread;
+
+// set before any worker thread starts, and read only afterwards
+bool trace_enabled;
+i64 trace_start;
+_Thread_local TraceThread* trace_thread;
+TraceThread** trace_threads;  // in the order they first recorded a span
+atomic_flag trace_threads_lock = ATOMIC_FLAG_INIT;
+i64 trace_accum[TRACE_ACCUM_MAX];
+i64 trace_accum_since[TRACE_ACCUM_MAX];
+
+i64 trace_now(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (i64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// the buffer of the calling thread, registered on its first span; it
+// outlives the thread
+TraceThread* trace_thread_get(void) {
+	if(trace_thread)
+		return trace_thread;
+	trace_thread = xcalloc(1, sizeof(TraceThread));
+	while(atomic_flag_test_and_set_explicit(&trace_threads_lock, memory_order_acquire))
+		;
+	buf_push(trace_threads, trace_thread);
+	trace_thread->tid = (i32)buf_len(trace_threads);
+	atomic_flag_clear_explicit(&trace_threads_lock, memory_order_release);
+	return trace_thread;
+}
+
+void trace_init(void) {
+	trace_enabled = true;
+	trace_start = trace_now();
+	trace_thread_get();
+}
+
+void trace_begin(TraceCat cat, const char* name) {
+	if(!trace_enabled)
+		return;
+	TraceThread* t = trace_thread_get();
+	buf_push(t->open, buf_len(t->events));
+	buf_push(t->events, (TraceEvent){ cat, name, trace_now() - trace_start, 0, (i32)buf_len(t->open) - 1 });
+}
+
+void trace_end(void) {
+	if(!trace_enabled)
+		return;
+	TraceThread* t = trace_thread;
+	assert(t && buf_len(t->open) > 0);
+	TraceEvent* ev = &t->events[t->open[--buf__len(t->open)]];
+	ev->dur = trace_now() - trace_start - ev->begin;
+}
+
+#define trace_accum_begin(a) (trace_enabled ? (void)(trace_accum_since[a] = trace_now()) : (void)0)
+#define trace_accum_end(a) (trace_enabled ? (void)(trace_accum[a] += trace_now() - trace_accum_since[a]) : (void)0)
+
+// Phases are spans of the thread that called trace_init.
+void trace_print_phases(void) {
+	TraceEvent* trace_events = trace_threads[0]->events;
+	i64 total = 0;
+	for(isize i = 0; i < buf_len(trace_events); i++) {
+		TraceEvent* ev = &trace_events[i];
+		if(ev->cat == TRACE_PHASE && ev->depth == 0)
+			total += ev->dur;
+	}
+	printf("phase timings:\n");
+	for(isize i = 0; i < buf_len(trace_events); i++) {
+		TraceEvent* ev = &trace_events[i];
+		if(ev->cat != TRACE_PHASE)
+			continue;
+		printf("  %*s%-*s %10.3f ms %6.1f%%\n", ev->depth * 2, "", 28 - ev->depth * 2, ev->name,
+			ev->dur / 1000.0, total ? 100.0 * ev->dur / total : 0.0);
+	}
+	for(isize i = 0; i < TRACE_ACCUM_MAX; i++) {
+		printf("  %-28s %10.3f ms (total)\n", trace_accum_names[i], trace_accum[i] / 1000.0);
+	}
+	isize nsyms = 0;
+	for(isize t = 0; t < buf_len(trace_threads); t++) {
+		for(isize i = 0; i < buf_len(trace_threads[t]->events); i++) {
+			nsyms += trace_threads[t]->events[i].cat == TRACE_SYMBOL;
+		}
+	}
+	if(nsyms)
+		printf("  %lld symbol spans recorded\n", (long long)nsyms);
+}
+
+void trace_json_string(char** out, const char* s) {
+	buf_putc(*out, '"');
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\') {
+			buf_putc(*out, '\\');
+			buf_putc(*out, *s);
+		} else if((u8)*s < 0x20) {
+			buf_printf(*out, "\\u%04x", *s);
+		} else {
+			buf_putc(*out, *s);
+		}
+	}
+	buf_putc(*out, '"');
+}
+
+void trace_json_event(char** out, const char* cat, const char* name, i32 tid, i64 ts, i64 dur) {
+	buf_puts(*out, "{\"name\":");
+	trace_json_string(out, name);
+	buf_puts(*out, ",\"cat\":\"");
+	buf_puts(*out, cat);
+	buf_puts(*out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+	buf_puti(*out, tid);
+	buf_puts(*out, ",\"ts\":");
+	buf_puti(*out, ts);
+	buf_puts(*out, ",\"dur\":");
+	buf_puti(*out, dur);
+	buf_putc(*out, '}');
+}
+
+// Returns the spans of every thread in the Chrome trace event format, one
+// track per thread. The accumulated timers are emitted as one span each,
+// on a track after those, starting at the end of the trace.
+char* trace_json(void) {
+	char* out = NULL;
+	buf_puts(out, "{\"traceEvents\":[\n");
+	i64 end = 0;
+	for(isize t = 0; t < buf_len(trace_threads); t++) {
+		TraceThread* thread = trace_threads[t];
+		for(isize i = 0; i < buf_len(thread->events); i++) {
+			TraceEvent* ev = &thread->events[i];
+			trace_json_event(&out, trace_cat_names[ev->cat], ev->name, thread->tid, ev->begin, ev->dur);
+			buf_puts(out, ",\n");
+			end = MAX(end, ev->begin + ev->dur);
+		}
+	}
+	i32 accum_tid = (i32)buf_len(trace_threads) + 1;
+	for(isize i = 0; i < TRACE_ACCUM_MAX; i++) {
+		trace_json_event(&out, "accum", trace_accum_names[i], accum_tid, end, trace_accum[i]);
+		buf_puts(out, i == TRACE_ACCUM_MAX - 1 ? "\n" : ",\n");
+	}
+	buf_puts(out, "],\"displayTimeUnit\":\"ms\"}\n");
+	return out;
+}
@@ -0,0 +1,137 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Buffered output file for large generated files.
+// Output is appended to buf with the string builder (buf_puts, buf_printf,
+// ...) and written to the file in large blocks: callers call writer_flush
+// at points where they are done with a unit of output, and the buffer is
+// written out once it holds WRITER_BLOCK bytes, so memory stays bounded by
+// the block size plus the largest unit.
+// A file whose contents would not change is left untouched, so build tools
+// that look at modification times do not rebuild what depends on it. Each
+// block is compared with the existing file as it is produced; on the first
+// difference the output moves to a temporary file next to it, named after
+// the process so that concurrent compilers do not share it, which replaces
+// the file in one step once complete. An interrupted compiler never leaves
+// a truncated output behind, and the file is never missing.
+// Usage:
+//   Writer w;
+//   writer_open(&w, "out.c");
+//   buf_puts(w.buf, "int x;\n");
+//   writer_flush(&w, false);
+//   writer_close(&w);
+
+#define WRITER_BLOCK (64 * 1024)
+
+#ifdef _WIN32
+__declspec(dllimport) int __stdcall MoveFileExA(const char* from, const char* to, unsigned long flags);
+__declspec(dllimport) unsigned long __stdcall GetCurrentProcessId(void);
+#define WRITER_MOVEFILE_REPLACE_EXISTING 0x1
+#endif
+
+long long writer_pid(void) {
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return getpid();
+#endif
+}
+
+// replaces path with from; rename does not replace an existing file on
+// Windows, MoveFileEx does
+bool writer_replace(const char* from, const char* path) {
+#ifdef _WIN32
+	return MoveFileExA(from, path, WRITER_MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from, path) == 0;
+#endif
+}
+
+typedef struct Writer {
+	const char* path;
+	char* tmp_path;
+	FILE* file;     // temporary file, once the output differs
+	FILE* old;      // existing file, while the output matches it
+	char* old_buf;  // blocks read from old
+	char* buf;
+	isize written;  // bytes of output so far
+	bool changed;   // output differs from the existing file
+} Writer;
+
+// Moves the output to the temporary file, copying the part that matched.
+void writer_diverge(Writer* w) {
+	w->changed = true;
+	if(fopen_s(&w->file, w->tmp_path, "wb") != 0)
+		fatal("cannot open output file \"%s\"", w->tmp_path);
+	if(!w->old)
+		return;
+	rewind(w->old);
+	for(isize off = 0; off < w->written; ) {
+		isize n = MIN(w->written - off, WRITER_BLOCK);
+		if((isize)fread(w->old_buf, 1, n, w->old) != n)
+			fatal("cannot read output file \"%s\"", w->path);
+		if((isize)fwrite(w->old_buf, 1, n, w->file) != n)
+			fatal("cannot write output file \"%s\"", w->tmp_path);
+		off += n;
+	}
+	fclose(w->old);
+	w->old = NULL;
+}
+
+void writer_write(Writer* w, const char* s, isize len) {
+	for(isize off = 0; !w->changed && off < len; ) {
+		isize n = MIN(len - off, WRITER_BLOCK);
+		if((isize)fread(w->old_buf, 1, n, w->old) != n || memcmp(w->old_buf, s + off, n) != 0)
+			writer_diverge(w);
+		off += n;
+	}
+	if(w->changed && (isize)fwrite(s, 1, len, w->file) != len)
+		fatal("cannot write output file \"%s\"", w->tmp_path);
+	w->written += len;
+}
+
+void writer_open(Writer* w, const char* path) {
+	*w = (Writer){ .path = path };
+	MemTag old_tag = mem_tag_set(MEM_CODEGEN);
+	buf_printf(w->tmp_path, "%s.%lld.tmp", path, writer_pid());
+	buf_reserve(w->buf, WRITER_BLOCK + WRITER_BLOCK / 4);
+	if(fopen_s(&w->old, path, "rb") == 0)
+		w->old_buf = xmalloc(WRITER_BLOCK);
+	else
+		writer_diverge(w);
+	mem_tag_set(old_tag);
+}
+
+// writes the buffer out when it is full, or always when force is set
+void writer_flush(Writer* w, bool force) {
+	isize len = buf_len(w->buf);
+	if(len == 0 || (!force && len < WRITER_BLOCK))
+		return;
+	writer_write(w, w->buf, len);
+	buf_clear(w->buf);
+}
+
+// Completes the output. Returns whether the file was written, false when it
+// already had the same contents.
+bool writer_close(Writer* w) {
+	writer_flush(w, true);
+	// the existing file may be longer
+	if(!w->changed && fgetc(w->old) != EOF)
+		writer_diverge(w);
+	bool changed = w->changed;
+	if(changed) {
+		if(fclose(w->file) != 0)
+			fatal("cannot write output file \"%s\"", w->tmp_path);
+		if(!writer_replace(w->tmp_path, w->path)) {
+			remove(w->tmp_path);
+			fatal("cannot replace output file \"%s\"", w->path);
+		}
+	} else {
+		fclose(w->old);
+	}
+	buf_free(w->tmp_path);
+	buf_free(w->buf);
+	xfree(w->old_buf);
+	*w = (Writer){0};
+	return changed;
+}
@@ -4,39 +4,399 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <stddef.h>
+#include <setjmp.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
 
 #include "lib/lib.c"
 #include "print/print.c"
 #include "syntax/syntax.c"
 #include "resolver/resolver.c"
+#include "ir/ir.c"
+#include "x64/x64.c"
+#include "vm/vm.c"
+#include "codegen/codegen.c"
+#include "check/complexity.c"
 
 typedef map_type(const char*, i32) MyMap;
 
-void main_compile_file(const char* name, StrRange contents) {
+// Writes the typed and laid out package to out, as C or as an object.
+void main_generate(Package* pkg, const char* out) {
+	if(ir_dump || x64_native) {
+		trace_begin(TRACE_PHASE, "ir_package");
+		IrPackage ir;
+		ir_package(pkg, &ir);
+		trace_end();
+		if(ir_dump)
+			puts(string_ir_package(&ir));
+		if(x64_native) {
+			trace_begin(TRACE_PHASE, "x64_package");
+			x64_package(&ir, out);
+			trace_end();
+		}
+		ir_package_free(&ir);
+	}
+
+	if(!x64_native) {
+		trace_begin(TRACE_PHASE, "codegen_package");
+		codegen_package(pkg, out);
+		trace_end();
+	}
+}
+
+void main_compile_file(const char* name, StrRange contents, const char* out) {
+	trace_begin(TRACE_PHASE, "parse");
 	Parser p;
 	parser_init(&p, name, contents);
-
 	AstFile* file = parser_parse_file(&p);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "print");
 	puts(string_ast_file(file));
+	trace_end();
+
+	Package pkg;
+	package_init(&pkg, "<source>");
+	trace_begin(TRACE_PHASE, "package_add_file");
+	package_add_file(&pkg, file);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "resolver_resolve_package");
+	resolver_resolve_package(&pkg);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "typing_package");
+	typing_package(&pkg);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "layout_package");
+	layout_package(&pkg);
+	trace_end();
+
+	main_generate(&pkg, out);
+}
+
+// Runs the source in the bytecode interpreter, and returns the exit code
+// of the program.
+int main_run_file(const char* name, StrRange contents) {
+	trace_begin(TRACE_PHASE, "parse");
+	Parser p;
+	parser_init(&p, name, contents);
+	AstFile* file = parser_parse_file(&p);
+	trace_end();
 
 	Package pkg;
 	package_init(&pkg, "<source>");
+	trace_begin(TRACE_PHASE, "package_add_file");
 	package_add_file(&pkg, file);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "resolver_resolve_package");
+	resolver_resolve_package(&pkg);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "typing_package");
+	typing_package(&pkg);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "layout_package");
+	layout_package(&pkg);
+	trace_end();
+
+	trace_begin(TRACE_PHASE, "ir_package");
+	IrPackage ir;
+	ir_package(&pkg, &ir);
+	trace_end();
+	if(ir_dump)
+		puts(string_ir_package(&ir));
+	int code = vm_package(&ir);
+	ir_package_free(&ir);
+	return code;
+}
+
+// Compiles one version of the source into the incremental package pkg,
+// and writes it to out. Errors are reported and unwind here; the package
+// is then left in the middle of the session and must be freed.
+bool main_watch_session(Package* pkg, const char* name, StrRange contents, const char* out) {
+	jmp_buf jmp;
+	error_jmp = &jmp;
+	if(setjmp(jmp) != 0) {
+		error_jmp = NULL;
+		return false;
+	}
+	Parser p;
+	parser_init(&p, name, contents);
+	AstFile* file = parser_parse_file(&p);
+	package_begin_session(pkg);
+	package_add_file(pkg, file);
+	resolver_resolve_package(pkg);
+	typing_package(pkg);
+	layout_package(pkg);
+	package_end_session(pkg);
+	// the writer leaves the files whose contents did not change untouched
+	main_generate(pkg, out);
+	error_jmp = NULL;
+	return true;
+}
+
+// Compiles the source again every time it changes. A session keeps the
+// symbols of the previous one whose declaration and dependencies did not
+// change; after an error the next session starts from scratch.
+void main_watch(const char* name, const char* out) {
+	Package pkg;
+	bool have_pkg = false;
+	// the ASTs of kept symbols point into the sources they were parsed from
+	StrRange* sources = NULL;
+	StrRange last = { NULL, -1 };
+	while(true) {
+		FILE* file;
+		if(fopen_s(&file, name, "r") != 0) {
+			// being replaced by an editor
+			thrd_sleep(&(struct timespec){ .tv_nsec = 200 * 1000000 }, NULL);
+			continue;
+		}
+		fclose(file);
+		StrRange contents = read_file(name);
+		if(contents.l == last.l && (contents.l == 0 || memcmp(contents.s, last.s, contents.l) == 0)) {
+			xfree((char*)contents.s);
+			thrd_sleep(&(struct timespec){ .tv_nsec = 200 * 1000000 }, NULL);
+			continue;
+		}
+		buf_push(sources, contents);
+		last = contents;
+
+		if(!have_pkg) {
+			package_init(&pkg, "<source>");
+			pkg.incremental = true;
+			have_pkg = true;
+		}
+		i64 start = trace_now();
+		bool ok = main_watch_session(&pkg, name, contents, out);
+		if(buf_len(error_buf) > 0)
+			fwrite(error_buf, 1, buf_len(error_buf), stdout);
+		buf_clear(error_buf);
+		if(ok) {
+			printf("session %lld: re-resolved %lld of %lld symbols in %.3f ms\n", (long long)pkg.session,
+				(long long)pkg.resolved, (long long)buf_len(pkg.decl_symbols), (trace_now() - start) / 1000.0);
+		} else {
+			printf("session %lld failed, the next one starts from scratch\n", (long long)pkg.session);
+			package_free(&pkg);
+			have_pkg = false;
+			mpool_free(&ast_pool);
+			for(isize i = 0; i < buf_len(sources) - 1; i++) {
+				xfree((char*)sources[i].s);
+			}
+			sources[0] = last;
+			buf_truncate(sources, 1);
+		}
+		fflush(stdout);
+	}
+}
+
+typedef struct Flags {
+	bool mem_stats;
+	bool time;
+	bool check_complexity;
+	bool watch;
+	const char* trace;
+	const char* input;
+	const char* output;
+} Flags;
+
+Flags flags;
+
+void main_usage(void) {
+	printf("Usage: nc [options] <file.nl> <out.c>\n");
+	printf("       nc --native [options] <file.nl> <out.o>\n");
+	printf("       nc run [options] <file.nl>\n");
+	printf("       nc --check-complexity\n");
+	printf("Options:\n");
+	printf("  --mem-stats         print memory usage per subsystem\n");
+	printf("  --time              print wall time per compiler phase\n");
+	printf("  --trace=<out.json>  write a Chrome/Perfetto trace of the compilation\n");
+	printf("  --jobs=<n>          resolve symbols and optimize fns on n threads (default 1)\n");
+	printf("  --units=<n>         split the generated C into n files and a header\n");
+	printf("  --inline-limit=<n>  inline calls to non-recursive fns of size up to n (default 16, 0 for none)\n");
+	printf("  --inline-report     print whether every call is inlined in the generated C, and why\n");
+	printf("  --bounds-checks=<m> check array and slice indexes in the generated C: on, hoisted (default) or off\n");
+	printf("  --bounds-report     print the index checks left in the generated C, and why\n");
+	printf("  --reachable         only resolve symbols reachable from main and the exports\n");
+	printf("  --roots=<a,b,...>   only resolve symbols reachable from the given symbols\n");
+	printf("  --dump-ir           print the optimized SSA IR of every fn\n");
+	printf("  --native            write an x86-64 ELF object instead of C, for fast debug builds\n");
+	printf("  --layout-report     print size, alignment, padding and field offsets of every struct\n");
+	printf("  --watch             compile again on every change of the source, re-resolving only what changed\n");
+}
+
+bool main_parse_flags(int argc, const char* argv[]) {
+	const char* args[2];
+	isize nargs = 0;
+	int first = 1;
+	if(argc > 1 && strcmp(argv[1], "run") == 0) {
+		vm_run = true;
+		first = 2;
+	}
+	for(int i = first; i < argc; i++) {
+		const char* arg = argv[i];
+		if(strcmp(arg, "--mem-stats") == 0) {
+			flags.mem_stats = true;
+		} else if(strcmp(arg, "--check-complexity") == 0) {
+			flags.check_complexity = true;
+		} else if(strcmp(arg, "--time") == 0) {
+			flags.time = true;
+		} else if(strncmp(arg, "--trace=", 8) == 0) {
+			flags.trace = arg + 8;
+		} else if(strncmp(arg, "--jobs=", 7) == 0) {
+			char* end;
+			long jobs = strtol(arg + 7, &end, 10);
+			if(*end || jobs < 1) {
+				printf("invalid job count %s\n", arg + 7);
+				return false;
+			}
+			resolver_jobs = jobs;
+		} else if(strncmp(arg, "--units=", 8) == 0) {
+			char* end;
+			long units = strtol(arg + 8, &end, 10);
+			if(*end || units < 1) {
+				printf("invalid unit count %s\n", arg + 8);
+				return false;
+			}
+			codegen_units = units;
+		} else if(strncmp(arg, "--inline-limit=", 15) == 0) {
+			char* end;
+			long limit = strtol(arg + 15, &end, 10);
+			if(*end || limit < 0) {
+				printf("invalid inline limit %s\n", arg + 15);
+				return false;
+			}
+			codegen_inline_limit = limit;
+		} else if(strcmp(arg, "--inline-report") == 0) {
+			codegen_inline_report = true;
+		} else if(strncmp(arg, "--bounds-checks=", 16) == 0) {
+			const char* mode = arg + 16;
+			if(strcmp(mode, "on") == 0) {
+				bounds_mode = BOUNDS_MODE_ON;
+			} else if(strcmp(mode, "hoisted") == 0) {
+				bounds_mode = BOUNDS_MODE_HOISTED;
+			} else if(strcmp(mode, "off") == 0) {
+				bounds_mode = BOUNDS_MODE_OFF;
+			} else {
+				printf("invalid bounds check mode %s\n", mode);
+				return false;
+			}
+		} else if(strcmp(arg, "--bounds-report") == 0) {
+			bounds_report = true;
+		} else if(strcmp(arg, "--dump-ir") == 0) {
+			ir_dump = true;
+		} else if(strcmp(arg, "--native") == 0) {
+			x64_native = true;
+		} else if(strcmp(arg, "--layout-report") == 0) {
+			layout_report = true;
+		} else if(strcmp(arg, "--watch") == 0) {
+			flags.watch = true;
+		} else if(strcmp(arg, "--reachable") == 0) {
+			resolver_reachable = true;
+		} else if(strncmp(arg, "--roots=", 8) == 0) {
+			// the names are interned by main_add_roots
+			resolver_reachable = true;
+		} else if(arg[0] == '-' && arg[1] == '-') {
+			printf("unknown option %s\n", arg);
+			return false;
+		} else if(nargs < 2) {
+			args[nargs++] = arg;
+		} else {
+			return false;
+		}
+	}
+	if(flags.check_complexity)
+		return nargs == 0;
+	if(flags.watch && resolver_reachable) {
+		printf("--watch cannot be combined with --reachable or --roots\n");
+		return false;
+	}
+	if(bounds_report && bounds_mode != BOUNDS_MODE_HOISTED) {
+		printf("--bounds-report needs --bounds-checks=hoisted\n");
+		return false;
+	}
+	if(x64_native && codegen_units > 1) {
+		printf("--native cannot be combined with --units\n");
+		return false;
+	}
+	if(vm_run && (x64_native || codegen_units > 1 || flags.watch)) {
+		printf("nc run cannot be combined with --native, --units or --watch\n");
+		return false;
+	}
+	if(vm_run) {
+		if(nargs != 1)
+			return false;
+		flags.input = args[0];
+		return true;
+	}
+	if(nargs != 2)
+		return false;
+	flags.input = args[0];
+	flags.output = args[1];
+	return true;
+}
+
+void main_add_roots(const char* list) {
+	for(const char* name = list; *name; ) {
+		const char* end = strchr(name, ',');
+		end = end ? end : name + strlen(name);
+		if(end > name)
+			buf_push(resolver_roots, str_intern(string_range_len(name, end - name)));
+		name = *end ? end + 1 : end;
+	}
 }
 
 int main(int argc, const char* argv[]) {
-	if(argc != 3) {
-		printf("Usage: nc <file.nl> <out.c>\n");
+	if(!main_parse_flags(argc, argv)) {
+		main_usage();
 		return 1;
 	}
+	// must be set before the first allocation
+	mem_stats_enabled = flags.mem_stats || flags.check_complexity;
+	for(int i = 1; i < argc; i++) {
+		if(strncmp(argv[i], "--roots=", 8) == 0)
+			main_add_roots(argv[i] + 8);
+	}
+	if(flags.check_complexity)
+		return complexity_check() ? 0 : 1;
+	if(flags.watch) {
+		main_watch(flags.input, flags.output);
+		return 0;
+	}
+	if(flags.time || flags.trace)
+		trace_init();
 
-	StrRange contents = read_file(argv[1]);
-	main_compile_file(argv[1], contents);
-	return 0;
+	trace_begin(TRACE_PHASE, "read_file");
+	StrRange contents = read_file(flags.input);
+	trace_end();
+	int code = 0;
+	if(vm_run)
+		code = main_run_file(flags.input, contents);
+	else
+		main_compile_file(flags.input, contents, flags.output);
+#ifdef BUF_GROW_STATS
+	buf_grow_stats_print();
+#endif
+	if(flags.mem_stats) {
+		mem_stats_print();
+		ast_stats_print();
+	}
+	if(flags.time)
+		trace_print_phases();
+	if(flags.trace)
+		write_file(flags.trace, string_range_c(trace_json()));
+	return code;
 }
-
@@ -1,31 +1,34 @@
 // Copyright 2018 Simone Miraglia. See the LICENSE
 // file at the top-level directory of this distribution
 
-typedef int (*p_printf_type)(const char* fmt, ...);
-p_printf_type p_printf = printf;
+// Printers append their output to p_buf through the string builder;
+// the string_* wrappers collect it and return it as a C string.
+_Thread_local char* p_buf;
 
-char* p_printf_buffer;
-int p_printf_to_buffer(const char* fmt, ...) {
-	va_list args;
+#define p_puts(s)    buf_puts(p_buf, s)
+#define p_putr(r)    buf_putr(p_buf, r)
+#define p_putc(c)    buf_putc(p_buf, c)
+#define p_putn(c, n) buf_putn(p_buf, c, n)
+#define p_putu(x)    buf_putu(p_buf, x)
+#define p_puti(x)    buf_puti(p_buf, x)
+
+int p_printf(const char* fmt, ...) {
+    va_list args;
     va_start(args, fmt);
-    buf_vprintf(p_printf_buffer, fmt, args);
+    buf_vprintf(p_buf, fmt, args);
     va_end(args);
     return 0;
 }
 
 #define PRINT_STRING_FUNC_IMPL(name, args1, args2) \
 const char* string_##name args1 {\
-    p_printf_type old_printf = p_printf;\
-    p_printf = p_printf_to_buffer;\
-    p_printf_buffer = NULL;\
+    char* old_buf = p_buf;\
+    MemTag old_tag = mem_tag_set(MEM_PRINTER);\
+    p_buf = NULL;\
     print_##name args2;\
-    char* ret = "";\
-    if(p_printf_buffer) {\
-        ret = memdup(p_printf_buffer, buf_len(p_printf_buffer) + 1);\
-        ret[buf_len(p_printf_buffer)] = '\0';\
-        buf_free(p_printf_buffer);\
-    }\
-    p_printf = old_printf;\
+    const char* ret = p_buf ? p_buf : "";\
+    p_buf = old_buf;\
+    mem_tag_set(old_tag);\
     return ret;\
 }
 
@@ -0,0 +1,387 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Compile-time evaluation of constant expressions: const initializers,
+// array lengths and enum discriminants. Integers are computed with the
+// exact width and signedness of their type and overflow is an error, so
+// results do not depend on the host. Untyped ints are evaluated as i64
+// and untyped floats as f64 until they meet a typed operand.
+// A const symbol is evaluated once, when it is declared, and its value is
+// kept in Symbol.value.
+
+Symbol* resolver_resolve_name(Package* pkg, FileLoc loc, StrIntern name, bool needresolve);
+Type* resolver_resolve_typedecl(Package* pkg, AstType* type);
+
+const char* const_type_name(ConstValue v) {
+	if(v.type)
+		return string_type(v.type);
+	return v.kind == CONST_INT ? "untyped int" : "untyped float";
+}
+
+Type* const_default_type(ConstValue v) {
+	if(v.type)
+		return v.type;
+	return v.kind == CONST_INT ? primitive_i64 : primitive_f64;
+}
+
+i64 const_min(Type* t) {
+	return t->size == 8 ? INT64_MIN : -((i64)1 << (t->size * 8 - 1));
+}
+i64 const_max(Type* t) {
+	return t->size == 8 ? INT64_MAX : ((i64)1 << (t->size * 8 - 1)) - 1;
+}
+u64 const_umax(Type* t) {
+	return t->size == 8 ? UINT64_MAX : ((u64)1 << (t->size * 8)) - 1;
+}
+
+// f32 constants are rounded after every operation
+double const_round(Type* t, double f) {
+	return t == primitive_f32 ? (double)(float)f : f;
+}
+
+// converts an untyped constant to type, the value must be representable
+ConstValue const_convert(FileLoc loc, ConstValue v, Type* type) {
+	if(v.type == type)
+		return v;
+	if(v.type)
+		resolve_error(loc, "cannot use constant of type '%s' as '%s'", const_type_name(v), string_type(type));
+	ConstValue r = { v.kind, type };
+	bool fits = true;
+	switch(type->kind) {
+		case TYPE_SIGNED:
+			fits = v.kind == CONST_INT && v.i >= const_min(type) && v.i <= const_max(type);
+			r.i = v.i;
+			break;
+		case TYPE_UNSIGNED:
+			fits = v.kind == CONST_INT && v.i >= 0 && (u64)v.i <= const_umax(type);
+			r.u = (u64)v.i;
+			break;
+		case TYPE_FLOAT:
+			r.kind = CONST_FLOAT;
+			r.f = const_round(type, v.kind == CONST_INT ? (double)v.i : v.f);
+			break;
+		default:
+			fits = false;
+			break;
+	}
+	if(!fits)
+		resolve_error(loc, "constant of type '%s' does not fit in '%s'", const_type_name(v), string_type(type));
+	return r;
+}
+
+// a * b for signed ints, false on overflow of i64
+bool const_mul_i64(i64 a, i64 b, i64* r) {
+	if(a > 0 ? (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a)
+	         : (b > 0 ? a < INT64_MIN / b : a != 0 && b < INT64_MAX / a))
+		return false;
+	*r = a * b;
+	return true;
+}
+
+ConstValue const_binary_int(FileLoc loc, TokenKind op, ConstValue x, ConstValue y) {
+	Type* type = const_default_type(x);
+	isize bits = type->size * 8;
+	ConstValue r = x;
+	bool overflow = false;
+	if(type->kind == TYPE_UNSIGNED) {
+		u64 a = x.u, b = y.u;
+		switch(op) {
+			case T_ADD: r.u = a + b; overflow = r.u < a; break;
+			case T_SUB: r.u = a - b; overflow = a < b; break;
+			case T_MUL: r.u = a * b; overflow = a != 0 && r.u / a != b; break;
+			case T_DIV: case T_REM:
+				if(b == 0)
+					resolve_error(loc, "division by zero in constant expression");
+				r.u = op == T_DIV ? a / b : a % b;
+				break;
+			case T_AND: r.u = a & b; break;
+			case T_OR: r.u = a | b; break;
+			case T_XOR: r.u = a ^ b; break;
+			case T_LSHIFT: case T_RSHIFT:
+				if(b >= (u64)bits)
+					resolve_error(loc, "shift count %llu out of range for '%s'", (unsigned long long)b, string_type(type));
+				r.u = op == T_LSHIFT ? a << b : a >> b;
+				overflow = op == T_LSHIFT && r.u >> b != a;
+				break;
+			default:
+				resolve_error(loc, "operator '%s' not defined on '%s'", token_kind_names[op], string_type(type));
+		}
+		overflow = overflow || r.u > const_umax(type);
+	} else {
+		i64 a = x.i, b = y.i;
+		switch(op) {
+			case T_ADD:
+				overflow = (b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b);
+				r.i = overflow ? 0 : a + b;
+				break;
+			case T_SUB:
+				overflow = (b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b);
+				r.i = overflow ? 0 : a - b;
+				break;
+			case T_MUL:
+				overflow = !const_mul_i64(a, b, &r.i);
+				break;
+			case T_DIV: case T_REM:
+				if(b == 0)
+					resolve_error(loc, "division by zero in constant expression");
+				if(b == -1) {
+					// INT64_MIN / -1 does not fit, INT64_MIN % -1 traps on x86
+					overflow = op == T_DIV && a == INT64_MIN;
+					r.i = op == T_DIV && !overflow ? -a : 0;
+					break;
+				}
+				r.i = op == T_DIV ? a / b : a % b;
+				break;
+			case T_AND: r.i = a & b; break;
+			case T_OR: r.i = a | b; break;
+			case T_XOR: r.i = a ^ b; break;
+			case T_LSHIFT: case T_RSHIFT:
+				if(b < 0 || b >= bits)
+					resolve_error(loc, "shift count %lld out of range for '%s'", (long long)b, const_type_name(x));
+				r.i = a;
+				if(op == T_RSHIFT) {
+					// rounds toward minus infinity, also for negative values
+					r.i = a < 0 ? ~(~a >> b) : a >> b;
+					break;
+				}
+				for(i64 k = 0; k < b && !overflow; k++) {
+					overflow = !const_mul_i64(r.i, 2, &r.i);
+				}
+				break;
+			default:
+				resolve_error(loc, "operator '%s' not defined on '%s'", token_kind_names[op], const_type_name(x));
+		}
+		overflow = overflow || r.i < const_min(type) || r.i > const_max(type);
+	}
+	if(overflow)
+		resolve_error(loc, "constant overflow in '%s' on '%s'", token_kind_names[op], const_type_name(x));
+	return r;
+}
+
+ConstValue const_binary_float(FileLoc loc, TokenKind op, ConstValue x, ConstValue y) {
+	ConstValue r = x;
+	switch(op) {
+		case T_ADD: r.f = x.f + y.f; break;
+		case T_SUB: r.f = x.f - y.f; break;
+		case T_MUL: r.f = x.f * y.f; break;
+		case T_DIV: r.f = x.f / y.f; break;
+		default:
+			resolve_error(loc, "operator '%s' not defined on '%s'", token_kind_names[op], const_type_name(x));
+	}
+	r.f = const_round(const_default_type(x), r.f);
+	return r;
+}
+
+ConstValue const_compare(FileLoc loc, TokenKind op, ConstValue x, ConstValue y) {
+	// -1, 0, 1 as x is less, equal or greater than y
+	int cmp = 0;
+	switch(x.kind) {
+		case CONST_INT:
+			if(x.type && x.type->kind == TYPE_UNSIGNED)
+				cmp = (x.u > y.u) - (x.u < y.u);
+			else
+				cmp = (x.i > y.i) - (x.i < y.i);
+			break;
+		case CONST_FLOAT:
+			cmp = (x.f > y.f) - (x.f < y.f);
+			break;
+		case CONST_BOOL:
+			if(op != T_EQL && op != T_NEQ)
+				resolve_error(loc, "operator '%s' not defined on 'bool'", token_kind_names[op]);
+			cmp = x.b != y.b;
+			break;
+	}
+	bool b = false;
+	switch(op) {
+		case T_EQL: b = cmp == 0; break;
+		case T_NEQ: b = cmp != 0; break;
+		case T_LT: b = cmp < 0; break;
+		case T_GT: b = cmp > 0; break;
+		case T_LTE: b = cmp <= 0; break;
+		case T_GTE: b = cmp >= 0; break;
+		default: assert(0); break;
+	}
+	// NaN is unordered: only != holds
+	if(x.kind == CONST_FLOAT && (x.f != x.f || y.f != y.f))
+		b = op == T_NEQ;
+	return (ConstValue){ CONST_BOOL, primitive_bool, .b = b };
+}
+
+ConstValue const_binary(FileLoc loc, TokenKind op, ConstValue x, ConstValue y) {
+	if(x.type && !y.type) {
+		y = const_convert(loc, y, x.type);
+	} else if(y.type && !x.type) {
+		x = const_convert(loc, x, y.type);
+	} else if(!x.type && !y.type && x.kind != y.kind) {
+		// untyped int and untyped float
+		if(x.kind == CONST_INT)
+			x = (ConstValue){ CONST_FLOAT, NULL, .f = (double)x.i };
+		else
+			y = (ConstValue){ CONST_FLOAT, NULL, .f = (double)y.i };
+	}
+	if(x.type != y.type) {
+		resolve_error(loc, "mismatched types '%s' and '%s' in constant expression",
+			const_type_name(x), const_type_name(y));
+	}
+	switch(op) {
+		case T_EQL: case T_NEQ: case T_LT: case T_GT: case T_LTE: case T_GTE:
+			return const_compare(loc, op, x, y);
+		case T_LAND: case T_LOR:
+			if(x.kind != CONST_BOOL)
+				resolve_error(loc, "operator '%s' not defined on '%s'", token_kind_names[op], const_type_name(x));
+			x.b = op == T_LAND ? x.b && y.b : x.b || y.b;
+			return x;
+		default:
+			break;
+	}
+	switch(x.kind) {
+		case CONST_INT:
+			return const_binary_int(loc, op, x, y);
+		case CONST_FLOAT:
+			return const_binary_float(loc, op, x, y);
+		default:
+			resolve_error(loc, "operator '%s' not defined on 'bool'", token_kind_names[op]);
+			return x;
+	}
+}
+
+ConstValue const_unary(FileLoc loc, TokenKind op, ConstValue x) {
+	Type* type = const_default_type(x);
+	bool is_unsigned = type->kind == TYPE_UNSIGNED;
+	switch(op) {
+		case T_ADD:
+			if(x.kind != CONST_BOOL)
+				return x;
+			break;
+		case T_SUB:
+			if(x.kind == CONST_FLOAT) {
+				x.f = -x.f;
+				return x;
+			}
+			if(x.kind != CONST_INT)
+				break;
+			if(is_unsigned ? x.u != 0 : x.i == const_min(type))
+				resolve_error(loc, "constant overflow in '-' on '%s'", const_type_name(x));
+			x.i = -x.i;
+			return x;
+		case T_NOT:
+			// logical not on bools, bitwise not on ints
+			if(x.kind == CONST_BOOL) {
+				x.b = !x.b;
+				return x;
+			}
+			if(x.kind != CONST_INT)
+				break;
+			if(is_unsigned)
+				x.u = ~x.u & const_umax(type);
+			else
+				x.i = ~x.i;
+			return x;
+		default:
+			break;
+	}
+	resolve_error(loc, "operator '%s' not defined on '%s'", token_kind_names[op],
+		x.kind == CONST_BOOL ? "bool" : const_type_name(x));
+	return x;
+}
+
+// Casts between ints wrap to the width of the target type, like the
+// generated code does; casts from floats must be in range.
+ConstValue const_cast(FileLoc loc, ConstValue v, Type* type) {
+	ConstValue r = { CONST_INT, type };
+	switch(type->kind) {
+		case TYPE_SIGNED:
+		case TYPE_UNSIGNED: {
+			u64 mask = const_umax(type);
+			if(v.kind == CONST_FLOAT) {
+				bool fits = type->kind == TYPE_UNSIGNED
+					? v.f > -1.0 && v.f < (double)mask + 1.0
+					: v.f > (double)const_min(type) - 1.0 && v.f < (double)const_max(type) + 1.0;
+				if(!fits)
+					resolve_error(loc, "constant %g does not fit in '%s'", v.f, string_type(type));
+				if(type->kind == TYPE_UNSIGNED)
+					r.u = (u64)v.f;
+				else
+					r.i = (i64)v.f;
+				return r;
+			}
+			u64 bits = (v.kind == CONST_BOOL ? (u64)v.b : v.u) & mask;
+			if(type->kind == TYPE_UNSIGNED) {
+				r.u = bits;
+			} else {
+				u64 sign = mask ^ (mask >> 1);
+				r.i = bits & sign ? -(i64)(~bits & mask) - 1 : (i64)bits;
+			}
+			return r;
+		}
+		case TYPE_FLOAT:
+			if(v.kind == CONST_BOOL)
+				break;
+			r.kind = CONST_FLOAT;
+			if(v.kind == CONST_FLOAT)
+				r.f = v.f;
+			else
+				r.f = v.type && v.type->kind == TYPE_UNSIGNED ? (double)v.u : (double)v.i;
+			r.f = const_round(type, r.f);
+			return r;
+		case TYPE_BOOLEAN:
+			if(v.kind == CONST_BOOL)
+				return v;
+			break;
+		default:
+			break;
+	}
+	resolve_error(loc, "cannot cast constant of type '%s' to '%s'",
+		v.kind == CONST_BOOL ? "bool" : const_type_name(v), string_type(type));
+	return r;
+}
+
+ConstValue const_eval(Package* pkg, AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+			if(expr->lit_int > (u64)INT64_MAX)
+				resolve_error(expr->loc, "integer constant too large");
+			return (ConstValue){ CONST_INT, NULL, .i = (i64)expr->lit_int };
+		case AST_EXPR_LIT_FLOAT:
+			return (ConstValue){ CONST_FLOAT, NULL, .f = expr->lit_float };
+		case AST_EXPR_LIT_CHAR:
+			return (ConstValue){ CONST_INT, NULL, .i = expr->lit_char };
+		case AST_EXPR_IDENT: {
+			if(expr->ident.depth >= 0)
+				resolve_error(expr->loc, "local '%s' is not a constant", expr->ident.name);
+			Symbol* sym = expr->ident.sym;
+			if(!sym)
+				sym = resolver_resolve_name(pkg, expr->loc, expr->ident.name, false);
+			if(!sym)
+				resolve_error(expr->loc, "undeclared identifier '%s'", expr->ident.name);
+			if(sym->kind != SYMBOL_CONST)
+				resolve_error(expr->loc, "'%s' is not a constant", expr->ident.name);
+			// consts are declared in dependency order
+			assert(sym->state >= SYMSTATE_DECLARED);
+			return sym->cold->value;
+		}
+		case AST_EXPR_UNARY:
+			return const_unary(expr->loc, expr->unary.op, const_eval(pkg, expr->unary.x));
+		case AST_EXPR_BINARY: {
+			ConstValue x = const_eval(pkg, expr->binary.x);
+			ConstValue y = const_eval(pkg, expr->binary.y);
+			return const_binary(expr->loc, expr->binary.op, x, y);
+		}
+		case AST_EXPR_CAST: {
+			ConstValue x = const_eval(pkg, expr->cast.x);
+			return const_cast(expr->loc, x, resolver_resolve_typedecl(pkg, expr->cast.type));
+		}
+		default:
+			resolve_error(expr->loc, "expression is not constant");
+			return (ConstValue){0};
+	}
+}
+
+// evaluates an array length, which must be a non-negative int
+i64 const_eval_len(Package* pkg, AstExpr* expr) {
+	ConstValue v = const_eval(pkg, expr);
+	bool is_unsigned = v.type && v.type->kind == TYPE_UNSIGNED;
+	if(v.kind != CONST_INT || (is_unsigned ? v.u > (u64)INT64_MAX : v.i < 0))
+		resolve_error(expr->loc, "array length must be a non-negative integer constant");
+	return v.i;
+}
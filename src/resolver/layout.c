@@ -0,0 +1,418 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Layout of aggregate types: size, alignment and field offsets of arrays,
+// tuples, structs and enums. Struct fields are laid out in declaration
+// order, as in C, unless the struct is declared with @reorder: then the
+// fields are sorted by decreasing alignment and the bool fields are packed
+// in a bitset after them, so there is no padding between fields.
+// Layouts are computed after resolution, on one thread. Nested types are
+// laid out first, with an explicit stack, so deep nesting does not
+// overflow the C stack; a type that contains itself by value is an error.
+// Enums store their tag in a niche of their payload when they can (see
+// TypeNiche), so an optional pointer or bool is as large as the pointer or
+// bool itself; otherwise the tag is the smallest integer that fits.
+
+// print the layout of every struct (--layout-report)
+bool layout_report;
+
+#define LAYOUT_PENDING -1
+
+typedef struct LayoutFrame {
+	Type* type;
+	isize next;  // next component to lay out
+} LayoutFrame;
+
+typedef struct LayoutSlot {
+	isize align;
+	isize index;
+} LayoutSlot;
+
+// components are the types stored by value inside t
+isize layout_components_len(Type* t) {
+	switch(t->kind) {
+		case TYPE_ARRAY:
+			return 1;
+		case TYPE_TUPLE:
+			return t->tuple.args_len;
+		case TYPE_STRUCT:
+			return t->struct_.fields_len;
+		case TYPE_ENUM:
+			return t->enum_.variants_len;
+		default:
+			return 0;
+	}
+}
+
+Type* layout_component(Type* t, isize i) {
+	switch(t->kind) {
+		case TYPE_ARRAY:
+			return t->array.base;
+		case TYPE_TUPLE:
+			return t->tuple.args[i];
+		case TYPE_STRUCT:
+			return t->struct_.fields[i].type;
+		case TYPE_ENUM:
+			return t->enum_.variants[i].payload;
+		default:
+			assert(0);
+			return NULL;
+	}
+}
+
+// location of a nominal type, structural types have none
+FileLoc layout_loc(Type* t) {
+	if(t->symbol && t->symbol->decl)
+		return t->symbol->decl->loc;
+	return (FileLoc){ "<type>" };
+}
+
+isize layout_add(Type* t, isize a, isize b) {
+	if(a > INTPTR_MAX - b)
+		resolve_error(layout_loc(t), "type '%s' is too large", string_type(t));
+	return a + b;
+}
+
+int layout_cmp_slot(const void* x, const void* y) {
+	const LayoutSlot* a = x;
+	const LayoutSlot* b = y;
+	if(a->align != b->align)
+		return a->align > b->align ? -1 : 1;
+	return a->index < b->index ? -1 : a->index > b->index;
+}
+
+// Sets the offsets of fields and returns the size of the struct. Fields
+// must be laid out already.
+isize layout_fields(Type* t, TypeField* fields, isize len, bool reorder, isize* align) {
+	isize offset = 0;
+	*align = 1;
+	if(!reorder) {
+		for(isize i = 0; i < len; i++) {
+			Type* ft = fields[i].type;
+			offset = ALIGN_UP(offset, ft->align);
+			fields[i].offset = offset;
+			fields[i].bit = -1;
+			offset = layout_add(t, offset, ft->size);
+			*align = MAX(*align, ft->align);
+		}
+		return ALIGN_UP(offset, *align);
+	}
+
+	LayoutSlot* slots = NULL;
+	isize bools = 0;
+	for(isize i = 0; i < len; i++) {
+		if(fields[i].type == primitive_bool)
+			bools++;
+		else
+			buf_push(slots, (LayoutSlot){ fields[i].type->align, i });
+	}
+	// sizes are multiples of the alignment, so by decreasing alignment
+	// every field starts right after the previous one
+	if(slots)
+		qsort(slots, buf_len(slots), sizeof(LayoutSlot), layout_cmp_slot);
+	for(isize i = 0; i < buf_len(slots); i++) {
+		TypeField* f = &fields[slots[i].index];
+		f->offset = offset;
+		f->bit = -1;
+		offset = layout_add(t, offset, f->type->size);
+		*align = MAX(*align, f->type->align);
+	}
+	isize k = 0;
+	for(isize i = 0; i < len; i++) {
+		if(fields[i].type != primitive_bool)
+			continue;
+		fields[i].offset = offset + k / 8;
+		fields[i].bit = k % 8;
+		k++;
+	}
+	offset = layout_add(t, offset, (bools + 7) / 8);
+	buf_free(slots);
+	return ALIGN_UP(offset, *align);
+}
+
+u64 layout_niche_mask(isize size) {
+	return size == 8 ? UINT64_MAX : ((u64)1 << (size * 8)) - 1;
+}
+
+// number of values outside the valid range
+u64 layout_niche_count(TypeNiche n) {
+	return n.size ? (n.start - n.end - 1) & layout_niche_mask(n.size) : 0;
+}
+
+// keeps the larger niche, the first one on ties
+void layout_niche_candidate(TypeNiche* best, Type* t, isize offset) {
+	if(layout_niche_count(t->niche) > layout_niche_count(*best)) {
+		*best = t->niche;
+		best->offset += offset;
+	}
+}
+
+// smallest integer type holding every discriminant
+Type* layout_tag_type(i64 min, i64 max) {
+	if(min >= 0) {
+		return max <= UINT8_MAX ? primitive_u8 : max <= UINT16_MAX ? primitive_u16
+			: max <= UINT32_MAX ? primitive_u32 : primitive_u64;
+	}
+	if(min >= INT8_MIN && max <= INT8_MAX)
+		return primitive_i8;
+	if(min >= INT16_MIN && max <= INT16_MAX)
+		return primitive_i16;
+	return min >= INT32_MIN && max <= INT32_MAX ? primitive_i32 : primitive_i64;
+}
+
+// An enum with a single variant has no tag. When only one variant has a
+// non-empty payload and that payload has enough invalid values, the other
+// variants are stored as those values and there is no tag either.
+// Otherwise the tag comes first, followed by the largest payload.
+void layout_enum(Type* t) {
+	isize len = t->enum_.variants_len;
+	t->enum_.niche_variant = -1;
+	t->enum_.payload_offset = 0;
+	t->niche = (TypeNiche){0};
+	if(len == 0) {
+		t->enum_.tag = NULL;
+		t->size = 0;
+		t->align = 1;
+		return;
+	}
+	i64 min = INT64_MAX, max = INT64_MIN;
+	isize payload_size = 0, payload_align = 1;
+	isize dataful = -1, ndataful = 0;
+	for(isize i = 0; i < len; i++) {
+		TypeVariant* v = &t->enum_.variants[i];
+		min = MIN(min, v->value);
+		max = MAX(max, v->value);
+		if(v->payload) {
+			payload_size = MAX(payload_size, v->payload->size);
+			payload_align = MAX(payload_align, v->payload->align);
+			if(v->payload->size > 0) {
+				dataful = i;
+				ndataful++;
+			}
+		}
+	}
+
+	Type* payload = dataful >= 0 ? t->enum_.variants[dataful].payload : NULL;
+	if(len == 1 || (ndataful == 1 && layout_niche_count(payload->niche) >= (u64)len - 1)) {
+		isize d = len == 1 ? 0 : dataful;
+		payload = t->enum_.variants[d].payload;
+		t->enum_.tag = NULL;
+		t->enum_.niche_variant = d;
+		t->size = payload ? payload->size : 0;
+		t->align = payload ? payload->align : 1;
+		if(!payload)
+			return;
+		// the other variants take the values right after the valid range
+		TypeNiche niche = payload->niche;
+		u64 mask = layout_niche_mask(niche.size);
+		for(isize i = 0; i < len; i++) {
+			if(i == d)
+				continue;
+			niche.end = (niche.end + 1) & mask;
+			t->enum_.variants[i].niche_value = niche.end;
+		}
+		t->niche = niche;
+		return;
+	}
+
+	Type* tag = layout_tag_type(min, max);
+	t->enum_.tag = tag;
+	t->enum_.payload_offset = ALIGN_UP(tag->size, payload_align);
+	t->align = MAX(tag->align, payload_align);
+	t->size = ALIGN_UP(layout_add(t, t->enum_.payload_offset, payload_size), t->align);
+	u64 mask = layout_niche_mask(tag->size);
+	t->niche = (TypeNiche){ 0, tag->size, (u64)min & mask, (u64)max & mask };
+}
+
+// computes the layout of t, its components are laid out already
+void layout_compute(Type* t) {
+	switch(t->kind) {
+		case TYPE_ARRAY: {
+			Type* base = t->array.base;
+			if(t->array.len > 0 && base->size > INTPTR_MAX / t->array.len)
+				resolve_error(layout_loc(t), "type '%s' is too large", string_type(t));
+			t->size = base->size * t->array.len;
+			t->align = base->align;
+			t->niche = t->array.len > 0 ? base->niche : (TypeNiche){0};
+			break;
+		}
+		case TYPE_TUPLE: {
+			isize offset = 0, align = 1;
+			TypeNiche niche = {0};
+			for(isize i = 0; i < t->tuple.args_len; i++) {
+				Type* arg = t->tuple.args[i];
+				offset = ALIGN_UP(offset, arg->align);
+				layout_niche_candidate(&niche, arg, offset);
+				offset = layout_add(t, offset, arg->size);
+				align = MAX(align, arg->align);
+			}
+			t->niche = niche;
+			t->size = ALIGN_UP(offset, align);
+			t->align = align;
+			break;
+		}
+		case TYPE_STRUCT: {
+			bool reorder = t->symbol->decl->attrs & AST_ATTR_REORDER;
+			isize align;
+			t->size = layout_fields(t, t->struct_.fields, t->struct_.fields_len, reorder, &align);
+			t->align = align;
+			TypeNiche niche = {0};
+			for(isize i = 0; i < t->struct_.fields_len; i++) {
+				TypeField* f = &t->struct_.fields[i];
+				if(f->bit < 0)
+					layout_niche_candidate(&niche, f->type, f->offset);
+			}
+			t->niche = niche;
+			break;
+		}
+		case TYPE_ENUM:
+			layout_enum(t);
+			break;
+		default:
+			assert(0);
+			break;
+	}
+}
+
+// the cycle is the part of the stack from t to the top
+void layout_error_cycle(LayoutFrame* stack, Type* t) {
+	isize first = buf_len(stack) - 1;
+	while(stack[first].type != t) {
+		first--;
+	}
+	Type* named = NULL;
+	char* msg = NULL;
+	for(isize i = first; i < buf_len(stack); i++) {
+		if(!named && stack[i].type->symbol && stack[i].type->symbol->decl)
+			named = stack[i].type;
+		buf_printf(msg, "'%s' -> ", string_type(stack[i].type));
+	}
+	buf_printf(msg, "'%s'", string_type(t));
+	assert(named);  // structural types cannot contain themselves
+	resolve_error(layout_loc(named), "type '%s' contains itself: %s", string_type(named), msg);
+}
+
+void layout_type(Type* type) {
+	if(!type || type->align != 0)
+		return;
+	LayoutFrame* stack = NULL;
+	type->align = LAYOUT_PENDING;
+	buf_push(stack, (LayoutFrame){ type, 0 });
+	while(buf_len(stack) > 0) {
+		LayoutFrame* f = &stack[buf_len(stack) - 1];
+		if(f->next < layout_components_len(f->type)) {
+			Type* c = layout_component(f->type, f->next++);
+			if(!c || c->align > 0)
+				continue;
+			if(c->align == LAYOUT_PENDING)
+				layout_error_cycle(stack, c);
+			c->align = LAYOUT_PENDING;
+			buf_push(stack, (LayoutFrame){ c, 0 });
+			continue;
+		}
+		layout_compute(f->type);
+		buf_truncate(stack, buf_len(stack) - 1);
+	}
+	buf_free(stack);
+}
+
+// bytes of t not used by any field
+isize layout_padding(Type* t) {
+	isize used = 0, bools = 0;
+	bool packed = t->symbol->decl->attrs & AST_ATTR_REORDER;
+	for(isize i = 0; i < t->struct_.fields_len; i++) {
+		Type* ft = t->struct_.fields[i].type;
+		if(packed && ft == primitive_bool)
+			bools++;
+		else
+			used += ft->size;
+	}
+	return t->size - used - (bools + 7) / 8;
+}
+
+void layout_print_struct(Type* t) {
+	isize len = t->struct_.fields_len;
+	printf("struct %s: size %lld, align %lld, padding %lld\n", t->symbol->name,
+		(long long)t->size, (long long)t->align, (long long)layout_padding(t));
+	for(isize i = 0; i < len; i++) {
+		TypeField* f = &t->struct_.fields[i];
+		printf("    %s: %s, offset %lld", f->name, string_type(f->type), (long long)f->offset);
+		if(f->bit >= 0)
+			printf(" bit %d", f->bit);
+		printf("\n");
+	}
+	if(t->symbol->decl->attrs & AST_ATTR_REORDER)
+		return;
+	// try the reordered layout on a copy of the fields
+	TypeField* fields = xmalloc(MAX(len, 1) * sizeof(TypeField));
+	memcpy(fields, t->struct_.fields, len * sizeof(TypeField));
+	isize align;
+	isize size = layout_fields(t, fields, len, true, &align);
+	if(size < t->size)
+		printf("    @reorder would make it %lld bytes\n", (long long)size);
+	xfree(fields);
+}
+
+void layout_print_enum(Type* t) {
+	printf("enum %s: size %lld, align %lld", t->symbol->name, (long long)t->size, (long long)t->align);
+	isize d = t->enum_.niche_variant;
+	if(t->enum_.tag) {
+		printf(", tag %s", string_type(t->enum_.tag));
+		if(t->size > t->enum_.tag->size)
+			printf(", payload at offset %lld", (long long)t->enum_.payload_offset);
+		printf("\n");
+	} else if(t->enum_.variants_len > 1) {
+		printf(", tag in the niche of '%s' at offset %lld\n", t->enum_.variants[d].name, (long long)t->niche.offset);
+	} else {
+		printf(", no tag\n");
+	}
+	for(isize i = 0; i < t->enum_.variants_len; i++) {
+		TypeVariant* v = &t->enum_.variants[i];
+		printf("    %s", v->name);
+		if(v->payload)
+			printf(v->payload->kind == TYPE_TUPLE ? "%s" : "(%s)", string_type(v->payload));
+		if(t->enum_.tag)
+			printf(" = %lld", (long long)v->value);
+		else if(i != d)
+			printf(" = %#llx in the niche", (unsigned long long)v->niche_value);
+		printf("\n");
+	}
+}
+
+// lays out the types of every resolved symbol
+void layout_package(Package* pkg) {
+	Symbol** syms = pkg->decl_symbols;
+	if(pkg->incremental) {
+		// fields may have changed since the previous session
+		type_reset_layouts();
+		for(isize i = 0; i < buf_len(syms); i++) {
+			AstDeclKind kind = syms[i]->decl->kind;
+			if((kind == AST_DECL_STRUCT || kind == AST_DECL_ENUM) && syms[i]->type)
+				syms[i]->type->align = 0;
+		}
+	}
+	for(isize i = 0; i < buf_len(syms); i++) {
+		Symbol* sym = syms[i];
+		if(sym->state != SYMSTATE_RESOLVED || !sym->type)
+			continue;
+		if(sym->kind == SYMBOL_FN) {
+			for(isize j = 0; j < sym->type->fn.args_len; j++) {
+				layout_type(sym->type->fn.args[j]);
+			}
+			layout_type(sym->type->fn.ret);
+		} else {
+			layout_type(sym->type);
+		}
+	}
+	if(!layout_report)
+		return;
+	for(isize i = 0; i < buf_len(syms); i++) {
+		Symbol* sym = syms[i];
+		if(sym->state != SYMSTATE_RESOLVED)
+			continue;
+		if(sym->decl->kind == AST_DECL_STRUCT)
+			layout_print_struct(sym->type);
+		else if(sym->decl->kind == AST_DECL_ENUM)
+			layout_print_enum(sym->type);
+	}
+}
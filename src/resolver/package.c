@@ -9,13 +9,35 @@ typedef struct Package {
 	const char* path;
 	MapSymbols symbols;
 	MapSymbols exported_symbols;
+	Symbol** decl_symbols;  // symbols declared in the source, in order
 	SymbolOrder* symbol_order;
+	SymbolArena arena;
+	isize resolved;          // symbols resolved by resolver_resolve_package
+
+	// Incremental mode (nc --watch): every compilation of the source is a
+	// session, and the symbols of the previous one are reused when their
+	// declaration did not change.
+	bool incremental;
+	isize session;
+	MapSymbols prev_symbols;     // symbols of the previous session
+	Symbol** prev_decl_symbols;
 } Package;
 
 Symbol* package_add_type(Package* p, Type* type, StrIntern name) {
-	Symbol* sym = symbol_new(SYMBOL_TYPE, name, NULL);
+	Symbol* sym = symbol_new(&p->arena, SYMBOL_TYPE, name, NULL);
 	sym->state = SYMSTATE_RESOLVED;
 	sym->type = type;
+	if(!type->symbol)
+		type->symbol = sym;
+	map_set(&p->symbols, (usize)name, sym);
+	return sym;
+}
+
+Symbol* package_add_const(Package* p, ConstValue value, StrIntern name) {
+	Symbol* sym = symbol_new(&p->arena, SYMBOL_CONST, name, NULL);
+	sym->state = SYMSTATE_RESOLVED;
+	sym->type = value.type;
+	sym->cold->value = value;
 	map_set(&p->symbols, (usize)name, sym);
 	return sym;
 }
@@ -37,32 +59,58 @@ Symbol* package_add_decl(Package* p, AstDecl* decl) {
 		case AST_DECL_TYPE:
 			kind = SYMBOL_TYPE;
 			break;
+		default:
+			assert(0);
+			return NULL;
 	}
 
 	StrIntern name = decl->name;
 	Symbol** parent = map_get(&p->symbols, (usize)name);
+	if(parent && !(*parent)->decl) {
+		resolve_error(decl->loc, "cannot redeclare builtin '%s'", name);
+		return NULL;
+	}
 	if(parent) {
-		resolve_warning(decl->loc, "symbol '%s' already declared in this package.");
+		resolve_warning(decl->loc, "symbol '%s' already declared in this package.", name);
 		resolve_error((*parent)->decl->loc, "previous definition was here.");
 		return NULL;
 	}
-	Symbol* sym = symbol_new(kind, name, decl);
+	Symbol* sym = NULL;
+	u64 fingerprint = 0;
+	if(p->incremental) {
+		fingerprint = ast_fingerprint(decl);
+		Symbol** prev = map_get(&p->prev_symbols, (u64)name);
+		sym = prev ? *prev : NULL;
+	}
+	if(!sym) {
+		sym = symbol_new(&p->arena, kind, name, decl);
+	} else if(sym->cold->fingerprint == fingerprint) {
+		// unchanged: stays resolved unless its dependencies changed
+		sym->cold->next_decl = decl;
+	} else {
+		symbol_reset(sym, kind, decl);
+	}
+	sym->cold->fingerprint = fingerprint;
+	sym->cold->session = p->session;
+	sym->id = buf_len(p->decl_symbols);
 	map_set(&p->symbols, (u64)name, sym);
+	buf_push(p->decl_symbols, sym);
 	return sym;
 }
 
 void package_add_file(Package* p, AstFile* file) {
+	trace_begin(TRACE_FILE, file->path);
 	for(isize i = 0; i < file->decls.len; i++) {
 		AstDecl* decl = file->decls.list[i];
 		package_add_decl(p, decl);
 	}
+	trace_end();
 }
 
 void package_init(Package* p, const char* path) {
+	*p = (Package){ .arena = SYMBOL_ARENA_INIT };
 	p->name = str_intern_c("main");
 	p->path = path;
-	p->symbols = (MapSymbols){0};
-	p->exported_symbols = (MapSymbols){0};
 
 	package_add_type(p, primitive_void, str_intern_c("void"));
 	package_add_type(p, primitive_bool, str_intern_c("bool"));
@@ -76,4 +124,59 @@ void package_init(Package* p, const char* path) {
 	package_add_type(p, primitive_i32, str_intern_c("i32"));
 	package_add_type(p, primitive_i64, str_intern_c("i64"));
 	package_add_type(p, primitive_isize, str_intern_c("isize"));
+	package_add_type(p, primitive_f32, str_intern_c("f32"));
+	package_add_type(p, primitive_f64, str_intern_c("f64"));
+
+	package_add_const(p, (ConstValue){ CONST_BOOL, primitive_bool, .b = true }, str_intern_c("true"));
+	package_add_const(p, (ConstValue){ CONST_BOOL, primitive_bool, .b = false }, str_intern_c("false"));
+}
+
+// Starts a new session of an incremental package. The symbols of the
+// previous session are set aside, package_add_decl takes them back by name.
+void package_begin_session(Package* p) {
+	assert(p->incremental && !p->prev_decl_symbols);
+	p->prev_symbols = p->symbols;
+	p->symbols = (MapSymbols){0};
+	MapSymbols* m = &p->prev_symbols;
+	for(MapIt it = map_begin(m); it != map_end(m); map_next(m, &it)) {
+		Symbol* sym = *(Symbol**)map_iter_value(m, &it);
+		if(!sym->decl)
+			map_set(&p->symbols, (u64)sym->name, sym);
+	}
+	p->prev_decl_symbols = p->decl_symbols;
+	p->decl_symbols = NULL;
+	buf_clear(p->symbol_order);
+	p->session++;
+}
+
+// Drops the symbols of the previous session that were not declared again.
+// Called once the session is resolved: until then they are needed to find
+// their dependents. Their memory goes away with the package arena.
+void package_end_session(Package* p) {
+	for(isize i = 0; i < buf_len(p->prev_decl_symbols); i++) {
+		if(p->prev_decl_symbols[i]->cold->session < p->session)
+			symbol_release(p->prev_decl_symbols[i]);
+	}
+	buf_free(p->prev_decl_symbols);
+	map_free(&p->prev_symbols);
+	p->prev_symbols = (MapSymbols){0};
+}
+
+void package_free(Package* p) {
+	package_end_session(p);
+	MapSymbols* m = &p->symbols;
+	for(MapIt it = map_begin(m); it != map_end(m); map_next(m, &it)) {
+		Symbol* sym = *(Symbol**)map_iter_value(m, &it);
+		// primitive types outlive the package
+		if(!sym->decl && sym->type && sym->type->symbol == sym)
+			sym->type->symbol = NULL;
+	}
+	for(isize i = 0; i < buf_len(p->decl_symbols); i++) {
+		symbol_release(p->decl_symbols[i]);
+	}
+	symbol_arena_free(&p->arena);
+	map_free(&p->symbols);
+	map_free(&p->exported_symbols);
+	buf_free(p->decl_symbols);
+	buf_free(p->symbol_order);
 }
@@ -9,28 +9,55 @@ void print_type(Type* type) {
         case TYPE_SIGNED:
         case TYPE_UNSIGNED:
         case TYPE_BOOLEAN:
+        case TYPE_FLOAT:
+        case TYPE_STRUCT:
+        case TYPE_ENUM:
             if(type->symbol) {
-                p_printf("%s", type->symbol->name);
+                p_puts(type->symbol->name);
                 return;
             }
-            p_printf("<unknown symbol>");
+            p_puts("<unknown symbol>");
             break;
         case TYPE_FN:
-            p_printf("fn");
+            p_puts("fn");
             print_type_fn(type);
             break;
+        case TYPE_PTR:
+            p_putc('*');
+            print_type(type->ptr);
+            break;
+        case TYPE_ARRAY:
+            p_putc('[');
+            print_type(type->array.base);
+            p_puts(", ");
+            p_puti(type->array.len);
+            p_putc(']');
+            break;
+        case TYPE_SLICE:
+            p_putc('[');
+            print_type(type->slice);
+            p_putc(']');
+            break;
+        case TYPE_TUPLE:
+            p_putc('(');
+            for(isize i = 0; i < type->tuple.args_len; i++) {
+                if(i > 0) p_puts(", ");
+                print_type(type->tuple.args[i]);
+            }
+            p_putc(')');
+            break;
     }
 }
 
 void print_type_fn(Type* type) {
     assert(type->kind == TYPE_FN);
-    p_printf("(");
+    p_putc('(');
     for(int i = 0; i < type->fn.args_len; i++) {
         Type* t = type->fn.args[i];
-        if(i > 0) p_printf(", ");
+        if(i > 0) p_puts(", ");
         print_type(t);
     }
-    p_printf(") -> ");
+    p_puts(") -> ");
     print_type(type->fn.ret);
 }
 
@@ -7,148 +7,935 @@ typedef struct Symbol Symbol;
 #include "types.c"
 #include "symbol.c"
 #include "package.c"
+#include "scope.c"
 #include "print.c"
-
-typedef map_type(const void*, Type*) MapType;
-
-u64 map_Type_fn_hash(const void* x) {
-	const Type* type = (const Type*)x;
-	assert(type->kind == TYPE_FN);
-	u64 hash = map_hash_mix(map_hash_u64((u64)(type->fn.ret)), map_hash_bytes(type->fn.args, type->fn.args_len));
-	return hash ? hash : 1;
-}
-isize map_Type_fn_cmp(const void* x, const void* y) {
-	const Type* tx = (const Type*)x;
-	const Type* ty = (const Type*)y;
-	if(tx->fn.args_len != ty->fn.args_len)
-		if(memcmp(tx->fn.args, ty->fn.args, sizeof(Type*) * tx->fn.args_len) == 0)
-			return 0;
-	return 1;
-}
-
-MapType TypeFnMap;
-void resolve_init_type_maps() {
-	TypeFnMap = (MapType){{0}, new_user_def_fn(map_Type_fn_cmp, map_Type_fn_hash)};
-}
+#include "const.c"
+#include "layout.c"
+#include "typing.c"
 
 Symbol* resolver_resolve_name(Package* pkg, FileLoc loc, StrIntern name, bool needresolve) {
-	Symbol** sym = map_get(&pkg->symbols, (usize)name);
+	Symbol** sym = map_lookup(&pkg->symbols, (usize)name);
 	return sym ? *sym : NULL;
 }
 
-Type* resolver_resolve_typedecl(Package* pkg, AstType* type, bool needresolve, bool forceresolve) {
+// Resolves a type annotation to its canonical Type. The result is cached
+// in the AstType node, so every annotation is hashed at most once.
+Type* resolver_resolve_typedecl(Package* pkg, AstType* type) {
 	if(!type)
 		return NULL;
-
-	needresolve = forceresolve || needresolve;
+	if(type->resolved)
+		return type->resolved;
 
 	Type* ret = NULL;
 	switch(type->kind) {
 		case AST_TYPE_NAME: {
-			//Symbol* sym = resolver_resolve_name(pkg, type->loc, type->name, needresolve);
-			
+			Symbol* sym = resolver_resolve_name(pkg, type->loc, type->name, false);
+			if(!sym) {
+				resolve_error(type->loc, "undeclared type '%s'", type->name);
+			}
+			if(sym->kind != SYMBOL_TYPE) {
+				resolve_error(type->loc, "'%s' is not a type", type->name);
+			}
+			// the package is declared in dependency order
+			assert(sym->state >= SYMSTATE_DECLARED);
+			ret = sym->type;
 			break;
 		}
-		case AST_TYPE_PTR: {
-			// TODO: implement
-			assert(0);
+		case AST_TYPE_PTR:
+			ret = type_ptr(resolver_resolve_typedecl(pkg, type->ptr));
 			break;
-		}
-		case AST_TYPE_ARRAY: {
-			// TODO: implement
-			assert(0);
+		case AST_TYPE_ARRAY:
+			ret = type_array(resolver_resolve_typedecl(pkg, type->array.type), const_eval_len(pkg, type->array.size));
 			break;
-		}
 		case AST_TYPE_FN: {
 			Type** args = NULL;
-			for(size_t i = 0; i < type->fn.args.len; i++) {
-				Type* arg_type = resolver_resolve_typedecl(pkg, type->fn.args.list[i], false, forceresolve);
-				buf_push(args, arg_type);
+			buf_reserve(args, type->fn.args.len);
+			for(isize i = 0; i < type->fn.args.len; i++) {
+				buf_push(args, resolver_resolve_typedecl(pkg, type->fn.args.list[i]));
 			}
-			//Type* rett = resolver_resolve_typedecl(pkg, type->fn.ret, false, forceresolve);
-			//ret = type_fn(args, buf_len(args), rett);
+			Type* rett = type->fn.ret ? resolver_resolve_typedecl(pkg, type->fn.ret) : primitive_void;
+			ret = type_fn(args, buf_len(args), rett);
+			buf_free(args);
 			break;
 		}
-		case AST_TYPE_SLICE: {
-			// TODO: implement
-			assert(0);
+		case AST_TYPE_SLICE:
+			ret = type_slice(resolver_resolve_typedecl(pkg, type->slice.type));
 			break;
-		}
 		case AST_TYPE_TUPLE: {
-			// TODO: implement
-			assert(0);
+			Type** args = NULL;
+			buf_reserve(args, type->tuple.args.len);
+			for(isize i = 0; i < type->tuple.args.len; i++) {
+				buf_push(args, resolver_resolve_typedecl(pkg, type->tuple.args.list[i]));
+			}
+			ret = type_tuple(args, buf_len(args));
+			buf_free(args);
 			break;
 		}
 	}
+	type->resolved = ret;
 	return ret;
 }
 
-void resolver_declare_symbol(Package* pkg, Symbol* sym) {
-	if(sym->state != SYMSTATE_INITIAL) {
-		if(sym->state == SYMSTATE_DECLARING) {
-			resolve_error(sym->decl->loc, "cyclic dependency for symbol '%s'", sym->name);
+Type* resolver_resolve_fn_type(Package* pkg, AstDecl* decl) {
+	assert(decl->kind == AST_DECL_FN);
+	Type** args = NULL;
+	buf_reserve(args, decl->fn.params.len);
+	for(isize i = 0; i < decl->fn.params.len; i++) {
+		buf_push(args, resolver_resolve_typedecl(pkg, decl->fn.params.list[i]->type));
+	}
+	Type* ret = decl->fn.ret ? resolver_resolve_typedecl(pkg, decl->fn.ret) : primitive_void;
+	Type* type = type_fn(args, buf_len(args), ret);
+	buf_free(args);
+	return type;
+}
+
+void resolver_resolve_struct(Package* pkg, Symbol* sym) {
+	AstParamList* fields = &sym->decl->struct_.params;
+	Type* type = sym->type;
+	type->struct_.fields = type_alloc(MAX(fields->len, 1) * sizeof(TypeField));
+	type->struct_.fields_len = fields->len;
+	for(isize i = 0; i < fields->len; i++) {
+		AstParam* field = fields->list[i];
+		for(isize j = 0; j < i; j++) {
+			if(type->struct_.fields[j].name == field->name) {
+				resolve_error(sym->decl->loc, "duplicate field '%s' in struct '%s'", field->name, sym->name);
+			}
+		}
+		type->struct_.fields[i] = (TypeField){ field->name, resolver_resolve_typedecl(pkg, field->type), 0, -1 };
+	}
+}
+
+void resolver_resolve_enum(Package* pkg, Symbol* sym) {
+	AstParamList* variants = &sym->decl->enum_.params;
+	Type* type = sym->type;
+	type->enum_.variants = type_alloc(MAX(variants->len, 1) * sizeof(TypeVariant));
+	type->enum_.variants_len = variants->len;
+	// discriminants without a value follow the previous one
+	i64 value = 0;
+	bool next_overflows = false;
+	for(isize i = 0; i < variants->len; i++) {
+		AstParam* variant = variants->list[i];
+		if(variant->value) {
+			ConstValue v = const_eval(pkg, variant->value);
+			bool is_unsigned = v.type && v.type->kind == TYPE_UNSIGNED;
+			if(v.kind != CONST_INT || (is_unsigned && v.u > (u64)INT64_MAX))
+				resolve_error(variant->value->loc, "discriminant of '%s' must be an integer constant", variant->name);
+			value = v.i;
+		} else if(next_overflows) {
+			resolve_error(sym->decl->loc, "discriminant of '%s' overflows", variant->name);
 		}
-		assert(sym->state >= SYMSTATE_DECLARED);
+		for(isize j = 0; j < i; j++) {
+			if(type->enum_.variants[j].name == variant->name) {
+				resolve_error(sym->decl->loc, "duplicate variant '%s' in enum '%s'", variant->name, sym->name);
+			}
+			if(type->enum_.variants[j].value == value) {
+				resolve_error(sym->decl->loc, "variants '%s' and '%s' of enum '%s' have the same discriminant %lld",
+					type->enum_.variants[j].name, variant->name, sym->name, (long long)value);
+			}
+		}
+		type->enum_.variants[i] = (TypeVariant){ variant->name, resolver_resolve_typedecl(pkg, variant->type), value, 0 };
+		next_overflows = value == INT64_MAX;
+		value = next_overflows ? value : value + 1;
+	}
+}
+
+void resolver_resolve_expr(Package* pkg, Scope* s, AstExpr* expr);
+
+void resolver_resolve_expr_list(Package* pkg, Scope* s, AstExprList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		resolver_resolve_expr(pkg, s, list->list[i]);
+	}
+}
+
+void resolver_resolve_expr(Package* pkg, Scope* s, AstExpr* expr) {
+	if(!expr)
 		return;
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+		case AST_EXPR_LIT_FLOAT:
+		case AST_EXPR_LIT_STRING:
+		case AST_EXPR_LIT_CHAR:
+			break;
+		case AST_EXPR_IDENT: {
+			Local* local = scope_lookup(s, expr->ident.name);
+			if(local) {
+				expr->ident.depth = local->depth;
+				expr->ident.slot = local->slot;
+				break;
+			}
+			Symbol* sym = resolver_resolve_name(pkg, expr->loc, expr->ident.name, false);
+			if(!sym) {
+				resolve_error(expr->loc, "undeclared identifier '%s'", expr->ident.name);
+			}
+			expr->ident.sym = sym;
+			if(s->collect_refs)
+				buf_push(s->refs, sym);
+			break;
+		}
+		case AST_EXPR_MEMBER:
+			resolver_resolve_expr(pkg, s, expr->member.x);
+			break;
+		case AST_EXPR_CALL:
+			resolver_resolve_expr(pkg, s, expr->call.x);
+			resolver_resolve_expr_list(pkg, s, &expr->call.args);
+			break;
+		case AST_EXPR_UNARY:
+			resolver_resolve_expr(pkg, s, expr->unary.x);
+			break;
+		case AST_EXPR_BINARY:
+			resolver_resolve_expr(pkg, s, expr->binary.x);
+			resolver_resolve_expr(pkg, s, expr->binary.y);
+			break;
+		case AST_EXPR_CAST:
+			resolver_resolve_expr(pkg, s, expr->cast.x);
+			resolver_resolve_typedecl(pkg, expr->cast.type);
+			break;
+		case AST_EXPR_INDEX:
+			resolver_resolve_expr(pkg, s, expr->index.x);
+			resolver_resolve_expr(pkg, s, expr->index.arg);
+			break;
+		case AST_EXPR_TUPLE:
+			resolver_resolve_expr_list(pkg, s, &expr->tuple.args);
+			break;
+		case AST_EXPR_ARRAY:
+			resolver_resolve_expr(pkg, s, expr->array.init);
+			resolver_resolve_expr(pkg, s, expr->array.len);
+			expr->array.count = const_eval_len(pkg, expr->array.len);
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			resolver_resolve_expr_list(pkg, s, &expr->array_list.args);
+			break;
+		case AST_EXPR_INIT:
+			resolver_resolve_expr(pkg, s, expr->init.x);
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				resolver_resolve_expr(pkg, s, expr->init.fields.list[i]->expr);
+			}
+			break;
+	}
+}
+
+void resolver_resolve_stmt(Package* pkg, Scope* s, AstStmt* stmt);
+
+void resolver_resolve_block(Package* pkg, Scope* s, AstStmtList* body) {
+	scope_enter(s);
+	for(isize i = 0; i < body->len; i++) {
+		resolver_resolve_stmt(pkg, s, body->list[i]);
 	}
-	sym->state = SYMSTATE_DECLARING;
+	scope_leave(s);
+}
+
+void resolver_resolve_stmt(Package* pkg, Scope* s, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL: {
+			AstDecl* decl = stmt->decl;
+			switch(decl->kind) {
+				case AST_DECL_LET:
+					// the initializer does not see the new local: let x = x
+					resolver_resolve_expr(pkg, s, decl->let.value);
+					resolver_resolve_typedecl(pkg, decl->let.type);
+					break;
+				case AST_DECL_CONST:
+					resolver_resolve_expr(pkg, s, decl->const_.value);
+					break;
+				default:
+					resolve_error(decl->loc, "declaration not supported inside a fn body");
+					break;
+			}
+			scope_declare(s, decl->loc, decl->name);
+			break;
+		}
+		case AST_STMT_EXPR:
+			resolver_resolve_expr(pkg, s, stmt->expr);
+			break;
+		case AST_STMT_IF:
+			resolver_resolve_expr(pkg, s, stmt->if_.cond);
+			resolver_resolve_block(pkg, s, &stmt->if_.body);
+			resolver_resolve_stmt(pkg, s, stmt->if_.els);
+			break;
+		case AST_STMT_FOR:
+			resolver_resolve_expr(pkg, s, stmt->for_.cond);
+			resolver_resolve_block(pkg, s, &stmt->for_.body);
+			break;
+		case AST_STMT_RETURN:
+			resolver_resolve_expr(pkg, s, stmt->return_);
+			break;
+		case AST_STMT_ASSIGN:
+			resolver_resolve_expr(pkg, s, stmt->assign.x);
+			resolver_resolve_expr(pkg, s, stmt->assign.y);
+			break;
+		case AST_STMT_BLOCK:
+			resolver_resolve_block(pkg, s, &stmt->block.body);
+			break;
+	}
+}
+
+// parameters are declared at depth 0, the body block starts at depth 1
+void resolver_resolve_fn_body(Package* pkg, Scope* s, Symbol* sym) {
 	AstDecl* decl = sym->decl;
-	assert(decl); // for not resolved symbols, decl is never null
+	scope_fn_begin(s);
+	scope_enter(s);
+	for(isize i = 0; i < decl->fn.params.len; i++) {
+		AstParam* param = decl->fn.params.list[i];
+		scope_declare(s, decl->loc, param->name);
+	}
+	resolver_resolve_block(pkg, s, &decl->fn.body);
+	scope_leave(s);
+	sym->cold->frame_slots = scope_fn_end(s);
+}
+
+void resolver_deps_expr(Package* pkg, Symbol* sym, AstExpr* expr, bool in_body);
+
+void resolver_deps_type(Package* pkg, Symbol* sym, AstType* type) {
+	if(!type)
+		return;
+	switch(type->kind) {
+		case AST_TYPE_NAME: {
+			Symbol* dep = resolver_resolve_name(pkg, type->loc, type->name, false);
+			if(dep)
+				buf_push(sym->deps, dep);
+			break;
+		}
+		case AST_TYPE_PTR:
+			resolver_deps_type(pkg, sym, type->ptr);
+			break;
+		case AST_TYPE_ARRAY:
+			resolver_deps_type(pkg, sym, type->array.type);
+			// the length is constant, its names are package symbols
+			resolver_deps_expr(pkg, sym, type->array.size, false);
+			break;
+		case AST_TYPE_FN:
+			for(isize i = 0; i < type->fn.args.len; i++) {
+				resolver_deps_type(pkg, sym, type->fn.args.list[i]);
+			}
+			resolver_deps_type(pkg, sym, type->fn.ret);
+			break;
+		case AST_TYPE_SLICE:
+			resolver_deps_type(pkg, sym, type->slice.type);
+			break;
+		case AST_TYPE_TUPLE:
+			for(isize i = 0; i < type->tuple.args.len; i++) {
+				resolver_deps_type(pkg, sym, type->tuple.args.list[i]);
+			}
+			break;
+	}
+}
+
+void resolver_deps_expr_list(Package* pkg, Symbol* sym, AstExprList* list, bool in_body) {
+	for(isize i = 0; i < list->len; i++) {
+		resolver_deps_expr(pkg, sym, list->list[i], in_body);
+	}
+}
+
+// Package level expressions have no locals, every name is a package
+// symbol. In fn bodies names may be locals, so only types are collected.
+void resolver_deps_expr(Package* pkg, Symbol* sym, AstExpr* expr, bool in_body) {
+	if(!expr)
+		return;
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+		case AST_EXPR_LIT_FLOAT:
+		case AST_EXPR_LIT_STRING:
+		case AST_EXPR_LIT_CHAR:
+			break;
+		case AST_EXPR_IDENT: {
+			if(in_body)
+				break;
+			Symbol* dep = resolver_resolve_name(pkg, expr->loc, expr->ident.name, false);
+			if(dep)
+				buf_push(sym->deps, dep);
+			break;
+		}
+		case AST_EXPR_MEMBER:
+			resolver_deps_expr(pkg, sym, expr->member.x, in_body);
+			break;
+		case AST_EXPR_CALL:
+			resolver_deps_expr(pkg, sym, expr->call.x, in_body);
+			resolver_deps_expr_list(pkg, sym, &expr->call.args, in_body);
+			break;
+		case AST_EXPR_UNARY:
+			resolver_deps_expr(pkg, sym, expr->unary.x, in_body);
+			break;
+		case AST_EXPR_BINARY:
+			resolver_deps_expr(pkg, sym, expr->binary.x, in_body);
+			resolver_deps_expr(pkg, sym, expr->binary.y, in_body);
+			break;
+		case AST_EXPR_CAST:
+			resolver_deps_expr(pkg, sym, expr->cast.x, in_body);
+			resolver_deps_type(pkg, sym, expr->cast.type);
+			break;
+		case AST_EXPR_INDEX:
+			resolver_deps_expr(pkg, sym, expr->index.x, in_body);
+			resolver_deps_expr(pkg, sym, expr->index.arg, in_body);
+			break;
+		case AST_EXPR_TUPLE:
+			resolver_deps_expr_list(pkg, sym, &expr->tuple.args, in_body);
+			break;
+		case AST_EXPR_ARRAY:
+			resolver_deps_expr(pkg, sym, expr->array.init, in_body);
+			resolver_deps_expr(pkg, sym, expr->array.len, false);
+			break;
+		case AST_EXPR_ARRAY_LIST:
+			resolver_deps_expr_list(pkg, sym, &expr->array_list.args, in_body);
+			break;
+		case AST_EXPR_INIT:
+			resolver_deps_expr(pkg, sym, expr->init.x, in_body);
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				resolver_deps_expr(pkg, sym, expr->init.fields.list[i]->expr, in_body);
+			}
+			break;
+	}
+}
+
+void resolver_deps_stmt(Package* pkg, Symbol* sym, AstStmt* stmt);
+
+void resolver_deps_block(Package* pkg, Symbol* sym, AstStmtList* body) {
+	for(isize i = 0; i < body->len; i++) {
+		resolver_deps_stmt(pkg, sym, body->list[i]);
+	}
+}
+
+void resolver_deps_stmt(Package* pkg, Symbol* sym, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL:
+			if(stmt->decl->kind == AST_DECL_LET) {
+				resolver_deps_type(pkg, sym, stmt->decl->let.type);
+				resolver_deps_expr(pkg, sym, stmt->decl->let.value, true);
+			} else if(stmt->decl->kind == AST_DECL_CONST) {
+				resolver_deps_expr(pkg, sym, stmt->decl->const_.value, true);
+			}
+			break;
+		case AST_STMT_EXPR:
+			resolver_deps_expr(pkg, sym, stmt->expr, true);
+			break;
+		case AST_STMT_IF:
+			resolver_deps_expr(pkg, sym, stmt->if_.cond, true);
+			resolver_deps_block(pkg, sym, &stmt->if_.body);
+			resolver_deps_stmt(pkg, sym, stmt->if_.els);
+			break;
+		case AST_STMT_FOR:
+			resolver_deps_expr(pkg, sym, stmt->for_.cond, true);
+			resolver_deps_block(pkg, sym, &stmt->for_.body);
+			break;
+		case AST_STMT_RETURN:
+			resolver_deps_expr(pkg, sym, stmt->return_, true);
+			break;
+		case AST_STMT_ASSIGN:
+			resolver_deps_expr(pkg, sym, stmt->assign.x, true);
+			resolver_deps_expr(pkg, sym, stmt->assign.y, true);
+			break;
+		case AST_STMT_BLOCK:
+			resolver_deps_block(pkg, sym, &stmt->block.body);
+			break;
+	}
+}
+
+// Collects the edges of the dependency graph going out of sym. Of fn
+// bodies only the types are part of the graph: fns may call each other in
+// any order, but every type a body names must be declared before it.
+// The list is built at the end of the package arena, so it grows in place.
+void resolver_collect_deps(Package* pkg, Symbol* sym) {
+	AstDecl* decl = sym->decl;
+	if(!sym->deps)
+		buf_arena(sym->deps, &pkg->arena.hot, 0);
 	switch(decl->kind) {
 		case AST_DECL_LET:
+			resolver_deps_type(pkg, sym, decl->let.type);
+			resolver_deps_expr(pkg, sym, decl->let.value, false);
+			break;
 		case AST_DECL_CONST:
-			// let and const need no declare, only resolve
+			resolver_deps_expr(pkg, sym, decl->const_.value, false);
 			break;
 		case AST_DECL_FN:
+			for(isize i = 0; i < decl->fn.params.len; i++) {
+				resolver_deps_type(pkg, sym, decl->fn.params.list[i]->type);
+			}
+			resolver_deps_type(pkg, sym, decl->fn.ret);
+			resolver_deps_block(pkg, sym, &decl->fn.body);
 			break;
 		case AST_DECL_STRUCT:
+			for(isize i = 0; i < decl->struct_.params.len; i++) {
+				resolver_deps_type(pkg, sym, decl->struct_.params.list[i]->type);
+			}
 			break;
 		case AST_DECL_ENUM:
+			for(isize i = 0; i < decl->enum_.params.len; i++) {
+				resolver_deps_type(pkg, sym, decl->enum_.params.list[i]->type);
+				resolver_deps_expr(pkg, sym, decl->enum_.params.list[i]->value, false);
+			}
 			break;
 		case AST_DECL_TYPE:
+			resolver_deps_type(pkg, sym, decl->type.type);
 			break;
 	}
-	sym->state = SYMSTATE_DECLARED;
-	buf_push(pkg->symbol_order, (SymbolOrder){ sym->name, true });
+	buf_shrink_to_fit(sym->deps);
 }
 
-void resolver_resolve_symbol(Package* pkg, Symbol* sym) {
-	resolver_declare_symbol(pkg, sym);
-	if(sym->state != SYMSTATE_DECLARED) {
-		if(sym->state == SYMSTATE_RESOLVING) {
-			resolve_error(sym->decl->loc, "cyclic dependency for symbol '%s'", sym->name);
+// Declaring gives a symbol its type. Struct and enum types are nominal
+// and exist before their fields, so they do not depend on anything to be
+// declared and can refer to themselves.
+bool resolver_declare_needs_deps(Symbol* sym) {
+	return sym->decl->kind != AST_DECL_STRUCT && sym->decl->kind != AST_DECL_ENUM;
+}
+
+// prints a path from sym back to itself inside its component
+void resolver_report_cycle(Symbol** syms, isize* comp, isize* parent, isize start) {
+	isize* queue = NULL;
+	buf_push(queue, start);
+	parent[start] = start;
+	isize last = -1;
+	for(isize q = 0; q < buf_len(queue) && last < 0; q++) {
+		Symbol* v = syms[queue[q]];
+		for(isize i = 0; i < buf_len(v->deps); i++) {
+			isize w = v->deps[i]->id;
+			if(w < 0 || comp[w] != comp[start])
+				continue;
+			if(w == start) {
+				last = queue[q];
+				break;
+			}
+			if(parent[w] < 0) {
+				parent[w] = queue[q];
+				buf_push(queue, w);
+			}
 		}
-		assert(sym->state == SYMSTATE_RESOLVED);
+	}
+	assert(last >= 0);
+	isize* path = NULL;
+	for(isize v = last; v != start; v = parent[v]) {
+		buf_push(path, v);
+	}
+	char* msg = NULL;
+	buf_printf(msg, "'%s'", syms[start]->name);
+	for(isize i = buf_len(path) - 1; i >= 0; i--) {
+		buf_printf(msg, " -> '%s'", syms[path[i]]->name);
+	}
+	buf_printf(msg, " -> '%s'", syms[start]->name);
+	print_error_pos(syms[start]->decl->loc, "resolve error: cyclic dependency %s", msg);
+	for(isize q = 0; q < buf_len(queue); q++) {
+		parent[queue[q]] = -1;
+	}
+	buf_free(msg);
+	buf_free(path);
+	buf_free(queue);
+}
+
+typedef struct TarjanFrame {
+	isize v;
+	isize edge;
+} TarjanFrame;
+
+// State of an iterative Tarjan SCC pass over the declare edges of the
+// dependency graph. Components come out with their dependencies first,
+// which is the order they are declared in. The pass can be resumed from
+// new roots: symbols visited by earlier calls are finished and are not
+// visited again, so the whole package is ordered in linear time.
+typedef struct Tarjan {
+	Symbol** syms;
+	isize* index;
+	isize* low;
+	isize* comp;
+	bool* on_stack;
+	isize* stack;
+	TarjanFrame* frames;
+	isize counter;
+	isize ncomps;
+	isize* cyclic;  // first declared symbol of every cyclic component
+} Tarjan;
+
+void tarjan_init(Tarjan* t, Symbol** syms) {
+	isize len = buf_len(syms);
+	*t = (Tarjan){ syms };
+	t->index = xmalloc(MAX(len, 1) * sizeof(isize));
+	t->low = xmalloc(MAX(len, 1) * sizeof(isize));
+	t->comp = xmalloc(MAX(len, 1) * sizeof(isize));
+	t->on_stack = xcalloc(MAX(len, 1), sizeof(bool));
+	for(isize i = 0; i < len; i++) {
+		t->index[i] = -1;
+		t->comp[i] = -1;
+	}
+}
+
+void tarjan_free(Tarjan* t) {
+	buf_free(t->cyclic);
+	buf_free(t->frames);
+	buf_free(t->stack);
+	xfree(t->on_stack);
+	xfree(t->comp);
+	xfree(t->low);
+	xfree(t->index);
+}
+
+// appends to order the components reachable from root not visited yet
+void tarjan_visit(Tarjan* t, isize root, Symbol*** order) {
+	Symbol** syms = t->syms;
+	isize* index = t->index;
+	isize* low = t->low;
+	if(index[root] >= 0)
 		return;
+	index[root] = low[root] = t->counter++;
+	buf_push(t->stack, root);
+	t->on_stack[root] = true;
+	buf_push(t->frames, (TarjanFrame){ root, 0 });
+	while(buf_len(t->frames) > 0) {
+		TarjanFrame* f = &t->frames[buf_len(t->frames) - 1];
+		isize v = f->v;
+		Symbol* sym = syms[v];
+		if(resolver_declare_needs_deps(sym) && f->edge < buf_len(sym->deps)) {
+			isize w = sym->deps[f->edge++]->id;
+			if(w < 0)
+				continue;  // primitive type
+			if(index[w] < 0) {
+				index[w] = low[w] = t->counter++;
+				buf_push(t->stack, w);
+				t->on_stack[w] = true;
+				buf_push(t->frames, (TarjanFrame){ w, 0 });
+			} else if(t->on_stack[w]) {
+				low[v] = MIN(low[v], index[w]);
+			}
+			continue;
+		}
+		buf_truncate(t->frames, buf_len(t->frames) - 1);
+		if(buf_len(t->frames) > 0) {
+			isize u = t->frames[buf_len(t->frames) - 1].v;
+			low[u] = MIN(low[u], low[v]);
+		}
+		if(low[v] != index[v])
+			continue;
+		isize first = buf_len(*order);
+		isize w;
+		do {
+			w = t->stack[buf_len(t->stack) - 1];
+			buf_truncate(t->stack, buf_len(t->stack) - 1);
+			t->on_stack[w] = false;
+			t->comp[w] = t->ncomps;
+			buf_push(*order, syms[w]);
+		} while(w != v);
+		t->ncomps++;
+
+		bool is_cyclic = buf_len(*order) - first > 1;
+		for(isize i = 0; !is_cyclic && resolver_declare_needs_deps(sym) && i < buf_len(sym->deps); i++) {
+			is_cyclic = sym->deps[i] == sym;
+		}
+		if(is_cyclic) {
+			// reported from the member declared first
+			isize min = v;
+			for(isize i = first; i < buf_len(*order); i++) {
+				min = MIN(min, (*order)[i]->id);
+			}
+			buf_push(t->cyclic, min);
+		}
+	}
+}
+
+// reports every cycle found so far, in source order, returns false if any
+bool tarjan_check_cycles(Tarjan* t) {
+	if(buf_len(t->cyclic) == 0)
+		return true;
+	isize len = buf_len(t->syms);
+	// the low links are not needed anymore, reuse them as BFS parents, and
+	// the stack marks, all clear now, as the cycles to report
+	isize* parent = t->low;
+	for(isize i = 0; i < len; i++) {
+		parent[i] = -1;
 	}
-	sym->state = SYMSTATE_RESOLVING;
+	for(isize i = 0; i < buf_len(t->cyclic); i++) {
+		t->on_stack[t->cyclic[i]] = true;
+	}
+	for(isize i = 0; i < len; i++) {
+		if(t->on_stack[i])
+			resolver_report_cycle(t->syms, t->comp, parent, i);
+	}
+	return false;
+}
+
+void resolver_declare_symbol(Package* pkg, Symbol* sym) {
+	assert(sym->state == SYMSTATE_INITIAL);
+	trace_begin(TRACE_SYMBOL, sym->name);
 	AstDecl* decl = sym->decl;
 	assert(decl); // for not resolved symbols, decl is never null
 	switch(decl->kind) {
 		case AST_DECL_LET:
 			if(decl->let.type) {
-				resolver_resolve_typedecl(pkg, decl->let.type, true, false);
+				sym->type = resolver_resolve_typedecl(pkg, decl->let.type);
 			}
 			break;
 		case AST_DECL_CONST:
+			sym->cold->value = const_eval(pkg, decl->const_.value);
+			sym->type = const_default_type(sym->cold->value);
 			break;
 		case AST_DECL_FN:
+			sym->type = resolver_resolve_fn_type(pkg, decl);
 			break;
 		case AST_DECL_STRUCT:
+			// kept by symbol_reset
+			sym->type = sym->type ? sym->type : type_nominal(TYPE_STRUCT, sym);
 			break;
 		case AST_DECL_ENUM:
+			sym->type = sym->type ? sym->type : type_nominal(TYPE_ENUM, sym);
 			break;
 		case AST_DECL_TYPE:
+			sym->type = resolver_resolve_typedecl(pkg, decl->type.type);
 			break;
 	}
-	sym->state = SYMSTATE_RESOLVED;
-	buf_push(pkg->symbol_order, (SymbolOrder){ sym->name, false });
+	trace_end();
+	sym->state = SYMSTATE_DECLARED;
+	if(pkg->incremental) {
+		u64 iface = symbol_interface(sym);
+		if(iface != sym->cold->iface) {
+			sym->cold->iface = iface;
+			sym->cold->iface_session = pkg->session;
+		}
+	}
+}
+
+// A symbol kept from the previous session is stale when one of the given
+// symbols, its deps or uses, changed interface or was removed this session.
+bool resolver_is_stale(Package* pkg, Symbol** syms) {
+	for(isize i = 0; i < buf_len(syms); i++) {
+		Symbol* sym = syms[i];
+		if(sym->decl && (sym->cold->iface_session == pkg->session || sym->cold->session < pkg->session))
+			return true;
+	}
+	return false;
 }
 
+// Resolving checks initializers, fields and fn bodies. It only needs the
+// symbols it refers to to be declared, so once the whole package is
+// declared symbols can be resolved in any order, on any thread.
+void resolver_resolve_symbol(Package* pkg, Scope* s, Symbol* sym) {
+	SymbolStatus expected = SYMSTATE_DECLARED;
+	if(!atomic_compare_exchange_strong(&sym->state, &expected, SYMSTATE_RESOLVING)) {
+		assert(expected == SYMSTATE_RESOLVING || expected == SYMSTATE_RESOLVED);
+		return;
+	}
+	trace_begin(TRACE_SYMBOL, sym->name);
+	AstDecl* decl = sym->decl;
+	assert(decl); // for not resolved symbols, decl is never null
+	switch(decl->kind) {
+		case AST_DECL_LET:
+			resolver_resolve_expr(pkg, s, decl->let.value);
+			break;
+		case AST_DECL_CONST:
+			resolver_resolve_expr(pkg, s, decl->const_.value);
+			break;
+		case AST_DECL_FN:
+			if(!decl->fn.is_extern)
+				resolver_resolve_fn_body(pkg, s, sym);
+			break;
+		case AST_DECL_STRUCT:
+			resolver_resolve_struct(pkg, sym);
+			break;
+		case AST_DECL_ENUM:
+			resolver_resolve_enum(pkg, sym);
+			break;
+		case AST_DECL_TYPE:
+			break;
+	}
+	trace_end();
+	atomic_store(&sym->state, SYMSTATE_RESOLVED);
+}
+
+// number of threads resolving symbols (--jobs)
+isize resolver_jobs = 1;
+// Demand-driven mode (--reachable, --roots): only what is reachable from
+// the roots is resolved. Without explicit roots, main and the exported
+// symbols are used.
+bool resolver_reachable;
+StrIntern* resolver_roots;
+
+typedef struct ResolveWorker {
+	Package* pkg;
+	Symbol** syms;
+	Scope scope;
+	jmp_buf jmp;
+	isize error_task;  // first failed task, -1 if none
+	char* error;       // message of error_task
+} ResolveWorker;
+
+void resolver_resolve_task(void* ctx, isize worker, isize task) {
+	ResolveWorker* w = (ResolveWorker*)ctx + worker;
+	Symbol* sym = w->syms[task];
+	// worker 0 is the calling thread, which may be catching errors itself
+	jmp_buf* old_jmp = error_jmp;
+	isize error_mark = buf_len(error_buf);
+	isize refs_mark = buf_len(w->scope.refs);
+	error_jmp = &w->jmp;
+	if(setjmp(w->jmp) == 0) {
+		resolver_resolve_symbol(w->pkg, &w->scope, sym);
+		if(w->pkg->incremental) {
+			MemTag old_tag = mem_tag_set(MEM_SYMBOLS);
+			for(isize i = refs_mark; i < buf_len(w->scope.refs); i++) {
+				buf_push(sym->cold->uses, w->scope.refs[i]);
+			}
+			mem_tag_set(old_tag);
+		}
+	} else {
+		scope_reset(&w->scope);
+		if(w->error_task < 0 || task < w->error_task) {
+			w->error_task = task;
+			buf_clear(w->error);
+			buf_puts(w->error, error_buf + error_mark);
+		}
+		buf_truncate(error_buf, error_mark);
+	}
+	error_jmp = old_jmp;
+}
+
+int resolver_cmp_symbol_id(const void* x, const void* y) {
+	isize a = (*(Symbol**)x)->id;
+	isize b = (*(Symbol**)y)->id;
+	return a < b ? -1 : a > b;
+}
+
+void resolver_reach(bool* reached, Symbol*** wave, Symbol* sym) {
+	if(sym->id < 0 || reached[sym->id])
+		return;
+	reached[sym->id] = true;
+	buf_push(*wave, sym);
+}
+
+void resolver_reach_roots(Package* pkg, bool* reached, Symbol*** wave) {
+	if(!resolver_reachable) {
+		for(isize i = 0; i < buf_len(pkg->decl_symbols); i++) {
+			resolver_reach(reached, wave, pkg->decl_symbols[i]);
+		}
+	} else if(buf_len(resolver_roots) > 0) {
+		for(isize i = 0; i < buf_len(resolver_roots); i++) {
+			Symbol* sym = resolver_resolve_name(pkg, (FileLoc){ pkg->path }, resolver_roots[i], false);
+			if(!sym || sym->id < 0)
+				fatal("root symbol '%s' not found", resolver_roots[i]);
+			resolver_reach(reached, wave, sym);
+		}
+	} else {
+		Symbol* sym = resolver_resolve_name(pkg, (FileLoc){ pkg->path }, str_intern_c("main"), false);
+		if(sym)
+			resolver_reach(reached, wave, sym);
+		MapSymbols* m = &pkg->exported_symbols;
+		for(MapIt it = map_begin(m); it != map_end(m); map_next(m, &it)) {
+			resolver_reach(reached, wave, *(Symbol**)map_iter_value(m, &it));
+		}
+	}
+}
+
+// Resolves the package in waves, starting from the roots. A wave is closed
+// over the dependency graph and declared in dependency order, then resolved
+// on the worker pool; the package symbols named in its fn bodies that were
+// not reached yet make up the next wave. When everything is resolved there
+// is a single wave. Errors are reported for the first failing symbol of a
+// wave in source order, whatever the number of jobs.
+// In incremental sessions symbols kept resolved from the previous session
+// are declared and resolved again only when stale, see resolver_is_stale.
 void resolver_resolve_package(Package* pkg) {
-	MapSymbols* m = &pkg->symbols;
-	for(MapIt it = map_begin(m); it != map_end(m); map_next(m, &it)) {
-		Symbol* sym = map_iter_value(m, &it);
-		resolver_declare_symbol(pkg, sym);
+	Symbol** syms = pkg->decl_symbols;
+	isize len = buf_len(syms);
+	for(isize i = 0; i < len; i++) {
+		Symbol* sym = syms[i];
+		// the ids of removed symbols are stale, they must leave the graph
+		if(sym->state == SYMSTATE_RESOLVED && resolver_is_stale(pkg, sym->deps))
+			symbol_reset(sym, sym->kind, sym->cold->next_decl);
+		if(sym->state == SYMSTATE_INITIAL) {
+			buf_clear(sym->deps);
+			resolver_collect_deps(pkg, sym);
+		}
+	}
+
+	bool* reached = xcalloc(MAX(len, 1), sizeof(bool));
+	Symbol** wave = NULL;
+	resolver_reach_roots(pkg, reached, &wave);
+
+	Tarjan t;
+	tarjan_init(&t, syms);
+	isize workers = MAX(MIN(resolver_jobs, len), 1);
+	ResolveWorker* ws = xcalloc(workers, sizeof(ResolveWorker));
+	Symbol** order = NULL;
+	isize nreached = 0;
+	bool ok = true;
+	pkg->resolved = 0;
+	while(ok && buf_len(wave) > 0) {
+		for(isize i = 0; i < buf_len(wave); i++) {
+			for(isize j = 0; j < buf_len(wave[i]->deps); j++) {
+				resolver_reach(reached, &wave, wave[i]->deps[j]);
+			}
+		}
+		qsort(wave, buf_len(wave), sizeof(Symbol*), resolver_cmp_symbol_id);
+		nreached += buf_len(wave);
+
+		buf_clear(order);
+		for(isize i = 0; i < buf_len(wave); i++) {
+			tarjan_visit(&t, wave[i]->id, &order);
+		}
+		if(!tarjan_check_cycles(&t)) {
+			ok = false;
+			break;
+		}
+		for(isize i = 0; i < buf_len(order); i++) {
+			Symbol* sym = order[i];
+			// kept symbols too, typing and codegen follow the declarations
+			buf_push(pkg->symbol_order, (SymbolOrder){ sym->name, true });
+			if(sym->state == SYMSTATE_RESOLVED && !resolver_is_stale(pkg, sym->deps))
+				continue;
+			if(sym->state == SYMSTATE_RESOLVED)
+				symbol_reset(sym, sym->kind, sym->cold->next_decl);
+			resolver_declare_symbol(pkg, sym);
+			pkg->resolved++;
+		}
+		// uses may come later in the order, they are all declared now
+		for(isize i = 0; pkg->incremental && i < buf_len(order); i++) {
+			Symbol* sym = order[i];
+			if(sym->state == SYMSTATE_RESOLVED && resolver_is_stale(pkg, sym->cold->uses)) {
+				symbol_reset(sym, sym->kind, sym->cold->next_decl);
+				resolver_declare_symbol(pkg, sym);
+				pkg->resolved++;
+			}
+		}
+
+		for(isize i = 0; i < workers; i++) {
+			ws[i].pkg = pkg;
+			ws[i].syms = wave;
+			ws[i].error_task = -1;
+			ws[i].scope.collect_refs = resolver_reachable || pkg->incremental;
+		}
+		jobs_run(workers, buf_len(wave), resolver_resolve_task, ws);
+		isize failed = -1;
+		for(isize i = 0; i < workers; i++) {
+			if(ws[i].error_task >= 0 && (failed < 0 || ws[i].error_task < ws[failed].error_task))
+				failed = i;
+		}
+		if(failed >= 0) {
+			error_puts(ws[failed].error);
+			ok = false;
+			break;
+		}
+		for(isize i = 0; i < buf_len(wave); i++) {
+			buf_push(pkg->symbol_order, (SymbolOrder){ wave[i]->name, false });
+		}
+
+		buf_clear(wave);
+		for(isize i = 0; i < workers; i++) {
+			for(isize j = 0; j < buf_len(ws[i].scope.refs); j++) {
+				resolver_reach(reached, &wave, ws[i].scope.refs[j]);
+			}
+			buf_clear(ws[i].scope.refs);
+		}
+	}
+	if(ok && resolver_reachable) {
+		printf("resolved %lld of %lld symbols, skipped %lld unreachable from the roots\n",
+			(long long)nreached, (long long)len, (long long)(len - nreached));
+	}
+
+	for(isize i = 0; i < workers; i++) {
+		scope_free(&ws[i].scope);
+		buf_free(ws[i].error);
 	}
+	xfree(ws);
+	buf_free(order);
+	buf_free(wave);
+	tarjan_free(&t);
+	xfree(reached);
+	if(!ok)
+		resolve_abort();
 }
@@ -0,0 +1,86 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Lexical scopes of fn bodies.
+// Locals live on one stack that is reused for every fn: entering a block
+// records the stack height and leaving it truncates the stack back, so
+// blocks allocate nothing. A local is addressed by (depth, slot): depth is
+// the block nesting level it was declared at (0 for parameters) and slot
+// its position among all the locals of the fn, in declaration order.
+// Lookups go through a map from name to the innermost local with that
+// name; every local remembers the one it shadows, so popping restores it.
+
+typedef struct Local {
+	StrIntern name;
+	i32 depth;
+	i32 slot;
+	isize shadowed;  // index of the outer local with the same name, or -1
+} Local;
+
+typedef map_type(u64, isize) MapLocals;
+
+typedef struct Scope {
+	Local* locals;  // visible locals, innermost last
+	isize* frames;  // height of locals at the start of every open block
+	MapLocals names;  // name -> index of the innermost local, or -1
+	i32 slots;      // locals declared so far in the current fn
+	bool collect_refs;
+	Symbol** refs;  // package symbols named, when collect_refs is set
+} Scope;
+
+void scope_fn_begin(Scope* s) {
+	assert(buf_len(s->frames) == 0);
+	s->slots = 0;
+}
+
+// returns the number of slots of the fn frame
+i32 scope_fn_end(Scope* s) {
+	assert(buf_len(s->frames) == 0 && buf_len(s->locals) == 0);
+	return s->slots;
+}
+
+void scope_enter(Scope* s) {
+	buf_push(s->frames, buf_len(s->locals));
+}
+
+void scope_leave(Scope* s) {
+	assert(buf_len(s->frames) > 0);
+	isize start = s->frames[buf_len(s->frames) - 1];
+	for(isize i = buf_len(s->locals) - 1; i >= start; i--) {
+		map_set(&s->names, (u64)s->locals[i].name, s->locals[i].shadowed);
+	}
+	buf_truncate(s->locals, start);
+	buf_truncate(s->frames, buf_len(s->frames) - 1);
+}
+
+Local* scope_lookup(Scope* s, StrIntern name) {
+	isize* index = map_get(&s->names, (u64)name);
+	return index && *index >= 0 ? &s->locals[*index] : NULL;
+}
+
+Local* scope_declare(Scope* s, FileLoc loc, StrIntern name) {
+	assert(buf_len(s->frames) > 0);
+	i32 depth = (i32)buf_len(s->frames) - 1;
+	Local* prev = scope_lookup(s, name);
+	if(prev && prev->depth == depth) {
+		resolve_error(loc, "'%s' already declared in this scope", name);
+	}
+	isize index = buf_len(s->locals);
+	buf_push(s->locals, (Local){ name, depth, s->slots++, prev ? prev - s->locals : -1 });
+	map_set(&s->names, (u64)name, index);
+	return &s->locals[index];
+}
+
+// leaves every open block, after an error unwound the resolver
+void scope_reset(Scope* s) {
+	while(buf_len(s->frames) > 0) {
+		scope_leave(s);
+	}
+}
+
+void scope_free(Scope* s) {
+	buf_free(s->locals);
+	buf_free(s->frames);
+	map_free(&s->names);
+	buf_free(s->refs);
+}
@@ -6,25 +6,81 @@ typedef enum TypeKind {
 	TYPE_UNSIGNED,
 	TYPE_SIGNED,
 	TYPE_BOOLEAN,
+	TYPE_FLOAT,
 	TYPE_FN,
+	TYPE_PTR,
+	TYPE_ARRAY,
+	TYPE_SLICE,
+	TYPE_TUPLE,
+	TYPE_STRUCT,
+	TYPE_ENUM,
 } TypeKind;
 
+typedef struct TypeField {
+	StrIntern name;
+	Type* type;
+	isize offset;
+	i32 bit;        // bool packed in a bitset: bit of the byte at offset, else -1
+} TypeField;
+
+typedef struct TypeVariant {
+	StrIntern name;
+	Type* payload;    // NULL for variants without payload
+	i64 value;
+	u64 niche_value;  // stored in the niche when the enum has no tag
+} TypeVariant;
+
+// Bit patterns a type never holds, which an enum containing it can use as
+// its tag: the integer of size bytes at offset only holds values from start
+// to end, wrapping around (a pointer holds 1 to UINTPTR_MAX, a bool 0 to 1).
+// size is 0 when there is no niche.
+typedef struct TypeNiche {
+	isize offset;
+	isize size;
+	u64 start;
+	u64 end;
+} TypeNiche;
+
+// size and align of arrays, tuples, structs and enums are computed by the
+// layout pass (layout.c) once the package is resolved, align is 0 until then
 struct Type {
 	TypeKind kind;
 	isize size;
 	isize align;
 	Symbol* symbol;
+	TypeNiche niche;
 	union {
 		struct {
 			Type** args;
 			isize args_len;
 			Type* ret;
-		} fn;
+		} fn;                 // TYPE_FN
+		Type* ptr;            // TYPE_PTR
+		struct {
+			Type* base;
+			isize len;
+		} array;              // TYPE_ARRAY
+		Type* slice;          // TYPE_SLICE
+		struct {
+			Type** args;
+			isize args_len;
+		} tuple;              // TYPE_TUPLE
+		struct {
+			TypeField* fields;
+			isize fields_len;
+		} struct_;            // TYPE_STRUCT
+		struct {
+			TypeVariant* variants;
+			isize variants_len;
+			Type* tag;            // type of the stored tag, NULL if there is none
+			isize payload_offset;
+			isize niche_variant;  // variant whose payload holds the tag, or -1
+		} enum_;              // TYPE_ENUM
 	};
 };
 
-Type* primitive_void = &(Type){ TYPE_VOID, 0, 0 };
-Type* primitive_bool = &(Type){ TYPE_BOOLEAN, 0, 0 };
+Type* primitive_void = &(Type){ TYPE_VOID, 0, 1 };
+Type* primitive_bool = &(Type){ TYPE_BOOLEAN, 1, 1, .niche = { 0, 1, 0, 1 } };
 
 Type* primitive_u8 = &(Type){  TYPE_UNSIGNED, 1, 1 };
 Type* primitive_u16 = &(Type){ TYPE_UNSIGNED, 2, 2 };
@@ -37,6 +93,185 @@ Type* primitive_i32 = &(Type){ TYPE_SIGNED, 4, 4 };
 Type* primitive_i64 = &(Type){ TYPE_SIGNED, 8, 8 };
 Type* primitive_isize = &(Type){ TYPE_SIGNED, sizeof(isize), sizeof(isize) };
 
-//Type* primitive_f32 = &(Type){ TYPE_FLOATING, 4, 4 };
-//Type* primitive_f64 = &(Type){ TYPE_FLOATING, 8, 4 };
+Type* primitive_f32 = &(Type){ TYPE_FLOAT, 4, 4 };
+Type* primitive_f64 = &(Type){ TYPE_FLOAT, 8, 8 };
+
+typedef enum ConstKind {
+	CONST_INT,
+	CONST_FLOAT,
+	CONST_BOOL,
+} ConstKind;
+
+// Value of a compile-time constant. Literals are untyped (type is NULL)
+// and take the type of the typed operand they are combined with.
+typedef struct ConstValue {
+	ConstKind kind;
+	Type* type;
+	union {
+		i64 i;     // signed and untyped ints
+		u64 u;     // unsigned ints
+		double f;
+		bool b;
+	};
+} ConstValue;
+
+// Canonical type table.
+// Every structural type (fn, ptr, array, slice, tuple) is hash-consed:
+// it is built from already canonical component types, so hashing and
+// comparing only looks at the component pointers, and two structural
+// types are the same type iff they are the same pointer. Struct and enum
+// types are nominal and are created once per declaring symbol. Fn bodies
+// are resolved on several threads, so interning is done under type_lock.
+
+typedef map_type(const void*, Type*) MapType;
+
+MemoryPool type_pool = {.tag = MEM_TYPES};
+MapType type_table;
+mtx_t type_lock;
+once_flag type_table_once = ONCE_FLAG_INIT;
+
+u64 type_hash(const void* x) {
+	const Type* t = x;
+	u64 hash = map_hash_u64(t->kind + 1);
+	switch(t->kind) {
+		case TYPE_FN:
+			hash = map_hash_mix(hash, map_hash_u64((u64)t->fn.ret));
+			return map_hash_mix(hash, map_hash_bytes(t->fn.args, t->fn.args_len * sizeof(Type*)));
+		case TYPE_PTR:
+			return map_hash_mix(hash, map_hash_u64((u64)t->ptr));
+		case TYPE_ARRAY:
+			hash = map_hash_mix(hash, map_hash_u64((u64)t->array.base));
+			return map_hash_mix(hash, map_hash_u64((u64)t->array.len));
+		case TYPE_SLICE:
+			return map_hash_mix(hash, map_hash_u64((u64)t->slice));
+		case TYPE_TUPLE:
+			return map_hash_mix(hash, map_hash_bytes(t->tuple.args, t->tuple.args_len * sizeof(Type*)));
+		default:
+			assert(0);
+			return 0;
+	}
+}
+
+isize type_cmp(const void* x, const void* y) {
+	const Type* tx = x;
+	const Type* ty = y;
+	if(tx->kind != ty->kind)
+		return 1;
+	switch(tx->kind) {
+		case TYPE_FN:
+			return tx->fn.ret != ty->fn.ret || tx->fn.args_len != ty->fn.args_len
+				|| (tx->fn.args_len > 0 && memcmp(tx->fn.args, ty->fn.args, tx->fn.args_len * sizeof(Type*)) != 0);
+		case TYPE_PTR:
+			return tx->ptr != ty->ptr;
+		case TYPE_ARRAY:
+			return tx->array.base != ty->array.base || tx->array.len != ty->array.len;
+		case TYPE_SLICE:
+			return tx->slice != ty->slice;
+		case TYPE_TUPLE:
+			return tx->tuple.args_len != ty->tuple.args_len
+				|| (tx->tuple.args_len > 0 && memcmp(tx->tuple.args, ty->tuple.args, tx->tuple.args_len * sizeof(Type*)) != 0);
+		default:
+			assert(0);
+			return 1;
+	}
+}
+
+void type_init_table(void) {
+	type_table = (MapType)map_init_udef(type_hash, type_cmp);
+	if(mtx_init(&type_lock, mtx_plain) != thrd_success)
+		fatal("cannot create type table lock");
+}
+
+Type** type_list_dup(Type** list, isize len) {
+	return len ? memcpy(mpool_alloc(&type_pool, len * sizeof(Type*)), list, len * sizeof(Type*)) : NULL;
+}
+
+// returns the canonical copy of the structural type t
+Type* type_intern(Type* t) {
+	call_once(&type_table_once, type_init_table);
+	mtx_lock(&type_lock);
+	Type** found = map_get(&type_table, t);
+	if(found) {
+		Type* type = *found;
+		mtx_unlock(&type_lock);
+		return type;
+	}
+	Type* type = mpool_alloc(&type_pool, sizeof(Type));
+	*type = *t;
+	if(type->kind == TYPE_FN)
+		type->fn.args = type_list_dup(t->fn.args, t->fn.args_len);
+	else if(type->kind == TYPE_TUPLE)
+		type->tuple.args = type_list_dup(t->tuple.args, t->tuple.args_len);
+	MemTag old_tag = mem_tag_set(MEM_TYPES);
+	map_set(&type_table, type, type);
+	mem_tag_set(old_tag);
+	mtx_unlock(&type_lock);
+	return type;
+}
+
+#define TYPE_NICHE_NONNULL ((TypeNiche){ 0, sizeof(void*), 1, UINTPTR_MAX })
+
+Type* type_fn(Type** args, isize args_len, Type* ret) {
+	Type t = { TYPE_FN, sizeof(void*), sizeof(void*), .niche = TYPE_NICHE_NONNULL };
+	t.fn.args = args;
+	t.fn.args_len = args_len;
+	t.fn.ret = ret;
+	return type_intern(&t);
+}
+
+Type* type_ptr(Type* base) {
+	Type t = { TYPE_PTR, sizeof(void*), sizeof(void*), .niche = TYPE_NICHE_NONNULL };
+	t.ptr = base;
+	return type_intern(&t);
+}
+
+Type* type_array(Type* base, isize len) {
+	Type t = { TYPE_ARRAY };
+	t.array.base = base;
+	t.array.len = len;
+	return type_intern(&t);
+}
+
+Type* type_slice(Type* base) {
+	Type t = { TYPE_SLICE, 2 * sizeof(void*), sizeof(void*) };
+	t.slice = base;
+	return type_intern(&t);
+}
+
+Type* type_tuple(Type** args, isize args_len) {
+	Type t = { TYPE_TUPLE };
+	t.tuple.args = args;
+	t.tuple.args_len = args_len;
+	return type_intern(&t);
+}
+
+// Forgets the layout of the structural types whose layout depends on
+// other types, for the fields of structs and enums to change (nc --watch).
+void type_reset_layouts(void) {
+	call_once(&type_table_once, type_init_table);
+	mtx_lock(&type_lock);
+	for(MapIt it = map_begin(&type_table); it != map_end(&type_table); map_next(&type_table, &it)) {
+		Type* t = *(Type**)map_iter_value(&type_table, &it);
+		if(t->kind == TYPE_ARRAY || t->kind == TYPE_TUPLE)
+			t->align = 0;
+	}
+	mtx_unlock(&type_lock);
+}
+
+// allocates type data outside of type_intern
+void* type_alloc(isize size) {
+	call_once(&type_table_once, type_init_table);
+	mtx_lock(&type_lock);
+	void* ptr = mpool_alloc(&type_pool, size);
+	mtx_unlock(&type_lock);
+	return ptr;
+}
 
+// struct and enum types are nominal: every declaration gets its own type
+Type* type_nominal(TypeKind kind, Symbol* sym) {
+	assert(kind == TYPE_STRUCT || kind == TYPE_ENUM);
+	Type* type = type_alloc(sizeof(Type));
+	*type = (Type){ kind };
+	type->symbol = sym;
+	return type;
+}
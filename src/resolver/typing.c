@@ -0,0 +1,317 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Types of expressions, for the passes after resolution (code generation).
+// The language has no type checking yet, so this only propagates types
+// up from the operands: an expression whose type cannot be told from them
+// is left with a NULL type. It runs on one thread once the whole package
+// is resolved, when the fields of every struct are known.
+// Locals are typed by slot: slots are numbered in declaration order, so
+// walking a fn body in order numbers them as the resolver did.
+
+typedef struct Typer {
+	Type** locals;  // type of every slot declared so far in the current fn
+} Typer;
+
+// Literals and constants without a type take the type of the operand they
+// are combined with.
+bool typing_is_untyped(AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+		case AST_EXPR_LIT_FLOAT:
+		case AST_EXPR_LIT_CHAR:
+			return true;
+		case AST_EXPR_IDENT:
+			return expr->ident.sym && expr->ident.sym->kind == SYMBOL_CONST && !expr->ident.sym->cold->value.type;
+		case AST_EXPR_UNARY:
+			return (expr->unary.op == T_SUB || expr->unary.op == T_ADD) && typing_is_untyped(expr->unary.x);
+		case AST_EXPR_BINARY:
+			return typing_is_untyped(expr->binary.x) && typing_is_untyped(expr->binary.y);
+		default:
+			return false;
+	}
+}
+
+// the enum named by x, when x is E in E.Variant
+Type* typing_enum_name(AstExpr* x) {
+	if(x->kind != AST_EXPR_IDENT || !x->ident.sym || x->ident.sym->kind != SYMBOL_TYPE)
+		return NULL;
+	Type* t = x->ident.sym->type;
+	return t && t->kind == TYPE_ENUM ? t : NULL;
+}
+
+TypeField* typing_field(Type* t, StrIntern name) {
+	if(t && t->kind == TYPE_PTR)
+		t = t->ptr;
+	if(!t || t->kind != TYPE_STRUCT)
+		return NULL;
+	for(isize i = 0; i < t->struct_.fields_len; i++) {
+		if(t->struct_.fields[i].name == name)
+			return &t->struct_.fields[i];
+	}
+	return NULL;
+}
+
+// index of the tuple member f<index> of t, -1 if there is none
+isize typing_tuple_index(Type* t, StrIntern name) {
+	if(name[0] != 'f' || !name[1])
+		return -1;
+	isize index = 0;
+	for(const char* c = name + 1; *c; c++) {
+		if(*c < '0' || *c > '9' || (index == 0 && c > name + 1) || index > t->tuple.args_len)
+			return -1;
+		index = index * 10 + (*c - '0');
+	}
+	return index < t->tuple.args_len ? index : -1;
+}
+
+// type of the member name of a struct, tuple (f0, f1, ...) or slice (ptr
+// and len), through a pointer
+Type* typing_member(Type* t, StrIntern name) {
+	if(t && t->kind == TYPE_PTR)
+		t = t->ptr;
+	if(!t)
+		return NULL;
+	switch(t->kind) {
+		case TYPE_STRUCT: {
+			TypeField* f = typing_field(t, name);
+			return f ? f->type : NULL;
+		}
+		case TYPE_TUPLE: {
+			isize index = typing_tuple_index(t, name);
+			return index >= 0 ? t->tuple.args[index] : NULL;
+		}
+		case TYPE_SLICE:
+			if(strcmp(name, "ptr") == 0)
+				return type_ptr(t->slice);
+			return strcmp(name, "len") == 0 ? primitive_isize : NULL;
+		default:
+			return NULL;
+	}
+}
+
+Type* typing_expr(Typer* ty, AstExpr* expr);
+
+void typing_expr_list(Typer* ty, AstExprList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		typing_expr(ty, list->list[i]);
+	}
+}
+
+Type* typing_tuple(AstExprList* args) {
+	Type** types = NULL;
+	Type* t = NULL;
+	for(isize i = 0; i < args->len && args->list[i]->type; i++) {
+		buf_push(types, args->list[i]->type);
+	}
+	if(buf_len(types) == args->len)
+		t = type_tuple(types, args->len);
+	buf_free(types);
+	return t;
+}
+
+Type* typing_expr_kind(Typer* ty, AstExpr* expr) {
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+		case AST_EXPR_LIT_CHAR:
+			return primitive_i64;
+		case AST_EXPR_LIT_FLOAT:
+			return primitive_f64;
+		case AST_EXPR_LIT_STRING:
+			return type_ptr(primitive_u8);
+		case AST_EXPR_IDENT: {
+			Symbol* sym = expr->ident.sym;
+			if(!sym)
+				return expr->ident.slot < buf_len(ty->locals) ? ty->locals[expr->ident.slot] : NULL;
+			return sym->kind != SYMBOL_TYPE ? sym->type : NULL;
+		}
+		case AST_EXPR_MEMBER: {
+			typing_expr(ty, expr->member.x);
+			Type* t = typing_enum_name(expr->member.x);
+			if(t)
+				return t;
+			return typing_member(expr->member.x->type, expr->member.name);
+		}
+		case AST_EXPR_CALL: {
+			typing_expr(ty, expr->call.x);
+			typing_expr_list(ty, &expr->call.args);
+			Type* t = expr->call.x->type;
+			if(t && t->kind == TYPE_ENUM)
+				return t;  // E.Variant(payload)
+			return t && t->kind == TYPE_FN ? t->fn.ret : NULL;
+		}
+		case AST_EXPR_UNARY: {
+			Type* t = typing_expr(ty, expr->unary.x);
+			switch(expr->unary.op) {
+				case T_NOT:
+					return primitive_bool;
+				case T_MUL:
+					return t && t->kind == TYPE_PTR ? t->ptr : NULL;
+				case T_AND:
+					return t ? type_ptr(t) : NULL;
+				default:
+					return t;
+			}
+		}
+		case AST_EXPR_BINARY: {
+			Type* x = typing_expr(ty, expr->binary.x);
+			Type* y = typing_expr(ty, expr->binary.y);
+			switch(expr->binary.op) {
+				case T_EQL: case T_NEQ: case T_LT: case T_GT: case T_LTE: case T_GTE:
+				case T_LAND: case T_LOR:
+					return primitive_bool;
+				case T_LSHIFT: case T_RSHIFT:
+					return x;
+				default:
+					return typing_is_untyped(expr->binary.x) ? y : x;
+			}
+		}
+		case AST_EXPR_CAST:
+			typing_expr(ty, expr->cast.x);
+			return expr->cast.type->resolved;
+		case AST_EXPR_INDEX: {
+			Type* t = typing_expr(ty, expr->index.x);
+			typing_expr(ty, expr->index.arg);
+			if(!t)
+				return NULL;
+			switch(t->kind) {
+				case TYPE_ARRAY:
+					return t->array.base;
+				case TYPE_SLICE:
+					return t->slice;
+				case TYPE_PTR:
+					return t->ptr;
+				default:
+					return NULL;
+			}
+		}
+		case AST_EXPR_TUPLE:
+			typing_expr_list(ty, &expr->tuple.args);
+			return typing_tuple(&expr->tuple.args);
+		case AST_EXPR_ARRAY: {
+			Type* t = typing_expr(ty, expr->array.init);
+			typing_expr(ty, expr->array.len);
+			return t ? type_array(t, expr->array.count) : NULL;
+		}
+		case AST_EXPR_ARRAY_LIST: {
+			AstExprList* args = &expr->array_list.args;
+			typing_expr_list(ty, args);
+			Type* t = args->len > 0 ? args->list[0]->type : NULL;
+			return t ? type_array(t, args->len) : NULL;
+		}
+		case AST_EXPR_INIT: {
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				typing_expr(ty, expr->init.fields.list[i]->expr);
+			}
+			AstExpr* x = expr->init.x;
+			if(x->kind == AST_EXPR_IDENT && x->ident.sym && x->ident.sym->kind == SYMBOL_TYPE)
+				return x->ident.sym->type;
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+// sets and returns the type of expr and of its subexpressions
+Type* typing_expr(Typer* ty, AstExpr* expr) {
+	if(!expr)
+		return NULL;
+	expr->type = typing_expr_kind(ty, expr);
+	return expr->type;
+}
+
+void typing_stmt(Typer* ty, AstStmt* stmt);
+
+void typing_block(Typer* ty, AstStmtList* list) {
+	for(isize i = 0; i < list->len; i++) {
+		typing_stmt(ty, list->list[i]);
+	}
+}
+
+void typing_stmt(Typer* ty, AstStmt* stmt) {
+	if(!stmt)
+		return;
+	switch(stmt->kind) {
+		case AST_STMT_DECL: {
+			AstDecl* decl = stmt->decl;
+			Type* t;
+			if(decl->kind == AST_DECL_LET) {
+				t = typing_expr(ty, decl->let.value);
+				t = decl->let.type ? decl->let.type->resolved : t;
+			} else {
+				t = typing_expr(ty, decl->const_.value);
+			}
+			buf_push(ty->locals, t);
+			break;
+		}
+		case AST_STMT_EXPR:
+			typing_expr(ty, stmt->expr);
+			break;
+		case AST_STMT_IF:
+			typing_expr(ty, stmt->if_.cond);
+			typing_block(ty, &stmt->if_.body);
+			typing_stmt(ty, stmt->if_.els);
+			break;
+		case AST_STMT_FOR:
+			typing_expr(ty, stmt->for_.cond);
+			typing_block(ty, &stmt->for_.body);
+			break;
+		case AST_STMT_RETURN:
+			typing_expr(ty, stmt->return_);
+			break;
+		case AST_STMT_ASSIGN:
+			typing_expr(ty, stmt->assign.x);
+			typing_expr(ty, stmt->assign.y);
+			break;
+		case AST_STMT_BLOCK:
+			typing_block(ty, &stmt->block.body);
+			break;
+	}
+}
+
+void typing_symbol(Typer* ty, Symbol* sym) {
+	AstDecl* decl = sym->decl;
+	switch(decl->kind) {
+		case AST_DECL_LET:
+			typing_expr(ty, decl->let.value);
+			// untyped lets take the type of their initializer
+			if(!sym->type && decl->let.value)
+				sym->type = decl->let.value->type;
+			break;
+		case AST_DECL_CONST:
+			typing_expr(ty, decl->const_.value);
+			break;
+		case AST_DECL_FN:
+			if(decl->fn.is_extern)
+				break;
+			buf_clear(ty->locals);
+			for(isize i = 0; i < sym->type->fn.args_len; i++) {
+				buf_push(ty->locals, sym->type->fn.args[i]);
+			}
+			typing_block(ty, &decl->fn.body);
+			break;
+		default:
+			break;
+	}
+}
+
+// Types every resolved symbol. Package initializers come first, in the
+// order the symbols were declared (symbol_order), which puts a let after
+// the lets its initializer names; fn bodies can then see every let.
+void typing_package(Package* pkg) {
+	Typer ty = {0};
+	for(isize i = 0; i < buf_len(pkg->symbol_order); i++) {
+		SymbolOrder o = pkg->symbol_order[i];
+		if(!o.is_decl)
+			continue;
+		Symbol* sym = resolver_resolve_name(pkg, (FileLoc){ pkg->path }, o.name, false);
+		if(sym && sym->state == SYMSTATE_RESOLVED && sym->kind != SYMBOL_FN)
+			typing_symbol(&ty, sym);
+	}
+	for(isize i = 0; i < buf_len(pkg->decl_symbols); i++) {
+		Symbol* sym = pkg->decl_symbols[i];
+		if(sym->state == SYMSTATE_RESOLVED && sym->kind == SYMBOL_FN)
+			typing_symbol(&ty, sym);
+	}
+	buf_free(ty.locals);
+}
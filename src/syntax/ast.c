@@ -5,6 +5,8 @@ typedef struct AstExpr AstExpr;
 typedef struct AstStmt AstStmt;
 typedef struct AstDecl AstDecl;
 typedef struct AstType AstType;
+typedef struct Type Type;
+typedef struct Symbol Symbol;
 
 typedef enum AstExprKind {
 	AST_EXPR_LIT_INT,
@@ -43,6 +45,11 @@ typedef enum AstDeclKind {
 	AST_DECL_TYPE
 } AstDeclKind;
 
+// declaration attributes, '@name' before the declaration
+typedef enum AstAttr {
+	AST_ATTR_REORDER = 1 << 0,  // struct: reorder fields to minimize padding
+} AstAttr;
+
 typedef enum AstTypeKind {
 	AST_TYPE_NAME,
 	AST_TYPE_PTR,
@@ -55,6 +62,7 @@ typedef enum AstTypeKind {
 typedef struct AstParam {
 	StrIntern name;
 	AstType* type;
+	AstExpr* value;            // enum discriminant, NULL if not given
 } AstParam;
 
 typedef struct AstArg {
@@ -95,12 +103,18 @@ typedef struct AstDeclList {
 struct AstExpr {
 	AstExprKind kind;
 	FileLoc loc;
+	Type* type;                // set by typing_package, NULL when not known
 	union {
 		u64 lit_int;           // AST_EXPR_LIT_INT
 		double lit_float;      // AST_EXPR_LIT_FLOAT
 		StrRange lit_string;   // AST_EXPR_LIT_STRING
 		i32 lit_char;          // AST_EXPR_LIT_CHAR
-		StrIntern ident;       // AST_EXPR_IDENT
+		struct {
+			StrIntern name;
+			i32 depth;         // scope depth of a local, -1 for package symbols
+			i32 slot;          // index of a local in its fn frame
+			Symbol* sym;       // package symbol, NULL for locals
+		} ident;               // AST_EXPR_IDENT
 		struct {
 			AstExpr* x;
 			StrIntern name;
@@ -131,7 +145,8 @@ struct AstExpr {
 		} tuple;               // AST_EXPR_TUPLE
 		struct {
 			AstExpr* init;
-			u32 len;
+			AstExpr* len;
+			i64 count;         // value of len, set by the resolver
 		} array;               // AST_EXPR_ARRAY
 		struct {
 			AstExprList args;
@@ -173,11 +188,12 @@ struct AstStmt {
 struct AstType {
 	AstTypeKind kind;
 	FileLoc loc;
+	Type* resolved;            // canonical type, set by the resolver
 	union {
 		StrIntern name;        // AST_TYPE_NAME
 		AstType* ptr;          // AST_TYPE_PTR
 		struct {
-			i32 size;
+			AstExpr* size;
 			AstType* type;
 		} array;               // AST_TYPE_ARRAY
 		struct {
@@ -197,6 +213,7 @@ struct AstDecl {
 	AstDeclKind kind;
 	FileLoc loc;
 	StrIntern name;
+	u32 attrs;                // AstAttr flags
 	union {
 		struct {
 			AstExpr* value;
@@ -229,7 +246,51 @@ typedef struct AstFile {
 	AstDeclList decls;
 } AstFile;
 
-MemoryPool ast_pool;
+const char* ast_expr_kind_names[] = {
+	[AST_EXPR_LIT_INT] = "EXPR_LIT_INT",
+	[AST_EXPR_LIT_FLOAT] = "EXPR_LIT_FLOAT",
+	[AST_EXPR_LIT_STRING] = "EXPR_LIT_STRING",
+	[AST_EXPR_LIT_CHAR] = "EXPR_LIT_CHAR",
+	[AST_EXPR_IDENT] = "EXPR_IDENT",
+	[AST_EXPR_MEMBER] = "EXPR_MEMBER",
+	[AST_EXPR_CALL] = "EXPR_CALL",
+	[AST_EXPR_UNARY] = "EXPR_UNARY",
+	[AST_EXPR_BINARY] = "EXPR_BINARY",
+	[AST_EXPR_CAST] = "EXPR_CAST",
+	[AST_EXPR_INDEX] = "EXPR_INDEX",
+	[AST_EXPR_TUPLE] = "EXPR_TUPLE",
+	[AST_EXPR_ARRAY] = "EXPR_ARRAY",
+	[AST_EXPR_ARRAY_LIST] = "EXPR_ARRAY_LIST",
+	[AST_EXPR_INIT] = "EXPR_INIT",
+};
+
+const char* ast_stmt_kind_names[] = {
+	[AST_STMT_DECL] = "STMT_DECL",
+	[AST_STMT_EXPR] = "STMT_EXPR",
+	[AST_STMT_IF] = "STMT_IF",
+	[AST_STMT_FOR] = "STMT_FOR",
+	[AST_STMT_RETURN] = "STMT_RETURN",
+	[AST_STMT_ASSIGN] = "STMT_ASSIGN",
+	[AST_STMT_BLOCK] = "STMT_BLOCK",
+};
+
+MemoryPool ast_pool = {.tag = MEM_AST};
+
+// node counts, only kept when mem_stats_enabled is set
+isize ast_expr_counts[AST_EXPR_INIT + 1];
+isize ast_stmt_counts[AST_STMT_BLOCK + 1];
+
+void ast_stats_print(void) {
+	printf("ast nodes by kind:\n");
+	for(isize i = 0; i <= AST_EXPR_INIT; i++) {
+		if(ast_expr_counts[i])
+			printf("  %-16s %10lld\n", ast_expr_kind_names[i], (long long)ast_expr_counts[i]);
+	}
+	for(isize i = 0; i <= AST_STMT_BLOCK; i++) {
+		if(ast_stmt_counts[i])
+			printf("  %-16s %10lld\n", ast_stmt_kind_names[i], (long long)ast_stmt_counts[i]);
+	}
+}
 
 void* ast_alloc(isize size) {
 	assert(size != 0);
@@ -257,41 +318,45 @@ AstParam* ast_param_new(StrIntern name, AstType* type) {
 	return arg;
 }
 
+// Lists are built in arena buffers on the ast pool (see ast_buf) and are
+// used in place; lists built in heap buffers are copied to the pool.
+#define ast_buf(b) buf_arena(b, &ast_pool, 4)
+
+void* ast_list_data(void* buf, isize elem_size) {
+	if(!buf)
+		return NULL;
+	if(buf__hdr(buf)->pool == &ast_pool) {
+		buf = buf__shrink(buf, elem_size);
+		return buf_len(buf) ? buf : NULL;
+	}
+	void* data = buf_len(buf) ? ast_dup(buf, buf_len(buf) * elem_size) : NULL;
+	xfree(buf__hdr(buf));
+	return data;
+}
+
 AstStmtList ast_stmt_list(AstStmt** buf) {
-	size_t len = buf_len(buf);
-	AstStmt** stmts = buf ? ast_dup(buf, len * sizeof(*buf)) : NULL;
-	buf_free(buf);
-	return (AstStmtList){stmts, len};
+	isize len = buf_len(buf);
+	return (AstStmtList){ast_list_data(buf, sizeof(*buf)), len};
 }
 AstParamList ast_param_list(AstParam** buf) {
-	size_t len = buf_len(buf);
-	AstParam** params = buf ? ast_dup(buf, len * sizeof(*buf)) : NULL;
-	buf_free(buf);
-	return (AstParamList){params, len};
+	isize len = buf_len(buf);
+	return (AstParamList){ast_list_data(buf, sizeof(*buf)), len};
 }
 AstArgList ast_arg_list(AstArg** buf) {
-	size_t len = buf_len(buf);
-	AstArg** args = buf ? ast_dup(buf, len * sizeof(*buf)) : NULL;
-	buf_free(buf);
-	return (AstArgList){args, len};
+	isize len = buf_len(buf);
+	return (AstArgList){ast_list_data(buf, sizeof(*buf)), len};
 }
 AstExprList ast_expr_list(AstExpr** buf) {
-	size_t len = buf_len(buf);
-	AstExpr** exprs = buf ? ast_dup(buf, len * sizeof(*buf)) : NULL;
-	buf_free(buf);
-	return (AstExprList){exprs, len};
+	isize len = buf_len(buf);
+	return (AstExprList){ast_list_data(buf, sizeof(*buf)), len};
 }
 AstTypeList ast_type_list(AstType** buf) {
-	size_t len = buf_len(buf);
-	AstType** types = buf ? ast_dup(buf, len * sizeof(*buf)) : NULL;
-	buf_free(buf);
-	return (AstTypeList){types, len};
+	isize len = buf_len(buf);
+	return (AstTypeList){ast_list_data(buf, sizeof(*buf)), len};
 }
 AstDeclList ast_decl_list(AstDecl** buf) {
-	size_t len = buf_len(buf);
-	AstDecl** decls = buf ? ast_dup(buf, len * sizeof(*buf)) : NULL;
-	buf_free(buf);
-	return (AstDeclList){decls, len};
+	isize len = buf_len(buf);
+	return (AstDeclList){ast_list_data(buf, sizeof(*buf)), len};
 }
 
 AstDecl* ast_decl_new(FileLoc loc, AstDeclKind kind, StrIntern name) {
@@ -340,6 +405,8 @@ AstDecl* ast_decl_type(FileLoc loc, StrIntern name, AstType* type) {
 
 AstExpr* ast_expr_new(FileLoc loc, AstExprKind kind) {
 	AstExpr* expr = ast_alloc(sizeof(AstExpr));
+	if(mem_stats_enabled)
+		ast_expr_counts[kind]++;
 	expr->loc = loc;
 	expr->kind = kind;
 	return expr;
@@ -366,7 +433,9 @@ AstExpr* ast_expr_lit_char(FileLoc loc, i32 lit) {
 }
 AstExpr* ast_expr_ident(FileLoc loc, StrIntern ident) {
 	AstExpr* expr = ast_expr_new(loc, AST_EXPR_IDENT);
-	expr->ident = ident;
+	expr->ident.name = ident;
+	expr->ident.depth = -1;
+	expr->ident.slot = -1;
 	return expr;
 }
 AstExpr* ast_expr_member(FileLoc loc, AstExpr* x, StrIntern name) {
@@ -411,7 +480,7 @@ AstExpr* ast_expr_tuple(FileLoc loc, AstExprList args) {
 	expr->tuple.args = args;
 	return expr;
 }
-AstExpr* ast_expr_array(FileLoc loc, AstExpr* init, u32 len) {
+AstExpr* ast_expr_array(FileLoc loc, AstExpr* init, AstExpr* len) {
 	AstExpr* expr = ast_expr_new(loc, AST_EXPR_ARRAY);
 	expr->array.init = init;
 	expr->array.len = len;
@@ -431,6 +500,8 @@ AstExpr* ast_expr_init(FileLoc loc, AstExpr* x, AstArgList fields) {
 
 AstStmt* ast_stmt_new(FileLoc loc, AstStmtKind kind) {
 	AstStmt* stmt = ast_alloc(sizeof(AstStmt));
+	if(mem_stats_enabled)
+		ast_stmt_counts[kind]++;
 	stmt->loc = loc;
 	stmt->kind = kind;
 	return stmt;
@@ -492,7 +563,7 @@ AstType* ast_type_ptr(FileLoc loc, AstType* ptr) {
 	type->ptr = ptr;
 	return type;
 }
-AstType* ast_type_array(FileLoc loc, u32 size, AstType* type_) {
+AstType* ast_type_array(FileLoc loc, AstExpr* size, AstType* type_) {
 	AstType* type = ast_type_new(loc, AST_TYPE_ARRAY);
 	type->array.size = size;
 	type->array.type = type_;
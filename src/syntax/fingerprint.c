@@ -0,0 +1,185 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Fingerprints of declarations, used to find what changed between two
+// compilations of a package (nc --watch). A fingerprint hashes the syntax
+// tree without source locations and without what the resolver stores in
+// it, so moving a declaration around does not change its fingerprint.
+// Names are interned, so they are hashed by pointer.
+
+u64 ast_fingerprint_mix(u64 h, u64 x) {
+	return map_hash_mix(h, map_hash_u64(x));
+}
+
+u64 ast_fingerprint_expr(u64 h, AstExpr* expr);
+u64 ast_fingerprint_stmt(u64 h, AstStmt* stmt);
+u64 ast_fingerprint_decl(u64 h, AstDecl* decl);
+
+u64 ast_fingerprint_type(u64 h, AstType* type) {
+	if(!type)
+		return ast_fingerprint_mix(h, 0);
+	h = ast_fingerprint_mix(h, type->kind + 1);
+	switch(type->kind) {
+		case AST_TYPE_NAME:
+			return ast_fingerprint_mix(h, (u64)type->name);
+		case AST_TYPE_PTR:
+			return ast_fingerprint_type(h, type->ptr);
+		case AST_TYPE_ARRAY:
+			h = ast_fingerprint_expr(h, type->array.size);
+			return ast_fingerprint_type(h, type->array.type);
+		case AST_TYPE_SLICE:
+			return ast_fingerprint_type(h, type->slice.type);
+		case AST_TYPE_FN:
+			for(isize i = 0; i < type->fn.args.len; i++) {
+				h = ast_fingerprint_type(h, type->fn.args.list[i]);
+			}
+			return ast_fingerprint_type(h, type->fn.ret);
+		case AST_TYPE_TUPLE:
+			h = ast_fingerprint_mix(h, type->tuple.args.len);
+			for(isize i = 0; i < type->tuple.args.len; i++) {
+				h = ast_fingerprint_type(h, type->tuple.args.list[i]);
+			}
+			return h;
+	}
+	return h;
+}
+
+u64 ast_fingerprint_expr_list(u64 h, AstExprList* list) {
+	h = ast_fingerprint_mix(h, list->len);
+	for(isize i = 0; i < list->len; i++) {
+		h = ast_fingerprint_expr(h, list->list[i]);
+	}
+	return h;
+}
+
+u64 ast_fingerprint_expr(u64 h, AstExpr* expr) {
+	if(!expr)
+		return ast_fingerprint_mix(h, 0);
+	h = ast_fingerprint_mix(h, expr->kind + 1);
+	switch(expr->kind) {
+		case AST_EXPR_LIT_INT:
+			return ast_fingerprint_mix(h, expr->lit_int);
+		case AST_EXPR_LIT_FLOAT: {
+			u64 bits;
+			memcpy(&bits, &expr->lit_float, sizeof(bits));
+			return ast_fingerprint_mix(h, bits);
+		}
+		case AST_EXPR_LIT_STRING:
+			return map_hash_mix(h, map_hash_bytes(expr->lit_string.s, expr->lit_string.l));
+		case AST_EXPR_LIT_CHAR:
+			return ast_fingerprint_mix(h, expr->lit_char);
+		case AST_EXPR_IDENT:
+			return ast_fingerprint_mix(h, (u64)expr->ident.name);
+		case AST_EXPR_MEMBER:
+			h = ast_fingerprint_expr(h, expr->member.x);
+			return ast_fingerprint_mix(h, (u64)expr->member.name);
+		case AST_EXPR_CALL:
+			h = ast_fingerprint_expr(h, expr->call.x);
+			return ast_fingerprint_expr_list(h, &expr->call.args);
+		case AST_EXPR_UNARY:
+			h = ast_fingerprint_mix(h, expr->unary.op);
+			return ast_fingerprint_expr(h, expr->unary.x);
+		case AST_EXPR_BINARY:
+			h = ast_fingerprint_mix(h, expr->binary.op);
+			h = ast_fingerprint_expr(h, expr->binary.x);
+			return ast_fingerprint_expr(h, expr->binary.y);
+		case AST_EXPR_CAST:
+			h = ast_fingerprint_expr(h, expr->cast.x);
+			return ast_fingerprint_type(h, expr->cast.type);
+		case AST_EXPR_INDEX:
+			h = ast_fingerprint_expr(h, expr->index.x);
+			return ast_fingerprint_expr(h, expr->index.arg);
+		case AST_EXPR_TUPLE:
+			return ast_fingerprint_expr_list(h, &expr->tuple.args);
+		case AST_EXPR_ARRAY:
+			h = ast_fingerprint_expr(h, expr->array.init);
+			return ast_fingerprint_expr(h, expr->array.len);
+		case AST_EXPR_ARRAY_LIST:
+			return ast_fingerprint_expr_list(h, &expr->array_list.args);
+		case AST_EXPR_INIT:
+			h = ast_fingerprint_expr(h, expr->init.x);
+			h = ast_fingerprint_mix(h, expr->init.fields.len);
+			for(isize i = 0; i < expr->init.fields.len; i++) {
+				h = ast_fingerprint_mix(h, (u64)expr->init.fields.list[i]->name);
+				h = ast_fingerprint_expr(h, expr->init.fields.list[i]->expr);
+			}
+			return h;
+	}
+	return h;
+}
+
+u64 ast_fingerprint_stmt_list(u64 h, AstStmtList* list) {
+	h = ast_fingerprint_mix(h, list->len);
+	for(isize i = 0; i < list->len; i++) {
+		h = ast_fingerprint_stmt(h, list->list[i]);
+	}
+	return h;
+}
+
+u64 ast_fingerprint_stmt(u64 h, AstStmt* stmt) {
+	if(!stmt)
+		return ast_fingerprint_mix(h, 0);
+	h = ast_fingerprint_mix(h, stmt->kind + 1);
+	switch(stmt->kind) {
+		case AST_STMT_DECL:
+			return ast_fingerprint_decl(h, stmt->decl);
+		case AST_STMT_EXPR:
+			return ast_fingerprint_expr(h, stmt->expr);
+		case AST_STMT_IF:
+			h = ast_fingerprint_expr(h, stmt->if_.cond);
+			h = ast_fingerprint_stmt_list(h, &stmt->if_.body);
+			return ast_fingerprint_stmt(h, stmt->if_.els);
+		case AST_STMT_FOR:
+			h = ast_fingerprint_expr(h, stmt->for_.cond);
+			return ast_fingerprint_stmt_list(h, &stmt->for_.body);
+		case AST_STMT_RETURN:
+			return ast_fingerprint_expr(h, stmt->return_);
+		case AST_STMT_ASSIGN:
+			h = ast_fingerprint_mix(h, stmt->assign.op);
+			h = ast_fingerprint_expr(h, stmt->assign.x);
+			return ast_fingerprint_expr(h, stmt->assign.y);
+		case AST_STMT_BLOCK:
+			return ast_fingerprint_stmt_list(h, &stmt->block.body);
+	}
+	return h;
+}
+
+u64 ast_fingerprint_params(u64 h, AstParamList* params) {
+	h = ast_fingerprint_mix(h, params->len);
+	for(isize i = 0; i < params->len; i++) {
+		h = ast_fingerprint_mix(h, (u64)params->list[i]->name);
+		h = ast_fingerprint_type(h, params->list[i]->type);
+		h = ast_fingerprint_expr(h, params->list[i]->value);
+	}
+	return h;
+}
+
+u64 ast_fingerprint_decl(u64 h, AstDecl* decl) {
+	h = ast_fingerprint_mix(h, decl->kind + 1);
+	h = ast_fingerprint_mix(h, (u64)decl->name);
+	h = ast_fingerprint_mix(h, decl->attrs);
+	switch(decl->kind) {
+		case AST_DECL_LET:
+			h = ast_fingerprint_mix(h, decl->let.is_extern);
+			h = ast_fingerprint_type(h, decl->let.type);
+			return ast_fingerprint_expr(h, decl->let.value);
+		case AST_DECL_CONST:
+			return ast_fingerprint_expr(h, decl->const_.value);
+		case AST_DECL_FN:
+			h = ast_fingerprint_mix(h, decl->fn.is_extern);
+			h = ast_fingerprint_params(h, &decl->fn.params);
+			h = ast_fingerprint_type(h, decl->fn.ret);
+			return ast_fingerprint_stmt_list(h, &decl->fn.body);
+		case AST_DECL_STRUCT:
+			return ast_fingerprint_params(h, &decl->struct_.params);
+		case AST_DECL_ENUM:
+			return ast_fingerprint_params(h, &decl->enum_.params);
+		case AST_DECL_TYPE:
+			return ast_fingerprint_type(h, decl->type.type);
+	}
+	return h;
+}
+
+u64 ast_fingerprint(AstDecl* decl) {
+	return ast_fingerprint_decl(0x9e3779b97f4a7c15, decl);
+}
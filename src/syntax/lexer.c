@@ -384,6 +384,9 @@ redo:
 		case ',':
 			l->token.tok = T_COMMA;
 			break;
+		case '@':
+			l->token.tok = T_AT;
+			break;
 		case '/':
 			c = lexer_getr(l);
 			if(c == '/') {
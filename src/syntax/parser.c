@@ -12,13 +12,17 @@ FileLoc parser_loc(Parser* p) {
 }
 
 void parser_next(Parser* p) {
+	trace_accum_begin(TRACE_ACCUM_LEX);
 	lexer_lex(&(p->l));
+	trace_accum_end(TRACE_ACCUM_LEX);
 	//printf("[%2d:%-2d]   %s\n", p->l.token.line, p->l.token.col, ttos(p->l.token));
 	p->t = p->l.token;
 }
 
 void parser_init(Parser* p, const char* file, StrRange src) {
 	lexer_init(&(p->l), file, src);
+	// size hint: roughly one new identifier every 64 bytes of source
+	str_intern_reserve(src.l / 64);
 	p->xnest = 0;
 	parser_next(p);
 }
@@ -39,7 +43,9 @@ int parser_accept(Parser* p, TokenKind tok) {
 
 StrIntern parser_parse_ident(Parser* p) {
 	if(p->t.tok == T_IDENT) {
+		trace_accum_begin(TRACE_ACCUM_INTERN);
 		StrIntern n = str_intern(p->t.lit);
+		trace_accum_end(TRACE_ACCUM_INTERN);
 		parser_next(p);
 		return n;
 	}
@@ -92,6 +98,8 @@ AstType* parser_parse_type(Parser* p);
 
 // ExprList = Expr | Expr ',' ExprList
 AstExpr** parser_parse_expr_list(Parser* p, AstExpr** exprs, int trailing_comma) {
+	if(!exprs)
+		ast_buf(exprs);
 	buf_push(exprs, parser_parse_expr(p));
 	while(p->t.tok == T_COMMA) {
 		parser_next(p);
@@ -104,6 +112,8 @@ AstExpr** parser_parse_expr_list(Parser* p, AstExpr** exprs, int trailing_comma)
 
 // TypeList = Type | Type ',' TypeList
 AstType** parser_parse_type_list(Parser* p, AstType** types, int trailing_comma) {
+	if(!types)
+		ast_buf(types);
 	buf_push(types, parser_parse_type(p));
 	while(p->t.tok == T_COMMA) {
 		parser_next(p);
@@ -127,8 +137,9 @@ AstType* parser_parse_type_tuple(Parser* p) {
 	AstType* t = parser_parse_type(p);
 	if(parser_accept(p, T_COMMA)) {
 		AstType** types = NULL;
+		ast_buf(types);
 		buf_push(types, t);
-		if(p->t.tok == T_RPAREN) {
+		if(p->t.tok != T_RPAREN) {
 			types = parser_parse_type_list(p, types, 1);
 		}
 		t = ast_type_tuple(loc, ast_type_list(types));
@@ -139,7 +150,7 @@ AstType* parser_parse_type_tuple(Parser* p) {
 
 // Type = ident | '*' Type | '(' Type ')'
 //      | '[' Type ']'
-//      | '[' Type ';' int ']'
+//      | '[' Type ',' Expr ']'
 //      | '(' Type ',' TypeList ')'
 AstType* parser_parse_type(Parser* p) {
 	FileLoc loc = parser_loc(p);
@@ -157,7 +168,7 @@ AstType* parser_parse_type(Parser* p) {
 			parser_next(p);
 			AstType* t = parser_parse_type(p);
 			if(parser_accept(p, T_COMMA)) {
-				u64 size = parser_parse_int(p);
+				AstExpr* size = parser_parse_expr(p);
 				parser_expect(p, T_RBRACK);
 				return ast_type_array(loc, size, t);
 			}
@@ -173,7 +184,7 @@ AstType* parser_parse_type(Parser* p) {
 // Operand = ident | int | float | string 
 //         | '(' Expr ')'
 //         | '(' Expr ',' ExprList ')' | '(' ')' 
-//         | '[' Expr ';' int ']'
+//         | '[' Expr ';' Expr ']'
 //         | '[' ExprList ']'
 AstExpr* parser_parse_operand(Parser* p) {
 	FileLoc loc = parser_loc(p);
@@ -199,6 +210,7 @@ AstExpr* parser_parse_operand(Parser* p) {
 			AstExpr* x = parser_parse_expr(p);
 			if(parser_accept(p, T_COMMA)) {
 				AstExpr** exprs = NULL;
+				ast_buf(exprs);
 				buf_push(exprs, x);
 				if(p->t.tok != T_RPAREN) {
 					exprs = parser_parse_expr_list(p, exprs, 0);
@@ -214,13 +226,10 @@ AstExpr* parser_parse_operand(Parser* p) {
 			p->xnest++;
 			AstExpr* x = parser_parse_expr(p);
 			if(parser_accept(p, T_SEMI)) {
-				if(p->t.tok != T_INT) {
-					parser_error("unexpected %s, expecting array size", ttos(p->t));
-					return NULL;
-				}
-				x = ast_expr_array(loc, x, parser_parse_int(p));
+				x = ast_expr_array(loc, x, parser_parse_expr(p));
 			} else {
 				AstExpr** exprs = NULL;
+				ast_buf(exprs);
 				buf_push(exprs, x);
 				if(parser_accept(p, T_COMMA) && p->t.tok != T_RBRACK) {
 					exprs = parser_parse_expr_list(p, exprs, 0);
@@ -285,9 +294,11 @@ AstExpr* parser_parse_expr_primary(Parser* p) {
 					case AST_EXPR_IDENT:
 						if(p->xnest >= 0)
 							complit = 1;
+						break;
 					case AST_EXPR_ARRAY:
 					case AST_EXPR_ARRAY_LIST:
 						complit = 1;
+						break;
 					default:
 						break;
 				}
@@ -297,6 +308,7 @@ AstExpr* parser_parse_expr_primary(Parser* p) {
 				parser_next(p);
 				p->xnest++;
 				AstArg** exprs = NULL;
+				ast_buf(exprs);
 				while(p->t.tok != T_RBRACE) {
 					StrIntern name = parser_parse_ident(p);
 					parser_expect(p, T_COLON);
@@ -359,6 +371,7 @@ AstExpr* parser_parse_expr(Parser* p) {
 // StmtList = Stmt | Stmt ';' StmtList
 AstStmt** parser_parse_stmt_list(Parser* p) {
 	AstStmt** stmts = NULL;
+	ast_buf(stmts);
 	while(p->t.tok != T_EOF && p->t.tok != T_RBRACE) {
 		AstStmt* stmt = parser_parse_stmt(p);
 		if(stmt)
@@ -374,6 +387,7 @@ AstStmt** parser_parse_stmt_list(Parser* p) {
 
 AstParam** parser_parse_arg_list(Parser* p) {
 	AstParam** args = NULL;
+	ast_buf(args);
 	while(1) {
 		StrIntern n = parser_parse_ident(p);
 		parser_expect(p, T_COLON);
@@ -436,6 +450,7 @@ AstDecl* parser_parse_decl_const(Parser* p) {
 AstParamList parser_parse_decl_struct_fields(Parser* p, FileLoc loc) {
 	parser_expect(p, T_LBRACE);
 	AstParam** args = NULL;
+	ast_buf(args);
 	while(p->t.tok != T_RBRACE) {
 		StrIntern name = parser_parse_ident(p);
 		parser_expect(p, T_COLON);
@@ -453,6 +468,7 @@ AstDecl* parser_parse_decl_enum(Parser* p) {
 	StrIntern n = parser_parse_ident(p);
 	parser_expect(p, T_LBRACE);
 	AstParam** args = NULL;
+	ast_buf(args);
 	while(p->t.tok != T_RBRACE) {
 		//FileLoc loc1 = parser_loc(p);
 		StrIntern name = parser_parse_ident(p);
@@ -462,7 +478,10 @@ AstDecl* parser_parse_decl_enum(Parser* p) {
 		} else if(p->t.tok == T_LBRACE) {
 			parser_error("not supported yet!");
 		}
-		buf_push(args, ast_param_new(name, type));
+		AstParam* variant = ast_param_new(name, type);
+		if(parser_accept(p, T_ASSIGN))
+			variant->value = parser_parse_expr(p);
+		buf_push(args, variant);
 		parser_expect(p, T_COMMA);
 	}
 	parser_expect(p, T_RBRACE);
@@ -485,8 +504,34 @@ AstDecl* parser_parse_decl_type(Parser* p) {
 	return ast_decl_type(loc, n, parser_parse_type(p));
 }
 
-// Decl = DeclFn | DeclLet | DeclConst | DeclType
+// Attrs = ('@' ident)+
+u32 parser_parse_attrs(Parser* p) {
+	u32 attrs = 0;
+	while(parser_accept(p, T_AT)) {
+		StrIntern name = parser_parse_ident(p);
+		if(name == str_intern_c("reorder")) {
+			attrs |= AST_ATTR_REORDER;
+		} else {
+			parser_error("unknown attribute '@%s'", name);
+		}
+		// the attributes may be on their own line
+		parser_accept(p, T_SEMI);
+	}
+	return attrs;
+}
+
+// Decl = Attrs? (DeclFn | DeclLet | DeclConst | DeclType)
 AstDecl* parser_parse_decl(Parser* p) {
+	if(p->t.tok == T_AT) {
+		u32 attrs = parser_parse_attrs(p);
+		AstDecl* decl = parser_parse_decl(p);
+		if((attrs & AST_ATTR_REORDER) && decl->kind != AST_DECL_STRUCT) {
+			print_error_pos(decl->loc, "parse error: attribute '@reorder' only applies to structs");
+			resolve_abort();
+		}
+		decl->attrs |= attrs;
+		return decl;
+	}
 	switch(p->t.tok) {
 		case T_EXTERN:
 			parser_next(p);
@@ -527,7 +572,17 @@ void parser_parse_decls(Parser* p) {
 	}
 }
 
-// Stmt = DeclLet 
+// Cond = Expr
+// the block after a condition is not a composite literal: 'if x {'
+AstExpr* parser_parse_cond(Parser* p) {
+	int xnest = p->xnest;
+	p->xnest = -1;
+	AstExpr* cond = parser_parse_expr(p);
+	p->xnest = xnest;
+	return cond;
+}
+
+// Stmt = DeclLet
 //      | DeclConst
 //      | 'return' Expr?
 //      | Expr
@@ -542,7 +597,7 @@ AstStmt* parser_parse_stmt(Parser* p) {
 			return ast_stmt_decl(loc, parser_parse_decl_const(p));
 		case T_IF: {
 			parser_next(p);
-			AstExpr* cond = parser_parse_expr(p);
+			AstExpr* cond = parser_parse_cond(p);
 			parser_expect(p, T_LBRACE);
 			AstStmt** body = parser_parse_stmt_list(p);
 			parser_expect(p, T_RBRACE);
@@ -558,7 +613,7 @@ AstStmt* parser_parse_stmt(Parser* p) {
 		}
 		case T_FOR: {
 			parser_next(p);
-			AstExpr* cond = parser_parse_expr(p);
+			AstExpr* cond = parser_parse_cond(p);
 			parser_expect(p, T_LBRACE);
 			AstStmt** stmts = parser_parse_stmt_list(p);
 			parser_expect(p, T_RBRACE);
@@ -593,6 +648,7 @@ AstStmt* parser_parse_stmt(Parser* p) {
 
 AstFile* parser_parse_file(Parser* p) {
 	AstDecl** decls = NULL;
+	ast_buf(decls);
 	while(p->t.tok != T_EOF) {
 		AstDecl* decl = parser_parse_decl(p);
 		buf_push(decls, decl);
@@ -600,5 +656,5 @@ AstFile* parser_parse_file(Parser* p) {
 			break;
 		parser_expect(p, T_SEMI);
 	}
-	return ast_file("", ast_decl_list(decls));
+	return ast_file(p->l.file, ast_decl_list(decls));
 }
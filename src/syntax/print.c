@@ -2,20 +2,21 @@
 // file at the top-level directory of this distribution
 
 int print_ast_i;
-char print_ast_ipos[256];
+char* print_ast_ipos; // one entry per nesting level, grown as needed
 
 void print_ast_nl() {
-    p_printf("\n");
+    p_putc('\n');
     for(int i = 1; i <= print_ast_i; i++) {
         if(print_ast_ipos[i])
-            p_printf("|%c", i == print_ast_i ? '-' : ' ');
+            p_puts(i == print_ast_i ? "|-" : "| ");
         else
-            p_printf(i == print_ast_i ? "`-" : "  ");
+            p_puts(i == print_ast_i ? "`-" : "  ");
     }
-    p_printf("- ");
+    p_puts("- ");
 }
 
 void print_ast_nest(int notlast) {
+    buf_fit(print_ast_ipos, print_ast_i + 2);
     print_ast_ipos[++print_ast_i] = notlast;
 }
 void print_ast_last() {
@@ -26,49 +27,96 @@ void print_ast_unnest() {
 }
 
 
+void print_ast_type(AstType* type);
+
+// prints a constant expression on one line, literals print as themselves
+void print_ast_expr_inline(AstExpr* expr) {
+    if(expr == NULL) {
+        p_puts("nil");
+        return;
+    }
+    switch(expr->kind) {
+        case AST_EXPR_LIT_INT:
+            p_putu(expr->lit_int);
+            break;
+        case AST_EXPR_LIT_FLOAT:
+            p_printf("%f", expr->lit_float);
+            break;
+        case AST_EXPR_LIT_CHAR:
+            p_printf("'%c'", expr->lit_char);
+            break;
+        case AST_EXPR_IDENT:
+            p_puts(expr->ident.name);
+            break;
+        case AST_EXPR_UNARY:
+            p_puts(token_kind_names[expr->unary.op]);
+            print_ast_expr_inline(expr->unary.x);
+            break;
+        case AST_EXPR_BINARY:
+            p_putc('(');
+            print_ast_expr_inline(expr->binary.x);
+            p_printf(" %s ", token_kind_names[expr->binary.op]);
+            print_ast_expr_inline(expr->binary.y);
+            p_putc(')');
+            break;
+        case AST_EXPR_CAST:
+            p_putc('(');
+            print_ast_expr_inline(expr->cast.x);
+            p_puts(" as ");
+            print_ast_type(expr->cast.type);
+            p_putc(')');
+            break;
+        default:
+            p_puts(ast_expr_kind_names[expr->kind]);
+            break;
+    }
+}
+
 void print_ast_type(AstType* type) {
     if(type == NULL) {
-        p_printf("nil");
+        p_puts("nil");
         return;
     }
     switch(type->kind) {
         case AST_TYPE_NAME:
-            p_printf("%s", type->name);
+            p_puts(type->name);
             break;
         case AST_TYPE_PTR:
-            p_printf("*");
+            p_putc('*');
             print_ast_type(type->ptr);
             break;
         case AST_TYPE_ARRAY:
-            p_printf("[");
+            p_putc('[');
             print_ast_type(type->array.type);
-            p_printf(", %d]", type->array.size);
+            p_puts(", ");
+            print_ast_expr_inline(type->array.size);
+            p_putc(']');
             break;
         case AST_TYPE_SLICE:
-            p_printf("[");
+            p_putc('[');
             print_ast_type(type->slice.type);
-            p_printf("]");
+            p_putc(']');
             break;
         case AST_TYPE_FN:
-            p_printf("fn(");
+            p_puts("fn(");
             for(int i = 0; i < type->fn.args.len; i++) {
                 AstType* t = type->fn.args.list[i];
-                if(i > 0) p_printf(", ");
+                if(i > 0) p_puts(", ");
                 print_ast_type(t);
             }
             if(type->fn.ret) {
-                p_printf(" -> ");
+                p_puts(" -> ");
                 print_ast_type(type->fn.ret);
             }
             break;
         case AST_TYPE_TUPLE: 
-            p_printf("(");
+            p_putc('(');
             for(int i = 0; i < type->tuple.args.len; i++) {
                 AstType* t = type->tuple.args.list[i];
-                if(i > 0) p_printf(", ");
+                if(i > 0) p_puts(", ");
                 print_ast_type(t);
             }
-            p_printf(")");
+            p_putc(')');
             break;
     }
 }
@@ -76,33 +124,40 @@ void print_ast_type(AstType* type) {
 void print_ast_expr(AstExpr* expr) {
     print_ast_nl();
     if(expr == NULL) {
-        p_printf("<NULL>");
+        p_puts("<NULL>");
         return;
     }
     switch(expr->kind) {
         case AST_EXPR_LIT_INT:
-            p_printf("EXPR_LIT_INT %"PRIu64"", expr->lit_int);
+            p_puts("EXPR_LIT_INT ");
+            p_putu(expr->lit_int);
             break;
         case AST_EXPR_LIT_FLOAT:
             p_printf("EXPR_LIT_FLOAT %f", expr->lit_float);
             break;
         case AST_EXPR_LIT_STRING:
-            p_printf("EXPR_LIT_STRING \"%.*s\"", (int)expr->lit_string.l, expr->lit_string.s);
+            p_puts("EXPR_LIT_STRING \"");
+            p_putr(expr->lit_string);
+            p_putc('"');
             break;
         case AST_EXPR_LIT_CHAR:
             p_printf("EXPR_LIT_CHAR '%c'", expr->lit_char);
             break;
         case AST_EXPR_IDENT:
-            p_printf("EXPR_IDENT \"%s\"", expr->ident);
+            p_puts("EXPR_IDENT \"");
+            p_puts(expr->ident.name);
+            p_putc('"');
             break;
         case AST_EXPR_MEMBER:
-            p_printf("EXPR_MEMBER \"%s\"", expr->member.name);
+            p_puts("EXPR_MEMBER \"");
+            p_puts(expr->member.name);
+            p_putc('"');
             print_ast_nest(0);
             print_ast_expr(expr->member.x);
             print_ast_unnest();
             break;
         case AST_EXPR_CALL:
-            p_printf("EXPR_CALL");
+            p_puts("EXPR_CALL");
             print_ast_nest(1);
             print_ast_expr(expr->call.x);
             for(int i = 0; i < expr->call.args.len; i++) {
@@ -113,13 +168,17 @@ void print_ast_expr(AstExpr* expr) {
             print_ast_unnest();
             break;
         case AST_EXPR_UNARY:
-            p_printf("EXPR_UNARY '%s'", token_kind_names[expr->unary.op]);
+            p_puts("EXPR_UNARY '");
+            p_puts(token_kind_names[expr->unary.op]);
+            p_putc('\'');
             print_ast_nest(0);
             print_ast_expr(expr->unary.x);
             print_ast_unnest();
             break;
         case AST_EXPR_BINARY:
-            p_printf("EXPR_BINARY '%s'", token_kind_names[expr->binary.op]);
+            p_puts("EXPR_BINARY '");
+            p_puts(token_kind_names[expr->binary.op]);
+            p_putc('\'');
             print_ast_nest(1);
             print_ast_expr(expr->binary.x);
             print_ast_last();
@@ -127,15 +186,15 @@ void print_ast_expr(AstExpr* expr) {
             print_ast_unnest();
             break;
         case AST_EXPR_CAST:
-            p_printf("EXPR_CAST '");
+            p_puts("EXPR_CAST '");
             print_ast_type(expr->cast.type);
-            p_printf("'");
+            p_puts("'");
             print_ast_nest(0);
             print_ast_expr(expr->cast.x);
             print_ast_unnest();
             break;
         case AST_EXPR_INDEX:
-            p_printf("EXPR_INDEX");
+            p_puts("EXPR_INDEX");
             print_ast_nest(1);
             print_ast_expr(expr->index.x);
             print_ast_last();
@@ -143,7 +202,7 @@ void print_ast_expr(AstExpr* expr) {
             print_ast_unnest();
             break;
         case AST_EXPR_TUPLE:
-            p_printf("EXPR_TUPLE");
+            p_puts("EXPR_TUPLE");
             print_ast_nest(1);
             for(int i = 0; i < expr->tuple.args.len; i++) {
                 if(i == expr->tuple.args.len - 1)
@@ -153,13 +212,14 @@ void print_ast_expr(AstExpr* expr) {
             print_ast_unnest();
             break;
         case AST_EXPR_ARRAY:
-            p_printf("EXPR_ARRAY %"PRIu32"", expr->array.len);
+            p_puts("EXPR_ARRAY ");
+            print_ast_expr_inline(expr->array.len);
             print_ast_nest(0);
             print_ast_expr(expr->array.init);
             print_ast_unnest();
             break;
         case AST_EXPR_ARRAY_LIST:
-            p_printf("EXPR_ARRAY_LIST");
+            p_puts("EXPR_ARRAY_LIST");
             print_ast_nest(1);
             for(int i = 0; i < expr->array_list.args.len; i++) {
                 if(i == expr->array_list.args.len - 1)
@@ -169,14 +229,16 @@ void print_ast_expr(AstExpr* expr) {
             print_ast_unnest();
             break;
         case AST_EXPR_INIT:
-            p_printf("EXPR_INIT");
+            p_puts("EXPR_INIT");
             print_ast_nest(expr->init.fields.len > 0 ? 1 : 0);
             print_ast_expr(expr->init.x);
             for(int i = 0; i < expr->init.fields.len; i++) {
                 if(i == expr->init.fields.len - 1)
                     print_ast_last();
                 print_ast_nl();
-                p_printf("FIELD \"%s\"", expr->init.fields.list[i]->name);
+                p_puts("FIELD \"");
+                p_puts(expr->init.fields.list[i]->name);
+                p_putc('"');
                 print_ast_nest(0);
                 print_ast_expr(expr->init.fields.list[i]->expr);
                 print_ast_unnest();
@@ -189,7 +251,7 @@ void print_ast_expr(AstExpr* expr) {
 void print_ast_stmt(AstStmt* stmt);
 void print_ast_stmt_list(AstStmtList list) {
     print_ast_nl();
-    p_printf("BLOCK");
+    p_puts("BLOCK");
     print_ast_nest(list.len > 1 ? 1 : 0);
     for(int i = 0; i < list.len; i++) {
         if(i == list.len - 1)
@@ -204,7 +266,7 @@ void print_ast_decl(AstDecl* decl);
 void print_ast_stmt(AstStmt* stmt) {
     if(stmt == NULL) {
         print_ast_nl();
-        p_printf("<NULL>");
+        p_puts("<NULL>");
         return;
     }
     switch(stmt->kind) {
@@ -216,7 +278,7 @@ void print_ast_stmt(AstStmt* stmt) {
             break;
         case AST_STMT_IF:
             print_ast_nl();
-            p_printf("STMT_IF ");
+            p_puts("STMT_IF ");
             print_ast_nest(1);
             print_ast_expr(stmt->if_.cond);
             print_ast_last();
@@ -225,7 +287,7 @@ void print_ast_stmt(AstStmt* stmt) {
             break;
         case AST_STMT_FOR: {
             print_ast_nl();
-            p_printf("STMT_FOR");
+            p_puts("STMT_FOR");
             print_ast_nest(1);
             print_ast_expr(stmt->for_.cond);
             print_ast_last();
@@ -234,14 +296,16 @@ void print_ast_stmt(AstStmt* stmt) {
         }
         case AST_STMT_RETURN:
             print_ast_nl();
-            p_printf("STMT_RETURN");
+            p_puts("STMT_RETURN");
             print_ast_nest(0);
             print_ast_expr(stmt->return_);
             print_ast_unnest();
             break;
         case AST_STMT_ASSIGN:
             print_ast_nl();
-            p_printf("STMT_ASSIGN '%s'", token_kind_names[stmt->assign.op]);
+            p_puts("STMT_ASSIGN '");
+            p_puts(token_kind_names[stmt->assign.op]);
+            p_putc('\'');
             print_ast_nest(1);
             print_ast_expr(stmt->assign.x);
             print_ast_last();
@@ -257,16 +321,18 @@ void print_ast_stmt(AstStmt* stmt) {
 void print_ast_decl(AstDecl* decl) {
     print_ast_nl();
     if(decl == NULL) {
-        p_printf("<NULL>");
+        p_puts("<NULL>");
         return;
     }
     switch(decl->kind) {
         case AST_DECL_LET:
-            p_printf("DECL_LET \"%s\" ", decl->name);
+            p_puts("DECL_LET \"");
+            p_puts(decl->name);
+            p_puts("\" ");
             if(decl->let.is_extern) {
-                p_printf("extern '");
+                p_puts("extern '");
                 print_ast_type(decl->let.type);
-                p_printf("'");
+                p_puts("'");
             }
             if(!decl->let.is_extern) {
                 print_ast_nest(0);
@@ -275,25 +341,31 @@ void print_ast_decl(AstDecl* decl) {
             }
             break;
         case AST_DECL_CONST:
-            p_printf("DECL_CONST \"%s\"", decl->name);
+            p_puts("DECL_CONST \"");
+            p_puts(decl->name);
+            p_putc('"');
             print_ast_nest(0);
             print_ast_expr(decl->const_.value);
             print_ast_unnest();
             break;
         case AST_DECL_FN:
-            p_printf("DECL_FN \"%s\"%s", decl->name, decl->fn.is_extern ? " extern" : "");
+            p_puts("DECL_FN \"");
+            p_puts(decl->name);
+            p_puts(decl->fn.is_extern ? "\" extern" : "\"");
             print_ast_nest(decl->fn.is_extern && decl->fn.params.len == 0 ? 0 : 1);
             print_ast_nl();
-            p_printf("RET '");
+            p_puts("RET '");
             print_ast_type(decl->fn.ret);
-            p_printf("'");
+            p_puts("'");
             for(int i = 0; i < decl->fn.params.len; i++) {
                 if(decl->fn.is_extern && i == decl->fn.params.len - 1)
                     print_ast_last();
                 print_ast_nl();
-                p_printf("ARG \"%s\" '", decl->fn.params.list[i]->name);
+                p_puts("ARG \"");
+                p_puts(decl->fn.params.list[i]->name);
+                p_puts("\" '");
                 print_ast_type(decl->fn.params.list[i]->type);
-                p_printf("'");
+                p_puts("'");
             }
             if(!decl->fn.is_extern) {
                 print_ast_last();
@@ -302,31 +374,47 @@ void print_ast_decl(AstDecl* decl) {
             print_ast_unnest();
             break;
         case AST_DECL_STRUCT:
-            p_printf("DECL_STRUCT \"%s\"", decl->name);
+            p_puts("DECL_STRUCT \"");
+            p_puts(decl->name);
+            p_putc('"');
+            if(decl->attrs & AST_ATTR_REORDER)
+                p_puts(" @reorder");
             print_ast_nest(0);
             for(int i = 0; i < decl->struct_.params.len; i++) {
                 print_ast_nl();
-                p_printf("FIELD \"%s\" '", decl->struct_.params.list[i]->name);
+                p_puts("FIELD \"");
+                p_puts(decl->struct_.params.list[i]->name);
+                p_puts("\" '");
                 print_ast_type(decl->struct_.params.list[i]->type);
-                p_printf("'");
+                p_puts("'");
             }
             print_ast_unnest();
             break;
         case AST_DECL_ENUM:
-            p_printf("DECL_ENUM \"%s\"", decl->name);
+            p_puts("DECL_ENUM \"");
+            p_puts(decl->name);
+            p_putc('"');
             print_ast_nest(0);
             for(int i = 0; i < decl->enum_.params.len; i++) {
                 print_ast_nl();
-                p_printf("FIELD \"%s\" '", decl->enum_.params.list[i]->name);
+                p_puts("FIELD \"");
+                p_puts(decl->enum_.params.list[i]->name);
+                p_puts("\" '");
                 print_ast_type(decl->enum_.params.list[i]->type);
-                p_printf("'");
+                p_puts("'");
+                if(decl->enum_.params.list[i]->value) {
+                    p_puts(" = ");
+                    print_ast_expr_inline(decl->enum_.params.list[i]->value);
+                }
             }
             print_ast_unnest();
             break;
         case AST_DECL_TYPE:
-            p_printf("DECL_TYPE \"%s\" '", decl->name);
+            p_puts("DECL_TYPE \"");
+            p_puts(decl->name);
+            p_puts("\" '");
             print_ast_type(decl->type.type);
-            p_printf("'");
+            p_puts("'");
             break;
     }
 }
@@ -335,7 +423,7 @@ void print_ast_file(AstFile* file) {
     for(int i = 0; i < file->decls.len; i++) {
         AstDecl* decl = file->decls.list[i];
         print_ast_decl(decl);
-        p_printf("\n");
+        p_putc('\n');
     }
 }
 
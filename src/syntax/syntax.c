@@ -6,3 +6,4 @@
 #include "lexer.c"
 #include "parser.c"
 #include "print.c"
+#include "fingerprint.c"
@@ -27,17 +27,22 @@ typedef struct Token {
 	StrRange lit;
 } Token;
 
+// the returned string is only valid until the next call
+char* ttos_buf;
 const char* ttos(Token t) {
+	buf_clear(ttos_buf);
 	switch(t.tok) {
 		case T_IDENT:
 		case T_SEMI:
-			return strf("%.*s", (int)t.lit.l, t.lit.s);
+			buf_putr(ttos_buf, t.lit);
+			return ttos_buf;
 		case T_INT:
 		case T_FLOAT:
 		case T_STRING:
-			return strf("literal %.*s", (int)t.lit.l, t.lit.s);
+			buf_puts(ttos_buf, "literal ");
+			buf_putr(ttos_buf, t.lit);
+			return ttos_buf;
 		default:
 			return token_kind_names[t.tok];
 	}
 }
-
@@ -24,6 +24,7 @@ TOKEN(T_DCOLON, "::")
 TOKEN(T_DOT, ".")
 TOKEN(T_DOTDOTDOT, "...")
 TOKEN(T_ARROW, "->")
+TOKEN(T_AT, "@")
 TOKEN(T_LPAREN, "(")
 TOKEN(T_LBRACK, "[")
 TOKEN(T_LBRACE, "{")
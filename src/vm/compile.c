@@ -0,0 +1,540 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Bytecode for one fn. Every value gets a register by a linear scan over
+// the live intervals (ir/live.c) with no limit on registers: a register
+// is taken again once the interval of its last holder is over, so frames
+// stay small. Phis become moves on the edges into their block, done as
+// one parallel move per edge, through the last register of the frame
+// when the moves form a cycle. A comparison of integers right before the
+// branch that is its only use becomes a compare and jump.
+
+typedef struct VmFixup {
+	isize at;         // jump target to patch
+	i32 block;
+} VmFixup;
+
+typedef struct VmMove {
+	i32 dst, src;
+} VmMove;
+
+typedef struct VmCompiler {
+	Vm* vm;
+	IrFn* fn;
+	VmFn* f;
+	i32* regs;        // per instruction, -1 without a result
+	i32* uses;        // per instruction, not counting direct calls
+	i32* slot_off;    // in the frame memory
+	i32* string_off;  // in f->strings
+	IrRef fused;      // comparison done by the branch of the current block
+	isize* block_pos;
+	VmFixup* fixups;
+} VmCompiler;
+
+// heap of values by the end of their interval
+void vm_heap_push(IrRef* heap, isize* len, IrInterval* iv, IrRef v) {
+	isize i = (*len)++;
+	while(i > 0 && iv[heap[(i - 1) / 2]].end > iv[v].end) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = v;
+}
+
+IrRef vm_heap_pop(IrRef* heap, isize* len, IrInterval* iv) {
+	IrRef top = heap[0];
+	IrRef v = heap[--*len];
+	isize i = 0;
+	while(2 * i + 1 < *len) {
+		isize k = 2 * i + 1;
+		if(k + 1 < *len && iv[heap[k + 1]].end < iv[heap[k]].end)
+			k++;
+		if(iv[heap[k]].end >= iv[v].end)
+			break;
+		heap[i] = heap[k];
+		i = k;
+	}
+	heap[i] = v;
+	return top;
+}
+
+void vm_regalloc(VmCompiler* c) {
+	IrFn* fn = c->fn;
+	isize n = buf_len(fn->instrs);
+	isize nblocks = buf_len(fn->blocks);
+	IrInterval* iv = xmalloc(MAX(n, 1) * sizeof(IrInterval));
+	i32* block_start = xmalloc(nblocks * sizeof(i32));
+	i32* block_end = xmalloc(nblocks * sizeof(i32));
+	ir_intervals(fn, iv, block_start, block_end);
+
+	c->regs = xmalloc(MAX(n, 1) * sizeof(i32));
+	IrRef* order = NULL;
+	for(IrRef r = 0; r < n; r++) {
+		c->regs[r] = -1;
+		if(ir_has_value(&fn->instrs[r]))
+			buf_push(order, r);
+	}
+	ir_sort_intervals(order, iv);
+
+	IrRef* active = xmalloc(MAX(buf_len(order), 1) * sizeof(IrRef));
+	isize active_len = 0;
+	i32* free_regs = NULL;
+	i32 regs = 0;
+	for(isize i = 0; i < buf_len(order); i++) {
+		IrRef v = order[i];
+		while(active_len > 0 && iv[active[0]].end < iv[v].start) {
+			buf_push(free_regs, c->regs[vm_heap_pop(active, &active_len, iv)]);
+		}
+		if(buf_len(free_regs) > 0) {
+			c->regs[v] = free_regs[buf_len(free_regs) - 1];
+			buf_truncate(free_regs, buf_len(free_regs) - 1);
+		} else {
+			c->regs[v] = regs++;
+		}
+		vm_heap_push(active, &active_len, iv, v);
+	}
+	// and the scratch register of the parallel moves
+	c->f->regs = regs + 1;
+
+	buf_free(free_regs);
+	xfree(active);
+	buf_free(order);
+	xfree(block_end);
+	xfree(block_start);
+	xfree(iv);
+}
+
+void vm_ins1(VmCompiler* c, VmOp op, i32 a) {
+	buf_push(c->f->code, op);
+	buf_push(c->f->code, a);
+}
+
+void vm_ins2(VmCompiler* c, VmOp op, i32 a, i32 b) {
+	vm_ins1(c, op, a);
+	buf_push(c->f->code, b);
+}
+
+void vm_ins3(VmCompiler* c, VmOp op, i32 a, i32 b, i32 d) {
+	vm_ins2(c, op, a, b);
+	buf_push(c->f->code, d);
+}
+
+i32 vm_const(VmCompiler* c, VmValue v) {
+	buf_push(c->f->k, v);
+	return (i32)(buf_len(c->f->k) - 1);
+}
+
+i32 vm_reg(VmCompiler* c, IrRef r) {
+	return c->regs[r];
+}
+
+// the op for an integer type in a family of VM_INT_OPS, given by its 8
+// bit op
+VmOp vm_int_op(VmOp op8, IrType t) {
+	return op8 + (t - IR_I8) * (VM_ADD16 - VM_ADD8);
+}
+
+VmOp vm_float_op(VmOp op32, IrType t) {
+	return op32 + (t == IR_F64) * (VM_FADD64 - VM_FADD32);
+}
+
+// the jump target at the end of the code goes to block
+void vm_fixup(VmCompiler* c, i32 block) {
+	buf_push(c->fixups, (VmFixup){ buf_len(c->f->code) - 1, block });
+}
+
+// points the jump target at 'at' to the end of the code
+void vm_label(VmCompiler* c, isize at) {
+	c->f->code[at] = (i32)buf_len(c->f->code);
+}
+
+void vm_goto(VmCompiler* c, i32 block, i32 next) {
+	if(block != next) {
+		vm_ins1(c, VM_JUMP, 0);
+		vm_fixup(c, block);
+	}
+}
+
+// Does all the moves at once: no move reads a register after another one
+// has written it. Moves are done when their destination is no longer
+// read; what is left are cycles, broken by copying a source to the
+// scratch register.
+void vm_parallel_move(VmCompiler* c, VmMove* moves) {
+	isize len = buf_len(moves);
+	i32 scratch = c->f->regs - 1;
+	isize done = 0;
+	while(done < len) {
+		bool progress = false;
+		for(isize i = 0; i < len; i++) {
+			VmMove* m = &moves[i];
+			if(m->dst < 0)
+				continue;
+			bool blocked = false;
+			for(isize k = 0; k < len && !blocked; k++) {
+				blocked = k != i && moves[k].dst >= 0 && moves[k].src == m->dst;
+			}
+			if(blocked)
+				continue;
+			vm_ins2(c, VM_MOV, m->dst, m->src);
+			m->dst = -1;
+			done++;
+			progress = true;
+		}
+		if(progress)
+			continue;
+		// every pending move is on a cycle
+		isize i = 0;
+		while(moves[i].dst < 0) {
+			i++;
+		}
+		i32 from = moves[i].src;
+		vm_ins2(c, VM_MOV, scratch, from);
+		for(isize k = 0; k < len; k++) {
+			if(moves[k].dst >= 0 && moves[k].src == from)
+				moves[k].src = scratch;
+		}
+	}
+}
+
+// the moves into the phis of to on the edge from from
+void vm_edge_moves(VmCompiler* c, i32 from, i32 to) {
+	IrFn* fn = c->fn;
+	isize phis = ir_phis_len(fn, to);
+	if(phis == 0)
+		return;
+	isize k = ir_pred_index(fn, to, from);
+	VmMove* moves = NULL;
+	for(isize i = 0; i < phis; i++) {
+		IrRef phi = fn->blocks[to].code[i];
+		i32 dst = vm_reg(c, phi), src = vm_reg(c, fn->args[fn->instrs[phi].args.start + k]);
+		if(dst != src)
+			buf_push(moves, (VmMove){ dst, src });
+	}
+	vm_parallel_move(c, moves);
+	buf_free(moves);
+}
+
+void vm_call(VmCompiler* c, IrRef r) {
+	IrFn* fn = c->fn;
+	IrInstr* in = &fn->instrs[r];
+	IrInstr* callee = &fn->instrs[in->x];
+	i32 dst = in->type == IR_VOID ? -1 : vm_reg(c, r);
+	if(callee->op == IR_FN) {
+		// the VmFn of another fn is being written by another thread
+		VmOp op = callee->sym->decl->fn.is_extern ? VM_CALLX : VM_CALL;
+		void* addr = *(void**)map_lookup(&c->vm->addrs, (u64)callee->sym);
+		vm_ins3(c, op, dst, vm_const(c, (VmValue){ .p = addr }), (i32)in->args.len);
+	} else {
+		vm_ins3(c, VM_CALLI, dst, vm_reg(c, in->x), (i32)in->args.len);
+	}
+	for(isize i = 0; i < in->args.len; i++) {
+		buf_push(c->f->code, vm_reg(c, fn->args[in->args.start + i]));
+	}
+}
+
+void vm_convert(VmCompiler* c, IrRef r) {
+	IrInstr* in = &c->fn->instrs[r];
+	IrType from = c->fn->instrs[in->x].type;
+	i32 a = vm_reg(c, r), b = vm_reg(c, in->x);
+	switch(in->op) {
+		case IR_TRUNC:
+			vm_ins2(c, VM_SEXT8 + (in->type - IR_I8), a, b);
+			break;
+		case IR_SEXT:
+			// already sign extended
+			vm_ins2(c, VM_MOV, a, b);
+			break;
+		case IR_ZEXT:
+			vm_ins2(c, VM_ZEXT8 + (from - IR_I8), a, b);
+			break;
+		case IR_ITOF:
+			vm_ins2(c, in->type == IR_F32 ? VM_ITOF32 : VM_ITOF64, a, b);
+			break;
+		case IR_UTOF:
+			if(from == IR_I64) {
+				vm_ins2(c, in->type == IR_F32 ? VM_UTOF32 : VM_UTOF64, a, b);
+			} else {
+				vm_ins2(c, VM_ZEXT8 + (from - IR_I8), a, b);
+				vm_ins2(c, in->type == IR_F32 ? VM_ITOF32 : VM_ITOF64, a, a);
+			}
+			break;
+		case IR_FTOI:
+		case IR_FTOU:
+			if(in->op == IR_FTOU && in->type == IR_I64) {
+				vm_ins2(c, from == IR_F32 ? VM_FTOU32 : VM_FTOU64, a, b);
+			} else {
+				vm_ins2(c, from == IR_F32 ? VM_FTOI32 : VM_FTOI64, a, b);
+				if(in->type != IR_I64)
+					vm_ins2(c, VM_SEXT8 + (in->type - IR_I8), a, a);
+			}
+			break;
+		case IR_FEXT:
+			vm_ins2(c, VM_FEXT, a, b);
+			break;
+		case IR_FTRUNC:
+			vm_ins2(c, VM_FTRUNC, a, b);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+void vm_instr(VmCompiler* c, IrRef r) {
+	IrFn* fn = c->fn;
+	IrInstr* in = &fn->instrs[r];
+	IrType t = in->type;
+	bool is_float = ir_is_float(t);
+	i32 a = vm_reg(c, r);
+	// fns only called directly are not loaded
+	if(in->op >= IR_CONST && in->op <= IR_STRING && c->uses[r] == 0)
+		return;
+	switch(in->op) {
+		case IR_NOP:
+		case IR_PARAM:
+		case IR_PHI:
+			break;
+		case IR_CONST: {
+			VmValue v = { 0 };
+			if(t == IR_F32)
+				v.f32 = (float)in->f;
+			else if(t == IR_F64)
+				v.f64 = in->f;
+			else
+				v.i = in->imm;
+			vm_ins2(c, VM_LOADK, a, vm_const(c, v));
+			break;
+		}
+		case IR_SLOT:
+			vm_ins2(c, VM_SLOT, a, c->slot_off[in->imm]);
+			break;
+		case IR_GLOBAL:
+		case IR_FN:
+			vm_ins2(c, VM_LOADK, a, vm_const(c, (VmValue){ .p = *(void**)map_lookup(&c->vm->addrs, (u64)in->sym) }));
+			break;
+		case IR_STRING:
+			vm_ins2(c, VM_LOADK, a, vm_const(c, (VmValue){ .p = c->f->strings + c->string_off[in->imm] }));
+			break;
+		case IR_ADD:
+			vm_ins3(c, is_float ? vm_float_op(VM_FADD32, t) : vm_int_op(VM_ADD8, t), a, vm_reg(c, in->x), vm_reg(c, in->y));
+			break;
+		case IR_SUB:
+			vm_ins3(c, is_float ? vm_float_op(VM_FSUB32, t) : vm_int_op(VM_SUB8, t), a, vm_reg(c, in->x), vm_reg(c, in->y));
+			break;
+		case IR_MUL:
+			vm_ins3(c, is_float ? vm_float_op(VM_FMUL32, t) : vm_int_op(VM_MUL8, t), a, vm_reg(c, in->x), vm_reg(c, in->y));
+			break;
+		case IR_DIV:
+			vm_ins3(c, is_float ? vm_float_op(VM_FDIV32, t) : vm_int_op(VM_DIV8, t), a, vm_reg(c, in->x), vm_reg(c, in->y));
+			break;
+		case IR_NEG:
+			vm_ins2(c, is_float ? vm_float_op(VM_FNEG32, t) : vm_int_op(VM_NEG8, t), a, vm_reg(c, in->x));
+			break;
+		case IR_UDIV:
+		case IR_REM:
+		case IR_UREM:
+		case IR_SHL:
+		case IR_SHR: {
+			static const VmOp ops[] = {
+				[IR_UDIV] = VM_UDIV8, [IR_REM] = VM_REM8, [IR_UREM] = VM_UREM8, [IR_SHL] = VM_SHL8, [IR_SHR] = VM_SHR8,
+			};
+			vm_ins3(c, vm_int_op(ops[in->op], t), a, vm_reg(c, in->x), vm_reg(c, in->y));
+			break;
+		}
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+		case IR_SAR: {
+			// keep the result sign extended
+			static const VmOp ops[] = { [IR_AND] = VM_AND, [IR_OR] = VM_OR, [IR_XOR] = VM_XOR, [IR_SAR] = VM_SAR };
+			vm_ins3(c, ops[in->op], a, vm_reg(c, in->x), vm_reg(c, in->y));
+			break;
+		}
+		case IR_EQ:
+		case IR_NE:
+		case IR_LT:
+		case IR_LE:
+		case IR_GT:
+		case IR_GE:
+		case IR_ULT:
+		case IR_ULE:
+		case IR_UGT:
+		case IR_UGE: {
+			if(r == c->fused)
+				break;
+			IrType from = fn->instrs[in->x].type;
+			VmOp op = ir_is_float(from) ? vm_float_op(VM_FEQ32, from) + (in->op - IR_EQ) : VM_EQ + (in->op - IR_EQ);
+			vm_ins3(c, op, a, vm_reg(c, in->x), vm_reg(c, in->y));
+			break;
+		}
+		case IR_TRUNC:
+		case IR_SEXT:
+		case IR_ZEXT:
+		case IR_ITOF:
+		case IR_UTOF:
+		case IR_FTOI:
+		case IR_FTOU:
+		case IR_FEXT:
+		case IR_FTRUNC:
+			vm_convert(c, r);
+			break;
+		case IR_LOAD:
+			vm_ins2(c, t == IR_F32 ? VM_LOADF32 : t == IR_F64 ? VM_LOAD64 : VM_LOAD8 + (t - IR_I8), a, vm_reg(c, in->x));
+			break;
+		case IR_STORE:
+			vm_ins2(c, t == IR_F32 ? VM_STOREF32 : t == IR_F64 ? VM_STORE64 : VM_STORE8 + (t - IR_I8), vm_reg(c, in->x),
+				vm_reg(c, in->y));
+			break;
+		case IR_MEMCPY:
+			vm_ins3(c, VM_MEMCPY, vm_reg(c, in->x), vm_reg(c, in->y), (i32)in->imm);
+			break;
+		case IR_MEMZERO:
+			vm_ins2(c, VM_MEMZERO, vm_reg(c, in->x), (i32)in->imm);
+			break;
+		case IR_CALL:
+			vm_call(c, r);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+// Jumps when the condition of a branch is when: returns where the jump
+// target is, to be patched.
+isize vm_jump_if(VmCompiler* c, IrRef cond, bool when) {
+	if(cond == c->fused) {
+		static const IrOp negate[] = {
+			[IR_EQ] = IR_NE, [IR_NE] = IR_EQ, [IR_LT] = IR_GE, [IR_LE] = IR_GT, [IR_GT] = IR_LE, [IR_GE] = IR_LT,
+			[IR_ULT] = IR_UGE, [IR_ULE] = IR_UGT, [IR_UGT] = IR_ULE, [IR_UGE] = IR_ULT,
+		};
+		IrInstr* in = &c->fn->instrs[cond];
+		IrOp op = when ? in->op : negate[in->op];
+		vm_ins3(c, VM_JEQ + (op - IR_EQ), vm_reg(c, in->x), vm_reg(c, in->y), 0);
+	} else {
+		vm_ins2(c, when ? VM_JNZ : VM_JZ, vm_reg(c, cond), 0);
+	}
+	return buf_len(c->f->code) - 1;
+}
+
+void vm_terminator(VmCompiler* c, i32 block, IrRef r) {
+	IrFn* fn = c->fn;
+	IrInstr* in = &fn->instrs[r];
+	IrBlock* b = &fn->blocks[block];
+	i32 next = block + 1;
+	switch(in->op) {
+		case IR_JUMP:
+			vm_edge_moves(c, block, b->succ[0]);
+			vm_goto(c, b->succ[0], next);
+			break;
+		case IR_BRANCH: {
+			// the jumps read the operands before the moves write the phis
+			i32 s0 = b->succ[0], s1 = b->succ[1];
+			if(ir_phis_len(fn, s1) == 0) {
+				buf_push(c->fixups, (VmFixup){ vm_jump_if(c, in->x, false), s1 });
+				vm_edge_moves(c, block, s0);
+				vm_goto(c, s0, next);
+			} else if(ir_phis_len(fn, s0) == 0) {
+				buf_push(c->fixups, (VmFixup){ vm_jump_if(c, in->x, true), s0 });
+				vm_edge_moves(c, block, s1);
+				vm_goto(c, s1, next);
+			} else {
+				isize at = vm_jump_if(c, in->x, false);
+				vm_edge_moves(c, block, s0);
+				vm_goto(c, s0, -1);
+				vm_label(c, at);
+				vm_edge_moves(c, block, s1);
+				vm_goto(c, s1, next);
+			}
+			break;
+		}
+		case IR_RET:
+			if(in->x >= 0)
+				vm_ins1(c, VM_RET, vm_reg(c, in->x));
+			else
+				buf_push(c->f->code, VM_RETV);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+// whether the branch ending block can compare and jump itself
+IrRef vm_fusable(VmCompiler* c, IrBlock* b) {
+	IrFn* fn = c->fn;
+	isize len = buf_len(b->code);
+	IrInstr* term = &fn->instrs[b->code[len - 1]];
+	if(term->op != IR_BRANCH || len < 2 || term->x != b->code[len - 2] || c->uses[term->x] != 1)
+		return -1;
+	IrInstr* cond = &fn->instrs[term->x];
+	if(cond->op < IR_EQ || cond->op > IR_UGE || ir_is_float(fn->instrs[cond->x].type))
+		return -1;
+	return term->x;
+}
+
+void vm_compile_fn(Vm* vm, IrFn* fn, VmFn* f) {
+	*f = (VmFn){ .kind = VM_CALLEE_FN, .sym = fn->sym, .params_len = fn->params_len };
+	VmCompiler c = { .vm = vm, .fn = fn, .f = f };
+	vm_regalloc(&c);
+	isize n = buf_len(fn->instrs);
+	c.uses = xcalloc(MAX(n, 1), sizeof(i32));
+	for(IrRef r = 0; r < n; r++) {
+		IrInstr* in = &fn->instrs[r];
+		if(in->x >= 0 && !(in->op == IR_CALL && fn->instrs[in->x].op == IR_FN)) c.uses[in->x]++;
+		if(in->y >= 0) c.uses[in->y]++;
+		if(in->op == IR_PHI || in->op == IR_CALL) {
+			for(isize k = 0; k < in->args.len; k++) {
+				c.uses[fn->args[in->args.start + k]]++;
+			}
+		}
+	}
+
+	i32 off = 0;
+	f->mem_align = 8;
+	c.slot_off = xmalloc(MAX(buf_len(fn->slots), 1) * sizeof(i32));
+	for(isize i = 0; i < buf_len(fn->slots); i++) {
+		i32 align = (i32)MAX(fn->slots[i].align, 1);
+		off = (i32)ALIGN_UP(off, align);
+		c.slot_off[i] = off;
+		off += (i32)fn->slots[i].size;
+		f->mem_align = MAX(f->mem_align, align);
+	}
+	f->mem_size = off;
+	c.string_off = xmalloc(MAX(buf_len(fn->strings), 1) * sizeof(i32));
+	for(isize i = 0; i < buf_len(fn->strings); i++) {
+		c.string_off[i] = (i32)buf_len(f->strings);
+		// the terminating NUL included
+		buf_write(f->strings, fn->strings[i], buf_len(fn->strings[i]));
+	}
+	f->params = xmalloc(MAX(fn->params_len, 1) * sizeof(i32));
+	for(isize i = 0; i < fn->params_len; i++) {
+		f->params[i] = -1;
+	}
+	IrBlock* entry = &fn->blocks[0];
+	for(isize i = 0; i < buf_len(entry->code); i++) {
+		IrInstr* in = &fn->instrs[entry->code[i]];
+		if(in->op == IR_PARAM)
+			f->params[in->imm] = vm_reg(&c, entry->code[i]);
+	}
+
+	isize nblocks = buf_len(fn->blocks);
+	c.block_pos = xmalloc(nblocks * sizeof(isize));
+	for(i32 b = 0; b < nblocks; b++) {
+		c.block_pos[b] = buf_len(f->code);
+		IrBlock* block = &fn->blocks[b];
+		isize len = buf_len(block->code);
+		c.fused = vm_fusable(&c, block);
+		for(isize i = 0; i < len - 1; i++) {
+			vm_instr(&c, block->code[i]);
+		}
+		vm_terminator(&c, b, block->code[len - 1]);
+	}
+	for(isize i = 0; i < buf_len(c.fixups); i++) {
+		f->code[c.fixups[i].at] = (i32)c.block_pos[c.fixups[i].block];
+	}
+
+	buf_free(c.fixups);
+	xfree(c.block_pos);
+	xfree(c.string_off);
+	xfree(c.slot_off);
+	xfree(c.uses);
+	xfree(c.regs);
+}
@@ -0,0 +1,134 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Calls from the interpreter to C. Extern fns and lets are looked up by
+// name among the symbols of the running process, when the package is
+// loaded. A C fn is called through a trampoline: a fn pointer type
+// taking every register that can hold an argument, to which the
+// arguments are assigned in the order the ABI does. On x86-64 System V
+// that is six integers then eight doubles, passed as variadic arguments
+// so that al holds their count as variadic callees expect; an f32 goes in
+// the low bits of a double. Elsewhere only integers and pointers are
+// passed, as 8 byte integers, which covers the C ABIs that pass the first
+// arguments in registers and the rest in 8 byte stack slots. Extern fns
+// with more arguments than registers, or with aggregates, are rejected.
+
+#ifdef _WIN32
+__declspec(dllimport) void* __stdcall GetModuleHandleA(const char* name);
+__declspec(dllimport) void* __stdcall GetProcAddress(void* module, const char* name);
+#endif
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define VM_FFI_SYSV 1
+#define VM_FFI_INTS 6
+#define VM_FFI_FLOATS 8
+#else
+#define VM_FFI_SYSV 0
+#define VM_FFI_INTS VM_EXTERN_ARGS
+#define VM_FFI_FLOATS 0
+#endif
+
+// the address of the C symbol of an extern fn or let
+void* vm_ffi_lookup(Symbol* sym) {
+	void* addr = NULL;
+#ifdef _WIN32
+	static const char* modules[] = { NULL, "ucrtbase.dll", "msvcrt.dll", "kernel32.dll" };
+	for(isize i = 0; i < (isize)(sizeof(modules) / sizeof(modules[0])) && !addr; i++) {
+		void* module = GetModuleHandleA(modules[i]);
+		if(module)
+			addr = GetProcAddress(module, sym->name);
+	}
+#else
+	static void* self;
+	if(!self)
+		self = dlopen(NULL, RTLD_LAZY);
+	if(self)
+		addr = dlsym(self, sym->name);
+#endif
+	if(!addr)
+		vm_error(sym->decl->loc, "extern %s '%s' is not found in the running process",
+			sym->kind == SYMBOL_FN ? "fn" : "let", sym->name);
+	return addr;
+}
+
+VmExtern* vm_ffi_extern(Symbol* sym) {
+	Type* t = sym->type;
+	if(ir_is_aggregate(t->fn.ret))
+		vm_error(sym->decl->loc, "extern fn '%s' returns an aggregate, which nc run cannot pass", sym->name);
+	VmExtern* x = xcalloc(1, sizeof(VmExtern));
+	*x = (VmExtern){ .kind = VM_CALLEE_EXTERN, .ret = ir_type(t->fn.ret), .sym = sym };
+	isize ints = 0, floats = 0;
+	for(isize i = 0; i < t->fn.args_len; i++) {
+		Type* at = t->fn.args[i];
+		if(ir_is_aggregate(at))
+			vm_error(sym->decl->loc, "extern fn '%s' takes an aggregate, which nc run cannot pass", sym->name);
+		IrType it = ir_type(at);
+		if(ir_is_float(it) ? ++floats > VM_FFI_FLOATS : ++ints > VM_FFI_INTS)
+			vm_error(sym->decl->loc, "extern fn '%s' takes more %s arguments than nc run can pass here", sym->name,
+				ir_is_float(it) ? "float" : "integer");
+		x->args[i] = (u8)it;
+		// C callees may rely on narrow unsigned arguments being zero
+		// extended, while they are kept sign extended here
+		if(at->kind == TYPE_UNSIGNED && at->size < 4)
+			x->zext |= (u16)(1u << i);
+	}
+	if(!VM_FFI_SYSV && ir_is_float(x->ret))
+		vm_error(sym->decl->loc, "extern fn '%s' returns a float, which nc run cannot pass here", sym->name);
+	x->args_len = (u8)t->fn.args_len;
+	x->addr = vm_ffi_lookup(sym);
+	return x;
+}
+
+// Calls x with the registers args of r, and returns its result sign
+// extended like every integer of the interpreter.
+VmValue vm_ffi_call(VmExtern* x, VmValue* r, const i32* args) {
+	u64 ints[VM_FFI_INTS] = { 0 };
+	isize n = 0;
+	VmValue ret = { 0 };
+#if VM_FFI_SYSV
+	double floats[VM_FFI_FLOATS] = { 0 };
+	isize nf = 0;
+	for(isize i = 0; i < x->args_len; i++) {
+		VmValue v = r[args[i]];
+		if(x->args[i] == IR_F32) {
+			u64 bits = 0;
+			memcpy(&bits, &v.f32, sizeof(float));
+			memcpy(&floats[nf++], &bits, sizeof(double));
+		} else if(x->args[i] == IR_F64) {
+			floats[nf++] = v.f64;
+		} else {
+			ints[n++] = x->zext & (1u << i) ? (x->args[i] == IR_I8 ? (u8)v.u : (u16)v.u) : v.u;
+		}
+	}
+#define VM_FFI_ARGS ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], \
+	floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7]
+	switch(x->ret) {
+		case IR_F32:
+			ret.f32 = ((float (*)(u64, u64, u64, u64, u64, u64, ...))x->addr)(VM_FFI_ARGS);
+			return ret;
+		case IR_F64:
+			ret.f64 = ((double (*)(u64, u64, u64, u64, u64, u64, ...))x->addr)(VM_FFI_ARGS);
+			return ret;
+		default:
+			ret.u = ((u64 (*)(u64, u64, u64, u64, u64, u64, ...))x->addr)(VM_FFI_ARGS);
+			break;
+	}
+#undef VM_FFI_ARGS
+#else
+	for(isize i = 0; i < x->args_len; i++) {
+		VmValue v = r[args[i]];
+		ints[n++] = x->zext & (1u << i) ? (x->args[i] == IR_I8 ? (u8)v.u : (u16)v.u) : v.u;
+	}
+	ret.u = ((u64 (*)(u64, u64, u64, u64, u64, u64, u64, u64, u64, u64, u64, u64, u64, u64))x->addr)(
+		ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], ints[6],
+		ints[7], ints[8], ints[9], ints[10], ints[11], ints[12], ints[13]);
+#endif
+	// the callee leaves the bits above the result undefined
+	switch(x->ret) {
+		case IR_I8: ret.i = (i8)ret.u; break;
+		case IR_I16: ret.i = (i16)ret.u; break;
+		case IR_I32: ret.i = (i32)ret.u; break;
+		default: break;
+	}
+	return ret;
+}
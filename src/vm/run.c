@@ -0,0 +1,279 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// The interpreter loop. With GCC and Clang every handler jumps straight to
+// the next one through a table of label addresses (computed goto), which
+// gives the branch predictor one indirect jump per handler; elsewhere it
+// is a switch in a loop. Integer operations wrap, shift counts are taken
+// modulo 64 and out of range float conversions give what the native
+// backend gives, so that programs run the same in both; division by zero
+// and running out of stack are runtime errors.
+
+#define VM_STACK_REGS (1 << 20)
+#define VM_STACK_MEM (8 << 20)
+#define VM_STACK_FRAMES (1 << 16)
+
+void vm_stack_init(Vm* vm) {
+	vm->stack = xmalloc(VM_STACK_REGS * sizeof(VmValue));
+	vm->stack_end = vm->stack + VM_STACK_REGS;
+	vm->mem = xmalloc(VM_STACK_MEM);
+	vm->mem_end = vm->mem + VM_STACK_MEM;
+	vm->frames = xmalloc(VM_STACK_FRAMES * sizeof(VmFrame));
+	vm->frames_len = 0;
+}
+
+void vm_stack_free(Vm* vm) {
+	xfree(vm->frames);
+	xfree(vm->mem);
+	xfree(vm->stack);
+}
+
+// prints msg and the innermost fns being run, and exits
+void vm_runtime_error(Vm* vm, VmFn* fn, const char* msg) {
+	printf("runtime error: %s in fn '%s'\n", msg, fn->sym ? fn->sym->name : "<init>");
+	isize shown = MIN(vm->frames_len, 16);
+	for(isize i = vm->frames_len - 1; i >= vm->frames_len - shown; i--) {
+		VmFn* caller = vm->frames[i].fn;
+		printf("    called from fn '%s'\n", caller->sym ? caller->sym->name : "<init>");
+	}
+	if(vm->frames_len > shown)
+		printf("    ... and %lld more\n", (long long)(vm->frames_len - shown));
+	exit(1);
+}
+
+i64 vm_sext8(u64 x) { return (i8)x; }
+i64 vm_sext16(u64 x) { return (i16)x; }
+i64 vm_sext32(u64 x) { return (i32)x; }
+i64 vm_sext64(u64 x) { return (i64)x; }
+u64 vm_zext8(u64 x) { return (u8)x; }
+u64 vm_zext16(u64 x) { return (u16)x; }
+u64 vm_zext32(u64 x) { return (u32)x; }
+u64 vm_zext64(u64 x) { return x; }
+
+// cvttsd2si: out of range and NaN give INT64_MIN
+i64 vm_ftoi(double f) {
+	return f >= -9223372036854775808.0 && f < 9223372036854775808.0 ? (i64)f : INT64_MIN;
+}
+
+u64 vm_ftou(double f) {
+	if(!(f >= 9223372036854775808.0))
+		return (u64)vm_ftoi(f);
+	return f < 18446744073709551616.0 ? (u64)f : 0;
+}
+
+// operand n of the instruction at ip as a register
+#define R(n) r[ip[n]]
+
+#define VM_INT_HANDLERS(W) \
+	VM_CASE(ADD##W) R(1).i = vm_sext##W(R(2).u + R(3).u); VM_NEXT(4); \
+	VM_CASE(SUB##W) R(1).i = vm_sext##W(R(2).u - R(3).u); VM_NEXT(4); \
+	VM_CASE(MUL##W) R(1).i = vm_sext##W(R(2).u * R(3).u); VM_NEXT(4); \
+	VM_CASE(DIV##W) \
+		if(R(3).i == 0) goto div_zero; \
+		/* INT64_MIN / -1 overflows in C */ \
+		R(1).i = R(3).i == -1 ? vm_sext##W(0 - R(2).u) : vm_sext##W((u64)(R(2).i / R(3).i)); \
+		VM_NEXT(4); \
+	VM_CASE(REM##W) \
+		if(R(3).i == 0) goto div_zero; \
+		R(1).i = R(3).i == -1 ? 0 : R(2).i % R(3).i; \
+		VM_NEXT(4); \
+	VM_CASE(UDIV##W) \
+		if(R(3).i == 0) goto div_zero; \
+		R(1).i = vm_sext##W(vm_zext##W(R(2).u) / vm_zext##W(R(3).u)); \
+		VM_NEXT(4); \
+	VM_CASE(UREM##W) \
+		if(R(3).i == 0) goto div_zero; \
+		R(1).i = vm_sext##W(vm_zext##W(R(2).u) % vm_zext##W(R(3).u)); \
+		VM_NEXT(4); \
+	VM_CASE(SHL##W) R(1).i = vm_sext##W(R(2).u << (R(3).u & 63)); VM_NEXT(4); \
+	VM_CASE(SHR##W) R(1).i = vm_sext##W(vm_zext##W(R(2).u) >> (R(3).u & 63)); VM_NEXT(4); \
+	VM_CASE(NEG##W) R(1).i = vm_sext##W(0 - R(2).u); VM_NEXT(3);
+
+#define VM_FLOAT_HANDLERS(W) \
+	VM_CASE(FADD##W) R(1).f##W = R(2).f##W + R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FSUB##W) R(1).f##W = R(2).f##W - R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FMUL##W) R(1).f##W = R(2).f##W * R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FDIV##W) R(1).f##W = R(2).f##W / R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FNEG##W) R(1).f##W = -R(2).f##W; VM_NEXT(3); \
+	VM_CASE(FEQ##W) R(1).i = R(2).f##W == R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FNE##W) R(1).i = R(2).f##W != R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FLT##W) R(1).i = R(2).f##W < R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FLE##W) R(1).i = R(2).f##W <= R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FGT##W) R(1).i = R(2).f##W > R(3).f##W; VM_NEXT(4); \
+	VM_CASE(FGE##W) R(1).i = R(2).f##W >= R(3).f##W; VM_NEXT(4);
+
+#define VM_LOAD(T) { T v; memcpy(&v, R(2).p, sizeof(T)); R(1).i = v; } VM_NEXT(3);
+#define VM_STORE(T) { T v = (T)R(2).i; memcpy(R(1).p, &v, sizeof(T)); } VM_NEXT(3);
+#define VM_JUMP_IF(cond) ip = (cond) ? code + ip[3] : ip + 4; VM_NEXT(0);
+
+// Runs entry from the bottom of the stacks of the interpreter, and
+// returns its result.
+VmValue vm_exec(Vm* vm, VmFn* entry) {
+	VmFn* fn = entry;
+	const i32* code = fn->code;
+	const i32* ip = code;
+	VmValue* k = fn->k;
+	VmValue* r = vm->stack;
+	char* mem = ALIGN_UP_PTR(vm->mem, fn->mem_align);
+	void* callee = NULL;
+	VmValue result = { 0 };
+	if(r + fn->regs > vm->stack_end || mem + fn->mem_size > vm->mem_end)
+		goto stack_overflow;
+
+#ifdef __GNUC__
+#define VM_LABEL(op) &&L_##op,
+	static void* labels[] = { VM_OPS(VM_LABEL) };
+#undef VM_LABEL
+#define VM_CASE(op) L_##op:
+#define VM_NEXT(n) do { ip += (n); goto *labels[*ip]; } while(0)
+	VM_NEXT(0);
+#else
+#define VM_CASE(op) case VM_##op:
+#define VM_NEXT(n) do { ip += (n); goto dispatch; } while(0)
+dispatch:
+	switch(*ip) {
+#endif
+	VM_CASE(MOV) R(1) = R(2); VM_NEXT(3);
+	VM_CASE(LOADK) R(1) = k[ip[2]]; VM_NEXT(3);
+	VM_CASE(SLOT) R(1).p = mem + ip[2]; VM_NEXT(3);
+	VM_INT_HANDLERS(8)
+	VM_INT_HANDLERS(16)
+	VM_INT_HANDLERS(32)
+	VM_INT_HANDLERS(64)
+	VM_CASE(AND) R(1).u = R(2).u & R(3).u; VM_NEXT(4);
+	VM_CASE(OR) R(1).u = R(2).u | R(3).u; VM_NEXT(4);
+	VM_CASE(XOR) R(1).u = R(2).u ^ R(3).u; VM_NEXT(4);
+	VM_CASE(SAR) R(1).i = R(2).i >> (R(3).u & 63); VM_NEXT(4);
+	// unsigned comparisons of sign extended integers of the same width
+	// order them as zero extended ones would
+	VM_CASE(EQ) R(1).i = R(2).i == R(3).i; VM_NEXT(4);
+	VM_CASE(NE) R(1).i = R(2).i != R(3).i; VM_NEXT(4);
+	VM_CASE(LT) R(1).i = R(2).i < R(3).i; VM_NEXT(4);
+	VM_CASE(LE) R(1).i = R(2).i <= R(3).i; VM_NEXT(4);
+	VM_CASE(GT) R(1).i = R(2).i > R(3).i; VM_NEXT(4);
+	VM_CASE(GE) R(1).i = R(2).i >= R(3).i; VM_NEXT(4);
+	VM_CASE(ULT) R(1).i = R(2).u < R(3).u; VM_NEXT(4);
+	VM_CASE(ULE) R(1).i = R(2).u <= R(3).u; VM_NEXT(4);
+	VM_CASE(UGT) R(1).i = R(2).u > R(3).u; VM_NEXT(4);
+	VM_CASE(UGE) R(1).i = R(2).u >= R(3).u; VM_NEXT(4);
+	VM_FLOAT_HANDLERS(32)
+	VM_FLOAT_HANDLERS(64)
+	VM_CASE(SEXT8) R(1).i = vm_sext8(R(2).u); VM_NEXT(3);
+	VM_CASE(SEXT16) R(1).i = vm_sext16(R(2).u); VM_NEXT(3);
+	VM_CASE(SEXT32) R(1).i = vm_sext32(R(2).u); VM_NEXT(3);
+	VM_CASE(ZEXT8) R(1).u = vm_zext8(R(2).u); VM_NEXT(3);
+	VM_CASE(ZEXT16) R(1).u = vm_zext16(R(2).u); VM_NEXT(3);
+	VM_CASE(ZEXT32) R(1).u = vm_zext32(R(2).u); VM_NEXT(3);
+	VM_CASE(ITOF32) R(1).f32 = (float)R(2).i; VM_NEXT(3);
+	VM_CASE(ITOF64) R(1).f64 = (double)R(2).i; VM_NEXT(3);
+	VM_CASE(UTOF32) R(1).f32 = (float)R(2).u; VM_NEXT(3);
+	VM_CASE(UTOF64) R(1).f64 = (double)R(2).u; VM_NEXT(3);
+	VM_CASE(FTOI32) R(1).i = vm_ftoi(R(2).f32); VM_NEXT(3);
+	VM_CASE(FTOI64) R(1).i = vm_ftoi(R(2).f64); VM_NEXT(3);
+	VM_CASE(FTOU32) R(1).u = vm_ftou(R(2).f32); VM_NEXT(3);
+	VM_CASE(FTOU64) R(1).u = vm_ftou(R(2).f64); VM_NEXT(3);
+	VM_CASE(FEXT) R(1).f64 = R(2).f32; VM_NEXT(3);
+	VM_CASE(FTRUNC) R(1).f32 = (float)R(2).f64; VM_NEXT(3);
+	VM_CASE(LOAD8) VM_LOAD(i8)
+	VM_CASE(LOAD16) VM_LOAD(i16)
+	VM_CASE(LOAD32) VM_LOAD(i32)
+	VM_CASE(LOAD64) VM_LOAD(i64)
+	VM_CASE(LOADF32) memcpy(&R(1).f32, R(2).p, sizeof(float)); VM_NEXT(3);
+	VM_CASE(STORE8) VM_STORE(i8)
+	VM_CASE(STORE16) VM_STORE(i16)
+	VM_CASE(STORE32) VM_STORE(i32)
+	VM_CASE(STORE64) VM_STORE(i64)
+	VM_CASE(STOREF32) memcpy(R(1).p, &R(2).f32, sizeof(float)); VM_NEXT(3);
+	VM_CASE(MEMCPY) memmove(R(1).p, R(2).p, ip[3]); VM_NEXT(4);
+	VM_CASE(MEMZERO) memset(R(1).p, 0, ip[2]); VM_NEXT(3);
+	VM_CASE(JUMP) ip = code + ip[1]; VM_NEXT(0);
+	VM_CASE(JZ) ip = R(1).i == 0 ? code + ip[2] : ip + 3; VM_NEXT(0);
+	VM_CASE(JNZ) ip = R(1).i != 0 ? code + ip[2] : ip + 3; VM_NEXT(0);
+	VM_CASE(JEQ) VM_JUMP_IF(R(1).i == R(2).i)
+	VM_CASE(JNE) VM_JUMP_IF(R(1).i != R(2).i)
+	VM_CASE(JLT) VM_JUMP_IF(R(1).i < R(2).i)
+	VM_CASE(JLE) VM_JUMP_IF(R(1).i <= R(2).i)
+	VM_CASE(JGT) VM_JUMP_IF(R(1).i > R(2).i)
+	VM_CASE(JGE) VM_JUMP_IF(R(1).i >= R(2).i)
+	VM_CASE(JULT) VM_JUMP_IF(R(1).u < R(2).u)
+	VM_CASE(JULE) VM_JUMP_IF(R(1).u <= R(2).u)
+	VM_CASE(JUGT) VM_JUMP_IF(R(1).u > R(2).u)
+	VM_CASE(JUGE) VM_JUMP_IF(R(1).u >= R(2).u)
+	VM_CASE(CALL)
+		callee = k[ip[2]].p;
+		goto call;
+	VM_CASE(CALLX)
+		callee = k[ip[2]].p;
+		goto call_extern;
+	VM_CASE(CALLI)
+		callee = R(2).p;
+		if(*(u8*)callee == VM_CALLEE_EXTERN)
+			goto call_extern;
+		goto call;
+	VM_CASE(RET)
+		result = R(1);
+		goto ret;
+	VM_CASE(RETV)
+		result.u = 0;
+		goto ret;
+#ifndef __GNUC__
+	default:
+		assert(0);
+	}
+#endif
+
+call: {
+		// the registers and the memory of the callee follow the caller's
+		VmFn* f = callee;
+		VmValue* args = r + fn->regs;
+		char* args_mem = ALIGN_UP_PTR(mem + fn->mem_size, f->mem_align);
+		if(args + f->regs > vm->stack_end || args_mem + f->mem_size > vm->mem_end ||
+				vm->frames_len == VM_STACK_FRAMES)
+			goto stack_overflow;
+		for(i32 i = 0; i < ip[3]; i++) {
+			if(f->params[i] >= 0)
+				args[f->params[i]] = R(4 + i);
+		}
+		vm->frames[vm->frames_len++] = (VmFrame){ fn, ip + 4 + ip[3], r, mem, ip[1] };
+		fn = f;
+		code = ip = f->code;
+		k = f->k;
+		r = args;
+		mem = args_mem;
+		VM_NEXT(0);
+	}
+call_extern: {
+		VmValue v = vm_ffi_call(callee, r, ip + 4);
+		if(ip[1] >= 0)
+			R(1) = v;
+		VM_NEXT(4 + ip[3]);
+	}
+ret: {
+		if(vm->frames_len == 0)
+			return result;
+		VmFrame* caller = &vm->frames[--vm->frames_len];
+		fn = caller->fn;
+		code = fn->code;
+		k = fn->k;
+		ip = caller->ip;
+		r = caller->r;
+		mem = caller->mem;
+		if(caller->dst >= 0)
+			r[caller->dst] = result;
+		VM_NEXT(0);
+	}
+div_zero:
+	vm_runtime_error(vm, fn, "division by zero");
+stack_overflow:
+	vm_runtime_error(vm, fn, "stack overflow");
+	return result;
+}
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP_IF
+#undef VM_STORE
+#undef VM_LOAD
+#undef VM_FLOAT_HANDLERS
+#undef VM_INT_HANDLERS
+#undef R
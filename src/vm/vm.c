@@ -0,0 +1,297 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Bytecode interpreter (nc run): the optimized IR of every fn is turned
+// into a compact register bytecode, which runs right away in the
+// compiler process, without going through C. An instruction is an opcode
+// followed by its operands in a stream of i32s; operands are registers of
+// the frame, constants of the fn, frame memory offsets or jump targets.
+// Registers are 8 bytes, values live in them as in the native backend
+// (x64.c): integers sign extended to 64 bits, floats in the low bits.
+// IR slots live in a separate stack of frame memory, so their addresses
+// can be handed to C. Calls between fns do not recurse in C: the
+// interpreter keeps its own stack of frames, and a callee's registers
+// follow the caller's in one register stack.
+// Package lets are allocated when the package is loaded and set by the
+// initializer, which runs before main. Extern fns and lets are looked up
+// by name in the running process (ffi.c), so C fns of libc and of the
+// libraries nc is linked against can be called.
+
+typedef union VmValue {
+	i64 i;
+	u64 u;
+	double f64;
+	float f32;
+	void* p;
+} VmValue;
+
+// Opcodes with their operands; W is the width of an integer operation,
+// whose result is sign extended from it, k a constant of the fn, t a
+// jump target.
+#define VM_INT_OPS(X, W) \
+	X(ADD##W)         /* a b c: a = b + c */ \
+	X(SUB##W) \
+	X(MUL##W) \
+	X(DIV##W) \
+	X(REM##W) \
+	X(UDIV##W) \
+	X(UREM##W) \
+	X(SHL##W) \
+	X(SHR##W) \
+	X(NEG##W)         /* a b: a = -b */
+
+#define VM_FLOAT_OPS(X, W) \
+	X(FADD##W) \
+	X(FSUB##W) \
+	X(FMUL##W) \
+	X(FDIV##W) \
+	X(FNEG##W) \
+	X(FEQ##W) \
+	X(FNE##W) \
+	X(FLT##W) \
+	X(FLE##W) \
+	X(FGT##W) \
+	X(FGE##W)
+
+#define VM_OPS(X) \
+	X(MOV)            /* a b: a = b */ \
+	X(LOADK)          /* a k */ \
+	X(SLOT)           /* a n: a = address of byte n of the frame memory */ \
+	VM_INT_OPS(X, 8) \
+	VM_INT_OPS(X, 16) \
+	VM_INT_OPS(X, 32) \
+	VM_INT_OPS(X, 64) \
+	X(AND) \
+	X(OR) \
+	X(XOR) \
+	X(SAR) \
+	X(EQ) \
+	X(NE) \
+	X(LT) \
+	X(LE) \
+	X(GT) \
+	X(GE) \
+	X(ULT) \
+	X(ULE) \
+	X(UGT) \
+	X(UGE) \
+	VM_FLOAT_OPS(X, 32) \
+	VM_FLOAT_OPS(X, 64) \
+	X(SEXT8)          /* a b */ \
+	X(SEXT16) \
+	X(SEXT32) \
+	X(ZEXT8) \
+	X(ZEXT16) \
+	X(ZEXT32) \
+	X(ITOF32) \
+	X(ITOF64) \
+	X(UTOF32) \
+	X(UTOF64) \
+	X(FTOI32)         /* from f32 */ \
+	X(FTOI64) \
+	X(FTOU32) \
+	X(FTOU64) \
+	X(FEXT) \
+	X(FTRUNC) \
+	X(LOAD8)          /* a b: a = *b */ \
+	X(LOAD16) \
+	X(LOAD32) \
+	X(LOAD64) \
+	X(LOADF32) \
+	X(STORE8)         /* a b: *a = b */ \
+	X(STORE16) \
+	X(STORE32) \
+	X(STORE64) \
+	X(STOREF32) \
+	X(MEMCPY)         /* a b n: n bytes from *b to *a */ \
+	X(MEMZERO)        /* a n */ \
+	X(JUMP)           /* t */ \
+	X(JZ)             /* a t: jump if a is zero */ \
+	X(JNZ) \
+	X(JEQ)            /* a b t: jump if a == b, signed */ \
+	X(JNE) \
+	X(JLT) \
+	X(JLE) \
+	X(JGT) \
+	X(JGE) \
+	X(JULT) \
+	X(JULE) \
+	X(JUGT) \
+	X(JUGE) \
+	X(CALL)           /* a k n args...: a = k(args), k a VmFn, a is -1 for void */ \
+	X(CALLX)          /* a k n args...: a = k(args), k a VmExtern */ \
+	X(CALLI)          /* a b n args...: a = b(args), b a fn value */ \
+	X(RET)            /* a */ \
+	X(RETV)
+
+#define VM_ENUM(op) VM_##op,
+typedef enum VmOp {
+	VM_OPS(VM_ENUM)
+	VM_OP_MAX
+} VmOp;
+#undef VM_ENUM
+
+// what a fn value points to
+typedef enum VmCalleeKind {
+	VM_CALLEE_FN,
+	VM_CALLEE_EXTERN,
+} VmCalleeKind;
+
+typedef struct VmFn {
+	u8 kind;          // VM_CALLEE_FN, first like in VmExtern
+	Symbol* sym;      // NULL for the package initializer
+	i32* code;
+	VmValue* k;       // constants
+	char* strings;    // string literals, the constants point into them
+	i32* params;      // register of every param, -1 when unused
+	i32 params_len;
+	i32 regs;
+	i32 mem_size;     // bytes of IR slots
+	i32 mem_align;
+} VmFn;
+
+// the most arguments an extern fn takes: as many as are passed in
+// registers (ffi.c)
+#define VM_EXTERN_ARGS 14
+
+typedef struct VmExtern {
+	u8 kind;          // VM_CALLEE_EXTERN
+	u8 ret;           // IrType
+	u8 args_len;
+	u8 args[VM_EXTERN_ARGS];  // IrType of every argument
+	u16 zext;         // arguments to zero extend, by bit
+	Symbol* sym;
+	void* addr;
+} VmExtern;
+
+typedef struct VmFrame {
+	VmFn* fn;
+	const i32* ip;    // where to return
+	VmValue* r;
+	char* mem;
+	i32 dst;          // register of the result in the caller, -1 for none
+} VmFrame;
+
+typedef map_type(u64, void*) MapVmAddrs;
+
+typedef struct Vm {
+	IrPackage* ir;
+	VmFn* fns;        // in the order of ir->fns
+	VmExtern** externs;
+	MapVmAddrs addrs; // Symbol* -> storage of a let, VmFn or VmExtern
+	char* globals;
+	VmValue* stack;   // registers of the frames
+	VmValue* stack_end;
+	char* mem;        // frame memory
+	char* mem_end;
+	VmFrame* frames;
+	isize frames_len;
+} Vm;
+
+#define vm_error(loc, fmt, ...) (print_error_pos(loc, "vm error: " fmt, ##__VA_ARGS__), resolve_abort())
+
+// run the package instead of compiling it (nc run)
+bool vm_run;
+
+#include "compile.c"
+#include "ffi.c"
+#include "run.c"
+
+void vm_fn_task(void* ctx, isize worker, isize task) {
+	Vm* vm = ctx;
+	MemTag old_tag = mem_tag_set(MEM_VM);
+	vm_compile_fn(vm, vm->ir->fns[task], &vm->fns[task]);
+	mem_tag_set(old_tag);
+}
+
+// Allocates the package lets, looks up the externs and compiles every fn,
+// on resolver_jobs threads. Errors are reported before the threads start.
+void vm_load(Vm* vm, IrPackage* ir) {
+	*vm = (Vm){ .ir = ir };
+	isize nfns = buf_len(ir->fns);
+	vm->fns = xcalloc(MAX(nfns, 1), sizeof(VmFn));
+	for(isize i = 0; i < nfns - 1; i++) {
+		map_set(&vm->addrs, (u64)ir->fns[i]->sym, &vm->fns[i]);
+	}
+	isize size = 0;
+	for(isize i = 0; i < buf_len(ir->globals); i++) {
+		Symbol* sym = ir->globals[i];
+		if(!sym->decl->let.is_extern) {
+			ir_layout(sym->type);
+			size = ALIGN_UP(size, MAX(sym->type->align, 1)) + sym->type->size;
+		}
+	}
+	vm->globals = xcalloc(MAX(size, 1), 1);
+	size = 0;
+	for(isize i = 0; i < buf_len(ir->globals); i++) {
+		Symbol* sym = ir->globals[i];
+		if(sym->decl->let.is_extern) {
+			map_set(&vm->addrs, (u64)sym, vm_ffi_lookup(sym));
+			continue;
+		}
+		size = ALIGN_UP(size, MAX(sym->type->align, 1));
+		map_set(&vm->addrs, (u64)sym, vm->globals + size);
+		size += sym->type->size;
+	}
+	for(isize i = 0; i < nfns; i++) {
+		IrFn* fn = ir->fns[i];
+		for(isize r = 0; r < buf_len(fn->instrs); r++) {
+			IrInstr* in = &fn->instrs[r];
+			if(in->op == IR_FN && in->sym->decl->fn.is_extern && !map_lookup(&vm->addrs, (u64)in->sym)) {
+				VmExtern* x = vm_ffi_extern(in->sym);
+				buf_push(vm->externs, x);
+				map_set(&vm->addrs, (u64)in->sym, x);
+			}
+		}
+	}
+	jobs_run(resolver_jobs, nfns, vm_fn_task, vm);
+}
+
+void vm_free(Vm* vm) {
+	for(isize i = 0; i < buf_len(vm->ir->fns); i++) {
+		VmFn* f = &vm->fns[i];
+		buf_free(f->code);
+		buf_free(f->k);
+		buf_free(f->strings);
+		xfree(f->params);
+	}
+	for(isize i = 0; i < buf_len(vm->externs); i++) {
+		xfree(vm->externs[i]);
+	}
+	buf_free(vm->externs);
+	map_free(&vm->addrs);
+	xfree(vm->globals);
+	xfree(vm->fns);
+}
+
+// Runs the initializer then main, and returns the result of main, which
+// is the exit code of nc run.
+int vm_package(IrPackage* ir) {
+	isize nfns = buf_len(ir->fns), main_index = -1;
+	for(isize i = 0; i < nfns - 1; i++) {
+		if(strcmp(ir->fns[i]->sym->name, "main") == 0)
+			main_index = i;
+	}
+	if(main_index < 0) {
+		printf("vm error: no fn main to run\n");
+		return 1;
+	}
+	IrFn* main_fn = ir->fns[main_index];
+	if(main_fn->params_len > 0)
+		vm_error(main_fn->sym->decl->loc, "fn main takes arguments, which nc run does not pass");
+	MemTag old_tag = mem_tag_set(MEM_VM);
+	Vm vm;
+	trace_begin(TRACE_PHASE, "vm_load");
+	vm_load(&vm, ir);
+	trace_end();
+	trace_begin(TRACE_PHASE, "vm_exec");
+	vm_stack_init(&vm);
+	vm_exec(&vm, &vm.fns[nfns - 1]);
+	VmValue ret = vm_exec(&vm, &vm.fns[main_index]);
+	vm_stack_free(&vm);
+	trace_end();
+	int code = main_fn->ret == IR_VOID ? 0 : (int)ret.i;
+	vm_free(&vm);
+	mem_tag_set(old_tag);
+	return code;
+}
@@ -0,0 +1,283 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// ELF64 relocatable object for the System V AMD64 ABI. Sections are
+//   .text             the fns, each aligned to 16 bytes
+//   .rodata           string literals
+//   .bss              package lets, set by the initializer
+//   .init_array       a pointer to the initializer, run before main
+//   .rela.text, .rela.init_array, .symtab, .strtab, .shstrtab
+//   .note.GNU-stack   asks for a non-executable stack
+// Fns and lets are global symbols with their names; the initializer is
+// the local symbol nl_init. Externs are undefined symbols, reached
+// through the PLT and the GOT so that they may be in shared libraries.
+
+enum {
+	ELF_SHT_PROGBITS = 1,
+	ELF_SHT_SYMTAB = 2,
+	ELF_SHT_STRTAB = 3,
+	ELF_SHT_RELA = 4,
+	ELF_SHT_NOBITS = 8,
+	ELF_SHT_INIT_ARRAY = 14,
+
+	ELF_SHF_WRITE = 0x1,
+	ELF_SHF_ALLOC = 0x2,
+	ELF_SHF_EXECINSTR = 0x4,
+	ELF_SHF_INFO_LINK = 0x40,
+
+	ELF_STB_LOCAL = 0,
+	ELF_STB_GLOBAL = 1,
+	ELF_STT_NOTYPE = 0,
+	ELF_STT_OBJECT = 1,
+	ELF_STT_FUNC = 2,
+	ELF_STT_SECTION = 3,
+
+	R_X86_64_64 = 1,
+	R_X86_64_PC32 = 2,
+	R_X86_64_PLT32 = 4,
+	R_X86_64_GOTPCREL = 9,
+};
+
+// section indices
+enum {
+	ELF_TEXT = 1,
+	ELF_RODATA,
+	ELF_BSS,
+	ELF_INIT_ARRAY,
+	ELF_RELA_TEXT,
+	ELF_RELA_INIT_ARRAY,
+	ELF_SYMTAB,
+	ELF_STRTAB,
+	ELF_SHSTRTAB,
+	ELF_NOTE_STACK,
+	ELF_SECTIONS
+};
+
+// symbol indices before the fns and lets
+enum {
+	ELF_SYM_TEXT = 1,
+	ELF_SYM_RODATA,
+	ELF_SYM_INIT,
+	ELF_SYM_FIRST_GLOBAL
+};
+
+typedef struct ElfSection {
+	const char* name;
+	u32 type;
+	u64 flags;
+	char* data;
+	u64 size;         // of .bss, the others are the length of data
+	u32 link, info;
+	u64 align, entsize;
+} ElfSection;
+
+typedef map_type(u64, isize) MapElfSymbols;
+
+typedef struct ElfWriter {
+	char* symtab;
+	char* strtab;
+	MapElfSymbols syms;   // Symbol* or interned extern name -> index in symtab
+	isize nsyms;
+} ElfWriter;
+
+// v little endian in the given number of bytes, zero padded past 8
+void elf_put(char** b, u64 v, isize bytes) {
+	for(isize i = 0; i < bytes; i++) {
+		buf_putc(*b, (char)(i < 8 ? v >> (8 * i) : 0));
+	}
+}
+
+void elf_pad(char** b, isize align) {
+	while(buf_len(*b) % align) {
+		buf_putc(*b, 0);
+	}
+}
+
+isize elf_add_symbol(ElfWriter* w, const char* name, u8 bind, u8 type, u16 shndx, u64 value, u64 size) {
+	elf_put(&w->symtab, name ? buf_len(w->strtab) : 0, 4);
+	if(name)
+		buf_write(w->strtab, name, strlen(name) + 1);
+	elf_put(&w->symtab, (u64)(bind << 4 | type), 1);
+	elf_put(&w->symtab, 0, 1);
+	elf_put(&w->symtab, shndx, 2);
+	elf_put(&w->symtab, value, 8);
+	elf_put(&w->symtab, size, 8);
+	return w->nsyms++;
+}
+
+// the index of the extern name, added as undefined the first time it is
+// used; the key is the interned name, so that an extern fn and a call of
+// the runtime to the same fn share the symbol
+isize elf_extern(ElfWriter* w, const char* name) {
+	StrIntern key = str_intern_c(name);
+	isize* index = map_lookup(&w->syms, (u64)key);
+	if(index)
+		return *index;
+	isize i = elf_add_symbol(w, key, ELF_STB_GLOBAL, ELF_STT_NOTYPE, 0, 0, 0);
+	map_set(&w->syms, (u64)key, i);
+	return i;
+}
+
+// the index of sym, which is an extern unless it was defined
+isize elf_symbol(ElfWriter* w, Symbol* sym) {
+	isize* index = map_lookup(&w->syms, (u64)sym);
+	if(index)
+		return *index;
+	isize i = elf_extern(w, sym->name);
+	map_set(&w->syms, (u64)sym, i);
+	return i;
+}
+
+void elf_rela(char** b, u64 offset, isize sym, u32 type, i64 addend) {
+	elf_put(b, offset, 8);
+	elf_put(b, (u64)sym << 32 | type, 8);
+	elf_put(b, (u64)addend, 8);
+}
+
+// Writes the object for the code of every fn of ir, codes[i] being the
+// code of ir->fns[i].
+void elf_write_object(IrPackage* ir, X64Code* codes, const char* out) {
+	ElfSection s[ELF_SECTIONS] = {
+		[ELF_TEXT] = { ".text", ELF_SHT_PROGBITS, ELF_SHF_ALLOC | ELF_SHF_EXECINSTR, .align = 16 },
+		[ELF_RODATA] = { ".rodata", ELF_SHT_PROGBITS, ELF_SHF_ALLOC, .align = 1 },
+		[ELF_BSS] = { ".bss", ELF_SHT_NOBITS, ELF_SHF_ALLOC | ELF_SHF_WRITE, .align = 1 },
+		[ELF_INIT_ARRAY] = { ".init_array", ELF_SHT_INIT_ARRAY, ELF_SHF_ALLOC | ELF_SHF_WRITE, .align = 8, .entsize = 8 },
+		[ELF_RELA_TEXT] = { ".rela.text", ELF_SHT_RELA, ELF_SHF_INFO_LINK, .link = ELF_SYMTAB, .info = ELF_TEXT,
+			.align = 8, .entsize = 24 },
+		[ELF_RELA_INIT_ARRAY] = { ".rela.init_array", ELF_SHT_RELA, ELF_SHF_INFO_LINK, .link = ELF_SYMTAB,
+			.info = ELF_INIT_ARRAY, .align = 8, .entsize = 24 },
+		[ELF_SYMTAB] = { ".symtab", ELF_SHT_SYMTAB, 0, .link = ELF_STRTAB, .info = ELF_SYM_FIRST_GLOBAL, .align = 8,
+			.entsize = 24 },
+		[ELF_STRTAB] = { ".strtab", ELF_SHT_STRTAB, 0, .align = 1 },
+		[ELF_SHSTRTAB] = { ".shstrtab", ELF_SHT_STRTAB, 0, .align = 1 },
+		[ELF_NOTE_STACK] = { ".note.GNU-stack", ELF_SHT_PROGBITS, 0, .align = 1 },
+	};
+	isize nfns = buf_len(ir->fns);
+	isize* text_off = xmalloc(nfns * sizeof(isize));
+	isize* rodata_off = xmalloc(nfns * sizeof(isize));
+	for(isize i = 0; i < nfns; i++) {
+		while(buf_len(s[ELF_TEXT].data) % 16) {
+			buf_putc(s[ELF_TEXT].data, (char)0xcc);   // int3
+		}
+		text_off[i] = buf_len(s[ELF_TEXT].data);
+		buf_write(s[ELF_TEXT].data, (const char*)codes[i].text, buf_len(codes[i].text));
+		rodata_off[i] = buf_len(s[ELF_RODATA].data);
+		if(codes[i].rodata)
+			buf_write(s[ELF_RODATA].data, codes[i].rodata, buf_len(codes[i].rodata));
+	}
+
+	ElfWriter w = { 0 };
+	buf_putc(w.strtab, 0);
+	elf_add_symbol(&w, NULL, ELF_STB_LOCAL, ELF_STT_NOTYPE, 0, 0, 0);
+	elf_add_symbol(&w, NULL, ELF_STB_LOCAL, ELF_STT_SECTION, ELF_TEXT, 0, 0);
+	elf_add_symbol(&w, NULL, ELF_STB_LOCAL, ELF_STT_SECTION, ELF_RODATA, 0, 0);
+	elf_add_symbol(&w, "nl_init", ELF_STB_LOCAL, ELF_STT_FUNC, ELF_TEXT, text_off[nfns - 1],
+		buf_len(codes[nfns - 1].text));
+	for(isize i = 0; i < nfns - 1; i++) {
+		Symbol* sym = ir->fns[i]->sym;
+		map_set(&w.syms, (u64)sym, elf_add_symbol(&w, sym->name, ELF_STB_GLOBAL, ELF_STT_FUNC, ELF_TEXT,
+			text_off[i], buf_len(codes[i].text)));
+	}
+	u64 bss = 0;
+	for(isize i = 0; i < buf_len(ir->globals); i++) {
+		Symbol* sym = ir->globals[i];
+		if(sym->decl->let.is_extern)
+			continue;
+		ir_layout(sym->type);
+		isize align = MAX(sym->type->align, 1);
+		bss = ALIGN_UP(bss, align);
+		s[ELF_BSS].align = MAX(s[ELF_BSS].align, (u64)align);
+		map_set(&w.syms, (u64)sym, elf_add_symbol(&w, sym->name, ELF_STB_GLOBAL, ELF_STT_OBJECT, ELF_BSS, bss,
+			sym->type->size));
+		bss += sym->type->size;
+	}
+	s[ELF_BSS].size = bss;
+
+	static const u32 types[] = {
+		[X64_REL_PC32] = R_X86_64_PC32,
+		[X64_REL_PLT32] = R_X86_64_PLT32,
+		[X64_REL_GOTPCREL] = R_X86_64_GOTPCREL,
+	};
+	for(isize i = 0; i < nfns; i++) {
+		for(isize k = 0; k < buf_len(codes[i].relocs); k++) {
+			X64Reloc r = codes[i].relocs[k];
+			if(r.sym)
+				elf_rela(&s[ELF_RELA_TEXT].data, text_off[i] + r.offset, elf_symbol(&w, r.sym), types[r.kind], r.addend);
+			else if(r.name)
+				elf_rela(&s[ELF_RELA_TEXT].data, text_off[i] + r.offset, elf_extern(&w, r.name), types[r.kind], r.addend);
+			else
+				elf_rela(&s[ELF_RELA_TEXT].data, text_off[i] + r.offset, ELF_SYM_RODATA, types[r.kind],
+					rodata_off[i] + r.addend);
+		}
+	}
+	elf_put(&s[ELF_INIT_ARRAY].data, 0, 8);
+	elf_rela(&s[ELF_RELA_INIT_ARRAY].data, 0, ELF_SYM_TEXT, R_X86_64_64, text_off[nfns - 1]);
+	s[ELF_SYMTAB].data = w.symtab;
+	s[ELF_STRTAB].data = w.strtab;
+
+	// header, section contents, section headers
+	char* o = NULL;
+	buf_write(o, "\x7f" "ELF", 4);
+	elf_put(&o, 2, 1);          // 64 bit
+	elf_put(&o, 1, 1);          // little endian
+	elf_put(&o, 1, 1);          // version
+	elf_put(&o, 0, 1);          // System V ABI
+	elf_put(&o, 0, 8);          // padding
+	elf_put(&o, 1, 2);          // relocatable
+	elf_put(&o, 62, 2);         // x86-64
+	elf_put(&o, 1, 4);
+	elf_put(&o, 0, 8);          // entry
+	elf_put(&o, 0, 8);          // no program headers
+	isize shoff_at = buf_len(o);
+	elf_put(&o, 0, 8);
+	elf_put(&o, 0, 4);          // flags
+	elf_put(&o, 64, 2);         // header size
+	elf_put(&o, 0, 2);
+	elf_put(&o, 0, 2);
+	elf_put(&o, 64, 2);         // section header size
+	elf_put(&o, ELF_SECTIONS, 2);
+	elf_put(&o, ELF_SHSTRTAB, 2);
+
+	u32 names[ELF_SECTIONS] = { 0 };
+	buf_putc(s[ELF_SHSTRTAB].data, 0);
+	for(isize i = 1; i < ELF_SECTIONS; i++) {
+		names[i] = (u32)buf_len(s[ELF_SHSTRTAB].data);
+		buf_write(s[ELF_SHSTRTAB].data, s[i].name, strlen(s[i].name) + 1);
+	}
+	u64 offsets[ELF_SECTIONS] = { 0 };
+	for(isize i = 1; i < ELF_SECTIONS; i++) {
+		elf_pad(&o, MAX(s[i].align, 1));
+		offsets[i] = buf_len(o);
+		if(s[i].type != ELF_SHT_NOBITS && s[i].data) {
+			s[i].size = buf_len(s[i].data);
+			buf_write(o, s[i].data, buf_len(s[i].data));
+		}
+	}
+	elf_pad(&o, 8);
+	u64 shoff = buf_len(o);
+	for(isize i = 0; i < 8; i++) {
+		o[shoff_at + i] = (char)(shoff >> (8 * i));
+	}
+	elf_put(&o, 0, 64);
+	for(isize i = 1; i < ELF_SECTIONS; i++) {
+		elf_put(&o, names[i], 4);
+		elf_put(&o, s[i].type, 4);
+		elf_put(&o, s[i].flags, 8);
+		elf_put(&o, 0, 8);      // address
+		elf_put(&o, offsets[i], 8);
+		elf_put(&o, s[i].size, 8);
+		elf_put(&o, s[i].link, 4);
+		elf_put(&o, s[i].info, 4);
+		elf_put(&o, s[i].align, 8);
+		elf_put(&o, s[i].entsize, 8);
+	}
+	write_file(out, (StrRange){ o, buf_len(o) });
+
+	buf_free(o);
+	for(isize i = 0; i < ELF_SECTIONS; i++) {
+		buf_free(s[i].data);
+	}
+	map_free(&w.syms);
+	xfree(rodata_off);
+	xfree(text_off);
+}
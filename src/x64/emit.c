@@ -0,0 +1,871 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Code generation for one fn. Instructions are selected one at a time:
+// their operands are read from where the allocator put them, into the
+// scratch registers (rax, rcx, xmm0, xmm1) when they are not in a register
+// already, the result is computed in a scratch register and written to
+// the location of the instruction. Phis become moves at the end of their
+// predecessors, done as one parallel move per edge. The frame is
+//   [rbp + 16 ...]  arguments passed on the stack
+//   [rbp + 8]       return address
+//   [rbp]           saved rbp
+//   [rbp - 8 ...]   saved callee-saved registers, IR slots, spill slots
+// and rsp stays 16 byte aligned between the prologue and the epilogue.
+
+enum {
+	X64_CC_B = 0x2,
+	X64_CC_AE = 0x3,
+	X64_CC_E = 0x4,
+	X64_CC_NE = 0x5,
+	X64_CC_BE = 0x6,
+	X64_CC_A = 0x7,
+	X64_CC_S = 0x8,
+	X64_CC_P = 0xa,
+	X64_CC_NP = 0xb,
+	X64_CC_L = 0xc,
+	X64_CC_GE = 0xd,
+	X64_CC_LE = 0xe,
+	X64_CC_G = 0xf,
+};
+
+typedef struct X64Fixup {
+	isize at;         // rel32 to patch
+	i32 block;        // target
+} X64Fixup;
+
+typedef struct X64Move {
+	X64Loc dst;
+	X64Loc src;       // X64_LOC_REMAT: the value of ref
+	IrRef ref;
+	bool is_float;
+} X64Move;
+
+typedef struct X64Emitter {
+	IrFn* fn;
+	X64Code* c;
+	X64Loc* locs;     // stack locations hold their rbp displacement
+	i32* slot_disp;   // rbp displacement of every IR slot
+	i32* string_off;  // offset of every string literal in the rodata of the fn
+	u32 saved;
+	isize* block_pos;
+	X64Fixup* fixups;
+	isize* div_zero;  // jumps to the division by zero error
+} X64Emitter;
+
+const i32 x64_int_args[] = { X64_RDI, X64_RSI, X64_RDX, X64_RCX, X64_R8, X64_R9 };
+
+bool x64_is_extern(Symbol* sym) {
+	return sym->kind == SYMBOL_FN ? sym->decl->fn.is_extern : sym->decl->let.is_extern;
+}
+
+X64Mem x64_stack(i32 disp) {
+	return x64_mem(X64_RBP, disp);
+}
+
+bool x64_loc_equal(X64Loc a, X64Loc b) {
+	return a.kind == b.kind && a.n == b.n;
+}
+
+// writes the value of a constant or an address into dst, floats as their
+// bits
+void x64_remat(X64Emitter* e, IrRef r, i32 dst) {
+	X64Code* c = e->c;
+	IrInstr* in = &e->fn->instrs[r];
+	switch(in->op) {
+		case IR_CONST:
+			if(in->type == IR_F64) {
+				u64 bits;
+				memcpy(&bits, &in->f, sizeof(bits));
+				x64_mov_imm(c, dst, (i64)bits);
+			} else if(in->type == IR_F32) {
+				float f = (float)in->f;
+				u32 bits;
+				memcpy(&bits, &f, sizeof(bits));
+				x64_mov_imm(c, dst, bits);
+			} else {
+				x64_mov_imm(c, dst, in->imm);
+			}
+			break;
+		case IR_SLOT:
+			x64_lea(c, dst, x64_stack(e->slot_disp[in->imm]));
+			break;
+		case IR_GLOBAL:
+		case IR_FN:
+			if(x64_is_extern(in->sym)) {
+				// may be in a shared library: its address is in the GOT
+				x64_rm(c, 0, X64_W, 0x8b, dst, x64_rip(X64_REL_GOTPCREL, in->sym, 0));
+			} else {
+				x64_lea(c, dst, x64_rip(X64_REL_PC32, in->sym, 0));
+			}
+			break;
+		case IR_STRING:
+			x64_lea(c, dst, x64_rip(X64_REL_PC32, NULL, e->string_off[in->imm]));
+			break;
+		default:
+			assert(0);
+	}
+}
+
+// the register holding the integer r: its own, or scratch loaded with it
+i32 x64_get(X64Emitter* e, IrRef r, i32 scratch) {
+	X64Loc l = e->locs[r];
+	if(l.kind == X64_LOC_GPR)
+		return l.n;
+	if(l.kind == X64_LOC_STACK)
+		x64_load(e->c, IR_I64, scratch, x64_stack(l.n));
+	else
+		x64_remat(e, r, scratch);
+	return scratch;
+}
+
+void x64_get_to(X64Emitter* e, IrRef r, i32 dst) {
+	x64_mov(e->c, dst, x64_get(e, r, dst));
+}
+
+// the xmm register holding the float r, constants go through r11
+i32 x64_fget(X64Emitter* e, IrRef r, i32 scratch) {
+	X64Loc l = e->locs[r];
+	if(l.kind == X64_LOC_XMM)
+		return l.n;
+	if(l.kind == X64_LOC_STACK) {
+		x64_fload(e->c, IR_F64, scratch, x64_stack(l.n));
+	} else {
+		x64_remat(e, r, X64_R11);
+		x64_movq_to_xmm(e->c, scratch, X64_R11);
+	}
+	return scratch;
+}
+
+void x64_fget_to(X64Emitter* e, IrRef r, i32 dst) {
+	x64_fmov(e->c, dst, x64_fget(e, r, dst));
+}
+
+// writes the result of r from src to its location
+void x64_put(X64Emitter* e, IrRef r, i32 src) {
+	X64Loc l = e->locs[r];
+	if(l.kind == X64_LOC_GPR)
+		x64_mov(e->c, l.n, src);
+	else if(l.kind == X64_LOC_STACK)
+		x64_store(e->c, IR_I64, x64_stack(l.n), src);
+}
+
+void x64_fput(X64Emitter* e, IrRef r, i32 src) {
+	X64Loc l = e->locs[r];
+	if(l.kind == X64_LOC_XMM)
+		x64_fmov(e->c, l.n, src);
+	else if(l.kind == X64_LOC_STACK)
+		x64_fstore(e->c, IR_F64, x64_stack(l.n), src);
+}
+
+void x64_move_loc(X64Emitter* e, X64Loc dst, X64Loc src) {
+	X64Code* c = e->c;
+	if(x64_loc_equal(dst, src))
+		return;
+	if(dst.kind == X64_LOC_STACK && src.kind == X64_LOC_STACK) {
+		x64_load(c, IR_I64, X64_RAX, x64_stack(src.n));
+		x64_store(c, IR_I64, x64_stack(dst.n), X64_RAX);
+	} else if(dst.kind == X64_LOC_STACK) {
+		if(src.kind == X64_LOC_XMM)
+			x64_fstore(c, IR_F64, x64_stack(dst.n), src.n);
+		else
+			x64_store(c, IR_I64, x64_stack(dst.n), src.n);
+	} else if(src.kind == X64_LOC_STACK) {
+		if(dst.kind == X64_LOC_XMM)
+			x64_fload(c, IR_F64, dst.n, x64_stack(src.n));
+		else
+			x64_load(c, IR_I64, dst.n, x64_stack(src.n));
+	} else if(dst.kind == X64_LOC_XMM) {
+		x64_fmov(c, dst.n, src.n);
+	} else {
+		x64_mov(c, dst.n, src.n);
+	}
+}
+
+// Does all the moves at once: no move reads a location after another
+// one has written it. Moves are done when their destination is no longer
+// read; what is left are cycles, broken by copying a source to r11 or
+// xmm15. Constants and addresses are written last, when the scratch
+// registers are free again.
+void x64_parallel_move(X64Emitter* e, X64Move* moves) {
+	isize len = buf_len(moves);
+	isize done = 0;
+	while(done < len) {
+		bool progress = false;
+		for(isize i = 0; i < len; i++) {
+			X64Move* m = &moves[i];
+			if(m->dst.kind == X64_LOC_NONE || m->src.kind == X64_LOC_REMAT)
+				continue;
+			bool blocked = false;
+			for(isize k = 0; k < len && !blocked; k++) {
+				blocked = k != i && moves[k].dst.kind != X64_LOC_NONE && moves[k].src.kind != X64_LOC_REMAT &&
+					x64_loc_equal(moves[k].src, m->dst);
+			}
+			if(blocked)
+				continue;
+			x64_move_loc(e, m->dst, m->src);
+			m->dst.kind = X64_LOC_NONE;
+			done++;
+			progress = true;
+		}
+		if(progress)
+			continue;
+		// every pending move is on a cycle, or a remat
+		isize i = 0;
+		while(i < len && (moves[i].dst.kind == X64_LOC_NONE || moves[i].src.kind == X64_LOC_REMAT)) {
+			i++;
+		}
+		if(i == len)
+			break;
+		X64Loc from = moves[i].src;
+		X64Loc scratch = moves[i].is_float ? (X64Loc){ X64_LOC_XMM, 15 } : (X64Loc){ X64_LOC_GPR, X64_R11 };
+		x64_move_loc(e, scratch, from);
+		for(isize k = 0; k < len; k++) {
+			if(moves[k].dst.kind != X64_LOC_NONE && x64_loc_equal(moves[k].src, from))
+				moves[k].src = scratch;
+		}
+	}
+	for(isize i = 0; i < len; i++) {
+		X64Move* m = &moves[i];
+		if(m->dst.kind == X64_LOC_NONE || m->src.kind != X64_LOC_REMAT)
+			continue;
+		if(m->dst.kind == X64_LOC_XMM) {
+			x64_fget_to(e, m->ref, m->dst.n);
+		} else if(m->dst.kind == X64_LOC_GPR) {
+			x64_remat(e, m->ref, m->dst.n);
+		} else {
+			x64_remat(e, m->ref, X64_RAX);
+			x64_store(e->c, IR_I64, x64_stack(m->dst.n), X64_RAX);
+		}
+	}
+}
+
+void x64_add_move(X64Emitter* e, X64Move** moves, X64Loc dst, IrRef src) {
+	X64Loc l = e->locs[src];
+	if(dst.kind == X64_LOC_NONE || x64_loc_equal(dst, l))
+		return;
+	buf_push(*moves, (X64Move){ dst, l, src, ir_is_float(e->fn->instrs[src].type) });
+}
+
+// the moves into the phis of to on the edge from from
+void x64_edge_moves(X64Emitter* e, i32 from, i32 to) {
+	IrFn* fn = e->fn;
+	isize phis = ir_phis_len(fn, to);
+	if(phis == 0)
+		return;
+	isize k = ir_pred_index(fn, to, from);
+	X64Move* moves = NULL;
+	for(isize i = 0; i < phis; i++) {
+		IrRef phi = fn->blocks[to].code[i];
+		x64_add_move(e, &moves, e->locs[phi], fn->args[fn->instrs[phi].args.start + k]);
+	}
+	x64_parallel_move(e, moves);
+	buf_free(moves);
+}
+
+void x64_goto(X64Emitter* e, i32 block, i32 next) {
+	if(block != next)
+		buf_push(e->fixups, (X64Fixup){ x64_jmp(e->c), block });
+}
+
+void x64_epilogue(X64Emitter* e) {
+	X64Code* c = e->c;
+	i32 k = 0;
+	for(i32 r = 0; r < 16; r++) {
+		if(e->saved & (1u << r))
+			x64_load(c, IR_I64, r, x64_stack(-8 * ++k));
+	}
+	x64_byte(c, 0xc9);    // leave
+	x64_byte(c, 0xc3);    // ret
+}
+
+// whether the extern fn takes or returns aggregates, which C passes in
+// ways the IR does not model
+bool x64_extern_has_aggregates(Symbol* sym) {
+	Type* t = sym->type;
+	if(ir_is_aggregate(t->fn.ret))
+		return true;
+	for(isize i = 0; i < t->fn.args_len; i++) {
+		if(ir_is_aggregate(t->fn.args[i]))
+			return true;
+	}
+	return false;
+}
+
+// C callees may rely on u8 and u16 arguments being zero extended to 32
+// bits, while they are kept sign extended here
+bool x64_needs_zext(Symbol* callee, isize i) {
+	if(!callee || !x64_is_extern(callee))
+		return false;
+	Type* t = callee->type->fn.args[i];
+	return t->kind == TYPE_UNSIGNED && t->size < 4;
+}
+
+void x64_call(X64Emitter* e, IrRef r) {
+	IrFn* fn = e->fn;
+	X64Code* c = e->c;
+	IrInstr* in = &fn->instrs[r];
+	IrRef* args = fn->args + in->args.start;
+	IrInstr* callee = &fn->instrs[in->x];
+	Symbol* direct = callee->op == IR_FN ? callee->sym : NULL;
+	X64Move* moves = NULL;
+	IrRef* stack_args = NULL;
+	isize ints = 0, floats = 0;
+	for(isize i = 0; i < in->args.len; i++) {
+		bool is_float = ir_is_float(fn->instrs[args[i]].type);
+		if(is_float && floats < 8)
+			x64_add_move(e, &moves, (X64Loc){ X64_LOC_XMM, (i32)floats++ }, args[i]);
+		else if(!is_float && ints < 6)
+			x64_add_move(e, &moves, (X64Loc){ X64_LOC_GPR, x64_int_args[ints++] }, args[i]);
+		else
+			buf_push(stack_args, (IrRef)i);
+	}
+	if(!direct)
+		x64_add_move(e, &moves, (X64Loc){ X64_LOC_GPR, X64_R10 }, in->x);
+
+	// stack arguments are pushed right to left, with rsp 16 byte aligned
+	// at the call
+	isize pushed = buf_len(stack_args) + buf_len(stack_args) % 2;
+	if(buf_len(stack_args) % 2)
+		x64_rsp_add(c, -8);
+	for(isize i = buf_len(stack_args) - 1; i >= 0; i--) {
+		IrRef a = args[stack_args[i]];
+		IrType t = fn->instrs[a].type;
+		if(ir_is_float(t)) {
+			x64_movq_from_xmm(c, X64_RAX, x64_fget(e, a, 0));
+		} else {
+			x64_get_to(e, a, X64_RAX);
+			if(x64_needs_zext(direct, stack_args[i]))
+				x64_zext(c, t, X64_RAX);
+		}
+		x64_push(c, X64_RAX);
+	}
+	x64_parallel_move(e, moves);
+	ints = 0;
+	for(isize i = 0; i < in->args.len && ints < 6; i++) {
+		IrType t = fn->instrs[args[i]].type;
+		if(ir_is_float(t))
+			continue;
+		if(x64_needs_zext(direct, i))
+			x64_zext(c, t, x64_int_args[ints]);
+		ints++;
+	}
+
+	// variadic callees take the number of vector registers used in al
+	x64_mov_imm(c, X64_RAX, MIN(floats, 8));
+	if(direct) {
+		x64_byte(c, 0xe8);
+		x64_reloc(c, X64_REL_PLT32, direct, -4);
+		x64_u32(c, 0);
+	} else {
+		x64_rr(c, 0, 0, 0xff, 2, X64_R10);
+	}
+	x64_rsp_add(c, 8 * pushed);
+
+	if(ir_is_float(in->type)) {
+		x64_fput(e, r, 0);
+	} else if(in->type != IR_VOID) {
+		// the callee leaves the bits above the result undefined
+		x64_sext(c, in->type, X64_RAX);
+		x64_put(e, r, X64_RAX);
+	}
+	buf_free(stack_args);
+	buf_free(moves);
+}
+
+void x64_compare(X64Emitter* e, IrRef r) {
+	X64Code* c = e->c;
+	IrInstr* in = &e->fn->instrs[r];
+	IrType t = e->fn->instrs[in->x].type;
+	if(ir_is_float(t)) {
+		i32 a = x64_fget(e, in->x, 0);
+		i32 b = x64_fget(e, in->y, 1);
+		// unordered sets zf, pf and cf
+		switch(in->op) {
+			case IR_EQ:
+				x64_ucomi(c, t, a, b);
+				x64_setcc(c, X64_CC_E, X64_RAX);
+				x64_setcc(c, X64_CC_NP, X64_RCX);
+				x64_rr(c, 0, 0, 0x20, X64_RCX, X64_RAX);   // and al, cl
+				break;
+			case IR_NE:
+				x64_ucomi(c, t, a, b);
+				x64_setcc(c, X64_CC_NE, X64_RAX);
+				x64_setcc(c, X64_CC_P, X64_RCX);
+				x64_rr(c, 0, 0, 0x08, X64_RCX, X64_RAX);   // or al, cl
+				break;
+			case IR_GT: x64_ucomi(c, t, a, b); x64_setcc(c, X64_CC_A, X64_RAX); break;
+			case IR_GE: x64_ucomi(c, t, a, b); x64_setcc(c, X64_CC_AE, X64_RAX); break;
+			case IR_LT: x64_ucomi(c, t, b, a); x64_setcc(c, X64_CC_A, X64_RAX); break;
+			case IR_LE: x64_ucomi(c, t, b, a); x64_setcc(c, X64_CC_AE, X64_RAX); break;
+			default: assert(0);
+		}
+	} else {
+		bool is_unsigned = in->op >= IR_ULT;
+		x64_get_to(e, in->x, X64_RAX);
+		i32 b = x64_get(e, in->y, X64_RCX);
+		if(is_unsigned) {
+			x64_mov(c, X64_RCX, b);
+			b = X64_RCX;
+			x64_zext(c, t, X64_RAX);
+			x64_zext(c, t, X64_RCX);
+		}
+		x64_alu(c, 0x39, X64_RAX, b);
+		static const u8 cc[] = {
+			[IR_EQ] = X64_CC_E, [IR_NE] = X64_CC_NE, [IR_LT] = X64_CC_L, [IR_LE] = X64_CC_LE,
+			[IR_GT] = X64_CC_G, [IR_GE] = X64_CC_GE, [IR_ULT] = X64_CC_B, [IR_ULE] = X64_CC_BE,
+			[IR_UGT] = X64_CC_A, [IR_UGE] = X64_CC_AE,
+		};
+		x64_setcc(c, cc[in->op], X64_RAX);
+	}
+	x64_zext(c, IR_I8, X64_RAX);
+	x64_put(e, r, X64_RAX);
+}
+
+void x64_float_op(X64Emitter* e, IrRef r) {
+	X64Code* c = e->c;
+	IrInstr* in = &e->fn->instrs[r];
+	x64_fget_to(e, in->x, 0);
+	if(in->op == IR_NEG) {
+		x64_movq_from_xmm(c, X64_RAX, 0);
+		x64_mov_imm(c, X64_RCX, in->type == IR_F32 ? (i64)1 << 31 : (i64)((u64)1 << 63));
+		x64_alu(c, 0x31, X64_RAX, X64_RCX);
+		x64_movq_to_xmm(c, 0, X64_RAX);
+	} else {
+		i32 b = x64_fget(e, in->y, 1);
+		static const u8 ops[] = { [IR_ADD] = 0x58, [IR_SUB] = 0x5c, [IR_MUL] = 0x59, [IR_DIV] = 0x5e };
+		x64_sse(c, in->type, ops[in->op], 0, b);
+	}
+	x64_fput(e, r, 0);
+}
+
+// calls the libc fn name, which the program need not declare
+void x64_call_libc(X64Code* c, const char* name) {
+	x64_byte(c, 0xe8);
+	buf_push(c->relocs, (X64Reloc){ buf_len(c->text), X64_REL_PLT32, NULL, -4, name });
+	x64_u32(c, 0);
+}
+
+// the target of the jumps in div_zero, after the blocks: prints the error
+// of the VM, without the calling fns, and exits with 1
+void x64_div_zero(X64Emitter* e) {
+	X64Code* c = e->c;
+	for(isize i = 0; i < buf_len(e->div_zero); i++) {
+		x64_label(c, e->div_zero[i]);
+	}
+	isize fmt = buf_len(c->rodata);
+	buf_printf(c->rodata, "runtime error: division by zero in fn '%s'\n", e->fn->sym ? e->fn->sym->name : "<init>");
+	buf_push(c->rodata, 0);
+	x64_lea(c, X64_RDI, x64_rip(X64_REL_PC32, NULL, (i32)fmt));
+	x64_mov_imm(c, X64_RAX, 0);
+	x64_call_libc(c, "printf");
+	x64_mov_imm(c, X64_RDI, 1);
+	x64_call_libc(c, "exit");
+}
+
+void x64_int_op(X64Emitter* e, IrRef r) {
+	X64Code* c = e->c;
+	IrInstr* in = &e->fn->instrs[r];
+	IrType t = in->type;
+	i32 result = X64_RAX;
+	x64_get_to(e, in->x, X64_RAX);
+	switch(in->op) {
+		case IR_ADD: x64_alu(c, 0x01, X64_RAX, x64_get(e, in->y, X64_RCX)); break;
+		case IR_SUB: x64_alu(c, 0x29, X64_RAX, x64_get(e, in->y, X64_RCX)); break;
+		case IR_AND: x64_alu(c, 0x21, X64_RAX, x64_get(e, in->y, X64_RCX)); break;
+		case IR_OR: x64_alu(c, 0x09, X64_RAX, x64_get(e, in->y, X64_RCX)); break;
+		case IR_XOR: x64_alu(c, 0x31, X64_RAX, x64_get(e, in->y, X64_RCX)); break;
+		case IR_MUL: x64_rr(c, 0, X64_W, 0x0faf, X64_RAX, x64_get(e, in->y, X64_RCX)); break;
+		case IR_NEG: x64_unary(c, 3, X64_RAX); break;
+		case IR_DIV:
+		case IR_REM: {
+			// as the VM: the least value divided by -1 wraps around
+			// instead of trapping
+			x64_get_to(e, in->y, X64_RCX);
+			x64_alu(c, 0x85, X64_RCX, X64_RCX);
+			buf_push(e->div_zero, x64_jcc(c, X64_CC_E));
+			x64_mov_imm(c, X64_RDX, -1);
+			x64_alu(c, 0x39, X64_RCX, X64_RDX);
+			isize minus_one = x64_jcc(c, X64_CC_E);
+			x64_byte(c, 0x48);
+			x64_byte(c, 0x99);    // cqo
+			x64_unary(c, 7, X64_RCX);
+			isize done = x64_jmp(c);
+			x64_label(c, minus_one);
+			if(in->op == IR_DIV)
+				x64_unary(c, 3, X64_RAX);
+			else
+				x64_mov_imm(c, X64_RDX, 0);
+			x64_label(c, done);
+			result = in->op == IR_DIV ? X64_RAX : X64_RDX;
+			break;
+		}
+		case IR_UDIV:
+		case IR_UREM:
+			x64_get_to(e, in->y, X64_RCX);
+			x64_zext(c, t, X64_RAX);
+			x64_zext(c, t, X64_RCX);
+			x64_alu(c, 0x85, X64_RCX, X64_RCX);
+			buf_push(e->div_zero, x64_jcc(c, X64_CC_E));
+			x64_mov_imm(c, X64_RDX, 0);
+			x64_unary(c, 6, X64_RCX);
+			result = in->op == IR_UDIV ? X64_RAX : X64_RDX;
+			break;
+		case IR_SHL:
+		case IR_SHR:
+		case IR_SAR:
+			x64_get_to(e, in->y, X64_RCX);
+			if(in->op == IR_SHR)
+				x64_zext(c, t, X64_RAX);
+			x64_shift(c, in->op == IR_SHL ? 4 : in->op == IR_SHR ? 5 : 7, X64_RAX);
+			break;
+		default:
+			assert(0);
+	}
+	// and, or, xor and sar keep the result sign extended
+	if(in->op != IR_AND && in->op != IR_OR && in->op != IR_XOR && in->op != IR_SAR)
+		x64_sext(c, t, result);
+	x64_put(e, r, result);
+}
+
+void x64_convert(X64Emitter* e, IrRef r) {
+	X64Code* c = e->c;
+	IrInstr* in = &e->fn->instrs[r];
+	IrType from = e->fn->instrs[in->x].type;
+	switch(in->op) {
+		case IR_TRUNC:
+		case IR_SEXT:
+			x64_get_to(e, in->x, X64_RAX);
+			x64_sext(c, in->type, X64_RAX);
+			x64_put(e, r, X64_RAX);
+			break;
+		case IR_ZEXT:
+			x64_get_to(e, in->x, X64_RAX);
+			x64_zext(c, from, X64_RAX);
+			x64_put(e, r, X64_RAX);
+			break;
+		case IR_ITOF:
+			x64_cvt_from_int(c, in->type, 0, x64_get(e, in->x, X64_RAX));
+			x64_fput(e, r, 0);
+			break;
+		case IR_UTOF:
+			x64_get_to(e, in->x, X64_RAX);
+			if(from != IR_I64) {
+				x64_zext(c, from, X64_RAX);
+				x64_cvt_from_int(c, in->type, 0, X64_RAX);
+			} else {
+				// above INT64_MAX: halve keeping the low bit for rounding,
+				// convert and double
+				x64_alu(c, 0x85, X64_RAX, X64_RAX);
+				isize big = x64_jcc(c, X64_CC_S);
+				x64_cvt_from_int(c, in->type, 0, X64_RAX);
+				isize done = x64_jmp(c);
+				x64_label(c, big);
+				x64_mov(c, X64_RCX, X64_RAX);
+				x64_rr(c, 0, X64_W, 0xd1, 5, X64_RCX);    // shr rcx, 1
+				x64_mov_imm(c, X64_RDX, 1);
+				x64_alu(c, 0x21, X64_RAX, X64_RDX);
+				x64_alu(c, 0x09, X64_RCX, X64_RAX);
+				x64_cvt_from_int(c, in->type, 0, X64_RCX);
+				x64_sse(c, in->type, 0x58, 0, 0);
+				x64_label(c, done);
+			}
+			x64_fput(e, r, 0);
+			break;
+		case IR_FTOI:
+			x64_cvt_to_int(c, from, X64_RAX, x64_fget(e, in->x, 0));
+			x64_sext(c, in->type, X64_RAX);
+			x64_put(e, r, X64_RAX);
+			break;
+		case IR_FTOU:
+			x64_fget_to(e, in->x, 0);
+			if(in->type == IR_I64) {
+				// from 2^63 up: subtract it before converting and set the
+				// top bit after
+				x64_mov_imm(c, X64_RCX, from == IR_F32 ? 0x5f000000 : 0x43e0000000000000);
+				x64_movq_to_xmm(c, 1, X64_RCX);
+				x64_ucomi(c, from, 0, 1);
+				isize big = x64_jcc(c, X64_CC_AE);
+				x64_cvt_to_int(c, from, X64_RAX, 0);
+				isize done = x64_jmp(c);
+				x64_label(c, big);
+				x64_sse(c, from, 0x5c, 0, 1);
+				x64_cvt_to_int(c, from, X64_RAX, 0);
+				x64_mov_imm(c, X64_RCX, (i64)((u64)1 << 63));
+				x64_alu(c, 0x31, X64_RAX, X64_RCX);
+				x64_label(c, done);
+			} else {
+				x64_cvt_to_int(c, from, X64_RAX, 0);
+				x64_sext(c, in->type, X64_RAX);
+			}
+			x64_put(e, r, X64_RAX);
+			break;
+		case IR_FEXT:
+		case IR_FTRUNC:
+			// cvtss2sd and cvtsd2ss
+			x64_sse(c, from, 0x5a, 0, x64_fget(e, in->x, 0));
+			x64_fput(e, r, 0);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+void x64_instr(X64Emitter* e, IrRef r) {
+	X64Code* c = e->c;
+	IrInstr* in = &e->fn->instrs[r];
+	switch(in->op) {
+		case IR_NOP:
+		case IR_CONST:
+		case IR_PARAM:
+		case IR_SLOT:
+		case IR_GLOBAL:
+		case IR_FN:
+		case IR_STRING:
+		case IR_PHI:
+			break;
+		case IR_ADD:
+		case IR_SUB:
+		case IR_MUL:
+		case IR_DIV:
+		case IR_NEG:
+			if(ir_is_float(in->type))
+				x64_float_op(e, r);
+			else
+				x64_int_op(e, r);
+			break;
+		case IR_UDIV:
+		case IR_REM:
+		case IR_UREM:
+		case IR_AND:
+		case IR_OR:
+		case IR_XOR:
+		case IR_SHL:
+		case IR_SHR:
+		case IR_SAR:
+			x64_int_op(e, r);
+			break;
+		case IR_EQ:
+		case IR_NE:
+		case IR_LT:
+		case IR_LE:
+		case IR_GT:
+		case IR_GE:
+		case IR_ULT:
+		case IR_ULE:
+		case IR_UGT:
+		case IR_UGE:
+			x64_compare(e, r);
+			break;
+		case IR_TRUNC:
+		case IR_SEXT:
+		case IR_ZEXT:
+		case IR_ITOF:
+		case IR_UTOF:
+		case IR_FTOI:
+		case IR_FTOU:
+		case IR_FEXT:
+		case IR_FTRUNC:
+			x64_convert(e, r);
+			break;
+		case IR_LOAD: {
+			X64Mem m = x64_mem(x64_get(e, in->x, X64_RAX), 0);
+			if(ir_is_float(in->type)) {
+				x64_fload(c, in->type, 0, m);
+				x64_fput(e, r, 0);
+			} else {
+				x64_load(c, in->type, X64_RAX, m);
+				x64_put(e, r, X64_RAX);
+			}
+			break;
+		}
+		case IR_STORE: {
+			X64Mem m = x64_mem(x64_get(e, in->x, X64_RAX), 0);
+			if(ir_is_float(in->type))
+				x64_fstore(c, in->type, m, x64_fget(e, in->y, 0));
+			else
+				x64_store(c, in->type, m, x64_get(e, in->y, X64_RCX));
+			break;
+		}
+		case IR_MEMCPY:
+			x64_get_to(e, in->x, X64_RDI);
+			x64_get_to(e, in->y, X64_RSI);
+			x64_mov_imm(c, X64_RCX, in->imm);
+			x64_byte(c, 0xf3);
+			x64_byte(c, 0xa4);    // rep movsb
+			break;
+		case IR_MEMZERO:
+			x64_get_to(e, in->x, X64_RDI);
+			x64_mov_imm(c, X64_RAX, 0);
+			x64_mov_imm(c, X64_RCX, in->imm);
+			x64_byte(c, 0xf3);
+			x64_byte(c, 0xaa);    // rep stosb
+			break;
+		case IR_CALL:
+			x64_call(e, r);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+void x64_terminator(X64Emitter* e, i32 block, IrRef r) {
+	X64Code* c = e->c;
+	IrFn* fn = e->fn;
+	IrInstr* in = &fn->instrs[r];
+	IrBlock* b = &fn->blocks[block];
+	i32 next = block + 1;
+	switch(in->op) {
+		case IR_JUMP:
+			x64_edge_moves(e, block, b->succ[0]);
+			x64_goto(e, b->succ[0], next);
+			break;
+		case IR_BRANCH: {
+			i32 s0 = b->succ[0], s1 = b->succ[1];
+			i32 cond = x64_get(e, in->x, X64_RAX);
+			x64_alu(c, 0x85, cond, cond);
+			if(ir_phis_len(fn, s1) == 0) {
+				buf_push(e->fixups, (X64Fixup){ x64_jcc(c, X64_CC_E), s1 });
+				x64_edge_moves(e, block, s0);
+				x64_goto(e, s0, next);
+			} else if(ir_phis_len(fn, s0) == 0) {
+				buf_push(e->fixups, (X64Fixup){ x64_jcc(c, X64_CC_NE), s0 });
+				x64_edge_moves(e, block, s1);
+				x64_goto(e, s1, next);
+			} else {
+				isize at = x64_jcc(c, X64_CC_E);
+				x64_edge_moves(e, block, s0);
+				x64_goto(e, s0, -1);
+				x64_label(c, at);
+				x64_edge_moves(e, block, s1);
+				x64_goto(e, s1, next);
+			}
+			break;
+		}
+		case IR_RET:
+			if(in->x >= 0 && ir_is_float(fn->instrs[in->x].type))
+				x64_fget_to(e, in->x, 0);
+			else if(in->x >= 0)
+				x64_get_to(e, in->x, X64_RAX);
+			x64_epilogue(e);
+			break;
+		default:
+			assert(0);
+	}
+}
+
+// Moves the arguments from where the caller put them to the locations of
+// the params, and sign extends the narrow ones.
+void x64_params(X64Emitter* e) {
+	IrFn* fn = e->fn;
+	bool* is_float = xcalloc(fn->params_len + 1, sizeof(bool));
+	if(fn->sym) {
+		Type* t = fn->sym->type;
+		for(isize i = 0; i < t->fn.args_len; i++) {
+			Type* pt = t->fn.args[i];
+			is_float[fn->ret_ptr + i] = !ir_is_aggregate(pt) && ir_is_float(ir_type(pt));
+		}
+	}
+	// where every param arrives, params being dropped when unused
+	X64Loc* from = xmalloc((fn->params_len + 1) * sizeof(X64Loc));
+	isize ints = 0, floats = 0, stack = 0;
+	for(isize i = 0; i < fn->params_len; i++) {
+		if(is_float[i] && floats < 8)
+			from[i] = (X64Loc){ X64_LOC_XMM, (i32)floats++ };
+		else if(!is_float[i] && ints < 6)
+			from[i] = (X64Loc){ X64_LOC_GPR, x64_int_args[ints++] };
+		else
+			from[i] = (X64Loc){ X64_LOC_STACK, (i32)(16 + 8 * stack++) };
+	}
+	X64Move* moves = NULL;
+	IrBlock* entry = &fn->blocks[0];
+	for(isize i = 0; i < buf_len(entry->code); i++) {
+		IrRef r = entry->code[i];
+		IrInstr* in = &fn->instrs[r];
+		if(in->op == IR_PARAM && e->locs[r].kind != X64_LOC_NONE && !x64_loc_equal(e->locs[r], from[in->imm]))
+			buf_push(moves, (X64Move){ e->locs[r], from[in->imm], r, is_float[in->imm] });
+	}
+	x64_parallel_move(e, moves);
+	for(isize i = 0; i < buf_len(entry->code); i++) {
+		IrRef r = entry->code[i];
+		IrInstr* in = &fn->instrs[r];
+		if(in->op != IR_PARAM || ir_is_float(in->type) || in->type == IR_I64)
+			continue;
+		X64Loc l = e->locs[r];
+		if(l.kind == X64_LOC_GPR) {
+			x64_sext(e->c, in->type, l.n);
+		} else if(l.kind == X64_LOC_STACK) {
+			x64_load(e->c, in->type, X64_RAX, x64_stack(l.n));
+			x64_store(e->c, IR_I64, x64_stack(l.n), X64_RAX);
+		}
+	}
+	buf_free(moves);
+	xfree(from);
+	xfree(is_float);
+}
+
+void x64_fn(IrFn* fn, X64Code* c) {
+	X64Alloc a;
+	x64_regalloc(fn, &a);
+	X64Emitter e = { .fn = fn, .c = c, .locs = a.locs, .saved = a.saved };
+
+	// frame layout
+	i32 off = 0;
+	for(i32 r = 0; r < 16; r++) {
+		if(a.saved & (1u << r))
+			off += 8;
+	}
+	e.slot_disp = xmalloc(MAX(buf_len(fn->slots), 1) * sizeof(i32));
+	for(isize i = 0; i < buf_len(fn->slots); i++) {
+		off = (i32)ALIGN_UP(off + fn->slots[i].size, MAX(fn->slots[i].align, 1));
+		e.slot_disp[i] = -off;
+	}
+	off = (i32)ALIGN_UP(off, 8);
+	for(isize r = 0; r < buf_len(fn->instrs); r++) {
+		if(e.locs[r].kind == X64_LOC_STACK)
+			e.locs[r].n = -(off + 8 * (e.locs[r].n + 1));
+	}
+	i32 frame = (i32)ALIGN_UP(off + 8 * a.spills, 16);
+
+	e.string_off = xmalloc(MAX(buf_len(fn->strings), 1) * sizeof(i32));
+	for(isize i = 0; i < buf_len(fn->strings); i++) {
+		e.string_off[i] = (i32)buf_len(c->rodata);
+		// the terminating NUL included
+		buf_write(c->rodata, fn->strings[i], buf_len(fn->strings[i]));
+	}
+
+	x64_push(c, X64_RBP);
+	x64_mov(c, X64_RBP, X64_RSP);
+	x64_rsp_add(c, -frame);
+	i32 k = 0;
+	for(i32 r = 0; r < 16; r++) {
+		if(a.saved & (1u << r))
+			x64_store(c, IR_I64, x64_stack(-8 * ++k), r);
+	}
+	x64_params(&e);
+
+	isize nblocks = buf_len(fn->blocks);
+	e.block_pos = xmalloc(nblocks * sizeof(isize));
+	for(i32 b = 0; b < nblocks; b++) {
+		e.block_pos[b] = buf_len(c->text);
+		IrBlock* block = &fn->blocks[b];
+		isize len = buf_len(block->code);
+		for(isize i = 0; i < len - 1; i++) {
+			x64_instr(&e, block->code[i]);
+		}
+		x64_terminator(&e, b, block->code[len - 1]);
+	}
+	for(isize i = 0; i < buf_len(e.fixups); i++) {
+		X64Fixup f = e.fixups[i];
+		x64_patch32(c, f.at, (u32)(e.block_pos[f.block] - (f.at + 4)));
+	}
+	if(e.div_zero)
+		x64_div_zero(&e);
+
+	buf_free(e.div_zero);
+	buf_free(e.fixups);
+	xfree(e.block_pos);
+	xfree(e.string_off);
+	xfree(e.slot_disp);
+	xfree(a.locs);
+}
@@ -0,0 +1,251 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Machine code encoding. Instructions are written with their operands in
+// registers or in memory at a register plus a 32 bit displacement, or at
+// a rip-relative displacement with a relocation; that is all the code
+// generator needs, so there are no shorter forms.
+
+void x64_byte(X64Code* c, u8 b) {
+	buf_push(c->text, b);
+}
+
+void x64_u32(X64Code* c, u32 v) {
+	for(isize i = 0; i < 4; i++) {
+		x64_byte(c, (u8)(v >> (8 * i)));
+	}
+}
+
+void x64_u64(X64Code* c, u64 v) {
+	x64_u32(c, (u32)v);
+	x64_u32(c, (u32)(v >> 32));
+}
+
+void x64_patch32(X64Code* c, isize at, u32 v) {
+	for(isize i = 0; i < 4; i++) {
+		c->text[at + i] = (u8)(v >> (8 * i));
+	}
+}
+
+X64Mem x64_mem(i32 base, i32 disp) {
+	return (X64Mem){ .base = base, .disp = disp };
+}
+
+// rip-relative operand: sym + disp, or the rodata of the fn + disp
+X64Mem x64_rip(u8 reloc, Symbol* sym, i32 disp) {
+	return (X64Mem){ .base = X64_RIP, .disp = disp, .sym = sym, .reloc = reloc };
+}
+
+void x64_reloc(X64Code* c, u8 kind, Symbol* sym, i64 addend) {
+	buf_push(c->relocs, (X64Reloc){ buf_len(c->text), kind, sym, addend });
+}
+
+// Writes the legacy or mandatory prefix, the REX prefix when needed and
+// the opcode, which is up to three bytes written most significant first.
+// reg and rm are the registers that go in ModRM.reg and ModRM.rm or the
+// base, -1 for none.
+void x64_opcode(X64Code* c, u8 prefix, u32 flags, u32 op, i32 reg, i32 rm) {
+	if(prefix)
+		x64_byte(c, prefix);
+	u8 rex = 0x40;
+	if(flags & X64_W) rex |= 8;
+	if(reg >= 0 && (reg & 8)) rex |= 4;
+	if(rm >= 0 && (rm & 8)) rex |= 1;
+	// spl, bpl, sil and dil instead of ah, ch, dh and bh
+	bool byte_reg = (flags & X64_B8) && ((reg >= 4 && reg < 8) || (!(flags & X64_MEM) && rm >= 4 && rm < 8));
+	if(rex != 0x40 || byte_reg)
+		x64_byte(c, rex);
+	if(op > 0xffff) x64_byte(c, (u8)(op >> 16));
+	if(op > 0xff) x64_byte(c, (u8)(op >> 8));
+	x64_byte(c, (u8)op);
+}
+
+// op reg, rm with both operands in registers
+void x64_rr(X64Code* c, u8 prefix, u32 flags, u32 op, i32 reg, i32 rm) {
+	x64_opcode(c, prefix, flags, op, reg, rm);
+	x64_byte(c, (u8)(0xc0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+// op reg, [m]
+void x64_rm(X64Code* c, u8 prefix, u32 flags, u32 op, i32 reg, X64Mem m) {
+	x64_opcode(c, prefix, flags | X64_MEM, op, reg, m.base == X64_RIP ? -1 : m.base);
+	if(m.base == X64_RIP) {
+		x64_byte(c, (u8)((reg & 7) << 3 | 5));
+		// the displacement is the last field of every rip-relative
+		// instruction written here, so rip is 4 bytes past it
+		x64_reloc(c, m.reloc, m.sym, (i64)m.disp - 4);
+		x64_u32(c, 0);
+		return;
+	}
+	x64_byte(c, (u8)(0x80 | (reg & 7) << 3 | (m.base & 7)));
+	if((m.base & 7) == X64_RSP)
+		x64_byte(c, 0x24);
+	x64_u32(c, (u32)m.disp);
+}
+
+void x64_mov(X64Code* c, i32 dst, i32 src) {
+	if(dst != src)
+		x64_rr(c, 0, X64_W, 0x89, src, dst);
+}
+
+void x64_mov_imm(X64Code* c, i32 dst, i64 imm) {
+	if(imm == 0) {
+		// xor r32, r32
+		x64_rr(c, 0, 0, 0x31, dst, dst);
+	} else if(imm > 0 && imm <= UINT32_MAX) {
+		// mov r32, imm32 zero extends
+		x64_opcode(c, 0, 0, 0xb8 + (dst & 7), -1, dst);
+		x64_u32(c, (u32)imm);
+	} else if(imm >= INT32_MIN && imm < 0) {
+		x64_rr(c, 0, X64_W, 0xc7, 0, dst);
+		x64_u32(c, (u32)imm);
+	} else {
+		x64_opcode(c, 0, X64_W, 0xb8 + (dst & 7), -1, dst);
+		x64_u64(c, (u64)imm);
+	}
+}
+
+// Integers are kept in registers and in memory sign extended to 64 bits
+// from the width of their IrType, see x64.c.
+void x64_sext(X64Code* c, IrType t, i32 r) {
+	switch(t) {
+		case IR_I8: x64_rr(c, 0, X64_W | X64_B8, 0x0fbe, r, r); break;
+		case IR_I16: x64_rr(c, 0, X64_W, 0x0fbf, r, r); break;
+		case IR_I32: x64_rr(c, 0, X64_W, 0x63, r, r); break;
+		default: break;
+	}
+}
+
+void x64_zext(X64Code* c, IrType t, i32 r) {
+	switch(t) {
+		case IR_I8: x64_rr(c, 0, X64_B8, 0x0fb6, r, r); break;
+		case IR_I16: x64_rr(c, 0, 0, 0x0fb7, r, r); break;
+		case IR_I32: x64_rr(c, 0, 0, 0x89, r, r); break;
+		default: break;
+	}
+}
+
+// loads a t from m into r, sign extended
+void x64_load(X64Code* c, IrType t, i32 r, X64Mem m) {
+	switch(t) {
+		case IR_I8: x64_rm(c, 0, X64_W, 0x0fbe, r, m); break;
+		case IR_I16: x64_rm(c, 0, X64_W, 0x0fbf, r, m); break;
+		case IR_I32: x64_rm(c, 0, X64_W, 0x63, r, m); break;
+		default: x64_rm(c, 0, X64_W, 0x8b, r, m); break;
+	}
+}
+
+void x64_store(X64Code* c, IrType t, X64Mem m, i32 r) {
+	switch(t) {
+		case IR_I8: x64_rm(c, 0, X64_B8, 0x88, r, m); break;
+		case IR_I16: x64_rm(c, 0x66, 0, 0x89, r, m); break;
+		case IR_I32: x64_rm(c, 0, 0, 0x89, r, m); break;
+		default: x64_rm(c, 0, X64_W, 0x89, r, m); break;
+	}
+}
+
+void x64_lea(X64Code* c, i32 r, X64Mem m) {
+	x64_rm(c, 0, X64_W, 0x8d, r, m);
+}
+
+// f32 and f64 are kept in the low bits of xmm registers; in memory a
+// spilled float takes 8 bytes like any value, stored with movsd.
+void x64_fload(X64Code* c, IrType t, i32 x, X64Mem m) {
+	x64_rm(c, t == IR_F32 ? 0xf3 : 0xf2, 0, 0x0f10, x, m);
+}
+
+void x64_fstore(X64Code* c, IrType t, X64Mem m, i32 x) {
+	x64_rm(c, t == IR_F32 ? 0xf3 : 0xf2, 0, 0x0f11, x, m);
+}
+
+void x64_fmov(X64Code* c, i32 dst, i32 src) {
+	// movaps
+	if(dst != src)
+		x64_rr(c, 0, 0, 0x0f28, dst, src);
+}
+
+// movq xmm, r64
+void x64_movq_to_xmm(X64Code* c, i32 x, i32 r) {
+	x64_rr(c, 0x66, X64_W, 0x0f6e, x, r);
+}
+
+// movq r64, xmm
+void x64_movq_from_xmm(X64Code* c, i32 r, i32 x) {
+	x64_rr(c, 0x66, X64_W, 0x0f7e, x, r);
+}
+
+// scalar sse op: 0x58 add, 0x59 mul, 0x5c sub, 0x5e div
+void x64_sse(X64Code* c, IrType t, u8 op, i32 dst, i32 src) {
+	x64_rr(c, t == IR_F32 ? 0xf3 : 0xf2, 0, 0x0f00 | op, dst, src);
+}
+
+// ucomiss/ucomisd a, b
+void x64_ucomi(X64Code* c, IrType t, i32 a, i32 b) {
+	x64_rr(c, t == IR_F32 ? 0 : 0x66, 0, 0x0f2e, a, b);
+}
+
+// cvtsi2ss/cvtsi2sd x, r64
+void x64_cvt_from_int(X64Code* c, IrType t, i32 x, i32 r) {
+	x64_rr(c, t == IR_F32 ? 0xf3 : 0xf2, X64_W, 0x0f2a, x, r);
+}
+
+// cvttss2si/cvttsd2si r64, x, t is the type of x
+void x64_cvt_to_int(X64Code* c, IrType t, i32 r, i32 x) {
+	x64_rr(c, t == IR_F32 ? 0xf3 : 0xf2, X64_W, 0x0f2c, r, x);
+}
+
+// op dst, src: 0x01 add, 0x09 or, 0x21 and, 0x29 sub, 0x31 xor, 0x39 cmp,
+// 0x85 test
+void x64_alu(X64Code* c, u8 op, i32 dst, i32 src) {
+	x64_rr(c, 0, X64_W, op, src, dst);
+}
+
+// group 3 on r: 3 neg, 6 div, 7 idiv
+void x64_unary(X64Code* c, u8 ext, i32 r) {
+	x64_rr(c, 0, X64_W, 0xf7, ext, r);
+}
+
+// shifts r by cl: 4 shl, 5 shr, 7 sar
+void x64_shift(X64Code* c, u8 ext, i32 r) {
+	x64_rr(c, 0, X64_W, 0xd3, ext, r);
+}
+
+// setcc r8
+void x64_setcc(X64Code* c, u8 cc, i32 r) {
+	x64_rr(c, 0, X64_B8, 0x0f90 | cc, 0, r);
+}
+
+// jmp to a label: returns where the rel32 is, to be patched
+isize x64_jmp(X64Code* c) {
+	x64_byte(c, 0xe9);
+	x64_u32(c, 0);
+	return buf_len(c->text) - 4;
+}
+
+isize x64_jcc(X64Code* c, u8 cc) {
+	x64_byte(c, 0x0f);
+	x64_byte(c, 0x80 | cc);
+	x64_u32(c, 0);
+	return buf_len(c->text) - 4;
+}
+
+// points the rel32 at 'at' to the current position
+void x64_label(X64Code* c, isize at) {
+	x64_patch32(c, at, (u32)(buf_len(c->text) - (at + 4)));
+}
+
+void x64_push(X64Code* c, i32 r) {
+	x64_opcode(c, 0, 0, 0x50 + (r & 7), -1, r);
+}
+
+void x64_pop(X64Code* c, i32 r) {
+	x64_opcode(c, 0, 0, 0x58 + (r & 7), -1, r);
+}
+
+// add or sub rsp, imm32
+void x64_rsp_add(X64Code* c, i64 n) {
+	if(n == 0)
+		return;
+	x64_rr(c, 0, X64_W, 0x81, n > 0 ? 0 : 5, X64_RSP);
+	x64_u32(c, (u32)(n > 0 ? n : -n));
+}
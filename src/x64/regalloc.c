@@ -0,0 +1,101 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Linear scan register allocation over the live intervals of a fn
+// (ir/live.c). Intervals are taken in order of their start and given a
+// free register, or the one of the active interval that ends last, which
+// is spilled for its whole life. Values live across a call only get
+// callee-saved registers; there are no callee-saved xmm registers, so
+// such floats live on the stack. Constants and addresses are not
+// allocated: they are written again wherever they are used.
+
+// the registers of the allocator, caller-saved ones first
+const i32 x64_gprs[] = { X64_R8, X64_R9, X64_R10, X64_RBX, X64_R12, X64_R13, X64_R14, X64_R15 };
+const i32 x64_xmms[] = { 8, 9, 10, 11, 12, 13, 14 };
+
+bool x64_is_callee_saved(i32 r) {
+	return r == X64_RBX || r >= X64_R12;
+}
+
+bool x64_is_remat(IrOp op) {
+	return op == IR_CONST || op == IR_SLOT || op == IR_GLOBAL || op == IR_FN || op == IR_STRING;
+}
+
+typedef struct X64Alloc {
+	X64Loc* locs;     // per instruction
+	i32 spills;       // spill slots of 8 bytes
+	u32 saved;        // callee-saved registers used, by number
+} X64Alloc;
+
+void x64_regalloc(IrFn* fn, X64Alloc* a) {
+	isize n = buf_len(fn->instrs);
+	isize nblocks = buf_len(fn->blocks);
+	IrInterval* iv = xmalloc(MAX(n, 1) * sizeof(IrInterval));
+	i32* block_start = xmalloc(nblocks * sizeof(i32));
+	i32* block_end = xmalloc(nblocks * sizeof(i32));
+	ir_intervals(fn, iv, block_start, block_end);
+
+	a->locs = xcalloc(MAX(n, 1), sizeof(X64Loc));
+	a->spills = 0;
+	a->saved = 0;
+	IrRef* order = NULL;
+	for(IrRef r = 0; r < n; r++) {
+		IrInstr* in = &fn->instrs[r];
+		if(!ir_has_value(in))
+			continue;
+		if(x64_is_remat(in->op)) {
+			a->locs[r] = (X64Loc){ X64_LOC_REMAT, 0 };
+			continue;
+		}
+		buf_push(order, r);
+	}
+	ir_sort_intervals(order, iv);
+
+	// holder of every register, -1 when free; xmm registers after the gprs
+	IrRef holder[32];
+	for(isize i = 0; i < 32; i++) {
+		holder[i] = -1;
+	}
+	for(isize i = 0; i < buf_len(order); i++) {
+		IrRef v = order[i];
+		IrInterval* cur = &iv[v];
+		for(isize r = 0; r < 32; r++) {
+			if(holder[r] >= 0 && iv[holder[r]].end < cur->start)
+				holder[r] = -1;
+		}
+		bool is_float = ir_is_float(fn->instrs[v].type);
+		const i32* regs = is_float ? x64_xmms : x64_gprs;
+		isize nregs = is_float ? (isize)(sizeof(x64_xmms) / sizeof(i32)) : (isize)(sizeof(x64_gprs) / sizeof(i32));
+		i32 base = is_float ? 16 : 0;
+		i32 pick = -1, victim = -1;
+		for(isize k = 0; k < nregs; k++) {
+			i32 r = regs[k];
+			if(cur->across_call && (is_float || !x64_is_callee_saved(r)))
+				continue;
+			if(holder[base + r] < 0) {
+				pick = r;
+				break;
+			}
+			if(victim < 0 || iv[holder[base + r]].end > iv[holder[base + victim]].end)
+				victim = r;
+		}
+		if(pick < 0 && victim >= 0 && iv[holder[base + victim]].end > cur->end) {
+			// the victim is spilled for its whole interval
+			a->locs[holder[base + victim]] = (X64Loc){ X64_LOC_STACK, a->spills++ };
+			pick = victim;
+		}
+		if(pick < 0) {
+			a->locs[v] = (X64Loc){ X64_LOC_STACK, a->spills++ };
+			continue;
+		}
+		holder[base + pick] = v;
+		a->locs[v] = (X64Loc){ is_float ? X64_LOC_XMM : X64_LOC_GPR, pick };
+		if(!is_float && x64_is_callee_saved(pick))
+			a->saved |= 1u << pick;
+	}
+
+	buf_free(order);
+	xfree(block_end);
+	xfree(block_start);
+	xfree(iv);
+}
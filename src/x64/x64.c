@@ -0,0 +1,138 @@
+// Copyright 2018 Simone Miraglia. See the LICENSE
+// file at the top-level directory of this distribution
+
+// Native x86-64 backend, for debug builds (--native): the optimized IR of
+// every fn is turned into machine code and written out as an ELF
+// relocatable object, linked by the system linker like the output of a C
+// compiler (cc out.o -o prog). It trades the quality of the code for
+// the time to get it; release builds go through the C backend.
+// Calls follow the System V AMD64 ABI for scalars, so extern fns are
+// plain C fns, with the IR conventions for aggregates (ir.c): they are
+// passed by address, which C does not do, so extern fns that take or
+// return aggregates are rejected. Integers narrower than 64 bits are kept
+// sign extended to 64 bits, whatever their signedness, like IR constants;
+// values coming from C (arguments and results of calls) are sign
+// extended first.
+// Fns are compiled on resolver_jobs threads, each into its own code and
+// relocations, which elf.c lays out one after the other.
+
+typedef enum X64Reg {
+	X64_RAX,
+	X64_RCX,
+	X64_RDX,
+	X64_RBX,
+	X64_RSP,
+	X64_RBP,
+	X64_RSI,
+	X64_RDI,
+	X64_R8,
+	X64_R9,
+	X64_R10,
+	X64_R11,
+	X64_R12,
+	X64_R13,
+	X64_R14,
+	X64_R15,
+	X64_RIP = -2,     // base of rip-relative operands
+} X64Reg;
+
+// xmm registers are numbered from 0 as well, the instruction tells them
+// apart from the gprs
+
+// instruction encoding flags
+enum {
+	X64_W = 0x1,      // 64 bit operand size
+	X64_B8 = 0x2,     // byte register operand
+	X64_MEM = 0x4,    // ModRM.rm is a memory operand
+};
+
+typedef enum X64RelocKind {
+	X64_REL_PC32,
+	X64_REL_PLT32,
+	X64_REL_GOTPCREL,
+} X64RelocKind;
+
+typedef struct X64Reloc {
+	isize offset;     // of the 32 bit field, in the code of the fn
+	u8 kind;          // X64RelocKind
+	Symbol* sym;      // NULL for the rodata of the fn, or name
+	i64 addend;
+	const char* name; // a libc fn the runtime calls, when not NULL
+} X64Reloc;
+
+// the output for one fn
+typedef struct X64Code {
+	u8* text;
+	char* rodata;
+	X64Reloc* relocs;
+} X64Code;
+
+typedef struct X64Mem {
+	i32 base;         // register, or X64_RIP
+	i32 disp;
+	Symbol* sym;      // rip-relative: relocation target, as in X64Reloc
+	u8 reloc;
+} X64Mem;
+
+typedef enum X64LocKind {
+	X64_LOC_NONE,     // no result
+	X64_LOC_GPR,
+	X64_LOC_XMM,
+	X64_LOC_STACK,    // 8 bytes in the frame
+	X64_LOC_REMAT,    // constants and addresses, written where used
+} X64LocKind;
+
+typedef struct X64Loc {
+	u8 kind;
+	i32 n;            // register, or spill slot then rbp displacement
+} X64Loc;
+
+// write an object file instead of C (--native)
+bool x64_native;
+
+#define x64_error(loc, fmt, ...) (print_error_pos(loc, "x64 error: " fmt, ##__VA_ARGS__), resolve_abort())
+
+#include "encode.c"
+#include "regalloc.c"
+#include "emit.c"
+#include "elf.c"
+
+typedef struct X64Package {
+	IrPackage* ir;
+	X64Code* codes;
+} X64Package;
+
+void x64_fn_task(void* ctx, isize worker, isize task) {
+	X64Package* p = ctx;
+	MemTag old_tag = mem_tag_set(MEM_X64);
+	x64_fn(p->ir->fns[task], &p->codes[task]);
+	mem_tag_set(old_tag);
+}
+
+// Writes the object file for the optimized IR of a package to out.
+void x64_package(IrPackage* ir, const char* out) {
+	// errors are reported here, before the threads start
+	for(isize i = 0; i < buf_len(ir->fns); i++) {
+		IrFn* fn = ir->fns[i];
+		for(isize r = 0; r < buf_len(fn->instrs); r++) {
+			IrInstr* in = &fn->instrs[r];
+			if(in->op != IR_CALL || fn->instrs[in->x].op != IR_FN)
+				continue;
+			Symbol* callee = fn->instrs[in->x].sym;
+			if(x64_is_extern(callee) && x64_extern_has_aggregates(callee))
+				x64_error(callee->decl->loc, "extern fn '%s' takes or returns aggregates, which --native cannot pass",
+					callee->name);
+		}
+	}
+	MemTag old_tag = mem_tag_set(MEM_X64);
+	X64Package p = { ir, xcalloc(MAX(buf_len(ir->fns), 1), sizeof(X64Code)) };
+	jobs_run(resolver_jobs, buf_len(ir->fns), x64_fn_task, &p);
+	elf_write_object(ir, p.codes, out);
+	for(isize i = 0; i < buf_len(ir->fns); i++) {
+		buf_free(p.codes[i].text);
+		buf_free(p.codes[i].rodata);
+		buf_free(p.codes[i].relocs);
+	}
+	xfree(p.codes);
+	mem_tag_set(old_tag);
+}
@@ -0,0 +1,8 @@
+// error
+@reorder struct Flags { a: bool, b: bool, }
+
+fn main() -> i32 {
+	let f = Flags { a: true, b: false }
+	let p = &f.b
+	return 0
+}
@@ -0,0 +1,12 @@
+// c only: nc run and --native do not check indexes
+fn main() -> i32 {
+	let a = [1, 2, 3, 4]
+	let i = 9223372036854775806
+	i += 2
+	let s = 0
+	for i < 4 {
+		s += a[i]
+		i += 1
+	}
+	return s as i32
+}
@@ -0,0 +1,12 @@
+// c only: nc run and --native do not check indexes
+extern fn printf(fmt: *u8, x: i64) -> i32
+
+fn main() -> i32 {
+	let a = [1, 2, 3, 4]
+	let i = 9223372036854775807
+	i += 1
+	if i < 4 {
+		printf("%lld\n", a[i])
+	}
+	return 0
+}
@@ -0,0 +1,16 @@
+extern fn printf(fmt: *u8, x: i64) -> i32
+
+// the VM adds the calling fns to a runtime error, which the C backend and
+// --native do not, so the division by zero is in main
+fn main() -> i32 {
+	let m = -2147483647 as i32
+	m -= 1
+	let d = -1 as i32
+	printf("%lld\n", (m / d) as i64)
+	printf("%lld\n", (m % d) as i64)
+	let u = 7 as u32
+	let z = d + 1
+	printf("%lld\n", (u / 2) as i64)
+	printf("%lld\n", (u / (z as u32)) as i64)
+	return 0
+}
@@ -0,0 +1,29 @@
+extern fn printf(fmt: *u8, x: i64) -> i32
+
+// a: 0, b: 8, c: 16, d: 18, e: 20, f: 21, size 24
+struct Plain { a: u8, b: i64, c: bool, d: u16, e: bool, f: bool, }
+
+// b: 0, d: 8, a: 10, c, e and f in a bitset at 11, size 16
+@reorder struct Packed { a: u8, b: i64, c: bool, d: u16, e: bool, f: bool, }
+
+// None is the null pointer, so there is no tag
+enum OptPtr { None, Some(*i64), }
+
+fn main() -> i32 {
+	let ps = [Plain { a: 1, b: 2, c: true, d: 3, e: false, f: true }; 2]
+	printf("%lld\n", (&ps[1] as i64) - (&ps[0] as i64))
+	let qs = [Packed { a: 1, b: 2, c: true, d: 3, e: false, f: true }; 2]
+	printf("%lld\n", (&qs[1] as i64) - (&qs[0] as i64))
+	// writing a bit keeps the others
+	qs[0].e = true
+	qs[0].c = false
+	printf("%lld\n", (qs[0].c as i64) + 10 * (qs[0].e as i64) + 100 * (qs[0].f as i64))
+	printf("%lld\n", (qs[1].c as i64) + 10 * (qs[1].e as i64) + 100 * (qs[1].f as i64))
+	let os = [OptPtr.None; 2]
+	printf("%lld\n", (&os[1] as i64) - (&os[0] as i64))
+	let x = 5
+	os[1] = OptPtr.Some(&x)
+	printf("%lld\n", *(&os[0] as *i64))
+	printf("%lld\n", (*(&os[1] as *i64) == (&x as i64)) as i64)
+	return 0
+}
@@ -0,0 +1,16 @@
+extern fn printf(fmt: *u8, x: i64) -> i32
+const BIG = 3000000
+
+fn main() -> i32 {
+	let a = 1 << 40
+	printf("%lld\n", a)
+	printf("%lld\n", 3000000 * 3000000)
+	printf("%lld\n", BIG * BIG)
+	let n = 33
+	printf("%lld\n", 1 << n)
+	let u = 4294967295 as u32
+	if u == -1 {
+		printf("%lld\n", 1)
+	}
+	return 0
+}
@@ -0,0 +1,45 @@
+extern fn printf(fmt: *u8, x: i64) -> i32
+
+fn grows(a: i32) -> i64 {
+	if a + 1 > a {
+		return 1
+	}
+	return 0
+}
+
+fn q(a: i64, b: i64) -> i64 {
+	return a / b
+}
+
+fn r(a: i64, b: i64) -> i64 {
+	return a % b
+}
+
+fn main() -> i32 {
+	printf("%lld\n", grows(2147483647))
+	let s = 200 as u8
+	printf("%lld\n", (s + 100) as i64)
+	let i = 7 as i32
+	printf("%lld\n", (i * 3000000000) as i64)
+	let m = -2147483647 as i32
+	m -= 2
+	printf("%lld\n", m as i64)
+	let b = -128 as i8
+	printf("%lld\n", (-b) as i64)
+	let big = 9223372036854775807
+	big += 1
+	printf("%lld\n", big)
+	printf("%lld\n", q(-9223372036854775807 - 1, -1))
+	printf("%lld\n", r(-9223372036854775807 - 1, -1))
+	let n = -128 as i8
+	n /= -1
+	printf("%lld\n", n as i64)
+	let one = 1
+	let k = 64
+	printf("%lld\n", one << k)
+	printf("%lld\n", (-256) >> (k + 4))
+	printf("%lld\n", ((-1 as i32) >> 40) as i64)
+	printf("%lld\n", ((255 as u8) << 4) as i64)
+	printf("%lld\n", ((3 as u32) << k) as i64)
+	return 0
+}
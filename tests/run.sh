@@ -0,0 +1,63 @@
+#!/bin/sh
+# Differential tests: every tests/*.nl must print the same under nc run,
+# the generated C and --native. A program whose first line is a comment
+# starting with "c only" is only built as C. When <name>.out exists, the
+# output of the generated C, followed by "exit <n>" when it does not exit
+# with 0, must match it. A program whose first line is "// error" must be
+# rejected by all three with the error of <name>.err, whatever the pass that
+# reports it. units.sh and watch.sh then check --units and --watch.
+#   tests/run.sh path/to/nc
+nc=${1:-bin/nc.exe}
+nc=$(cd "$(dirname "$nc")" && pwd)/$(basename "$nc")
+cd "$(dirname "$0")" || exit 1
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+status=0
+for f in *.nl; do
+	name=${f%.nl}
+	if head -n 1 "$f" | grep -q '^// error'; then
+		for b in c run native; do
+			case $b in
+				c) set -- "$f" "$tmp/out.c" ;;
+				run) set -- run "$f" ;;
+				native) set -- --native "$f" "$tmp/out.o" ;;
+			esac
+			if "$nc" "$@" > "$tmp/err.txt"; then
+				echo "$f: $b accepts it"
+				status=1
+			elif ! sed -n 's/^\([^ ]*\) [a-z0-9]* error: /\1 error: /p' "$tmp/err.txt" | cmp -s "$name.err" -; then
+				echo "$f: $b does not report the error of $name.err"
+				grep error "$tmp/err.txt"
+				status=1
+			fi
+		done
+		continue
+	fi
+	"$nc" "$f" "$tmp/out.c" > /dev/null &&
+		gcc -std=gnu11 -fno-builtin -w -o "$tmp/c" "$tmp/out.c" &&
+		{ "$tmp/c" > "$tmp/c.txt" || echo "exit $?" >> "$tmp/c.txt"; }
+	if [ -f "$name.out" ] && ! cmp -s "$name.out" "$tmp/c.txt"; then
+		echo "$f: output differs from $name.out"
+		diff "$name.out" "$tmp/c.txt"
+		status=1
+	fi
+	if head -n 1 "$f" | grep -q '^// c only'; then
+		rm -f "$tmp"/*.txt
+		continue
+	fi
+	"$nc" run "$f" > "$tmp/vm.txt" || echo "exit $?" >> "$tmp/vm.txt"
+	"$nc" --native "$f" "$tmp/out.o" > /dev/null &&
+		gcc -no-pie -o "$tmp/native" "$tmp/out.o" &&
+		{ "$tmp/native" > "$tmp/native.txt" || echo "exit $?" >> "$tmp/native.txt"; }
+	for b in c native; do
+		if ! cmp -s "$tmp/vm.txt" "$tmp/$b.txt"; then
+			echo "$f: $b differs from nc run"
+			diff "$tmp/vm.txt" "$tmp/$b.txt"
+			status=1
+		fi
+	done
+	rm -f "$tmp"/*.txt
+done
+./units.sh "$nc" || status=1
+./watch.sh "$nc" || status=1
+exit $status
@@ -0,0 +1,46 @@
+extern fn printf(fmt: *u8, x: i64) -> i32
+
+// small enough to be inlined everywhere, through its copy nl_i_twice
+fn twice(a: i64) -> i64 {
+	return a * 2
+}
+
+fn sum(n: i64) -> i64 {
+	let s = 0
+	let i = 0
+	for i < n {
+		s += twice(i)
+		i += 1
+	}
+	return s
+}
+
+fn odd(n: i64) -> i64 {
+	let s = 0
+	let i = 0
+	for i < n {
+		if i % 2 == 1 {
+			s += twice(i) + 1
+		}
+		i += 1
+	}
+	return s
+}
+
+fn squares(n: i64) -> i64 {
+	let s = 0
+	let i = 0
+	for i < n {
+		s += i * i
+		i += 1
+	}
+	return s
+}
+
+fn main() -> i32 {
+	printf("%lld\n", sum(10))
+	printf("%lld\n", odd(10))
+	printf("%lld\n", squares(10))
+	printf("%lld\n", twice(21))
+	return 0
+}
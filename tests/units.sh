@@ -0,0 +1,36 @@
+#!/bin/sh
+# nc --units on units.nl: every fn is defined in exactly one unit, the
+# small fn is inlined through its copy in the header, the units build into
+# the program of units.out, and a smaller --units removes the stale units.
+#   tests/units.sh path/to/nc
+nc=${1:-bin/nc.exe}
+nc=$(cd "$(dirname "$nc")" && pwd)/$(basename "$nc")
+cd "$(dirname "$0")" || exit 1
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+status=0
+fail() {
+	echo "units.sh: $*"
+	status=1
+}
+
+"$nc" --units=3 units.nl "$tmp/o.c" > /dev/null || exit 1
+for f in o.h o_0.c o_1.c o_2.c; do
+	[ -f "$tmp/$f" ] || fail "$f is missing"
+done
+for fn in 'int64_t twice' 'int64_t sum' 'int64_t odd' 'int64_t squares' 'int32_t main'; do
+	n=$(cat "$tmp"/o_*.c | grep -c "^$fn(")
+	[ "$n" = 1 ] || fail "$fn is defined in $n units"
+done
+grep -q '^static inline __attribute__((always_inline)) int64_t nl_i_twice(.*{$' "$tmp/o.h" ||
+	fail "o.h does not define nl_i_twice"
+# the only call to twice left is the forwarding one
+[ "$(cat "$tmp"/o_*.c | grep -c '[^_]twice(')" = 1 ] || fail "calls to twice are not inlined"
+gcc -std=gnu11 -fno-builtin -w -o "$tmp/prog" "$tmp"/o_*.c || fail "the units do not build"
+"$tmp/prog" > "$tmp/out.txt"
+cmp -s units.out "$tmp/out.txt" || fail "the units print $(cat "$tmp/out.txt")"
+
+"$nc" --units=2 --inline-limit=0 units.nl "$tmp/o.c" > /dev/null || exit 1
+[ -f "$tmp/o_2.c" ] && fail "o_2.c is left from --units=3"
+grep -q nl_i_ "$tmp"/o.h "$tmp"/o_*.c && fail "--inline-limit=0 still inlines"
+exit $status
@@ -0,0 +1,53 @@
+#!/bin/sh
+# nc --watch with --units: editing the body of one fn must rewrite only the
+# unit that holds it, and leave the same files as a fresh build.
+#   tests/watch.sh path/to/nc
+nc=${1:-bin/nc.exe}
+nc=$(cd "$(dirname "$nc")" && pwd)/$(basename "$nc")
+tmp=$(mktemp -d)
+pid=
+trap '[ -n "$pid" ] && kill $pid; rm -rf "$tmp"' EXIT
+cd "$tmp" || exit 1
+mkdir watch fresh
+for f in 0 1 2 3 4 5 6 7; do
+	printf 'fn f%s(a: i64) -> i64 {\n\tlet b = a * %s\n\treturn b + %s\n}\n\n' $f $f $f
+done > w.nl
+printf 'fn main() -> i32 {\n\treturn f3(1) as i32\n}\n' >> w.nl
+
+# waits for the log to show session $1
+session() {
+	for i in $(seq 50); do
+		grep -q "^session $1" log.txt && return 0
+		sleep 0.1
+	done
+	echo "watch.sh: no session $1"
+	cat log.txt
+	exit 1
+}
+
+"$nc" --units=4 --inline-limit=0 --watch w.nl watch/o.c > log.txt 2>&1 &
+pid=$!
+session 1
+sleep 1
+touch stamp
+sed 's/return b + 5$/return b + 50/' w.nl > w2.nl
+mv w2.nl w.nl
+session 2
+kill $pid
+pid=
+
+status=0
+changed=$(find watch -newer stamp -type f | sort | tr '\n' ' ')
+holder=$(grep -l '^int64_t f5(' watch/*.c 2>/dev/null)
+if [ "$changed" != "$holder " ]; then
+	echo "watch.sh: rewrote $changed instead of $holder"
+	status=1
+fi
+"$nc" --units=4 --inline-limit=0 w.nl fresh/o.c > /dev/null
+for f in fresh/*; do
+	if ! cmp -s "$f" "watch/${f#fresh/}"; then
+		echo "watch.sh: watch/${f#fresh/} differs from a fresh build"
+		status=1
+	fi
+done
+exit $status